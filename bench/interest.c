@@ -0,0 +1,194 @@
+/*
+
+   Copyright (C) 2020 BIAGINI Nathan
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+*/
+
+/*
+    Interest grid benchmark: moves BENCH_ENTITY_COUNT entities around and computes the view changes of
+    BENCH_CLIENT_COUNT moving clients every tick, then compares with a brute force relevancy check.
+*/
+
+#include <stdio.h>
+#include <time.h>
+
+#define NBNET_IMPL
+
+#define NBN_LogInfo(...) (printf(__VA_ARGS__), printf("\n"))
+#define NBN_LogError(...) (printf(__VA_ARGS__), printf("\n"))
+#define NBN_LogDebug(...) (void)0
+#define NBN_LogTrace(...) (void)0
+
+#include "../nbnet.h"
+#include "../net_drivers/udp.h"
+
+#define BENCH_CLIENT_COUNT 1000
+#define BENCH_ENTITY_COUNT 50000
+#define BENCH_TICK_COUNT 100
+#define BENCH_WORLD_SIZE 4000.f
+#define BENCH_VIEW_RADIUS 100.f
+#define BENCH_CELL_SIZE 100.f
+#define BENCH_MOVE_SPEED 5.f
+
+typedef struct
+{
+    float x;
+    float y;
+    float vx;
+    float vy;
+} Mover;
+
+static float RandomFloat(float min, float max)
+{
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+static void InitMover(Mover *mover)
+{
+    mover->x = RandomFloat(0, BENCH_WORLD_SIZE);
+    mover->y = RandomFloat(0, BENCH_WORLD_SIZE);
+    mover->vx = RandomFloat(-BENCH_MOVE_SPEED, BENCH_MOVE_SPEED);
+    mover->vy = RandomFloat(-BENCH_MOVE_SPEED, BENCH_MOVE_SPEED);
+}
+
+static void Move(Mover *mover)
+{
+    mover->x += mover->vx;
+    mover->y += mover->vy;
+
+    if (mover->x < 0 || mover->x > BENCH_WORLD_SIZE)
+        mover->vx = -mover->vx;
+
+    if (mover->y < 0 || mover->y > BENCH_WORLD_SIZE)
+        mover->vy = -mover->vy;
+}
+
+static double Elapsed(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1000;
+}
+
+int main(void)
+{
+    srand(42);
+
+    NBN_InterestGrid *grid = NBN_InterestGrid_Create(BENCH_CELL_SIZE, BENCH_ENTITY_COUNT);
+
+    if (grid == NULL)
+        return 1;
+
+    /* only the slots of the connections are used by the grid */
+    NBN_Connection *clients = calloc(BENCH_CLIENT_COUNT, sizeof(NBN_Connection));
+    Mover *client_movers = malloc(sizeof(Mover) * BENCH_CLIENT_COUNT);
+    Mover *entity_movers = malloc(sizeof(Mover) * BENCH_ENTITY_COUNT);
+    uint32_t *entity_ids = malloc(sizeof(uint32_t) * BENCH_ENTITY_COUNT);
+
+    for (unsigned int i = 0; i < BENCH_ENTITY_COUNT; i++)
+    {
+        InitMover(&entity_movers[i]);
+
+        entity_ids[i] = NBN_InterestGrid_AddEntity(grid, entity_movers[i].x, entity_movers[i].y);
+    }
+
+    for (unsigned int i = 0; i < BENCH_CLIENT_COUNT; i++)
+    {
+        clients[i].slot = i;
+
+        InitMover(&client_movers[i]);
+    }
+
+    unsigned long long enter_count = 0;
+    unsigned long long leave_count = 0;
+    unsigned long long update_count = 0;
+    double move_time = 0;
+    double update_time = 0;
+
+    for (unsigned int tick = 0; tick < BENCH_TICK_COUNT; tick++)
+    {
+        clock_t start = clock();
+
+        for (unsigned int i = 0; i < BENCH_ENTITY_COUNT; i++)
+        {
+            Move(&entity_movers[i]);
+
+            NBN_InterestGrid_SetEntityPosition(grid, entity_ids[i], entity_movers[i].x, entity_movers[i].y);
+        }
+
+        for (unsigned int i = 0; i < BENCH_CLIENT_COUNT; i++)
+        {
+            Move(&client_movers[i]);
+
+            NBN_InterestGrid_SetClientView(grid, &clients[i], client_movers[i].x, client_movers[i].y, BENCH_VIEW_RADIUS);
+        }
+
+        move_time += Elapsed(start);
+        start = clock();
+
+        if (NBN_InterestGrid_Update(grid) < 0)
+            return 1;
+
+        update_time += Elapsed(start);
+
+        for (unsigned int i = 0; i < BENCH_CLIENT_COUNT; i++)
+        {
+            NBN_InterestChanges changes = NBN_InterestGrid_GetClientChanges(grid, &clients[i]);
+
+            enter_count += changes.enter_count;
+            leave_count += changes.leave_count;
+            update_count += changes.update_count;
+        }
+    }
+
+    printf("%d clients, %d entities, %d ticks\n", BENCH_CLIENT_COUNT, BENCH_ENTITY_COUNT, BENCH_TICK_COUNT);
+    printf("grid: move %.3f ms/tick, update %.3f ms/tick\n",
+            move_time / BENCH_TICK_COUNT, update_time / BENCH_TICK_COUNT);
+    printf("events/tick: enter %.1f, leave %.1f, update %.1f\n",
+            (double)enter_count / BENCH_TICK_COUNT,
+            (double)leave_count / BENCH_TICK_COUNT,
+            (double)update_count / BENCH_TICK_COUNT);
+
+    /* brute force relevancy of a single tick, for reference */
+    clock_t start = clock();
+    unsigned long long visible_count = 0;
+    float radius_sq = BENCH_VIEW_RADIUS * BENCH_VIEW_RADIUS;
+
+    for (unsigned int i = 0; i < BENCH_CLIENT_COUNT; i++)
+    {
+        for (unsigned int j = 0; j < BENCH_ENTITY_COUNT; j++)
+        {
+            float dx = entity_movers[j].x - client_movers[i].x;
+            float dy = entity_movers[j].y - client_movers[i].y;
+
+            if (dx * dx + dy * dy <= radius_sq)
+                visible_count++;
+        }
+    }
+
+    printf("brute force: %.3f ms/tick (%llu visible)\n", Elapsed(start), visible_count);
+
+    NBN_InterestGrid_Destroy(grid);
+    free(clients);
+    free(client_movers);
+    free(entity_movers);
+    free(entity_ids);
+
+    return 0;
+}
@@ -0,0 +1,440 @@
+/*
+
+   Copyright (C) 2020 BIAGINI Nathan
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+*/
+
+/*
+    Message serialization benchmark: compares the serializers generated by tools/msggen.c from messages.schema with
+    the hand written serializers of the raylib example (copied below).
+
+    The generated serializers are first checked to produce the same bytes and sizes as the hand written ones, then
+    both are timed on the paths nbnet runs them on:
+
+        - send: two measures (when the message is queued and when it is packed in a packet) and a write
+        - receive: a read
+        - builders and destructors: malloc/free against the generated pools
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+
+#define NBNET_IMPL
+#define NBN_LogInfo(...) (printf(__VA_ARGS__), printf("\n"))
+#define NBN_LogError(...) (printf(__VA_ARGS__), printf("\n"))
+#define NBN_LogDebug(...) (void)0
+#define NBN_LogTrace(...) (void)0
+
+#include "../nbnet.h"
+#include "../net_drivers/udp.h"
+
+#define BENCH_MESSAGES_IMPL
+
+#include "bench_messages.h"
+
+#define BENCH_MESSAGE_COUNT 1024
+#define BENCH_ITERATIONS 1000
+#define BENCH_DATA_LENGTH 256
+#define BENCH_ALLOC_BATCH 64
+#define BENCH_BUFFER_SIZE (DATA_MESSAGE_MAX_SIZE + 8)
+
+#pragma region Hand written messages
+
+/* Same as the raylib example */
+
+typedef struct
+{
+    int x;
+    int y;
+    float val;
+} HandUpdateStateMessage;
+
+typedef struct
+{
+    uint32_t client_id;
+    int x;
+    int y;
+    float val;
+    unsigned int color;
+} HandClientState;
+
+typedef struct
+{
+    unsigned int client_count;
+    HandClientState client_states[MAX_CLIENTS];
+} HandGameStateMessage;
+
+/* Same as the echo example, with an optional payload */
+typedef struct
+{
+    unsigned int length;
+    uint8_t data[MAX_DATA_LENGTH];
+} HandDataMessage;
+
+static int HandUpdateStateMessage_Serialize(HandUpdateStateMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->x, 0, GAME_WIDTH);
+    NBN_SerializeUInt(stream, msg->y, 0, GAME_HEIGHT);
+    NBN_SerializeFloat(stream, msg->val, MIN_FLOAT_VAL, MAX_FLOAT_VAL, 3);
+
+    return 0;
+}
+
+static int HandGameStateMessage_Serialize(HandGameStateMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->client_count, 0, MAX_CLIENTS);
+
+    for (unsigned int i = 0; i < msg->client_count; i++)
+    {
+        NBN_SerializeUInt(stream, msg->client_states[i].client_id, 0, UINT_MAX);
+        NBN_SerializeUInt(stream, msg->client_states[i].color, 0, MAX_COLORS_MINUS_ONE);
+        NBN_SerializeUInt(stream, msg->client_states[i].x, 0, GAME_WIDTH);
+        NBN_SerializeUInt(stream, msg->client_states[i].y, 0, GAME_HEIGHT);
+        NBN_SerializeFloat(stream, msg->client_states[i].val, MIN_FLOAT_VAL, MAX_FLOAT_VAL, 3);
+    }
+
+    return 0;
+}
+
+static int HandDataMessage_Serialize(HandDataMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->length, 0, MAX_DATA_LENGTH);
+
+    if (msg->length > 0)
+        NBN_SerializeBytes(stream, msg->data, msg->length);
+
+    return 0;
+}
+
+#pragma endregion /* Hand written messages */
+
+typedef struct
+{
+    const char *name;
+    NBN_MessageSerializer hand_serializer;
+    NBN_MessageSerializer generated_serializer;
+    void *hand_messages[BENCH_MESSAGE_COUNT];
+    void *generated_messages[BENCH_MESSAGE_COUNT];
+    size_t hand_size;
+    size_t generated_size;
+} Bench;
+
+static uint8_t buffers[BENCH_MESSAGE_COUNT][BENCH_BUFFER_SIZE];
+static volatile unsigned int sink;
+
+static unsigned int RandomUInt(unsigned int min, unsigned int max)
+{
+    return min + (unsigned int)rand() % (max - min + 1);
+}
+
+static float RandomFloat(float min, float max)
+{
+    return min + (max - min) * ((float)rand() / (float)RAND_MAX);
+}
+
+static void GenerateMessages(Bench *bench, unsigned int index)
+{
+    if (bench->generated_serializer == (NBN_MessageSerializer)UpdateStateMessage_Serialize)
+    {
+        HandUpdateStateMessage *hand_msg = (HandUpdateStateMessage *)bench->hand_messages[index];
+        UpdateStateMessage *msg = (UpdateStateMessage *)bench->generated_messages[index];
+
+        msg->x = hand_msg->x = RandomUInt(0, GAME_WIDTH);
+        msg->y = hand_msg->y = RandomUInt(0, GAME_HEIGHT);
+        msg->val = hand_msg->val = RandomFloat(MIN_FLOAT_VAL, MAX_FLOAT_VAL);
+    }
+    else if (bench->generated_serializer == (NBN_MessageSerializer)GameStateMessage_Serialize)
+    {
+        HandGameStateMessage *hand_msg = (HandGameStateMessage *)bench->hand_messages[index];
+        GameStateMessage *msg = (GameStateMessage *)bench->generated_messages[index];
+
+        msg->client_states_count = hand_msg->client_count = RandomUInt(0, MAX_CLIENTS);
+
+        for (unsigned int i = 0; i < msg->client_states_count; i++)
+        {
+            msg->client_states[i].client_id = hand_msg->client_states[i].client_id = (uint32_t)rand() * 2654435761u;
+            msg->client_states[i].color = hand_msg->client_states[i].color = RandomUInt(0, MAX_COLORS_MINUS_ONE);
+            msg->client_states[i].x = hand_msg->client_states[i].x = RandomUInt(0, GAME_WIDTH);
+            msg->client_states[i].y = hand_msg->client_states[i].y = RandomUInt(0, GAME_HEIGHT);
+            msg->client_states[i].val = hand_msg->client_states[i].val = RandomFloat(MIN_FLOAT_VAL, MAX_FLOAT_VAL);
+        }
+    }
+    else
+    {
+        HandDataMessage *hand_msg = (HandDataMessage *)bench->hand_messages[index];
+        DataMessage *msg = (DataMessage *)bench->generated_messages[index];
+
+        msg->data_length = hand_msg->length = index % 16 == 0 ? 0 : RandomUInt(1, BENCH_DATA_LENGTH);
+
+        for (unsigned int i = 0; i < msg->data_length; i++)
+            msg->data[i] = hand_msg->data[i] = (uint8_t)rand();
+    }
+}
+
+static unsigned int Measure(NBN_MessageSerializer serializer, void *msg)
+{
+    NBN_MeasureStream measure_stream;
+
+    NBN_MeasureStream_Init(&measure_stream);
+
+    serializer(msg, (NBN_Stream *)&measure_stream);
+
+    return measure_stream.number_of_bits;
+}
+
+static int Write(NBN_MessageSerializer serializer, void *msg, uint8_t *buffer)
+{
+    NBN_WriteStream write_stream;
+
+    NBN_WriteStream_Init(&write_stream, buffer, BENCH_BUFFER_SIZE);
+
+    if (serializer(msg, (NBN_Stream *)&write_stream) < 0)
+        return NBN_ERROR;
+
+    return NBN_WriteStream_Flush(&write_stream);
+}
+
+static int Read(NBN_MessageSerializer serializer, void *msg, uint8_t *buffer)
+{
+    NBN_ReadStream read_stream;
+
+    NBN_ReadStream_Init(&read_stream, buffer, BENCH_BUFFER_SIZE);
+
+    return serializer(msg, (NBN_Stream *)&read_stream);
+}
+
+/* The generated serializers must be wire compatible with the hand written ones */
+static int Check(Bench *bench)
+{
+    uint8_t hand_buffer[BENCH_BUFFER_SIZE];
+    uint8_t generated_buffer[BENCH_BUFFER_SIZE];
+    uint8_t hand_msg[sizeof(HandDataMessage)];
+    uint8_t generated_msg[sizeof(DataMessage)];
+
+    for (unsigned int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+    {
+        unsigned int bits = Measure(bench->hand_serializer, bench->hand_messages[i]);
+
+        if (Measure(bench->generated_serializer, bench->generated_messages[i]) != bits)
+        {
+            printf("%s: measure mismatch (message %d)\n", bench->name, i);
+
+            return NBN_ERROR;
+        }
+
+        memset(hand_buffer, 0, sizeof(hand_buffer));
+        memset(generated_buffer, 0, sizeof(generated_buffer));
+
+        if (Write(bench->hand_serializer, bench->hand_messages[i], hand_buffer) < 0 ||
+                Write(bench->generated_serializer, bench->generated_messages[i], generated_buffer) < 0)
+        {
+            printf("%s: failed to write message %d\n", bench->name, i);
+
+            return NBN_ERROR;
+        }
+
+        if (memcmp(hand_buffer, generated_buffer, (bits + 7) / 8) != 0)
+        {
+            printf("%s: write mismatch (message %d)\n", bench->name, i);
+
+            return NBN_ERROR;
+        }
+
+        /* read back with both serializers and check they decode the same data */
+        memset(hand_msg, 0, sizeof(hand_msg));
+        memset(generated_msg, 0, sizeof(generated_msg));
+
+        if (Read(bench->hand_serializer, hand_msg, hand_buffer) < 0 ||
+                Read(bench->generated_serializer, generated_msg, hand_buffer) < 0)
+        {
+            printf("%s: failed to read message %d\n", bench->name, i);
+
+            return NBN_ERROR;
+        }
+
+        /* float quantization is not idempotent so the decoded messages are compared by writing them again */
+        memcpy(buffers[i], hand_buffer, sizeof(hand_buffer));
+        memset(hand_buffer, 0, sizeof(hand_buffer));
+        memset(generated_buffer, 0, sizeof(generated_buffer));
+
+        if (Write(bench->hand_serializer, hand_msg, hand_buffer) < 0 ||
+                Write(bench->generated_serializer, generated_msg, generated_buffer) < 0 ||
+                memcmp(hand_buffer, generated_buffer, (bits + 7) / 8) != 0)
+        {
+            printf("%s: read mismatch (message %d)\n", bench->name, i);
+
+            return NBN_ERROR;
+        }
+    }
+
+    return 0;
+}
+
+static double Elapsed(clock_t start)
+{
+    return (double)(clock() - start) / CLOCKS_PER_SEC * 1000;
+}
+
+/* Nanoseconds per message */
+static double BenchSend(NBN_MessageSerializer serializer, void **messages)
+{
+    uint8_t buffer[BENCH_BUFFER_SIZE];
+    unsigned int total = 0;
+    clock_t start = clock();
+
+    for (unsigned int n = 0; n < BENCH_ITERATIONS; n++)
+    {
+        for (unsigned int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+        {
+            total += Measure(serializer, messages[i]);
+            total += Measure(serializer, messages[i]);
+            total += Write(serializer, messages[i], buffer);
+        }
+    }
+
+    double ms = Elapsed(start);
+
+    sink = total + buffer[0];
+
+    return ms * 1e6 / ((double)BENCH_ITERATIONS * BENCH_MESSAGE_COUNT);
+}
+
+static double BenchReceive(NBN_MessageSerializer serializer, size_t msg_size)
+{
+    void *msg = malloc(msg_size);
+    unsigned int total = 0;
+    clock_t start = clock();
+
+    for (unsigned int n = 0; n < BENCH_ITERATIONS; n++)
+    {
+        for (unsigned int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+            total += Read(serializer, msg, buffers[i]) + *(uint8_t *)msg;
+    }
+
+    double ms = Elapsed(start);
+
+    sink = total;
+    free(msg);
+
+    return ms * 1e6 / ((double)BENCH_ITERATIONS * BENCH_MESSAGE_COUNT);
+}
+
+static double BenchAlloc(bool pooled)
+{
+    void *messages[BENCH_ALLOC_BATCH];
+    unsigned int iterations = BENCH_ITERATIONS * 100;
+    clock_t start = clock();
+
+    for (unsigned int n = 0; n < iterations; n++)
+    {
+        for (unsigned int i = 0; i < BENCH_ALLOC_BATCH; i++)
+        {
+            messages[i] = pooled ? (void *)GameStateMessage_Create() : malloc(sizeof(GameStateMessage));
+
+            ((GameStateMessage *)messages[i])->client_states_count = i;
+        }
+
+        for (unsigned int i = 0; i < BENCH_ALLOC_BATCH; i++)
+        {
+            sink += ((GameStateMessage *)messages[i])->client_states_count;
+
+            if (pooled)
+                GameStateMessage_Destroy((GameStateMessage *)messages[i]);
+            else
+                free(messages[i]);
+        }
+    }
+
+    double ms = Elapsed(start);
+
+    return ms * 1e6 / ((double)iterations * BENCH_ALLOC_BATCH);
+}
+
+int main(void)
+{
+    Bench benches[] = {
+        {
+            "UpdateStateMessage",
+            (NBN_MessageSerializer)HandUpdateStateMessage_Serialize,
+            (NBN_MessageSerializer)UpdateStateMessage_Serialize,
+            {0}, {0},
+            sizeof(HandUpdateStateMessage), sizeof(UpdateStateMessage)
+        },
+        {
+            "GameStateMessage",
+            (NBN_MessageSerializer)HandGameStateMessage_Serialize,
+            (NBN_MessageSerializer)GameStateMessage_Serialize,
+            {0}, {0},
+            sizeof(HandGameStateMessage), sizeof(GameStateMessage)
+        },
+        {
+            "DataMessage",
+            (NBN_MessageSerializer)HandDataMessage_Serialize,
+            (NBN_MessageSerializer)DataMessage_Serialize,
+            {0}, {0},
+            sizeof(HandDataMessage), sizeof(DataMessage)
+        }
+    };
+    unsigned int bench_count = sizeof(benches) / sizeof(Bench);
+
+    srand(42);
+
+    printf("%d messages, %d iterations (ns/message)\n\n", BENCH_MESSAGE_COUNT, BENCH_ITERATIONS);
+    printf("%-20s %10s %10s %10s %10s\n", "", "send", "send gen", "recv", "recv gen");
+
+    for (unsigned int b = 0; b < bench_count; b++)
+    {
+        Bench *bench = &benches[b];
+
+        for (unsigned int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+        {
+            bench->hand_messages[i] = calloc(1, bench->hand_size);
+            bench->generated_messages[i] = calloc(1, bench->generated_size);
+
+            GenerateMessages(bench, i);
+        }
+
+        if (Check(bench) < 0)
+            return 1;
+
+        printf("%-20s %10.1f %10.1f %10.1f %10.1f\n",
+                bench->name,
+                BenchSend(bench->hand_serializer, bench->hand_messages),
+                BenchSend(bench->generated_serializer, bench->generated_messages),
+                BenchReceive(bench->hand_serializer, bench->hand_size),
+                BenchReceive(bench->generated_serializer, bench->generated_size));
+
+        for (unsigned int i = 0; i < BENCH_MESSAGE_COUNT; i++)
+        {
+            free(bench->hand_messages[i]);
+            free(bench->generated_messages[i]);
+        }
+    }
+
+    printf("\nGameStateMessage builder + destructor: malloc %.1f ns, pool %.1f ns\n",
+            BenchAlloc(false), BenchAlloc(true));
+
+    BenchMessages_ReleasePools();
+
+    return 0;
+}
@@ -0,0 +1,456 @@
+/*
+
+   Copyright (C) 2020 BIAGINI Nathan
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+*/
+
+/*
+    Receive path benchmark: feeds a packet capture of the UDP driver (see NBN_UDP_StartCapture) to a game server
+    through a fake driver, as fast as possible, and reports the time spent reading packets (NBN_Packet_InitRead),
+    processing them (NBN_Connection_ProcessReceivedPacket) and delivering their messages to the server.
+
+    The capture is replayed by ticks of REPLAY_TICK_DT seconds of capture time, the packets sent by the server are
+    dropped. Captures of encrypted connections cannot be replayed.
+
+    The soak test message is registered, captures of the soak server can be made with:
+
+        server --capture=<path>
+
+    Usage: replay <capture file> [protocol name]
+*/
+
+#include <stdio.h>
+
+#define NBNET_IMPL
+
+#define NBN_LogInfo(...) (void)0
+#define NBN_LogError(...) (printf(__VA_ARGS__), printf("\n"))
+#define NBN_LogDebug(...) (void)0
+#define NBN_LogTrace(...) (void)0
+
+#include "../nbnet.h"
+
+#define REPLAY_TICK_DT (1.0 / 60)
+#define REPLAY_DEFAULT_PROTOCOL_NAME "nbnet_soak"
+
+/* Same as in net_drivers/udp.h */
+#define NBN_UDP_CAPTURE_MAGIC 0x4E425543
+
+typedef struct
+{
+    double time;
+    uint32_t host;
+    uint16_t port;
+    uint16_t size;
+} NBN_UDPCaptureRecord;
+
+/* Same as the soak test message (see soak/soak.c) */
+#define SOAK_MESSAGE 0
+#define SOAK_MESSAGE_MAX_DATA_LENGTH 4096
+
+typedef struct
+{
+    uint32_t id;
+    unsigned int data_length;
+    uint8_t data[SOAK_MESSAGE_MAX_DATA_LENGTH];
+} SoakMessage;
+
+typedef struct
+{
+    NBN_UDPCaptureRecord record;
+    uint8_t *data;
+} CapturedPacket;
+
+typedef struct
+{
+    uint32_t host;
+    uint16_t port;
+    NBN_Connection *connection;
+} ReplayClient;
+
+typedef struct
+{
+    unsigned int packet_count;
+    unsigned int invalid_packet_count;
+    unsigned int message_count;
+    uint64_t byte_count;
+    double read_time; /* NBN_Packet_InitRead */
+    double process_time; /* NBN_Connection_ProcessReceivedPacket */
+    double recv_time; /* Whole NBN_Driver_GServ_RecvPackets */
+    double poll_time; /* Whole NBN_GameServer_Poll loop, including the message delivery */
+    double send_time; /* NBN_GameServer_SendPackets */
+} ReplayStats;
+
+static CapturedPacket *packets = NULL;
+static unsigned int packet_count = 0;
+static unsigned int next_packet = 0;
+static double replay_time = 0;
+static uint32_t protocol_id = 0;
+static ReplayClient clients[NBN_MAX_CLIENTS];
+static unsigned int next_connection_id = 0;
+static ReplayStats stats = {0};
+
+static SoakMessage *SoakMessage_Create(void)
+{
+    return (SoakMessage *)NBN_Allocator(sizeof(SoakMessage));
+}
+
+static void SoakMessage_Destroy(SoakMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+static int SoakMessage_Serialize(SoakMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->id, 0, UINT32_MAX);
+    NBN_SerializeUInt(stream, msg->data_length, 1, SOAK_MESSAGE_MAX_DATA_LENGTH);
+    NBN_SerializeBytes(stream, msg->data, msg->data_length);
+
+    return 0;
+}
+
+static uint8_t *LoadCapture(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL)
+    {
+        printf("Failed to open %s\n", path);
+
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+
+    long size = ftell(file);
+    uint8_t *buffer = (uint8_t *)NBN_Allocator(size);
+
+    fseek(file, 0, SEEK_SET);
+
+    if (size < (long)sizeof(uint32_t) || fread(buffer, size, 1, file) != 1)
+    {
+        printf("Failed to read %s\n", path);
+        fclose(file);
+        NBN_Deallocator(buffer);
+
+        return NULL;
+    }
+
+    fclose(file);
+
+    uint32_t magic;
+
+    memcpy(&magic, buffer, sizeof(magic));
+
+    if (magic != NBN_UDP_CAPTURE_MAGIC)
+    {
+        printf("%s is not a packet capture\n", path);
+        NBN_Deallocator(buffer);
+
+        return NULL;
+    }
+
+    unsigned int capacity = 1024;
+    long offset = sizeof(uint32_t);
+
+    packets = (CapturedPacket *)NBN_Allocator(sizeof(CapturedPacket) * capacity);
+
+    while (offset + (long)sizeof(NBN_UDPCaptureRecord) <= size)
+    {
+        CapturedPacket packet;
+
+        memcpy(&packet.record, buffer + offset, sizeof(NBN_UDPCaptureRecord));
+
+        packet.data = buffer + offset + sizeof(NBN_UDPCaptureRecord);
+        offset += sizeof(NBN_UDPCaptureRecord) + packet.record.size;
+
+        if (offset > size)
+            break; /* the capture was not stopped properly */
+
+        if (packet_count >= capacity)
+        {
+            capacity *= 2;
+            packets = (CapturedPacket *)NBN_Reallocator(packets, sizeof(CapturedPacket) * capacity);
+        }
+
+        packets[packet_count++] = packet;
+    }
+
+    return buffer;
+}
+
+static NBN_Connection *FindOrCreateClient(uint32_t host, uint16_t port)
+{
+    ReplayClient *free_client = NULL;
+
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
+    {
+        ReplayClient *client = &clients[i];
+
+        if (client->connection == NULL)
+        {
+            if (free_client == NULL)
+                free_client = client;
+        }
+        else if (client->host == host && client->port == port)
+        {
+            return client->connection;
+        }
+    }
+
+    if (free_client == NULL)
+        return NULL;
+
+    free_client->host = host;
+    free_client->port = port;
+    free_client->connection = NBN_GameServer_CreateClientConnection(next_connection_id++, free_client);
+
+    NBN_Driver_GServ_RaiseEvent(NBN_DRIVER_GSERV_CLIENT_CONNECTED, free_client->connection);
+
+    return free_client->connection;
+}
+
+#pragma region Replay driver
+
+int NBN_Driver_GServ_Start(uint32_t proto_id, uint16_t port)
+{
+    (void)port;
+
+    protocol_id = proto_id;
+
+    return 0;
+}
+
+void NBN_Driver_GServ_Stop(void)
+{
+}
+
+/* Feed the captured packets received before the current replay time */
+int NBN_Driver_GServ_RecvPackets(void)
+{
+    double start_time = NBN_Clock_GetTime();
+
+    while (next_packet < packet_count && packets[next_packet].record.time <= replay_time)
+    {
+        CapturedPacket *captured_packet = &packets[next_packet++];
+        unsigned int size = captured_packet->record.size;
+
+        stats.packet_count++;
+        stats.byte_count += size;
+
+        if (NBN_Packet_ReadProtocolId(captured_packet->data, size) != protocol_id)
+        {
+            stats.invalid_packet_count++;
+
+            continue;
+        }
+
+        NBN_Connection *connection = FindOrCreateClient(captured_packet->record.host, captured_packet->record.port);
+
+        if (connection == NULL)
+            continue;
+
+        NBN_Packet packet;
+        double t0 = NBN_Clock_GetTime();
+
+        if (NBN_Packet_InitRead(&packet, connection, captured_packet->data, size) < 0)
+        {
+            stats.invalid_packet_count++;
+
+            continue;
+        }
+
+        double t1 = NBN_Clock_GetTime();
+
+        if (NBN_Driver_GServ_RaiseEvent(NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED, &packet) < 0)
+        {
+            NBN_LogError("Failed to raise game server event");
+
+            return NBN_ERROR;
+        }
+
+        stats.read_time += t1 - t0;
+        stats.process_time += NBN_Clock_GetTime() - t1;
+    }
+
+    stats.recv_time += NBN_Clock_GetTime() - start_time;
+
+    return 0;
+}
+
+void NBN_Driver_GServ_RemoveClientConnection(NBN_Connection *connection)
+{
+    ((ReplayClient *)connection->driver_data)->connection = NULL;
+}
+
+int NBN_Driver_GServ_SendPacketTo(NBN_Packet *packet, NBN_Connection *connection)
+{
+    (void)packet;
+    (void)connection;
+
+    return 0;
+}
+
+int NBN_Driver_GCli_Start(uint32_t proto_id, const char *host, uint16_t port)
+{
+    (void)proto_id;
+    (void)host;
+    (void)port;
+
+    return NBN_ERROR;
+}
+
+void NBN_Driver_GCli_Stop(void)
+{
+}
+
+int NBN_Driver_GCli_RecvPackets(void)
+{
+    return 0;
+}
+
+int NBN_Driver_GCli_SendPacket(NBN_Packet *packet)
+{
+    (void)packet;
+
+    return NBN_ERROR;
+}
+
+#pragma endregion /* Replay driver */
+
+static int Poll(void)
+{
+    int ev;
+
+    while ((ev = NBN_GameServer_Poll()) != NBN_NO_EVENT)
+    {
+        if (ev < 0)
+            return NBN_ERROR;
+
+        if (ev == NBN_NEW_CONNECTION)
+        {
+            NBN_GameServer_AcceptIncomingConnection();
+        }
+        else if (ev == NBN_CLIENT_MESSAGE_RECEIVED)
+        {
+            NBN_MessageInfo msg_info = NBN_GameServer_GetMessageInfo();
+
+            stats.message_count++;
+
+            if (msg_info.type == SOAK_MESSAGE)
+                SoakMessage_Destroy((SoakMessage *)msg_info.data);
+        }
+    }
+
+    return 0;
+}
+
+static void PrintStage(const char *name, double time)
+{
+    printf("%-32s %10.3f ms %10.1f ns/packet\n",
+            name, time * 1000, stats.packet_count ? time * 1e9 / stats.packet_count : 0);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        printf("Usage: replay <capture file> [protocol name]\n");
+
+        return 1;
+    }
+
+    uint8_t *capture = LoadCapture(argv[1]);
+
+    if (capture == NULL)
+        return 1;
+
+    if (packet_count == 0)
+    {
+        printf("The capture is empty\n");
+
+        return 1;
+    }
+
+    if (NBN_GameServer_Start(argc > 2 ? argv[2] : REPLAY_DEFAULT_PROTOCOL_NAME, 0, false) < 0)
+    {
+        printf("Failed to start game server\n");
+
+        return 1;
+    }
+
+    NBN_GameServer_RegisterMessage(SOAK_MESSAGE,
+            (NBN_MessageBuilder)SoakMessage_Create,
+            (NBN_MessageDestructor)SoakMessage_Destroy,
+            (NBN_MessageSerializer)SoakMessage_Serialize);
+
+    double capture_duration = packets[packet_count - 1].record.time - packets[0].record.time;
+    double start_time = NBN_Clock_GetTime();
+
+    replay_time = packets[0].record.time;
+
+    while (next_packet < packet_count)
+    {
+        replay_time += REPLAY_TICK_DT;
+
+        NBN_GameServer_AddTime(REPLAY_TICK_DT);
+
+        double t0 = NBN_Clock_GetTime();
+
+        if (Poll() < 0)
+        {
+            printf("Failed to poll game server\n");
+
+            break;
+        }
+
+        double t1 = NBN_Clock_GetTime();
+
+        if (NBN_GameServer_SendPackets() < 0)
+        {
+            printf("Failed to send packets\n");
+
+            break;
+        }
+
+        stats.poll_time += t1 - t0;
+        stats.send_time += NBN_Clock_GetTime() - t1;
+    }
+
+    double total_time = NBN_Clock_GetTime() - start_time;
+
+    printf("Replayed %u packets (%u invalid, %.1f KB) and %u messages of a %.1f s capture in %.3f s (%.1fx)\n",
+            stats.packet_count, stats.invalid_packet_count, stats.byte_count / 1024.0, stats.message_count,
+            capture_duration, total_time, total_time > 0 ? capture_duration / total_time : 0);
+    printf("%.0f packets/s\n", total_time > 0 ? stats.packet_count / total_time : 0);
+
+    PrintStage("NBN_Packet_InitRead", stats.read_time);
+    PrintStage("Packet processing", stats.process_time);
+    PrintStage("Message delivery", stats.poll_time - stats.recv_time);
+    PrintStage("NBN_GameServer_SendPackets", stats.send_time);
+
+    NBN_GameServer_Stop();
+
+    NBN_Deallocator(packets);
+    NBN_Deallocator(capture);
+
+    return 0;
+}
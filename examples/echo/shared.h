@@ -49,6 +49,11 @@ enum
 
 void Log(int, const char *, ...);
 
+#ifdef __EMSCRIPTEN__
+// the WebRTC driver batches the packets of a tick
+#define NBN_DRIVER_HAS_FLUSH
+#endif
+
 #include "../../nbnet.h"
 
 #ifdef __EMSCRIPTEN__
@@ -93,6 +93,11 @@ typedef struct tagMSG *LPMSG;
 #define NBN_LogDebug(...) TraceLog(LOG_DEBUG, __VA_ARGS__)
 #define NBN_LogTrace(...) TraceLog(LOG_TRACE, __VA_ARGS__)
 
+#ifdef __EMSCRIPTEN__
+// the WebRTC driver batches the packets of a tick
+#define NBN_DRIVER_HAS_FLUSH
+#endif
+
 #include "../../nbnet.h"
 
 #ifdef __EMSCRIPTEN__
@@ -26,6 +26,7 @@
 #define NBNET_H
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
@@ -53,9 +54,112 @@
 
 #define NBN_ERROR -1
 
+#pragma region Logging
+
+/*
+ * nbnet logs through the NBN_LogError, NBN_LogInfo, NBN_LogDebug and NBN_LogTrace macros that are defined by
+ * the user. NBN_LOG_LEVEL filters them at compile time: the calls above that level are removed along with
+ * their arguments and the corresponding macros do not need to be defined.
+ *
+ * With NBN_USE_TRACE_LOG, trace logs are not formatted when they are emitted: their format string and
+ * integer arguments are written to a lock-free ring buffer that keeps the last NBN_TRACE_LOG_SIZE entries.
+ * The buffer is formatted on demand with NBN_TraceLog_Dump (after a disconnection, in a crash handler, etc.),
+ * which makes trace level diagnostics cheap enough to be left on in production.
+ *
+ * Both options also apply to the user code that calls those macros after including nbnet.
+ */
+
+#define NBN_LOG_LEVEL_NONE 0
+#define NBN_LOG_LEVEL_ERROR 1
+#define NBN_LOG_LEVEL_INFO 2
+#define NBN_LOG_LEVEL_DEBUG 3
+#define NBN_LOG_LEVEL_TRACE 4
+
+#ifndef NBN_LOG_LEVEL
+#define NBN_LOG_LEVEL NBN_LOG_LEVEL_TRACE
+#endif
+
+#if NBN_LOG_LEVEL < NBN_LOG_LEVEL_ERROR
+#undef NBN_LogError
+#define NBN_LogError(...) ((void)0)
+#endif
+
+#if NBN_LOG_LEVEL < NBN_LOG_LEVEL_INFO
+#undef NBN_LogInfo
+#define NBN_LogInfo(...) ((void)0)
+#endif
+
+#if NBN_LOG_LEVEL < NBN_LOG_LEVEL_DEBUG
+#undef NBN_LogDebug
+#define NBN_LogDebug(...) ((void)0)
+#endif
+
+#if NBN_LOG_LEVEL < NBN_LOG_LEVEL_TRACE
+#undef NBN_LogTrace
+#define NBN_LogTrace(...) ((void)0)
+#elif defined(NBN_USE_TRACE_LOG)
+#undef NBN_LogTrace
+#define NBN_LogTrace(...) NBN_TraceLog_Write(__VA_ARGS__)
+#endif
+
+#ifdef NBN_USE_TRACE_LOG
+
+#include <stdio.h>
+
+#ifndef NBN_TRACE_LOG_SIZE
+#define NBN_TRACE_LOG_SIZE 4096 /* Must be a power of two */
+#endif
+
+#define NBN_TRACE_LOG_MAX_ARGS 6
+
+typedef struct
+{
+    uint64_t seq; /* Index of the entry + 1, 0 while it's being written */
+    const char *format; /* Also identifies the call site */
+    int arg_count; /* -1 when the format is not supported */
+    int args[NBN_TRACE_LOG_MAX_ARGS];
+} NBN_TraceLogEntry;
+
+typedef struct
+{
+    NBN_TraceLogEntry entries[NBN_TRACE_LOG_SIZE];
+    uint64_t head;
+} NBN_TraceLog;
+
+extern NBN_TraceLog __trace_log;
+
+/**
+ * Write a trace log entry. Only integer conversions (%d, %i, %u, %x, %X, %c, with flags, width and precision)
+ * are supported, up to NBN_TRACE_LOG_MAX_ARGS of them. The arguments of other formats are not read: the format
+ * string is dumped as is.
+ *
+ * Safe to call from any thread.
+ *
+ * @param format printf like format string, must outlive the trace log (a string literal)
+ */
+void NBN_TraceLog_Write(const char *format, ...);
+
+/**
+ * Format the entries of the trace log, from the oldest to the most recent, and write them to a file.
+ *
+ * Entries that are overwritten while being dumped are skipped.
+ *
+ * @param file File to write to
+ *
+ * @return The number of written entries
+ */
+unsigned int NBN_TraceLog_Dump(FILE *file);
+
+#endif /* NBN_USE_TRACE_LOG */
+
+#pragma endregion /* Logging */
+
 typedef struct __NBN_Endpoint NBN_Endpoint;
 typedef struct __NBN_Connection NBN_Connection;
 typedef struct __NBN_Channel NBN_Channel;
+typedef struct __NBN_Replicator NBN_Replicator;
+typedef struct __NBN_Recorder NBN_Recorder;
+typedef struct __NBN_RecordReader NBN_RecordReader;
 
 #pragma region NBN_ConnectionVector
 
@@ -116,12 +220,42 @@ typedef uint32_t Word;
 #define WORD_BITS (WORD_BYTES * 8)
 #define BITS_REQUIRED(min, max) (min == max) ? 0 : GetRequiredNumberOfBitsFor(max - min)
 
-#define B_MASK(n) (1 << (n))
+#define B_MASK(n) ((uint32_t)1 << (n))
 #define B_SET(mask, n) (mask |= B_MASK(n))
 #define B_UNSET(mask, n) (mask &= ~B_MASK(n))
 #define B_IS_SET(mask, n) ((B_MASK(n) & mask) == B_MASK(n))
 #define B_IS_UNSET(mask, n) ((B_MASK(n) & mask) == 0)
 
+/* Index of the lowest set bit of a non zero 32 bits mask */
+#if defined(__GNUC__) || defined(__clang__)
+#define B_CTZ(mask) ((unsigned int)__builtin_ctz(mask))
+#else
+static unsigned int B_CTZ(uint32_t mask)
+{
+    unsigned int n = 0;
+
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        n++;
+    }
+
+    return n;
+}
+#endif
+
+/* Index of the lowest set bit of a non zero 64 bits mask */
+#if defined(__GNUC__) || defined(__clang__)
+#define B_CTZ64(mask) ((unsigned int)__builtin_ctzll(mask))
+#else
+static unsigned int B_CTZ64(uint64_t mask)
+{
+    uint32_t low = (uint32_t)mask;
+
+    return low ? B_CTZ(low) : 32 + B_CTZ((uint32_t)(mask >> 32));
+}
+#endif
+
 #define ASSERT_VALUE_IN_RANGE(v, min, max) assert(v >= min && v <= max)
 #define ASSERTED_SERIALIZE(stream, v, min, max, func)       \
 {                                                           \
@@ -283,6 +417,9 @@ typedef struct
     uint8_t channel_id;
 } NBN_MessageHeader;
 
+/* Number of bytes taken by a serialized message header (see NBN_Message_SerializeHeader) */
+#define NBN_MESSAGE_HEADER_SIZE 4
+
 /*
  * Holds the user message's data as well as a reference count for message recycling
  */
@@ -477,18 +614,43 @@ enum
     NBN_PACKET_WRITE_NO_SPACE,
 };
 
+/* Value of the ack_delay header field when the sender has not received any packet yet */
+#define NBN_PACKET_NO_ACK_DELAY 0xFFFF
+
+/* Value of the time header field when the send time of the packet is unknown */
+#define NBN_PACKET_NO_TIME 0xFFFFFFFF
+
 typedef enum
 {
     NBN_PACKET_MODE_WRITE = 1,
     NBN_PACKET_MODE_READ
 } NBN_PacketMode;
 
+/* Fields are ordered from the largest to the smallest so the header has no padding between them */
 typedef struct
 {
     uint32_t protocol_id;
+    uint32_t ack_bits;
+
+    /*
+     * Clock synchronization part
+     */
+
+    /* Sender's clock time when the packet was sent, relative to the connection start (in 0.1 ms, wraps around) */
+    uint32_t time;
+
     uint16_t seq_number;
     uint16_t ack;
-    uint32_t ack_bits;
+
+    /* Time spent by the sender between the reception of the acked packet and the sending of this one (in 0.1 ms) */
+    uint16_t ack_delay;
+
+    /*
+     * Input stream part
+     */
+
+    uint16_t input_ack; /* Lowest 16 bits of the last input frame read by the server (see NBN_InputReceiver) */
+
     uint8_t messages_count;
 
     /*
@@ -506,6 +668,8 @@ typedef struct
     NBN_PacketHeader header;
     NBN_PacketMode mode;
     struct __NBN_Connection *sender; /* not serialized, fill by the network driver upon reception */
+    double recv_time; /* not serialized, clock time of the reception (see NBN_Clock_GetTime), negative when the driver does not provide it */
+    bool is_reliable; /* not serialized, all the messages of the packet are from reliable channels (see NBN_DRIVER_PACKET_SENT_RELIABLY) */
     uint8_t buffer[NBN_PACKET_MAX_SIZE];
     unsigned int size; /* in bytes */
     bool sealed;
@@ -581,6 +745,7 @@ int NBN_ClientClosedMessage_Serialize(NBN_ClientClosedMessage *, NBN_Stream *);
 
 typedef struct
 {
+    double start_time; /* Server clock time the connection was created at (see NBN_GameClient_GetServerTime) */
     uint8_t data[NBN_ACCEPT_DATA_MAX_SIZE];
 } NBN_ClientAcceptedMessage;
 
@@ -660,12 +825,341 @@ int NBN_ConnectionRequestMessage_Serialize(NBN_ConnectionRequestMessage *, NBN_S
 
 #pragma endregion /* NBN_PublicCryptoInfoMessage */
 
+#pragma region NBN_FECParityMessage
+
+#define NBN_FEC_PARITY_MESSAGE_TYPE (NBN_MAX_MESSAGE_TYPES - 9) /* Reserved message type */
+
+/* Number of bytes taken by the parity message fields that precede the parity data */
+#define NBN_FEC_PARITY_HEADER_SIZE 20
+
+/* Maximum size of a packet's data for the packet to be protected by a parity packet */
+#define NBN_FEC_MAX_PAYLOAD_SIZE \
+    (NBN_PACKET_MAX_USER_DATA_SIZE - NBN_MESSAGE_HEADER_SIZE - NBN_FEC_PARITY_HEADER_SIZE)
+
+/*
+ * XOR of a group of packets (header fields and data), sent in its own packet. Any single packet
+ * of the group can be rebuilt from the parity and the other packets of the group.
+ */
+typedef struct
+{
+    uint16_t first_seq_number; /* Sequence number of the first packet of the group */
+    uint32_t packet_mask; /* Packets of the group, relative to first_seq_number */
+    uint16_t length;
+    uint16_t ack;
+    uint32_t ack_bits;
+    uint8_t messages_count;
+    unsigned int data_length; /* Length of the longest packet of the group */
+    uint8_t data[NBN_FEC_MAX_PAYLOAD_SIZE];
+} NBN_FECParityMessage;
+
+NBN_FECParityMessage *NBN_FECParityMessage_Create(void);
+void NBN_FECParityMessage_Destroy(NBN_FECParityMessage *);
+int NBN_FECParityMessage_Serialize(NBN_FECParityMessage *, NBN_Stream *);
+
+#pragma endregion /* NBN_FECParityMessage */
+
+#pragma region NBN_ReplicationMessage
+
+#define NBN_REPLICATION_MESSAGE_TYPE (NBN_MAX_MESSAGE_TYPES - 10) /* Reserved message type */
+
+#define NBN_REPLICATION_MAX_ENTITY_TYPES 32
+#define NBN_REPLICATION_MAX_FIELDS 32 /* Maximum number of fields of an entity type (bits of a field mask) */
+#define NBN_REPLICATION_MAX_ENTITIES 65536 /* Entity IDs are serialized on 16 bits */
+#define NBN_REPLICATION_MAX_RECORDS 64 /* Maximum number of entity records per replication message */
+#define NBN_REPLICATION_MESSAGE_DATA_SIZE 2048 /* Size of the buffer holding the values of a message's fields */
+
+/* Replication messages are never split into chunks */
+#define NBN_REPLICATION_MAX_MESSAGE_SIZE NBN_MESSAGE_CHUNK_SIZE
+
+enum
+{
+    /* The entity has to be created by the receiver, the record holds all its fields */
+    NBN_REPLICATION_RECORD_CREATE = 1,
+
+    /* The entity has to be destroyed by the receiver, the record holds no field */
+    NBN_REPLICATION_RECORD_DESTROY = 2
+};
+
+typedef enum
+{
+    NBN_REPLICATION_FIELD_UINT, /* unsigned int */
+    NBN_REPLICATION_FIELD_INT, /* int */
+    NBN_REPLICATION_FIELD_FLOAT, /* float */
+    NBN_REPLICATION_FIELD_BOOL, /* bool */
+    NBN_REPLICATION_FIELD_BYTES /* uint8_t array */
+} NBN_ReplicationFieldType;
+
+/*
+ * Description of a replicated field of an entity's state structure.
+ *
+ * Values must stay within [min, max], floats are serialized with the given precision (number of decimals).
+ */
+typedef struct
+{
+    NBN_ReplicationFieldType type;
+    size_t offset; /* Offset of the field in the entity's state structure */
+    double min;
+    double max;
+    int precision;
+    unsigned int length; /* Length of byte array fields */
+} NBN_ReplicationField;
+
+#define NBN_REPLICATED_UINT(type, member, min, max) \
+    { NBN_REPLICATION_FIELD_UINT, offsetof(type, member), min, max, 0, 0 }
+#define NBN_REPLICATED_INT(type, member, min, max) \
+    { NBN_REPLICATION_FIELD_INT, offsetof(type, member), min, max, 0, 0 }
+#define NBN_REPLICATED_FLOAT(type, member, min, max, precision) \
+    { NBN_REPLICATION_FIELD_FLOAT, offsetof(type, member), min, max, precision, 0 }
+#define NBN_REPLICATED_BOOL(type, member) \
+    { NBN_REPLICATION_FIELD_BOOL, offsetof(type, member), 0, 1, 0, 0 }
+#define NBN_REPLICATED_BYTES(type, member, length) \
+    { NBN_REPLICATION_FIELD_BYTES, offsetof(type, member), 0, 0, 0, length }
+
+typedef struct
+{
+    NBN_ReplicationField fields[NBN_REPLICATION_MAX_FIELDS];
+    unsigned int field_count;
+    bool is_registered;
+} NBN_ReplicatedEntityType;
+
+/*
+ * Changes of a single entity, the values of the fields listed in field_mask are stored (in field order)
+ * in the message's data buffer.
+ */
+typedef struct
+{
+    unsigned int entity_id;
+    unsigned int entity_type;
+    unsigned int flags;
+    unsigned int field_mask;
+    unsigned int spawn_sequence; /* Sequence of the first message that created the entity (create records only) */
+    unsigned int data_offset;
+} NBN_ReplicationRecord;
+
+typedef struct
+{
+    unsigned int sequence; /* Per client sequence number, used to discard outdated values */
+    unsigned int record_count;
+    unsigned int data_length;
+    NBN_ReplicationRecord records[NBN_REPLICATION_MAX_RECORDS];
+    uint8_t data[NBN_REPLICATION_MESSAGE_DATA_SIZE];
+
+    /*
+     * Replication messages are sent to a single client and carry their own outgoing message so that they don't
+     * use up the endpoint's outgoing message buffer (released along with the replication message).
+     */
+    NBN_OutgoingMessage outgoing_msg;
+} NBN_ReplicationMessage;
+
+extern NBN_ReplicatedEntityType __replicated_entity_types[NBN_REPLICATION_MAX_ENTITY_TYPES];
+
+/**
+ * Register a type of replicated entity, has to be called with the same fields on both the client and the server.
+ *
+ * @param type_id A user defined entity type, from 0 to NBN_REPLICATION_MAX_ENTITY_TYPES - 1
+ * @param fields The replicated fields of the entity's state structure (see NBN_REPLICATED_UINT and friends)
+ * @param field_count The number of fields (NBN_REPLICATION_MAX_FIELDS at most)
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_Replication_RegisterEntityType(uint8_t type_id, const NBN_ReplicationField *fields, unsigned int field_count);
+
+NBN_ReplicationMessage *NBN_ReplicationMessage_Create(void);
+void NBN_ReplicationMessage_Destroy(NBN_ReplicationMessage *);
+int NBN_ReplicationMessage_Serialize(NBN_ReplicationMessage *, NBN_Stream *);
+
+#pragma endregion /* NBN_ReplicationMessage */
+
+#pragma region NBN_SnapshotMessage
+
+#define NBN_SNAPSHOT_MESSAGE_TYPE (NBN_MAX_MESSAGE_TYPES - 11) /* Reserved message type */
+
+#define NBN_SNAPSHOT_MAX_ENTITIES 256 /* Maximum number of entities per snapshot message */
+#define NBN_SNAPSHOT_MAX_ENTITY_IDS 65536 /* Entity IDs are serialized on 16 bits */
+
+/* Snapshot messages are never split into chunks */
+#define NBN_SNAPSHOT_MAX_MESSAGE_SIZE NBN_MESSAGE_CHUNK_SIZE
+
+/*
+ * Serializes the state of an entity, called with the state of the entity on the server side and with
+ * a zeroed state structure (of the registered size) on the client side.
+ */
+typedef int (*NBN_SnapshotEntitySerializer)(void *, NBN_Stream *);
+
+typedef struct
+{
+    NBN_SnapshotEntitySerializer serializer;
+    size_t size; /* Size of an entity's state structure */
+} NBN_SnapshotEntityType;
+
+typedef struct
+{
+    uint32_t tick; /* User defined server tick the snapshot was taken at */
+    unsigned int entity_count;
+    unsigned int entity_ids[NBN_SNAPSHOT_MAX_ENTITIES];
+    uint8_t *states; /* entity_count copies of the entities' state structures */
+
+    /* Snapshot messages are sent to a single client, see NBN_ReplicationMessage */
+    NBN_OutgoingMessage outgoing_msg;
+} NBN_SnapshotMessage;
+
+extern NBN_SnapshotEntityType __snapshot_entity_type;
+
+/**
+ * Register the serializer of the entities sent in snapshot messages, has to be called on both the client
+ * and the server.
+ *
+ * @param serializer The entity serializer
+ * @param size The size of the entities' state structure
+ */
+void NBN_Snapshot_RegisterEntitySerializer(NBN_SnapshotEntitySerializer serializer, size_t size);
+
+/**
+ * Return the state of an entity of a snapshot message.
+ *
+ * @param msg The snapshot message
+ * @param index The index of the entity in the message (from 0 to entity_count - 1)
+ *
+ * @return The state of the entity, its ID is msg->entity_ids[index]
+ */
+void *NBN_SnapshotMessage_GetEntity(NBN_SnapshotMessage *msg, unsigned int index);
+
+NBN_SnapshotMessage *NBN_SnapshotMessage_Create(void);
+void NBN_SnapshotMessage_Destroy(NBN_SnapshotMessage *);
+int NBN_SnapshotMessage_Serialize(NBN_SnapshotMessage *, NBN_Stream *);
+
+#pragma endregion /* NBN_SnapshotMessage */
+
+#pragma region NBN_InputMessage
+
+/*
+ * Input stream
+ *
+ * Client inputs are tagged with consecutive frame numbers (starting at 1) and sent on a library reserved
+ * unreliable channel. Every input message carries all the inputs the server has not acknowledged yet (up to
+ * NBN_INPUT_MAX_FRAMES), so a lost message does not lose inputs.
+ *
+ * The server reads the inputs of each client in frame order; the last frame read is acknowledged in the header
+ * of every packet sent to that client, the client is notified through its input ack callback and can replay
+ * its predicted inputs from there.
+ */
+
+#define NBN_INPUT_MESSAGE_TYPE (NBN_MAX_MESSAGE_TYPES - 12) /* Reserved message type */
+
+/* Maximum number of unacknowledged inputs kept by the client and buffered by the server */
+#define NBN_INPUT_MAX_FRAMES 32
+
+/*
+ * Serializes an input, called with the input on the client side and with a zeroed input structure (of
+ * the registered size) on the server side.
+ */
+typedef int (*NBN_InputSerializer)(void *, NBN_Stream *);
+
+/* Called on the client when the server acknowledges an input frame */
+typedef void (*NBN_InputAckCallback)(uint32_t, void *);
+
+typedef struct
+{
+    NBN_InputSerializer serializer;
+    size_t size; /* Size of an input structure */
+} NBN_InputType;
+
+typedef struct
+{
+    uint32_t first_frame;
+    unsigned int frame_count;
+    uint8_t *inputs; /* frame_count consecutive inputs */
+} NBN_InputMessage;
+
+/* Client side of an input stream */
+typedef struct
+{
+    uint32_t next_frame; /* Frame number of the next input */
+    uint32_t acked_frame; /* Last frame acknowledged by the server (0 when none) */
+    uint8_t *inputs; /* Unacknowledged inputs, indexed by frame */
+    NBN_InputAckCallback ack_callback;
+    void *ack_callback_user_data;
+} NBN_InputSender;
+
+/* Server side of an input stream */
+typedef struct
+{
+    uint32_t next_frame; /* Frame number of the next input to read */
+    uint32_t last_frame; /* Last frame received without gaps since the last read one */
+    uint32_t frames[NBN_INPUT_MAX_FRAMES]; /* Frame stored in each slot, indexed by frame */
+    uint8_t *inputs;
+} NBN_InputReceiver;
+
+extern NBN_InputType __input_type;
+
+/**
+ * Register the serializer of the inputs, has to be called on both the client and the server.
+ *
+ * @param serializer The input serializer
+ * @param size The size of the input structure
+ */
+void NBN_Input_RegisterSerializer(NBN_InputSerializer serializer, size_t size);
+
+NBN_InputMessage *NBN_InputMessage_Create(void);
+void NBN_InputMessage_Destroy(NBN_InputMessage *);
+int NBN_InputMessage_Serialize(NBN_InputMessage *, NBN_Stream *);
+
+#pragma endregion /* NBN_InputMessage */
+
+#pragma region NBN_AckRangesMessage
+
+/*
+ * Extended acks
+ *
+ * A packet header acks the most recent received packet and the 32 before it (see NBN_PacketHeader.ack_bits),
+ * so a burst of lost packets can take away every header acking some packets, and more than 33 packets received
+ * between two sent ones are not all acked by their headers. The packets the remote peer may not know about are
+ * acked again with this message, added to the first packet of a flush: the ones received since the previous
+ * header or, when packets carrying acks have not been acked in time (the same delay as message resends), since
+ * the most recent ack known to be delivered.
+ *
+ * The acks are encoded as alternating runs of received and not received packets, starting (with received
+ * ones) 33 packets before the packet header's ack.
+ */
+
+#define NBN_ACK_RANGES_MESSAGE_TYPE (NBN_MAX_MESSAGE_TYPES - 13) /* Reserved message type */
+
+/* Lowest message type reserved by nbnet, user message types go from 0 to NBN_FIRST_RESERVED_MESSAGE_TYPE - 1 */
+#define NBN_FIRST_RESERVED_MESSAGE_TYPE NBN_ACK_RANGES_MESSAGE_TYPE
+
+/* Number of packets acked by a packet header */
+#define NBN_PACKET_HEADER_ACK_COUNT 33
+
+/* Maximum number of runs of an ack ranges message, the oldest acks are left out */
+#define NBN_ACK_RANGES_MAX_RUNS 32
+
+typedef struct
+{
+    unsigned int run_count;
+    unsigned int runs[NBN_ACK_RANGES_MAX_RUNS]; /* Run lengths, the first one (possibly empty) is of received packets */
+} NBN_AckRangesMessage;
+
+NBN_AckRangesMessage *NBN_AckRangesMessage_Create(void);
+void NBN_AckRangesMessage_Destroy(NBN_AckRangesMessage *);
+int NBN_AckRangesMessage_Serialize(NBN_AckRangesMessage *, NBN_Stream *);
+
+#pragma endregion /* NBN_AckRangesMessage */
+
 #pragma region NBN_Channel
 
+/* Default size of the message buffers of the channels (see NBN_Config) */
+#ifndef NBN_CHANNEL_BUFFER_SIZE
 #define NBN_CHANNEL_BUFFER_SIZE 1024
+#endif
+
 #define NBN_CHANNEL_CHUNKS_BUFFER_SIZE 255
 #define NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE 2048
 
+/* Number of consecutive packets an unreliable redundant message is included in (unless acked before) */
+#ifndef NBN_CHANNEL_REDUNDANT_SEND_COUNT
+#define NBN_CHANNEL_REDUNDANT_SEND_COUNT 3
+#endif
+
 /* Library reserved unreliable ordered channel */
 #define NBN_CHANNEL_RESERVED_UNRELIABLE (NBN_MAX_CHANNELS - 1)
 
@@ -675,17 +1169,27 @@ int NBN_ConnectionRequestMessage_Serialize(NBN_ConnectionRequestMessage *, NBN_S
 /* Library reserved messages reliable ordered channel */
 #define NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES (NBN_MAX_CHANNELS - 3)
 
+/* Library reserved input stream unreliable unordered channel (see NBN_GameClient_SendInput), user channels must not use it */
+#define NBN_CHANNEL_RESERVED_INPUTS (NBN_MAX_CHANNELS - 4)
+
+#define NBN_IsReservedChannel(id) (id == NBN_CHANNEL_RESERVED_UNRELIABLE || id == NBN_CHANNEL_RESERVED_RELIABLE \
+|| id == NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES || id == NBN_CHANNEL_RESERVED_INPUTS)
+
 typedef enum
 {
     NBN_CHANNEL_TYPE_UNDEFINED = -1,
     NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED,
-    NBN_CHANNEL_TYPE_RELIABLE_ORDERED
+    NBN_CHANNEL_TYPE_RELIABLE_ORDERED,
+    NBN_CHANNEL_TYPE_UNRELIABLE_REDUNDANT,
+    NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED
 } NBN_ChannelType;
 
 typedef struct
 {
     NBN_Message message;
     double last_send_time;
+    unsigned int send_count;
+    bool is_sent_reliably; /* Sent through the driver's reliable transport, not resent while waiting for its ack */
     bool free;
 } NBN_MessageSlot;
 
@@ -700,13 +1204,12 @@ struct __NBN_Channel
     unsigned int chunk_count;
     int last_received_chunk_id;
     double time;
-    uint8_t *write_chunk_buffer;
     uint8_t *read_chunk_buffer;
-    unsigned int write_chunk_buffer_size;
     unsigned int read_chunk_buffer_size;
     unsigned int next_outgoing_chunked_message;
-    NBN_MessageSlot outgoing_message_slot_buffer[NBN_CHANNEL_BUFFER_SIZE];
-    NBN_MessageSlot recved_message_slot_buffer[NBN_CHANNEL_BUFFER_SIZE];
+    unsigned int buffer_size; /* Number of slots of the message buffers */
+    NBN_MessageSlot *outgoing_message_slot_buffer;
+    NBN_MessageSlot *recved_message_slot_buffer;
     NBN_MessageChunk *recv_chunk_buffer[NBN_CHANNEL_CHUNKS_BUFFER_SIZE];
 
     bool (*AddReceivedMessage)(NBN_Channel *, NBN_Message *);
@@ -714,13 +1217,13 @@ struct __NBN_Channel
     NBN_Message *(*GetNextRecvedMessage)(NBN_Channel *);
     NBN_Message *(*GetNextOutgoingMessage)(NBN_Channel *);
     int (*OnOutgoingMessageAcked)(NBN_Channel *, uint16_t);
+    int (*OnOutgoingMessageSent)(NBN_Channel *, NBN_Message *);
 };
 
 void NBN_Channel_Destroy(NBN_Channel *);
 void NBN_Channel_AddTime(NBN_Channel *, double);
 bool NBN_Channel_AddChunk(NBN_Channel *, NBN_Message *);
 int NBN_Channel_ReconstructMessageFromChunks(NBN_Channel *, NBN_Connection *, NBN_Message *);
-void NBN_Channel_ResizeWriteChunkBuffer(NBN_Channel *, unsigned int);
 void NBN_Channel_ResizeReadChunkBuffer(NBN_Channel *, unsigned int);
 void NBN_Channel_UpdateMessageLastSendTime(NBN_Channel *, NBN_Message *, double);
 
@@ -739,7 +1242,7 @@ typedef struct
     unsigned int next_outgoing_message_slot;
 } NBN_UnreliableOrderedChannel;
 
-NBN_UnreliableOrderedChannel *NBN_UnreliableOrderedChannel_Create(void);
+NBN_UnreliableOrderedChannel *NBN_UnreliableOrderedChannel_Create(unsigned int);
 
 /*
    Reliable ordered
@@ -752,10 +1255,45 @@ typedef struct
     NBN_Channel base;
     uint16_t oldest_unacked_message_id;
     uint16_t most_recent_message_id;
-    bool ack_buffer[NBN_CHANNEL_BUFFER_SIZE];
+    bool *ack_buffer;
 } NBN_ReliableOrderedChannel;
 
-NBN_ReliableOrderedChannel *NBN_ReliableOrderedChannel_Create(void);
+NBN_ReliableOrderedChannel *NBN_ReliableOrderedChannel_Create(unsigned int);
+
+/*
+   Unreliable redundant
+
+   Every message is included in the next NBN_CHANNEL_REDUNDANT_SEND_COUNT sent packets, or until one of the packets
+   it was included in is acked. The receiver drops duplicates and delivers messages in order, skipping the ones
+   that were lost in all the packets they were part of. This is meant to be used for small time critical messages
+   that should survive occasional packet loss without paying the round-trip delay of a reliable channel, for
+   example player inputs.
+   */
+typedef struct
+{
+    NBN_Channel base;
+    uint16_t oldest_pending_message_id;
+    uint16_t most_recent_message_id;
+} NBN_UnreliableRedundantChannel;
+
+NBN_UnreliableRedundantChannel *NBN_UnreliableRedundantChannel_Create(unsigned int);
+
+/*
+   Unreliable unordered
+
+   Messages are delivered in the order they are received, late messages are not dropped. Messages sent on this
+   channel cannot be split into chunks so they must fit in a single packet. This is meant to be used by messages
+   that carry their own sequencing, for example entity replication updates (see NBN_Replicator).
+   */
+typedef struct
+{
+    NBN_Channel base;
+    unsigned int next_outgoing_message_slot;
+    unsigned int next_recv_message_slot;
+    unsigned int recved_message_count;
+} NBN_UnreliableUnorderedChannel;
+
+NBN_UnreliableUnorderedChannel *NBN_UnreliableUnorderedChannel_Create(unsigned int);
 
 #pragma endregion /* NBN_Channel */
 
@@ -767,25 +1305,109 @@ typedef struct
     const char *ip_address;
     uint16_t port;
     bool is_encryption_enabled;
+    bool is_fec_enabled;
+
+    /*
+     * Protocol limits, fields left to 0 take their default value (the macro in parenthesis)
+     */
+
+    /* Number of message slots of each channel, power of two (NBN_CHANNEL_BUFFER_SIZE) */
+    unsigned int channel_buffer_size;
+
+    /* Number of sent packets tracked by each connection, power of two (NBN_MAX_PACKET_ENTRIES) */
+    unsigned int max_packet_entries;
+
+    /* Maximum number of pending events, power of two between 16 and 65536 (NBN_EVENT_QUEUE_CAPACITY) */
+    unsigned int event_queue_capacity;
+
+    /*
+     * Number of outgoing messages that can be in use at the same time, it must hold every message (and message chunk)
+     * not yet acked by all its recipients, power of two between 16 and 65536 (NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE)
+     */
+    unsigned int outgoing_message_buffer_size;
+
+    /*
+     * Maximum number of packets sent to a connection in a single flush, at most 32 or 28 when FEC is enabled
+     * (NBN_CONNECTION_MAX_SENT_PACKET_COUNT)
+     */
+    unsigned int max_sent_packet_count;
+
+    /* Number of seconds without receiving anything before a connection gets closed (NBN_CONNECTION_STALE_TIME_THRESHOLD) */
+    double stale_time_threshold;
 } NBN_Config;
 
 #pragma endregion
 
 #pragma region NBN_Connection
 
+/* Default number of sent packets tracked for acking (see NBN_Config) */
+#ifndef NBN_MAX_PACKET_ENTRIES
 #define NBN_MAX_PACKET_ENTRIES 1024
+#endif
 
-/* Maximum number of packets that can be sent in a single flush
- *
- * IMPORTANT: do not increase this, it will break packet acks
-*/
+/*
+ * Number of packets, counting back from the most recent one, whose reception is tracked (multiple of 64).
+ * Older packets cannot be told apart from duplicates and are dropped.
+ */
+#ifndef NBN_PACKET_RECV_WINDOW_SIZE
+#define NBN_PACKET_RECV_WINDOW_SIZE 256
+#endif
+
+#if NBN_PACKET_RECV_WINDOW_SIZE <= 0 || NBN_PACKET_RECV_WINDOW_SIZE % 64 != 0
+#error NBN_PACKET_RECV_WINDOW_SIZE must be a non-zero multiple of 64
+#endif
+
+#define NBN_PACKET_RECV_WINDOW_WORDS (NBN_PACKET_RECV_WINDOW_SIZE / 64)
+
+/* Default maximum number of packets that can be sent in a single flush (see NBN_Config) */
+#ifndef NBN_CONNECTION_MAX_SENT_PACKET_COUNT
 #define NBN_CONNECTION_MAX_SENT_PACKET_COUNT 16
+#endif
+
+/*
+ * Upper bound of the maximum number of packets sent in a single flush: a packet acks the last received one and the
+ * 32 before it (ack bits), sending more would leave packets that can never be acked.
+ */
+#define NBN_CONNECTION_MAX_SENT_PACKET_COUNT_LIMIT 32
 
-/* Number of seconds before the connection is considered stale and get closed */
+/* Default number of seconds before the connection is considered stale and get closed (see NBN_Config) */
+#ifndef NBN_CONNECTION_STALE_TIME_THRESHOLD
 #define NBN_CONNECTION_STALE_TIME_THRESHOLD 3
+#endif
 
-typedef struct
-{
+/*
+ * Maximum number of seconds received packets can go without being acked when there are no messages to send.
+ * Acks are sent along with messages so this only limits the rate of packets carrying nothing but acks.
+ */
+#ifndef NBN_CONNECTION_ACK_DELAY
+#define NBN_CONNECTION_ACK_DELAY 0.02
+#endif
+
+/*
+ * Number of seconds without sending any packet after which an empty packet is sent to keep the connection alive.
+ * Must be lower than the stale time threshold (see NBN_Config).
+ */
+#ifndef NBN_CONNECTION_KEEP_ALIVE_INTERVAL
+#define NBN_CONNECTION_KEEP_ALIVE_INTERVAL 0.5
+#endif
+
+/*
+ * Forward error correction
+ *
+ * When enabled, a parity packet is sent after every group of packets. The size of the groups adapts to the
+ * measured packet loss, between NBN_FEC_MIN_GROUP_SIZE and NBN_FEC_MAX_GROUP_SIZE packets.
+ */
+#define NBN_FEC_MIN_GROUP_SIZE 2
+#define NBN_FEC_MAX_GROUP_SIZE 16
+
+/* Maximum distance between the sequence numbers of the first and last packets of a group (see packet_mask) */
+#define NBN_FEC_MAX_GROUP_SPAN 32
+
+/* Number of received packets kept around to rebuild lost ones */
+#define NBN_FEC_RECV_BUFFER_SIZE 64
+
+typedef struct
+{
     uint16_t id;
     uint8_t channel_id;
 } NBN_MessageEntry;
@@ -795,9 +1417,69 @@ typedef struct
     bool acked;
     unsigned int messages_count;
     double send_time;
+    double clock_send_time; /* Clock time the packet was sent at (used for clock synchronization) */
+    uint16_t ack; /* Ack carried by the packet header (see NBN_AckRangesMessage) */
+    bool has_ack_ranges; /* The packet carries a NBN_AckRangesMessage, not recorded in messages */
     NBN_MessageEntry messages[NBN_MAX_MESSAGES_PER_PACKET];
 } NBN_PacketEntry;
 
+typedef struct
+{
+    NBN_FECParityMessage parity;
+    unsigned int packet_count;
+    unsigned int group_size;
+} NBN_FECEncoder;
+
+typedef struct
+{
+    uint32_t seq_number;
+    uint16_t length;
+    uint16_t ack;
+    uint32_t ack_bits;
+    uint8_t messages_count;
+    uint8_t data[NBN_FEC_MAX_PAYLOAD_SIZE];
+} NBN_FECPacketEntry;
+
+typedef struct
+{
+    NBN_FECPacketEntry packets[NBN_FEC_RECV_BUFFER_SIZE];
+} NBN_FECDecoder;
+
+/* Number of time samples the remote clock offset and drift are estimated on */
+#define NBN_CLOCK_SYNC_SAMPLES 64
+
+/*
+ * Samples whose round trip time exceeds the lowest one of the window by more than this are discarded (in seconds),
+ * the offset error of a sample being at most half of its extra round trip time
+ */
+#ifndef NBN_CLOCK_SYNC_RTT_TOLERANCE
+#define NBN_CLOCK_SYNC_RTT_TOLERANCE 0.002
+#endif
+
+/* Minimum time span of the accepted samples to estimate the drift on (in seconds) */
+#define NBN_CLOCK_SYNC_MIN_DRIFT_SPAN 1.0
+
+/* Maximum drift between two clocks (in seconds per second) */
+#define NBN_CLOCK_SYNC_MAX_DRIFT 0.001
+
+typedef struct
+{
+    double local_time; /* Local clock time the sample was taken at */
+    double offset; /* Remote clock minus local clock */
+    double rtt; /* Round trip time of the sample */
+} NBN_ClockSample;
+
+typedef struct
+{
+    NBN_ClockSample samples[NBN_CLOCK_SYNC_SAMPLES];
+    unsigned int sample_count;
+    unsigned int next_sample;
+    double offset; /* Estimated remote clock minus local clock at reference_time */
+    double drift; /* Estimated remote clock drift relative to the local clock */
+    double reference_time;
+    bool is_synced; /* At least one sample has been taken */
+} NBN_ClockSync;
+
 typedef struct
 {
     double ping;
@@ -808,6 +1490,7 @@ typedef struct
 
 #ifdef NBN_DEBUG
 
+/* Kept for compatibility, see NBN_GameClient_SetHook and NBN_GameServer_SetHook */
 typedef enum
 {
     NBN_DEBUG_CB_MSG_ADDED_TO_RECV_QUEUE
@@ -828,6 +1511,12 @@ struct __NBN_Connection
     uint32_t protocol_id;
     double last_recv_packet_time; /* Used to detect stale connections */
     double last_flush_time; /* Last time the send queue was flushed */
+    double last_send_packet_time; /* Last time a packet was sent (used for keep alive) */
+    double ack_pending_time; /* Time of the oldest received packet that has not been acked yet */
+    bool is_ack_pending; /* Received packets with messages since the last sent packet */
+    unsigned int send_interval; /* Number of send calls between two flushes of the send queue */
+    unsigned int slot; /* Index of the client in the game server's slots (used by broadcast groups and interest grids) */
+    unsigned int send_countdown; /* Number of send calls left before the next flush */
     double last_read_packets_time; /* Last time packets were read from the socket */
     double time; /* Current time */
     unsigned int downloaded_bytes; /* Keep track of bytes read from the socket (used for download bandwith calculation) */
@@ -843,19 +1532,42 @@ struct __NBN_Connection
     NBN_WriteStream accept_data_w_stream; /* Used by the game server to write accept data */
     NBN_ReadStream accept_data_r_stream; /* Used by the client to read accept data */
 
-#ifdef NBN_DEBUG
-    /* Debug callbacks */
-    void (*OnMessageAddedToRecvQueue)(struct __NBN_Connection *, NBN_Message *);
-#endif /* NBN_DEBUG */
-
     /*
      *  Packet sequencing & acking
      */
     uint16_t next_packet_seq_number;
     uint16_t last_received_packet_seq_number;
-    uint32_t packet_send_seq_buffer[NBN_MAX_PACKET_ENTRIES];
-    NBN_PacketEntry packet_send_buffer[NBN_MAX_PACKET_ENTRIES];
-    uint32_t packet_recv_seq_buffer[NBN_MAX_PACKET_ENTRIES];
+    uint64_t packet_recv_window[NBN_PACKET_RECV_WINDOW_WORDS]; /* Bit n: last_received_packet_seq_number - n received */
+    uint16_t last_received_ack; /* Most recent ack read from a packet header */
+    uint64_t received_ack_window; /* Bit n: last_received_ack - n read from a packet header */
+    uint16_t delivered_ack; /* Most recent ack carried by a packet acked by the remote peer */
+    uint16_t due_ack; /* Most recent ack carried by a packet that should have been acked by now */
+    uint16_t next_due_packet_seq_number; /* Next sent packet to check for due_ack */
+    unsigned int max_packet_entries; /* Size of the following buffers */
+    uint32_t *packet_send_seq_buffer;
+    NBN_PacketEntry *packet_send_buffer;
+
+    /*
+     *  Clock synchronization
+     */
+    double last_received_packet_clock_time; /* Clock time the packet with the highest sequence number was received at */
+    double start_time; /* Clock time the connection was created at, packet header timestamps are relative to it */
+    double remote_start_time; /* Remote clock time the remote connection was created at (0 when unknown) */
+    uint32_t last_remote_timestamp; /* Most recent packet header timestamp */
+    double last_remote_time; /* Remote time of the most recent packet header timestamp (without wrap around) */
+    NBN_ClockSync clock_sync; /* Estimate of the remote endpoint's clock */
+
+    /*
+     *  Input stream (allocated on demand)
+     */
+    NBN_InputSender *input_sender; /* Client side */
+    NBN_InputReceiver *input_receiver; /* Server side */
+
+    /*
+     *  Forward error correction (allocated on demand)
+     */
+    NBN_FECEncoder *fec_encoder;
+    NBN_FECDecoder *fec_decoder;
 
     /*
      *  Messages channeling (sending & receiving)
@@ -882,6 +1594,7 @@ int NBN_Connection_FlushSendQueue(NBN_Connection *);
 int NBN_Connection_CreateChannel(NBN_Connection *, NBN_ChannelType, uint8_t);
 bool NBN_Connection_CheckIfStale(NBN_Connection *);
 void NBN_Connection_AddTime(NBN_Connection *, double);
+double NBN_Connection_GetRemoteTime(NBN_Connection *);
 
 #pragma endregion /* NBN_Connection */
 
@@ -889,7 +1602,11 @@ void NBN_Connection_AddTime(NBN_Connection *, double);
 
 #define NBN_NO_EVENT 0 /* No event left in the events queue */
 #define NBN_SKIP_EVENT 1 /* Indicates that the event should be skipped */
+
+/* Default capacity of the event queue (see NBN_Config) */
+#ifndef NBN_EVENT_QUEUE_CAPACITY
 #define NBN_EVENT_QUEUE_CAPACITY 1024
+#endif
 
 typedef struct
 {
@@ -904,14 +1621,15 @@ typedef struct
 
 typedef struct
 {
-    NBN_Event events[NBN_EVENT_QUEUE_CAPACITY];
+    NBN_Event *events;
+    unsigned int capacity;
     unsigned int head;
     unsigned int tail;
     unsigned int count;
 } NBN_EventQueue;
 
-NBN_EventQueue *NBN_EventQueue_Create(void);
-void NBN_EventQueue_Destroy(NBN_EventQueue *);
+int NBN_EventQueue_Init(NBN_EventQueue *, unsigned int);
+void NBN_EventQueue_Deinit(NBN_EventQueue *);
 bool NBN_EventQueue_Enqueue(NBN_EventQueue *, NBN_Event);
 bool NBN_EventQueue_Dequeue(NBN_EventQueue *, NBN_Event *);
 bool NBN_EventQueue_IsEmpty(NBN_EventQueue *);
@@ -988,6 +1706,8 @@ int NBN_PacketSimulator_EnqueuePacket(NBN_PacketSimulator *, NBN_Packet *, NBN_C
 void NBN_PacketSimulator_Start(NBN_PacketSimulator *);
 void NBN_PacketSimulator_Stop(NBN_PacketSimulator *);
 void NBN_PacketSimulator_AddTime(NBN_PacketSimulator *, double);
+void NBN_PacketSimulator_Lock(NBN_PacketSimulator *); /* Keep the simulator thread from sending packets */
+void NBN_PacketSimulator_Unlock(NBN_PacketSimulator *);
 
 #else
 
@@ -1005,9 +1725,79 @@ void NBN_PacketSimulator_AddTime(NBN_PacketSimulator *, double);
 
 #pragma endregion /* Packet simulator */
 
+#pragma region Hooks
+
+/*
+ * Hooks
+ *
+ * Hooks let the user code observe what happens inside the library (for metrics, tracing, etc.) in every build.
+ * At most one hook can be installed per hook type and per endpoint. A hook is called synchronously, from the
+ * nbnet function that triggered it, with the concerned connection and the data described below; that data is
+ * only valid for the duration of the call and must not be modified.
+ *
+ * When no hook is installed, a hook point costs a single branch. Define NBN_DISABLE_HOOKS to compile them out.
+ */
+
+typedef enum
+{
+    /* A packet is about to be handed to the driver (data: NBN_Packet *, sealed) */
+    NBN_HOOK_PACKET_SENT,
+
+    /* A packet that is not a duplicate has been received, before its messages are read (data: NBN_Packet *) */
+    NBN_HOOK_PACKET_RECEIVED,
+
+    /* A reliable message has been acked by the remote endpoint (data: NBN_Message *) */
+    NBN_HOOK_MESSAGE_ACKED,
+
+    /* A reliable message that was not acked in time is sent again (data: NBN_Message *) */
+    NBN_HOOK_MESSAGE_RESENT,
+
+    /* A received message has been added to its channel's recv queue (data: NBN_Message *) */
+    NBN_HOOK_MESSAGE_ADDED_TO_RECV_QUEUE,
+
+    /* All the chunks of a message have been received and the message has been rebuilt (data: NBN_Message *) */
+    NBN_HOOK_CHUNKS_COMPLETED,
+
+    /* Client: the connection request has been sent, server: a connection request has been received (data: NULL) */
+    NBN_HOOK_CONNECTION_REQUESTED,
+
+    /* The public keys have been sent to the remote endpoint (data: NULL) */
+    NBN_HOOK_CRYPTO_INFO_SENT,
+
+    /* The public keys of the remote endpoint have been received (data: NULL) */
+    NBN_HOOK_CRYPTO_INFO_RECEIVED,
+
+    /* Packets of the connection are now encrypted (data: NULL) */
+    NBN_HOOK_ENCRYPTION_STARTED,
+
+    /* The connection has been accepted by the game server (data: NULL) */
+    NBN_HOOK_CONNECTION_ACCEPTED,
+
+    /* The connection has been closed, by either side (data: NULL) */
+    NBN_HOOK_CONNECTION_CLOSED,
+
+    /* Nothing has been received on the connection for too long (data: NULL) */
+    NBN_HOOK_CONNECTION_STALE,
+
+    NBN_HOOK_COUNT
+} NBN_HookType;
+
+typedef void (*NBN_Hook)(NBN_HookType type, NBN_Connection *connection, void *data, void *user_data);
+
+typedef struct
+{
+    NBN_Hook callback;
+    void *user_data;
+} NBN_HookEntry;
+
+#pragma endregion /* Hooks */
+
 #pragma region NBN_Endpoint
 
+/* Default number of outgoing messages that can be in use at the same time (see NBN_Config) */
+#ifndef NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE
 #define NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE 1024
+#endif
 
 #define NBN_IsReservedMessage(type) (type == NBN_MESSAGE_CHUNK_TYPE || type == NBN_CLIENT_CLOSED_MESSAGE_TYPE \
 || type == NBN_CLIENT_ACCEPTED_MESSAGE_TYPE || type == NBN_BYTE_ARRAY_MESSAGE_TYPE \
@@ -1021,28 +1811,32 @@ struct __NBN_Endpoint
     NBN_MessageBuilder message_builders[NBN_MAX_MESSAGE_TYPES];
     NBN_MessageDestructor message_destructors[NBN_MAX_MESSAGE_TYPES];
     NBN_MessageSerializer message_serializers[NBN_MAX_MESSAGE_TYPES];
-    NBN_OutgoingMessage outgoing_message_buffer[NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE];
+    NBN_OutgoingMessage *outgoing_message_buffer; /* config.outgoing_message_buffer_size messages */
+    uint8_t *write_chunk_buffer; /* Messages are serialized in there before being split into chunks */
+    unsigned int write_chunk_buffer_size;
     NBN_EventQueue event_queue;
     bool is_server;
     unsigned int next_outgoing_message;
+    double start_time; /* Clock time the endpoint was initialized at, the endpoint's clock starts from there */
+    NBN_Replicator *replicator; /* Entity replication of the game server (NULL when not used) */
+    NBN_Recorder *recorder; /* Message recording (NULL when not recording) */
 
-#ifdef NBN_DEBUG
-    /* Debug callbacks */
-    void (*OnMessageAddedToRecvQueue)(NBN_Connection *, NBN_Message *);
-#endif
+    NBN_HookEntry hooks[NBN_HOOK_COUNT];
 
 #if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
     NBN_PacketSimulator packet_simulator;
 #endif
 };
 
-void NBN_Endpoint_Init(NBN_Endpoint *, NBN_Config, bool);
+int NBN_Endpoint_Init(NBN_Endpoint *, NBN_Config, bool);
 void NBN_Endpoint_Deinit(NBN_Endpoint *);
 void NBN_Endpoint_RegisterMessageBuilder(NBN_Endpoint *, NBN_MessageBuilder, uint8_t);
 void NBN_Endpoint_RegisterMessageDestructor(NBN_Endpoint *, NBN_MessageDestructor, uint8_t);
 void NBN_Endpoint_RegisterMessageSerializer(NBN_Endpoint *, NBN_MessageSerializer, uint8_t);
 void NBN_Endpoint_RegisterChannel(NBN_Endpoint *, NBN_ChannelType, uint8_t);
 NBN_Connection *NBN_Endpoint_CreateConnection(NBN_Endpoint *, uint32_t, void *);
+double NBN_Endpoint_GetTime(NBN_Endpoint *);
+void NBN_Endpoint_SetHook(NBN_Endpoint *, NBN_HookType, NBN_Hook, void *);
 
 #pragma endregion /* NBN_Endpoint */
 
@@ -1083,6 +1877,16 @@ extern NBN_GameClient __game_client;
  */
 int NBN_GameClient_Start(const char *protocol_name, const char *ip_address, uint16_t port, bool encryption, uint8_t *connection_data);
 
+/**
+ * Same as NBN_GameClient_Start but takes a configuration, to tune the protocol limits (buffer sizes, stale time, etc.).
+ * 
+ * @param config Protocol name, IP address, port, encryption and limits (the limits left to 0 take their default value)
+ * @param connection_data Data that will be sent to the server during the connection request phase (cannot exceed NBN_CONNECTION_DATA_MAX_SIZE bytes). Pass NULL if you do not want to send anything.
+ * 
+ * @return 0 when successully started, -1 otherwise
+ */
+int NBN_GameClient_StartWithConfig(NBN_Config config, uint8_t *connection_data);
+
 /**
  * Disconnect from the server.
  * 
@@ -1099,7 +1903,8 @@ void NBN_GameClient_Stop(void);
  * Register a type of message on the game client, has to be called after NBN_GameClient_Start.
  * 
  * 
- * @param msg_type A user defined message type, can be any value from 0 to 245 (245 to 255 are reserved by nbnet).
+ * @param msg_type A user defined message type, can be any value from 0 to NBN_FIRST_RESERVED_MESSAGE_TYPE - 1 (241),
+ * the following ones are reserved by nbnet
  * @param msg_builder The function responsible for building the message
  * @param msg_destructor The function responsible for destroying the message (and releasing memory)
  * @param msg_serializer The function responsible for serializing the message
@@ -1115,8 +1920,11 @@ void NBN_GameClient_RegisterMessage(
  * 
  * The channel must be created on both the client and the server.
  * 
- * @param type The channel type, can be either NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED or NBN_CHANNEL_TYPE_RELIABLE_ORDERED
- * @param id A unique ID between 0 and 25 (26 to 31 are reserved by nbnet, 32 is the maximum number of channels)
+ * @param type The channel type, can be NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED, NBN_CHANNEL_TYPE_RELIABLE_ORDERED,
+ * NBN_CHANNEL_TYPE_UNRELIABLE_REDUNDANT or NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED
+ * @param id A unique ID between 0 and 25 (26 to 31 are reserved by nbnet, 32 is the maximum number of channels).
+ * The reserved IDs are 31 (NBN_CHANNEL_RESERVED_UNRELIABLE), 30 (NBN_CHANNEL_RESERVED_RELIABLE),
+ * 29 (NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES) and 28 (NBN_CHANNEL_RESERVED_INPUTS, the input stream channel)
  */
 void NBN_GameClient_RegisterChannel(uint8_t type, uint8_t id);
 
@@ -1233,6 +2041,43 @@ NBN_MessageInfo NBN_GameClient_GetMessageInfo(void);
  */
 NBN_ConnectionStats NBN_GameClient_GetStats(void);
 
+/**
+ * Estimate the current time of the game server's clock (see NBN_GameServer_GetTime).
+ * 
+ * The estimate is computed from the timestamps carried by every packet header and gets refined as packets
+ * are exchanged with the server.
+ * 
+ * @return The estimated server time (in seconds) or -1 when no estimate is available yet
+ */
+double NBN_GameClient_GetServerTime(void);
+
+/**
+ * Send an input to the server on the input stream (see NBN_InputMessage). The input is tagged with the next
+ * frame number and sent along with the previous inputs the server has not acknowledged yet.
+ * 
+ * Inputs are sent on the NBN_CHANNEL_RESERVED_INPUTS channel (28), reserved by nbnet.
+ * 
+ * @param input The input (of the size registered with NBN_Input_RegisterSerializer), it is copied
+ * @param frame Filled with the frame number of the input
+ * 
+ * @return 0 when successful, -1 otherwise (for instance when no input serializer is registered)
+ */
+int NBN_GameClient_SendInput(void *input, uint32_t *frame);
+
+/**
+ * Set the function called when the server acknowledges an input frame: the server has read all the inputs
+ * up to this frame, the inputs predicted after it have to be replayed on top of the server state.
+ * 
+ * @param ack_callback The input ack callback
+ * @param user_data Passed to the input ack callback
+ */
+void NBN_GameClient_SetInputAckCallback(NBN_InputAckCallback ack_callback, void *user_data);
+
+/**
+ * @return The last input frame acknowledged by the server (0 when none)
+ */
+uint32_t NBN_GameClient_GetLastAckedInputFrame(void);
+
 /**
  * Retrieve the code sent by the server when closing the connection.
  * 
@@ -1259,6 +2104,28 @@ bool NBN_GameClient_IsConnected(void);
  */
 bool NBN_GameClient_IsEncryptionEnabled(void);
 
+/**
+ * Enable or disable forward error correction on packets sent to the server.
+ *
+ * When enabled, parity packets are sent along with regular packets so the server can rebuild lost packets
+ * without waiting for them to be resent. The bandwidth overhead adapts to the measured packet loss (between
+ * 1/NBN_FEC_MAX_GROUP_SIZE and 1/NBN_FEC_MIN_GROUP_SIZE).
+ *
+ * @param enabled true to enable forward error correction, false to disable it
+ */
+void NBN_GameClient_SetFECEnabled(bool enabled);
+
+/**
+ * Install a hook (see NBN_HookType), replacing the one previously installed for that type.
+ *
+ * Hooks can be installed before the game client is started and are removed when it is stopped.
+ *
+ * @param type Type of hook
+ * @param hook Function to call, NULL to remove the hook
+ * @param user_data Passed to the hook
+ */
+void NBN_GameClient_SetHook(NBN_HookType type, NBN_Hook hook, void *user_data);
+
 #ifdef NBN_DEBUG
 
 void NBN_GameClient_Debug_RegisterCallback(NBN_ConnectionDebugCallback, void *);
@@ -1271,6 +2138,7 @@ void NBN_GameClient_Debug_RegisterCallback(NBN_ConnectionDebugCallback, void *);
 
 #define NBN_MAX_CLIENTS 1024
 #define NBN_CONNECTION_VECTOR_INITIAL_CAPACITY 32
+#define NBN_MAX_BROADCAST_GROUPS 32
 
 enum
 {
@@ -1290,10 +2158,23 @@ typedef struct
     float download_bandwidth; /* Total download bandwith of the game server */
 } NBN_GameServerStats;
 
+/*
+ * Set of clients messages can be broadcasted to (a team, a room, an area, etc.)
+ *
+ * Each bit represents a client slot (see the slot field of NBN_Connection).
+ */
+typedef struct
+{
+    uint32_t members[NBN_MAX_CLIENTS / 32];
+    unsigned int member_count;
+} NBN_BroadcastGroup;
+
 typedef struct
 {
     NBN_Endpoint endpoint;
     NBN_ConnectionVector *clients;
+    NBN_Connection *client_slots[NBN_MAX_CLIENTS];
+    NBN_BroadcastGroup groups[NBN_MAX_BROADCAST_GROUPS];
     NBN_GameServerStats stats;
     void *context;
 } NBN_GameServer;
@@ -1311,6 +2192,15 @@ extern NBN_GameServer __game_server;
  */
 int NBN_GameServer_Start(const char *protocol_name, uint16_t port, bool encryption);
 
+/**
+ * Same as NBN_GameServer_Start but takes a configuration, to tune the protocol limits (buffer sizes, stale time, etc.).
+ * 
+ * @param config Protocol name, port, encryption and limits (the limits left to 0 take their default value)
+ * 
+ * @return 0 when successully started, -1 otherwise
+ */
+int NBN_GameServer_StartWithConfig(NBN_Config config);
+
 /**
  * Stop the game server.
  */
@@ -1320,7 +2210,8 @@ void NBN_GameServer_Stop(void);
  * Register a type of message on the game server, has to be called after NBN_GameServer_Start.
  * 
  * 
- * @param msg_type A user defined message type, can be any value from 0 to 245 (245 to 255 are reserved by nbnet).
+ * @param msg_type A user defined message type, can be any value from 0 to NBN_FIRST_RESERVED_MESSAGE_TYPE - 1 (241),
+ * the following ones are reserved by nbnet
  * @param msg_builder The function responsible for building the message
  * @param msg_destructor The function responsible for destroying the message (and releasing memory)
  * @param msg_serializer The function responsible for serializing the message
@@ -1333,8 +2224,11 @@ void NBN_GameServer_RegisterMessage(
  * 
  * The channel must be created on both the client and the server.
  * 
- * @param type The channel type, can be either NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED or NBN_CHANNEL_TYPE_RELIABLE_ORDERED
- * @param id A unique ID between 0 and 25 (26 to 31 are reserved by nbnet, 32 is the maximum number of channels)
+ * @param type The channel type, can be NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED, NBN_CHANNEL_TYPE_RELIABLE_ORDERED,
+ * NBN_CHANNEL_TYPE_UNRELIABLE_REDUNDANT or NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED
+ * @param id A unique ID between 0 and 25 (26 to 31 are reserved by nbnet, 32 is the maximum number of channels).
+ * The reserved IDs are 31 (NBN_CHANNEL_RESERVED_UNRELIABLE), 30 (NBN_CHANNEL_RESERVED_RELIABLE),
+ * 29 (NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES) and 28 (NBN_CHANNEL_RESERVED_INPUTS, the input stream channel)
  */
 void NBN_GameServer_RegisterChannel(uint8_t type, uint8_t id);
 
@@ -1362,11 +2256,30 @@ int NBN_GameServer_Poll(void);
  * 
  * This should be called at a relatively high frequency, probably at the end of
  * every game tick.
+ *
+ * Clients with a send interval greater than 1 (see NBN_GameServer_SetClientSendInterval) are skipped
+ * until their next send, their messages stay in the send queue in the meantime.
  * 
  * @return 0 when successful, -1 otherwise
  */
 int NBN_GameServer_SendPackets(void);
 
+/**
+ * Set the rate at which packets are sent to a client.
+ *
+ * The client's send queue will be flushed once every interval calls to NBN_GameServer_SendPackets,
+ * an interval of 1 (the default) means the client's send queue is flushed on every call.
+ * This can be used to lower the CPU and bandwidth spent on clients that need fewer updates,
+ * like spectators, clients far from the action or clients suffering from a high packet loss
+ * (see the stats field of NBN_Connection).
+ *
+ * Flushes of clients sharing the same interval are spread across calls to avoid bursts.
+ *
+ * @param client The client
+ * @param interval Number of calls to NBN_GameServer_SendPackets between two flushes (at least 1)
+ */
+void NBN_GameServer_SetClientSendInterval(NBN_Connection *client, unsigned int interval);
+
 /**
  * Set game server's context.
  * 
@@ -1463,7 +2376,8 @@ int NBN_GameServer_SendReliableMessageTo(NBN_Connection *client, NBN_OutgoingMes
  * @param outgoing_msg The message to broadcast
  * @param channel_id The ID of the channel to send the message on
  * 
- * @return 0 when successful, -1 otherwise
+ * @return 0 when successful, -1 otherwise (the clients the message could not be sent to are closed, the
+ * others still get it)
  */
 int NBN_GameServer_BroadcastMessage(NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id);
 
@@ -1485,6 +2399,54 @@ int NBN_GameServer_BroadcastUnreliableMessage(NBN_OutgoingMessage *outgoing_msg)
  */
 int NBN_GameServer_BroadcastReliableMessage(NBN_OutgoingMessage *outgoing_msg);
 
+/**
+ * Add a client to a broadcast group.
+ *
+ * Groups are identified by a user defined ID (from 0 to NBN_MAX_BROADCAST_GROUPS - 1), a client can be part of
+ * any number of groups. Clients are automatically removed from all groups when their connection is removed.
+ *
+ * @param client The client to add
+ * @param group_id The ID of the group
+ */
+void NBN_GameServer_AddClientToGroup(NBN_Connection *client, uint8_t group_id);
+
+/**
+ * Remove a client from a broadcast group.
+ *
+ * @param client The client to remove
+ * @param group_id The ID of the group
+ */
+void NBN_GameServer_RemoveClientFromGroup(NBN_Connection *client, uint8_t group_id);
+
+/**
+ * @param client The client
+ * @param group_id The ID of the group
+ *
+ * @return true if the client is a member of the group, false otherwise
+ */
+bool NBN_GameServer_IsClientInGroup(NBN_Connection *client, uint8_t group_id);
+
+/**
+ * Remove all clients from a broadcast group.
+ *
+ * @param group_id The ID of the group
+ */
+void NBN_GameServer_ClearGroup(uint8_t group_id);
+
+/**
+ * Broadcast a message to all members of a group on a given channel.
+ *
+ * The message is measured (and split into chunks if needed) only once for the whole group.
+ *
+ * @param outgoing_msg The message to broadcast
+ * @param group_id The ID of the group
+ * @param channel_id The ID of the channel to send the message on
+ *
+ * @return 0 when successful, -1 otherwise (the clients the message could not be sent to are closed, the
+ * others still get it)
+ */
+int NBN_GameServer_BroadcastToGroup(NBN_OutgoingMessage *outgoing_msg, uint8_t group_id, uint8_t channel_id);
+
 /**
  * Retrieve a stream to write data that will be send to the client upon accepting its connection.
  * 
@@ -1562,11 +2524,90 @@ NBN_MessageInfo NBN_GameServer_GetMessageInfo(void);
  */
 NBN_GameServerStats NBN_GameServer_GetStats(void);
 
+/**
+ * Get the time of the game server's clock, the one game clients synchronize to (see NBN_GameClient_GetServerTime).
+ * 
+ * @return The time elapsed since the game server was started (in seconds)
+ */
+double NBN_GameServer_GetTime(void);
+
+/**
+ * Read the next input of a client (see NBN_GameClient_SendInput), inputs are read in frame order. The frame of
+ * the last read input is acknowledged to the client in the header of the next packets.
+ * 
+ * Missing inputs are waited for until the client stops sending them (when more than NBN_INPUT_MAX_FRAMES
+ * inputs are left unacknowledged), they are skipped then.
+ * 
+ * @param client The client connection
+ * @param input Filled with the input (of the size registered with NBN_Input_RegisterSerializer)
+ * @param frame Filled with the frame number of the input
+ * 
+ * @return 1 when an input was read, 0 when the next input has not been received yet
+ */
+int NBN_GameServer_ReadInput(NBN_Connection *client, void *input, uint32_t *frame);
+
+/**
+ * @param client The client connection
+ * 
+ * @return The last input frame of a client received without gaps (0 when none)
+ */
+uint32_t NBN_GameServer_GetLastInputFrame(NBN_Connection *client);
+
+/**
+ * Start recording the messages sent to and received from clients (see NBN_Recorder).
+ * 
+ * Failing to record a message (for instance when the disk is full) does not affect the game server: the error is
+ * logged and the recording is stopped, keeping the messages recorded so far.
+ * 
+ * @param path Path of the recording file, an existing file is overwritten
+ * 
+ * @return 0 when successful, NBN_ERROR otherwise
+ */
+int NBN_GameServer_StartRecording(const char *path);
+
+/**
+ * Stop recording messages, the recording is also stopped by NBN_GameServer_Stop.
+ * 
+ * @return 0 when successful, NBN_ERROR otherwise
+ */
+int NBN_GameServer_StopRecording(void);
+
+/**
+ * Open a recording file, messages are deserialized with the messages registered on the game server.
+ * 
+ * @param path Path of the recording file
+ * 
+ * @return The record reader or NULL in case of error
+ */
+NBN_RecordReader *NBN_GameServer_OpenRecording(const char *path);
+
 /**
  * @return true if packet encryption is enabled, false otherwise
  */
 bool NBN_GameServer_IsEncryptionEnabled(void);
 
+/**
+ * Enable or disable forward error correction on packets sent to clients.
+ *
+ * When enabled, parity packets are sent along with regular packets so clients can rebuild lost packets
+ * without waiting for them to be resent. The bandwidth overhead adapts to the measured packet loss of each
+ * client (between 1/NBN_FEC_MAX_GROUP_SIZE and 1/NBN_FEC_MIN_GROUP_SIZE).
+ *
+ * @param enabled true to enable forward error correction, false to disable it
+ */
+void NBN_GameServer_SetFECEnabled(bool enabled);
+
+/**
+ * Install a hook (see NBN_HookType), replacing the one previously installed for that type.
+ *
+ * Hooks can be installed before the game server is started and are removed when it is stopped.
+ *
+ * @param type Type of hook
+ * @param hook Function to call, NULL to remove the hook
+ * @param user_data Passed to the hook
+ */
+void NBN_GameServer_SetHook(NBN_HookType type, NBN_Hook hook, void *user_data);
+
 #ifdef NBN_DEBUG
 
 void NBN_GameServer_Debug_RegisterCallback(NBN_ConnectionDebugCallback, void *);
@@ -1575,3018 +2616,9431 @@ void NBN_GameServer_Debug_RegisterCallback(NBN_ConnectionDebugCallback, void *);
 
 #pragma endregion /* NBN_GameServer */
 
-#pragma region Network driver
+#pragma region NBN_InterestGrid
 
 /*
- * Game client driver
+ * Interest management based on a uniform spatial hash grid.
+ *
+ * Entities register their positions, clients register a view (a position and a radius) and every tick
+ * NBN_InterestGrid_Update computes, for each client, the entities that entered its view, the ones that
+ * left it and the ones that are still in view and were updated (moved or marked as dirty) since the
+ * previous update.
+ *
+ * Only the grid cells overlapping a client's view are visited so the cost of an update is proportional to the
+ * number of visible entities rather than to clients x entities.
+ *
+ * The grid is two dimensional, 3D games should use the coordinates of their ground plane.
  */
 
+#define NBN_INTEREST_INVALID_ENTITY 0xFFFFFFFF
+
 typedef enum
 {
-    NBN_DRIVER_GCLI_CONNECTED,
-    NBN_DRIVER_GCLI_SERVER_PACKET_RECEIVED
-} NBN_Driver_GCli_EventType;
+    /* The entity entered the client's view */
+    NBN_INTEREST_ENTER,
 
-int NBN_Driver_GCli_Start(uint32_t, const char *, uint16_t);
-void NBN_Driver_GCli_Stop(void);
-int NBN_Driver_GCli_RecvPackets(void);
-int NBN_Driver_GCli_SendPacket(NBN_Packet *);
-void NBN_Driver_GCli_RaiseEvent(NBN_Driver_GCli_EventType, void *);
+    /* The entity left the client's view (or was removed from the grid) */
+    NBN_INTEREST_LEAVE,
 
-/*
- * Game server driver
- */
+    /* The entity is still in the client's view and has been updated */
+    NBN_INTEREST_UPDATE
+} NBN_InterestEvent;
 
-typedef enum
+typedef struct
 {
-    NBN_DRIVER_GSERV_CLIENT_CONNECTED,
-    NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED
-} NBN_Driver_GServ_EventType;
+    float x;
+    float y;
+    int32_t cell_x;
+    int32_t cell_y;
+    uint32_t bucket;
+    uint32_t prev; /* Previous entity in the same bucket */
+    uint32_t next; /* Next entity in the same bucket */
+    bool is_active;
+    bool is_dirty;
+} NBN_InterestEntity;
 
-int NBN_Driver_GServ_Start(uint32_t, uint16_t);
-void NBN_Driver_GServ_Stop(void);
-int NBN_Driver_GServ_RecvPackets(void);
-void NBN_Driver_GServ_RemoveClientConnection(NBN_Connection *);
-int NBN_Driver_GServ_SendPacketTo(NBN_Packet *, NBN_Connection *);
-int NBN_Driver_GServ_RaiseEvent(NBN_Driver_GServ_EventType, void *);
+typedef struct
+{
+    NBN_Connection *connection;
+    float x;
+    float y;
+    float radius;
+    uint32_t *visible_bits; /* One bit per entity, set when the entity was visible at the last update */
+    uint32_t *visible; /* Entities visible at the last update */
+    uint32_t *changes; /* Entered, left and updated entities (in that order) */
+    unsigned int visible_count;
+    unsigned int enter_count;
+    unsigned int leave_count;
+    unsigned int update_count;
+    unsigned int capacity;
+    bool is_active;
+} NBN_InterestClient;
 
-#pragma endregion /* Network driver */
+typedef struct
+{
+    NBN_InterestEntity *entities;
+    uint32_t *buckets; /* First entity of each bucket */
+    uint32_t *free_entities;
+    uint32_t *removed_entities; /* Removed entities, their IDs can't be reused before the next update */
+    uint32_t *dirty_entities;
+    uint32_t *visible_stamps; /* Per entity, stamp of the last client view the entity was found in */
+    uint32_t *scratch;
+    NBN_InterestClient clients[NBN_MAX_CLIENTS];
+    float cell_size;
+    unsigned int entity_capacity;
+    unsigned int bucket_mask;
+    unsigned int free_count;
+    unsigned int removed_count;
+    unsigned int dirty_count;
+    uint32_t stamp;
+} NBN_InterestGrid;
 
-#pragma region Utils
+/*
+ * List of changes of a client's view, the arrays remain valid until the next call to NBN_InterestGrid_Update.
+ */
+typedef struct
+{
+    const uint32_t *entered;
+    const uint32_t *left;
+    const uint32_t *updated;
+    unsigned int enter_count;
+    unsigned int leave_count;
+    unsigned int update_count;
+} NBN_InterestChanges;
 
-#ifndef MIN
-#define MIN(a, b) (((a) < (b)) ? (a) : (b))
-#endif
+/*
+ * Build the message sent to a client for an interest event, the same outgoing message can be returned
+ * for multiple clients (it only has to be created once per entity and per tick).
+ *
+ * Returning NULL skips the event.
+ */
+typedef NBN_OutgoingMessage *(*NBN_InterestMessageBuilder)(NBN_InterestEvent, uint32_t, void *);
 
-#ifndef MAX
-#define MAX(a, b) (((a) > (b)) ? (a) : (b))
-#endif
+/**
+ * Create an interest grid.
+ *
+ * The cell size should be close to the typical view radius of clients: a smaller size means more cells to visit
+ * per view while a bigger size means more entities to test against each view.
+ *
+ * @param cell_size Size of the grid cells, in world units
+ * @param entity_capacity Maximum number of entities in the grid
+ *
+ * @return The created grid or NULL in case of error
+ */
+NBN_InterestGrid *NBN_InterestGrid_Create(float cell_size, unsigned int entity_capacity);
+
+/**
+ * Destroy an interest grid.
+ *
+ * @param grid The grid to destroy
+ */
+void NBN_InterestGrid_Destroy(NBN_InterestGrid *grid);
+
+/**
+ * Add an entity to the grid.
+ *
+ * @param grid The grid
+ * @param x The x position of the entity
+ * @param y The y position of the entity
+ *
+ * @return The ID of the entity or NBN_INTEREST_INVALID_ENTITY when the grid is full
+ */
+uint32_t NBN_InterestGrid_AddEntity(NBN_InterestGrid *grid, float x, float y);
+
+/**
+ * Remove an entity from the grid, it will be reported as left to the clients that could see it on the next update.
+ *
+ * @param grid The grid
+ * @param entity_id The ID of the entity to remove
+ */
+void NBN_InterestGrid_RemoveEntity(NBN_InterestGrid *grid, uint32_t entity_id);
+
+/**
+ * Set the position of an entity, the entity is marked as dirty.
+ *
+ * @param grid The grid
+ * @param entity_id The ID of the entity
+ * @param x The new x position of the entity
+ * @param y The new y position of the entity
+ */
+void NBN_InterestGrid_SetEntityPosition(NBN_InterestGrid *grid, uint32_t entity_id, float x, float y);
+
+/**
+ * Mark an entity as dirty without moving it, it will be reported as updated to the clients that can see it
+ * on the next update.
+ *
+ * @param grid The grid
+ * @param entity_id The ID of the entity
+ */
+void NBN_InterestGrid_MarkEntityDirty(NBN_InterestGrid *grid, uint32_t entity_id);
+
+/**
+ * Set the view of a client, an entity is visible by a client when it's inside the circle defined by
+ * the client's view.
+ *
+ * @param grid The grid
+ * @param client The client
+ * @param x The x position of the center of the view
+ * @param y The y position of the center of the view
+ * @param radius The radius of the view
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_InterestGrid_SetClientView(NBN_InterestGrid *grid, NBN_Connection *client, float x, float y, float radius);
+
+/**
+ * Remove a client from the grid, should be called when the client disconnects.
+ *
+ * @param grid The grid
+ * @param client The client to remove
+ */
+void NBN_InterestGrid_RemoveClient(NBN_InterestGrid *grid, NBN_Connection *client);
+
+/**
+ * Compute the changes of every client's view since the previous update and clear the dirty flag of all entities.
+ *
+ * Should be called once every tick, after the entities have been moved.
+ *
+ * @param grid The grid
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_InterestGrid_Update(NBN_InterestGrid *grid);
+
+/**
+ * Retrieve the changes of a client's view computed by the last update.
+ *
+ * @param grid The grid
+ * @param client The client
+ *
+ * @return The changes of the client's view
+ */
+NBN_InterestChanges NBN_InterestGrid_GetClientChanges(NBN_InterestGrid *grid, NBN_Connection *client);
+
+/**
+ * Send the changes computed by the last update to every client of the grid.
+ *
+ * For each client, the builder is called once for each entered, left and updated entity and the returned message
+ * is sent to the client on the given channel.
+ *
+ * @param grid The grid
+ * @param builder The function building the messages
+ * @param channel_id The ID of the channel to send the messages on
+ * @param user_data Passed to the builder
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_GameServer_SendInterestChanges(
+    NBN_InterestGrid *grid, NBN_InterestMessageBuilder builder, uint8_t channel_id, void *user_data);
+
+#pragma endregion /* NBN_InterestGrid */
+
+#pragma region NBN_Replicator
+
+/*
+ * Entity replication
+ *
+ * The game server registers entities (a type and a pointer to a state structure described by the fields
+ * of the entity type, see NBN_Replication_RegisterEntityType), marks the fields that changed and sets which
+ * entities are in the scope of each client. Every tick, NBN_Replicator_Send builds replication messages for
+ * each client containing only the fields the client has not acknowledged yet:
+ *
+ * - entities entering the scope of a client are sent with all their fields
+ * - changed fields are sent once and resent only if the packets they were part of are not acked in time
+ * - entities leaving the scope of a client (or removed) are destroyed on the client
+ *
+ * Replication messages are sent on a user defined channel of type NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED that
+ * must not be used for anything else.
+ *
+ * On the client side, received replication messages (of type NBN_REPLICATION_MESSAGE_TYPE) are handed to
+ * a NBN_ReplicationReceiver that creates, updates and destroys the local copies of the entities.
+ */
+
+/* Maximum number of replication messages waiting to be acked per client */
+#define NBN_REPLICATOR_MAX_PENDING_MESSAGES 256
+
+/* Maximum number of entity records waiting to be acked per client */
+#define NBN_REPLICATOR_MAX_PENDING_RECORDS 4096
+
+/* Maximum number of replication messages sent to a client per call to NBN_Replicator_Send */
+#ifndef NBN_REPLICATOR_MAX_MESSAGES_PER_SEND
+#define NBN_REPLICATOR_MAX_MESSAGES_PER_SEND 4
+#endif
+
+typedef struct
+{
+    void *state;
+    unsigned int type;
+    uint32_t dirty_mask; /* Fields changed since the last call to NBN_Replicator_Send */
+    bool is_active;
+} NBN_ReplicatedEntity;
+
+typedef enum
+{
+    NBN_REPLICA_FREE,
+    NBN_REPLICA_CREATING, /* Created on the client side once the create record is acked */
+    NBN_REPLICA_ALIVE,
+    NBN_REPLICA_DESTROYING /* Freed once the destroy record is acked */
+} NBN_ReplicaState;
+
+/*
+ * State of an entity in the scope of a client.
+ */
+typedef struct
+{
+    uint32_t entity_id;
+    uint32_t generation; /* Incremented every time the scope entry is freed */
+    uint32_t unacked_mask; /* Fields the client has not acked yet */
+    uint32_t in_flight_mask; /* Fields sent and waiting for an ack */
+    uint32_t last_change_sequence; /* Last sequence at which a field changed */
+    uint32_t spawn_sequence; /* Sequence of the first message that created the entity (0 until sent) */
+    NBN_ReplicaState state;
+    bool is_record_in_flight; /* A create or destroy record is waiting for an ack */
+} NBN_ReplicaScopeEntry;
+
+typedef struct
+{
+    uint32_t scope_index;
+    uint32_t generation;
+    uint32_t field_mask;
+    unsigned int flags;
+} NBN_ReplicatorSentRecord;
+
+typedef struct
+{
+    uint16_t msg_id;
+    uint32_t sequence;
+    double send_time;
+    unsigned int first_record;
+    unsigned int record_count;
+    bool is_pending;
+} NBN_ReplicatorSentMessage;
+
+typedef struct
+{
+    NBN_Connection *connection;
+    NBN_ReplicaScopeEntry *scope;
+    uint32_t *scope_lookup; /* Open addressing hash table, entity ID -> scope index + 1 (0 means empty) */
+    uint32_t *free_scope_entries;
+    unsigned int scope_count;
+    unsigned int scope_capacity;
+    unsigned int free_scope_count;
+    unsigned int lookup_capacity;
+    uint32_t next_sequence;
+    NBN_ReplicatorSentMessage sent_messages[NBN_REPLICATOR_MAX_PENDING_MESSAGES];
+    NBN_ReplicatorSentRecord sent_records[NBN_REPLICATOR_MAX_PENDING_RECORDS];
+    unsigned int oldest_sent_message;
+    unsigned int sent_message_count;
+    unsigned int next_sent_record;
+    unsigned int sent_record_count;
+    unsigned int scope_cursor; /* Scope entry to start from on the next send (when the send was cut short) */
+} NBN_ReplicatorClient;
+
+struct __NBN_Replicator
+{
+    uint8_t channel_id;
+    NBN_ReplicatedEntity *entities;
+    uint32_t *free_entities;
+    uint32_t *dirty_entities;
+    unsigned int entity_capacity;
+    unsigned int free_count;
+    unsigned int dirty_count;
+    NBN_ReplicatorClient *clients[NBN_MAX_CLIENTS];
+};
+
+/**
+ * Create the entity replicator of the game server, has to be called after NBN_GameServer_Start and after
+ * the replication channel has been registered.
+ *
+ * @param channel_id The ID of the channel replication messages are sent on (of type NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED)
+ * @param entity_capacity Maximum number of replicated entities (at most NBN_REPLICATION_MAX_ENTITIES)
+ *
+ * @return The replicator or NULL in case of error
+ */
+NBN_Replicator *NBN_Replicator_Create(uint8_t channel_id, unsigned int entity_capacity);
+
+/**
+ * Destroy the entity replicator.
+ *
+ * @param replicator The replicator
+ */
+void NBN_Replicator_Destroy(NBN_Replicator *replicator);
+
+/**
+ * Add an entity to replicate, the entity is not sent to any client until it's added to their scope.
+ *
+ * @param replicator The replicator
+ * @param type The type of the entity (see NBN_Replication_RegisterEntityType)
+ * @param state The entity's state structure, must remain valid until the entity is removed
+ *
+ * @return The ID of the entity or NBN_REPLICATION_MAX_ENTITIES in case of error
+ */
+uint32_t NBN_Replicator_AddEntity(NBN_Replicator *replicator, uint8_t type, void *state);
+
+/**
+ * Remove an entity, it will be destroyed on all the clients it was replicated to.
+ *
+ * @param replicator The replicator
+ * @param entity_id The ID of the entity
+ */
+void NBN_Replicator_RemoveEntity(NBN_Replicator *replicator, uint32_t entity_id);
+
+/**
+ * Mark fields of an entity as changed, they will be sent to the clients on the next call to NBN_Replicator_Send.
+ *
+ * @param replicator The replicator
+ * @param entity_id The ID of the entity
+ * @param field_mask The changed fields (bit i is the i-th field of the entity type)
+ */
+void NBN_Replicator_MarkDirty(NBN_Replicator *replicator, uint32_t entity_id, uint32_t field_mask);
+
+/**
+ * Add an entity to the scope of a client or remove it.
+ *
+ * Only the entities in the scope of a client are replicated to it (see NBN_InterestGrid to compute scopes).
+ *
+ * @param replicator The replicator
+ * @param client The client
+ * @param entity_id The ID of the entity
+ * @param in_scope true to replicate the entity to the client, false to destroy it on the client
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_Replicator_SetEntityScope(NBN_Replicator *replicator, NBN_Connection *client, uint32_t entity_id, bool in_scope);
+
+/**
+ * Release the replication state of a client, this is done automatically when the client's connection is removed.
+ *
+ * @param replicator The replicator
+ * @param client The client
+ */
+void NBN_Replicator_RemoveClient(NBN_Replicator *replicator, NBN_Connection *client);
+
+/**
+ * Build and send the replication messages of all clients, should be called once every tick before
+ * NBN_GameServer_SendPackets.
+ *
+ * @param replicator The replicator
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_Replicator_Send(NBN_Replicator *replicator);
+
+#pragma endregion /* NBN_Replicator */
+
+#pragma region NBN_ReplicationReceiver
+
+/*
+ * Called when an entity is created on the client side, must return the state structure the fields of the entity
+ * are written to (or NULL to ignore the entity).
+ */
+typedef void *(*NBN_ReplicaCreateCallback)(uint32_t, uint8_t, void *);
+
+/* Called after fields of an entity have been written to its state structure, with the mask of the written fields */
+typedef void (*NBN_ReplicaUpdateCallback)(uint32_t, void *, uint32_t, void *);
+
+/* Called when an entity is destroyed on the client side */
+typedef void (*NBN_ReplicaDestroyCallback)(uint32_t, void *, void *);
+
+typedef struct
+{
+    void *state;
+    unsigned int type;
+    uint32_t spawn_sequence; /* Spawn sequence of the current (or last destroyed) incarnation */
+    uint32_t field_sequences[NBN_REPLICATION_MAX_FIELDS]; /* Sequence of the last value written to each field */
+    bool exists;
+} NBN_Replica;
+
+typedef struct
+{
+    NBN_Replica *replicas; /* Indexed by entity ID */
+    unsigned int capacity;
+    NBN_ReplicaCreateCallback on_create;
+    NBN_ReplicaUpdateCallback on_update;
+    NBN_ReplicaDestroyCallback on_destroy;
+    void *user_data;
+} NBN_ReplicationReceiver;
+
+/**
+ * Create a replication receiver.
+ *
+ * @param on_create Called when an entity is created
+ * @param on_update Called when fields of an entity have been updated (can be NULL)
+ * @param on_destroy Called when an entity is destroyed
+ * @param user_data Passed to the callbacks
+ *
+ * @return The receiver
+ */
+NBN_ReplicationReceiver *NBN_ReplicationReceiver_Create(
+    NBN_ReplicaCreateCallback on_create, NBN_ReplicaUpdateCallback on_update, NBN_ReplicaDestroyCallback on_destroy, void *user_data);
+
+/**
+ * Destroy a replication receiver, the destroy callback is called for every existing entity.
+ *
+ * @param receiver The receiver
+ */
+void NBN_ReplicationReceiver_Destroy(NBN_ReplicationReceiver *receiver);
+
+/**
+ * Apply a received replication message (a message of type NBN_REPLICATION_MESSAGE_TYPE).
+ *
+ * Messages can be applied in any order, outdated values are discarded.
+ *
+ * @param receiver The receiver
+ * @param msg The message
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_ReplicationReceiver_ProcessMessage(NBN_ReplicationReceiver *receiver, NBN_ReplicationMessage *msg);
+
+#pragma endregion /* NBN_ReplicationReceiver */
+
+#pragma region NBN_SnapshotBuilder
+
+/*
+ * Snapshot builder
+ *
+ * Builds, for every client, a snapshot message that fits in a fixed byte budget. Every entity accumulates
+ * its priority on each send until it's included in a snapshot (its accumulator is then reset), entities are
+ * packed by decreasing accumulated priority. Low priority entities are sent less often but are never starved.
+ *
+ * Snapshots are meant to be sent on an unreliable channel, entities are serialized with the serializer
+ * registered with NBN_Snapshot_RegisterEntitySerializer.
+ */
+
+/*
+ * Called for every client and every entity on each send, returns the priority of the entity for the client
+ * (0 or less to leave the entity out of the client's snapshots).
+ */
+typedef float (*NBN_SnapshotPriorityCallback)(NBN_Connection *, uint32_t, void *, float, void *);
+
+typedef struct
+{
+    void *state;
+    float priority;
+    unsigned int bits; /* Measured size of the entity, updated on each send */
+    unsigned int active_index;
+    bool is_active;
+} NBN_SnapshotEntity;
+
+typedef struct
+{
+    NBN_Connection *connection;
+    float *accumulators; /* Indexed by entity ID */
+} NBN_SnapshotClient;
+
+typedef struct
+{
+    uint32_t entity_id;
+    float accumulator;
+} NBN_SnapshotCandidate;
+
+typedef struct
+{
+    uint8_t channel_id;
+    unsigned int budget;
+    unsigned int entity_capacity;
+    NBN_SnapshotEntity *entities;
+    uint32_t *active_entities;
+    unsigned int active_count;
+    NBN_SnapshotCandidate *candidates;
+    NBN_SnapshotClient *clients[NBN_MAX_CLIENTS]; /* Indexed by connection slot */
+} NBN_SnapshotBuilder;
+
+/**
+ * Create a snapshot builder on the game server.
+ *
+ * @param channel_id The ID of the channel snapshot messages are sent on (an unreliable channel)
+ * @param entity_capacity Maximum number of entities, entity IDs range from 0 to entity_capacity - 1
+ * (NBN_SNAPSHOT_MAX_ENTITY_IDS at most)
+ * @param budget Maximum size of a snapshot message in bytes (NBN_SNAPSHOT_MAX_MESSAGE_SIZE at most)
+ *
+ * @return The snapshot builder or NULL in case of error
+ */
+NBN_SnapshotBuilder *NBN_SnapshotBuilder_Create(uint8_t channel_id, unsigned int entity_capacity, unsigned int budget);
+
+/**
+ * Destroy a snapshot builder.
+ *
+ * @param builder The snapshot builder
+ */
+void NBN_SnapshotBuilder_Destroy(NBN_SnapshotBuilder *builder);
+
+/**
+ * Add an entity to the snapshots or update its priority.
+ *
+ * @param builder The snapshot builder
+ * @param entity_id The ID of the entity
+ * @param state The entity's state structure, must remain valid until the entity is removed
+ * @param priority The priority accumulated by the entity on each send
+ */
+void NBN_SnapshotBuilder_SetEntity(NBN_SnapshotBuilder *builder, uint32_t entity_id, void *state, float priority);
+
+/**
+ * Remove an entity from the snapshots.
+ *
+ * @param builder The snapshot builder
+ * @param entity_id The ID of the entity
+ */
+void NBN_SnapshotBuilder_RemoveEntity(NBN_SnapshotBuilder *builder, uint32_t entity_id);
+
+/**
+ * Release the accumulators of a client. Not required when a client disconnects, the accumulators of
+ * a connection slot are reset when it's reused.
+ *
+ * @param builder The snapshot builder
+ * @param client The client
+ */
+void NBN_SnapshotBuilder_RemoveClient(NBN_SnapshotBuilder *builder, NBN_Connection *client);
+
+/**
+ * Build and send a snapshot to every accepted client, should be called once per tick before
+ * NBN_GameServer_SendPackets.
+ *
+ * @param builder The snapshot builder
+ * @param tick The current server tick, sent along with the snapshots
+ * @param priority_cb Computes the priority of an entity for a client (NULL to use the priority of the entities)
+ * @param user_data Passed to the priority callback
+ *
+ * @return 0 when successful, -1 otherwise
+ */
+int NBN_SnapshotBuilder_Send(
+    NBN_SnapshotBuilder *builder, uint32_t tick, NBN_SnapshotPriorityCallback priority_cb, void *user_data);
+
+#pragma endregion /* NBN_SnapshotBuilder */
+
+#pragma region NBN_SnapshotBuffer
+
+/*
+ * Snapshot playout buffer
+ *
+ * Client side buffer of received snapshot messages keyed by server tick. Snapshots are rendered with a delay
+ * so that the next snapshot has most likely arrived by the time it's needed: the delay adapts to the jitter
+ * measured on the arrival times of the last snapshots (a percentile of the jitter histogram).
+ *
+ * NBN_SnapshotBuffer_Sample returns the two snapshots bracketing the current render time and the interpolation
+ * factor between them; when the next snapshot is late, the last two snapshots are extrapolated for a limited time.
+ */
+
+/* Maximum number of buffered snapshots */
+#ifndef NBN_SNAPSHOT_BUFFER_SIZE
+#define NBN_SNAPSHOT_BUFFER_SIZE 32
+#endif
+
+/* Number of snapshot arrivals the jitter is measured on */
+#define NBN_SNAPSHOT_BUFFER_JITTER_SAMPLES 128
+
+/* Jitter histogram resolution (in seconds) and number of bins */
+#define NBN_SNAPSHOT_BUFFER_JITTER_BIN_SIZE 0.001
+#define NBN_SNAPSHOT_BUFFER_JITTER_BINS 256
+
+/* Fraction of the snapshots that should arrive before they are needed */
+#ifndef NBN_SNAPSHOT_BUFFER_JITTER_PERCENTILE
+#define NBN_SNAPSHOT_BUFFER_JITTER_PERCENTILE 0.95
+#endif
+
+/* Maximum rate at which the delay is adjusted (0.1 means playback runs up to 10% slower or faster) */
+#ifndef NBN_SNAPSHOT_BUFFER_DELAY_ADJUST_RATE
+#define NBN_SNAPSHOT_BUFFER_DELAY_ADJUST_RATE 0.1
+#endif
+
+typedef struct
+{
+    NBN_SnapshotMessage *from;
+    NBN_SnapshotMessage *to;
+    float t; /* Interpolation factor between from and to, greater than 1 when extrapolating */
+    bool is_extrapolated;
+} NBN_SnapshotSample;
+
+typedef struct
+{
+    double tick_dt; /* Duration of a server tick */
+    double max_extrapolation; /* Maximum extrapolation time past the last snapshot */
+    double time;
+    double delay; /* Current playout delay */
+    double target_delay;
+    double jitter; /* Measured jitter percentile */
+    double arrival_offsets[NBN_SNAPSHOT_BUFFER_JITTER_SAMPLES]; /* Arrival time minus tick time */
+    unsigned int arrival_offset_count;
+    unsigned int next_arrival_offset;
+    double min_arrival_offset; /* Arrival offset of the fastest snapshot (latency and clock difference) */
+    double arrival_offset; /* min_arrival_offset adjusted at the same rate as the delay, used for the render time */
+    unsigned int jitter_histogram[NBN_SNAPSHOT_BUFFER_JITTER_BINS];
+    NBN_SnapshotMessage *snapshots[NBN_SNAPSHOT_BUFFER_SIZE]; /* Indexed by tick */
+    uint32_t render_tick; /* Snapshots older than the last sampled one are dropped */
+    bool has_sampled;
+} NBN_SnapshotBuffer;
+
+/**
+ * Create a snapshot playout buffer.
+ *
+ * @param tick_dt The duration of a server tick in seconds (the interval between two snapshot ticks)
+ * @param max_extrapolation Maximum time (in seconds) snapshots are extrapolated for when the next one is late
+ *
+ * @return The snapshot buffer
+ */
+NBN_SnapshotBuffer *NBN_SnapshotBuffer_Create(double tick_dt, double max_extrapolation);
+
+/**
+ * Destroy a snapshot playout buffer and the snapshots it holds.
+ *
+ * @param buffer The snapshot buffer
+ */
+void NBN_SnapshotBuffer_Destroy(NBN_SnapshotBuffer *buffer);
+
+/**
+ * Advance the local time of the buffer, should be called every frame.
+ *
+ * @param buffer The snapshot buffer
+ * @param time The elapsed time in seconds
+ */
+void NBN_SnapshotBuffer_AddTime(NBN_SnapshotBuffer *buffer, double time);
+
+/**
+ * Add a received snapshot message to the buffer. The snapshot is copied, received messages only remain valid
+ * until the next poll. Duplicated snapshots and snapshots arriving too late to be rendered are dropped.
+ *
+ * @param buffer The snapshot buffer
+ * @param msg The received snapshot message
+ */
+void NBN_SnapshotBuffer_Add(NBN_SnapshotBuffer *buffer, NBN_SnapshotMessage *msg);
+
+/**
+ * Get the snapshots to render at the current time. The returned snapshots remain valid until the next
+ * call to NBN_SnapshotBuffer_Add or NBN_SnapshotBuffer_Sample.
+ *
+ * @param buffer The snapshot buffer
+ * @param sample Filled with the snapshots to interpolate and the interpolation factor
+ *
+ * @return 0 when successful, -1 when there is no snapshot to render yet
+ */
+int NBN_SnapshotBuffer_Sample(NBN_SnapshotBuffer *buffer, NBN_SnapshotSample *sample);
+
+#pragma endregion /* NBN_SnapshotBuffer */
+
+#pragma region NBN_LagCompensator
+
+/*
+ * Lag compensation history
+ *
+ * Server side history of the entity states of the last ticks, used to rewind entities to the state a client was
+ * seeing when it performed an action (hit detection). The view time of a client is the current tick minus its
+ * round trip time and its interpolation delay.
+ *
+ * An entity state is an array of floats. States are stored as a structure of arrays: for every tick of the
+ * history, each float of the state has its own array indexed by entity id, so rewinding a float of many
+ * entities reads contiguous memory. States are interpolated linearly between ticks, angles have to be
+ * stored in a form that interpolates correctly (a direction vector for instance).
+ */
+
+typedef struct
+{
+    unsigned int history_size; /* Number of ticks kept in the history */
+    unsigned int entity_capacity; /* Entity ids range from 0 to entity_capacity - 1 */
+    unsigned int value_count; /* Number of floats of an entity state */
+    double tick_dt; /* Duration of a server tick */
+    uint32_t *ticks; /* Tick stored in each slot of the history, indexed by tick */
+    bool *is_tick_stored; /* Whether each slot of the history holds a tick */
+    uint8_t *is_entity_stored; /* Whether each entity has a state in each slot */
+    float *values; /* values[(slot * value_count + value) * entity_capacity + entity_id] */
+    uint32_t last_tick;
+    bool has_ticks;
+} NBN_LagCompensator;
+
+/**
+ * Create a lag compensation history.
+ *
+ * @param history_size Number of ticks to keep (the maximum rewind time is history_size * tick_dt)
+ * @param entity_capacity Maximum number of entities, entity ids range from 0 to entity_capacity - 1
+ * @param value_count Number of floats of an entity state
+ * @param tick_dt The duration of a server tick in seconds
+ *
+ * @return The lag compensation history
+ */
+NBN_LagCompensator *NBN_LagCompensator_Create(
+        unsigned int history_size, unsigned int entity_capacity, unsigned int value_count, double tick_dt);
+
+/**
+ * Destroy a lag compensation history.
+ *
+ * @param compensator The lag compensation history
+ */
+void NBN_LagCompensator_Destroy(NBN_LagCompensator *compensator);
+
+/**
+ * Start recording the entity states of a new tick, replacing the oldest tick of the history.
+ *
+ * @param compensator The lag compensation history
+ * @param tick The server tick, greater than the previously pushed ones
+ */
+void NBN_LagCompensator_PushTick(NBN_LagCompensator *compensator, uint32_t tick);
+
+/**
+ * Record the state of an entity for the last pushed tick.
+ *
+ * @param compensator The lag compensation history
+ * @param entity_id The entity id
+ * @param values The entity state (value_count floats)
+ */
+void NBN_LagCompensator_SetEntity(NBN_LagCompensator *compensator, unsigned int entity_id, const float *values);
+
+/**
+ * Compute the tick a client was seeing when it sent a message received on this tick: the last pushed tick minus
+ * the client's round trip time (ping from NBN_ConnectionStats) and its interpolation delay.
+ *
+ * @param compensator The lag compensation history
+ * @param connection The client connection
+ * @param interpolation_delay Rendering delay of the client in seconds (the delay of its snapshot buffer)
+ *
+ * @return The view tick, fractional
+ */
+double NBN_LagCompensator_GetViewTick(
+        NBN_LagCompensator *compensator, NBN_Connection *connection, double interpolation_delay);
+
+/**
+ * Get the state of an entity at a past tick, interpolated between the two recorded ticks around it. The tick is
+ * clamped to the range of the history.
+ *
+ * @param compensator The lag compensation history
+ * @param entity_id The entity id
+ * @param tick The tick to rewind to, fractional (see NBN_LagCompensator_GetViewTick)
+ * @param values Filled with the entity state (value_count floats)
+ *
+ * @return 0 when successful, NBN_ERROR when the entity has no state around that tick
+ */
+int NBN_LagCompensator_GetEntity(NBN_LagCompensator *compensator, unsigned int entity_id, double tick, float *values);
+
+#pragma endregion /* NBN_LagCompensator */
+
+#pragma region NBN_Recorder
+
+/*
+ * Message recording
+ *
+ * Records the messages sent and received by an endpoint to an append-only, memory mapped file: the time, the
+ * connection, the channel, the type and the serialized data of every message. Messages are serialized once,
+ * straight into the mapped file, when they are enqueued (before being split into chunks, resent or
+ * encrypted) and when they are delivered, so the file holds the message stream seen by the user code.
+ *
+ * The file starts with a NBN_RecordFileHeader and is followed by the records, each one made of a
+ * NBN_RecordHeader and the serialized message data padded to 8 bytes. Every NBN_RECORDER_INDEX_INTERVAL
+ * records, the time and offset of the record are added to an index that is appended to the file when the
+ * recording is stopped. A file that was not closed properly can still be read, without the index.
+ *
+ * Recordings are read with NBN_RecordReader, which deserializes the messages with the serializers registered
+ * on an endpoint, as fast as they can be read.
+ */
+
+#ifndef NBN_RECORDER_INITIAL_FILE_SIZE
+#define NBN_RECORDER_INITIAL_FILE_SIZE (1 << 20) /* The file size is doubled whenever it's full */
+#endif
+
+#define NBN_RECORDER_INDEX_INTERVAL 64
+#define NBN_RECORD_FILE_MAGIC 0x4E42524E /* NBRN */
+#define NBN_RECORD_FILE_VERSION 1
+
+typedef enum
+{
+    NBN_RECORD_SENT,
+    NBN_RECORD_RECEIVED
+} NBN_RecordDirection;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t data_size; /* Size of the header and the records, updated after every record */
+    uint64_t index_offset; /* Offset of the index (0 when the recording was not stopped properly) */
+    uint32_t record_count;
+    uint32_t index_count;
+} NBN_RecordFileHeader;
+
+typedef struct
+{
+    double time; /* Time of the endpoint's clock */
+    uint32_t connection_id;
+    uint32_t size; /* Size of the serialized message data */
+    uint8_t type;
+    uint8_t channel_id;
+    uint8_t direction;
+    uint8_t padding[5];
+} NBN_RecordHeader;
+
+typedef struct
+{
+    double time;
+    uint64_t offset;
+} NBN_RecordIndexEntry;
+
+struct __NBN_Recorder
+{
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint8_t *map; /* Mapped file */
+    uint64_t map_size;
+    uint64_t data_size;
+    uint32_t record_count;
+    NBN_RecordIndexEntry *index;
+    unsigned int index_count;
+    unsigned int index_capacity;
+};
+
+typedef struct
+{
+    double time;
+    uint32_t connection_id;
+    uint8_t channel_id;
+    uint8_t type;
+    NBN_RecordDirection direction;
+    void *data; /* Deserialized message, valid until the next read from the record reader */
+} NBN_RecordedMessage;
+
+struct __NBN_RecordReader
+{
+    NBN_Endpoint *endpoint; /* Endpoint the message builders, destructors and serializers are taken from */
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+    uint8_t *map;
+    uint64_t map_size;
+    uint64_t data_size;
+    uint64_t cursor; /* Offset of the next record */
+    NBN_RecordIndexEntry *index; /* Index in the mapped file (NULL when the file has no index) */
+    unsigned int index_count;
+    void *last_message_data;
+    uint8_t last_message_type;
+};
+
+/**
+ * Create a recording file, an existing file is overwritten.
+ *
+ * @param path Path of the file
+ *
+ * @return The recorder or NULL in case of error
+ */
+NBN_Recorder *NBN_Recorder_Create(const char *path);
+
+/**
+ * Append the index to the recording file and close it.
+ *
+ * @param recorder The recorder
+ *
+ * @return 0 when successful, NBN_ERROR otherwise
+ */
+int NBN_Recorder_Destroy(NBN_Recorder *recorder);
+
+/**
+ * Record a message.
+ *
+ * @param recorder The recorder
+ * @param time Time of the message, has to be greater or equal to the time of the previously recorded messages
+ * @param connection_id Id of the connection the message is sent to or received from
+ * @param channel_id Channel of the message
+ * @param type Type of the message
+ * @param data The message
+ * @param msg_serializer Serializer of the message
+ * @param direction Whether the message is sent or received
+ *
+ * @return 0 when successful, NBN_ERROR otherwise
+ */
+int NBN_Recorder_RecordMessage(
+        NBN_Recorder *recorder,
+        double time,
+        uint32_t connection_id,
+        uint8_t channel_id,
+        uint8_t type,
+        void *data,
+        NBN_MessageSerializer msg_serializer,
+        NBN_RecordDirection direction);
+
+/**
+ * Open a recording file.
+ *
+ * @param path Path of the file
+ * @param endpoint Endpoint with the message builders, destructors and serializers of the recorded messages
+ *
+ * @return The record reader or NULL in case of error
+ */
+NBN_RecordReader *NBN_RecordReader_Open(const char *path, NBN_Endpoint *endpoint);
+
+/**
+ * Close a recording file, the last read message is destroyed.
+ *
+ * @param reader The record reader
+ */
+void NBN_RecordReader_Close(NBN_RecordReader *reader);
+
+/**
+ * Read the next recorded message, the previously read message is destroyed.
+ *
+ * @param reader The record reader
+ * @param message Filled with the recorded message
+ *
+ * @return 1 when a message was read, 0 at the end of the recording, NBN_ERROR in case of error
+ */
+int NBN_RecordReader_Next(NBN_RecordReader *reader, NBN_RecordedMessage *message);
+
+/**
+ * Move to the first message recorded at or after a given time, using the index of the file.
+ *
+ * @param reader The record reader
+ * @param time Time of the endpoint's clock
+ *
+ * @return 0 when successful, NBN_ERROR when the recording is corrupted
+ */
+int NBN_RecordReader_Seek(NBN_RecordReader *reader, double time);
+
+#pragma endregion /* NBN_Recorder */
+
+#pragma region Clock
+
+/**
+ * Read the monotonic high resolution clock of the system.
+ * 
+ * The clock is not affected by changes of the wall clock time, its origin is unspecified.
+ * 
+ * @return The current time of the clock (in seconds)
+ */
+double NBN_Clock_GetTime(void);
+
+#pragma endregion /* Clock */
+
+#pragma region NBN_TickDriver
+
+/*
+ * Fixed timestep tick driver
+ *
+ * Runs a tick callback at a fixed rate, ticks are scheduled on the monotonic clock (see NBN_Clock_GetTime) so
+ * that the send cadence does not drift. The driver sleeps until shortly before the next tick is due and spins
+ * for the rest of the wait, OS sleeps being too coarse to wake up on time.
+ *
+ * When a tick starts late by more than a tick duration (a tick took too long or the process was descheduled),
+ * the overrun policy decides what happens to the missed ticks.
+ */
+
+/* Time before a tick is due after which the driver stops sleeping and spins (in seconds) */
+#ifndef NBN_TICK_DRIVER_SPIN_TIME
+#ifdef __EMSCRIPTEN__
+#define NBN_TICK_DRIVER_SPIN_TIME 0 /* never spin in a browser */
+#else
+#define NBN_TICK_DRIVER_SPIN_TIME 0.002
+#endif
+#endif /* NBN_TICK_DRIVER_SPIN_TIME */
+
+/* Maximum number of missed ticks run back to back by the NBN_TICK_OVERRUN_CATCH_UP policy */
+#ifndef NBN_TICK_DRIVER_MAX_CATCH_UP_TICKS
+#define NBN_TICK_DRIVER_MAX_CATCH_UP_TICKS 5
+#endif
+
+typedef enum
+{
+    /* Run the missed ticks back to back (up to NBN_TICK_DRIVER_MAX_CATCH_UP_TICKS, the others are skipped) */
+    NBN_TICK_OVERRUN_CATCH_UP,
+
+    /* Skip the missed ticks, the following ones stay aligned on the original schedule */
+    NBN_TICK_OVERRUN_SKIP,
+
+    /* Skip the missed ticks and restart the schedule from the current time */
+    NBN_TICK_OVERRUN_RESET
+} NBN_TickOverrunPolicy;
+
+/*
+ * Tick callback, called with the tick number and the fixed tick duration.
+ *
+ * Return a negative value on error, a positive value to stop the driver and 0 to keep running.
+ */
+typedef int (*NBN_TickCallback)(uint32_t, double, void *);
+
+typedef struct
+{
+    unsigned int tick_count; /* Number of ticks run */
+    unsigned int overrun_count; /* Number of ticks that ended after the next one was due */
+    unsigned int skipped_tick_count; /* Number of ticks dropped by the overrun policy */
+    double min_tick_duration; /* Time spent in the tick callback */
+    double max_tick_duration;
+    double avg_tick_duration;
+    double max_lateness; /* Time between the scheduled start of a tick and its actual start */
+    double avg_lateness;
+} NBN_TickStats;
+
+typedef struct
+{
+    double tick_dt;
+    NBN_TickOverrunPolicy overrun_policy;
+    double next_tick_time; /* Clock time the next tick is scheduled at */
+    uint32_t tick;
+    NBN_TickStats stats;
+    bool is_running;
+} NBN_TickDriver;
+
+/**
+ * Create a tick driver.
+ *
+ * @param tick_rate Number of ticks per second
+ * @param overrun_policy What to do with the missed ticks when ticks run late
+ *
+ * @return The tick driver
+ */
+NBN_TickDriver *NBN_TickDriver_Create(double tick_rate, NBN_TickOverrunPolicy overrun_policy);
+
+/**
+ * Destroy a tick driver.
+ *
+ * @param driver The tick driver
+ */
+void NBN_TickDriver_Destroy(NBN_TickDriver *driver);
+
+/**
+ * Run the tick callback at the tick rate until it returns a non zero value or NBN_TickDriver_Stop is called.
+ *
+ * A typical game server tick adds the tick duration to the server time, polls the server events and sends packets.
+ *
+ * @param driver The tick driver
+ * @param tick_callback The tick callback
+ * @param user_data Passed to the tick callback
+ *
+ * @return The non zero value returned by the tick callback or 0 when the driver has been stopped
+ */
+int NBN_TickDriver_Run(NBN_TickDriver *driver, NBN_TickCallback tick_callback, void *user_data);
+
+/**
+ * Stop a running tick driver after the current tick.
+ *
+ * @param driver The tick driver
+ */
+void NBN_TickDriver_Stop(NBN_TickDriver *driver);
+
+/**
+ * Get the tick duration and lateness statistics of a tick driver.
+ *
+ * @param driver The tick driver
+ *
+ * @return The tick statistics
+ */
+NBN_TickStats NBN_TickDriver_GetStats(NBN_TickDriver *driver);
+
+#pragma endregion /* NBN_TickDriver */
+
+#pragma region Network driver
+
+/*
+ * Drivers having a reliable transport next to the unreliable one (see NBN_WEBRTC_RELIABLE_CHANNEL) may send the
+ * packets flagged as reliable (NBN_Packet.is_reliable) through it and return this value from their send function:
+ * the messages of the packet are then not resent by nbnet but, like any other message, they stay in flight until
+ * the packet is acked (so the channels never get ahead of the receiver). The packet simulator sends packets later
+ * on, through nbnet reliability.
+ */
+#define NBN_DRIVER_PACKET_SENT_RELIABLY 1
+
+/*
+ * Drivers batching the packets they are given have to be told when all the packets of a tick have been sent:
+ * they implement NBN_Driver_GCli_FlushPackets and NBN_Driver_GServ_FlushPackets, which are only called when
+ * NBN_DRIVER_HAS_FLUSH is defined before including nbnet (the driver is included after the implementation).
+ */
+
+/*
+ * Game client driver
+ */
+
+typedef enum
+{
+    NBN_DRIVER_GCLI_CONNECTED,
+    NBN_DRIVER_GCLI_SERVER_PACKET_RECEIVED
+} NBN_Driver_GCli_EventType;
+
+int NBN_Driver_GCli_Start(uint32_t, const char *, uint16_t);
+void NBN_Driver_GCli_Stop(void);
+int NBN_Driver_GCli_RecvPackets(void);
+int NBN_Driver_GCli_SendPacket(NBN_Packet *);
+#ifdef NBN_DRIVER_HAS_FLUSH
+int NBN_Driver_GCli_FlushPackets(void); /* Called once the packets of a tick are sent */
+#endif
+void NBN_Driver_GCli_RaiseEvent(NBN_Driver_GCli_EventType, void *);
+
+/*
+ * Game server driver
+ */
+
+typedef enum
+{
+    NBN_DRIVER_GSERV_CLIENT_CONNECTED,
+    NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED
+} NBN_Driver_GServ_EventType;
+
+int NBN_Driver_GServ_Start(uint32_t, uint16_t);
+void NBN_Driver_GServ_Stop(void);
+int NBN_Driver_GServ_RecvPackets(void);
+void NBN_Driver_GServ_RemoveClientConnection(NBN_Connection *);
+int NBN_Driver_GServ_SendPacketTo(NBN_Packet *, NBN_Connection *);
+#ifdef NBN_DRIVER_HAS_FLUSH
+int NBN_Driver_GServ_FlushPackets(void); /* Called once the packets of a tick are sent */
+#endif
+int NBN_Driver_GServ_RaiseEvent(NBN_Driver_GServ_EventType, void *);
+
+#pragma endregion /* Network driver */
+
+#pragma region Utils
+
+#ifndef MIN
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef MAX
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#ifndef ABS
+#define ABS(v) (((v) > 0) ? (v) : -(v))
+#endif
+
+#define IS_POWER_OF_TWO(v) ((v) > 0 && ((v) & ((v) - 1)) == 0)
+
+#define SEQUENCE_NUMBER_GT(seq1, seq2) \
+    ((seq1 > seq2 && (seq1 - seq2) <= 32767) || (seq1 < seq2 && (seq2 - seq1) >= 32767))
+#define SEQUENCE_NUMBER_GTE(seq1, seq2) \
+    ((seq1 >= seq2 && (seq1 - seq2) <= 32767) || (seq1 <= seq2 && (seq2 - seq1) >= 32767))
+#define SEQUENCE_NUMBER_LT(seq1, seq2) \
+    ((seq1 < seq2 && (seq2 - seq1) <= 32767) || (seq1 > seq2 && (seq1 - seq2) >= 32767))
+
+#pragma endregion /* Utils */
+
+#pragma endregion /* Declarations */
+
+#endif /* NBNET_H */
+
+#pragma region Implementations
+
+#ifdef NBNET_IMPL
+
+#pragma region NBN_ConnectionVector
+
+static int NBN_ConnectionVector_Grow(NBN_ConnectionVector *vector, unsigned int new_capacity);
+
+static NBN_ConnectionVector *NBN_ConnectionVector_Create(void)
+{
+    NBN_ConnectionVector *vector = NBN_Allocator(sizeof(NBN_ConnectionVector));
+
+    vector->connections = NULL;
+    vector->capacity = 0;
+    vector->count = 0;
+
+    if (NBN_ConnectionVector_Grow(vector, NBN_CONNECTION_VECTOR_INITIAL_CAPACITY) < 0)
+        return NULL;
+
+    return vector;
+}
+
+static void NBN_ConnectionVector_Destroy(NBN_ConnectionVector *vector)
+{
+    for (unsigned int i = 0; i < vector->count; i++)
+        NBN_Connection_Destroy(vector->connections[i]);
+
+    NBN_Deallocator(vector->connections);
+    NBN_Deallocator(vector);
+}
+
+static int NBN_ConnectionVector_Add(NBN_ConnectionVector *vector, NBN_Connection *conn)
+{
+    if (vector->count >= vector->capacity)
+    {
+        if (NBN_ConnectionVector_Grow(vector, vector->capacity * 2) < 0)
+            return NBN_ERROR;
+    }
+
+    if (vector->connections[vector->count])
+        return NBN_ERROR;
+
+    vector->connections[vector->count] = conn;
+    vector->count++;
+
+    return 0;
+}
+
+static void NBN_ConnectionVector_Remove(NBN_ConnectionVector *vector, NBN_Connection *conn)
+{
+    unsigned int idx = 0;
+
+    for (; idx < vector->count && vector->connections[idx] != conn; idx++);
+
+    if (idx == vector->count) return; // not found
+
+    for (unsigned int i = idx; i < vector->count - 1; i++)
+        vector->connections[i] = vector->connections[i + 1];
+
+    vector->connections[vector->count - 1] = NULL;
+    vector->count--;
+}
+
+static int NBN_ConnectionVector_Grow(NBN_ConnectionVector *vector, unsigned int new_capacity)
+{
+    vector->connections = NBN_Reallocator(vector->connections, sizeof(NBN_Connection *) * new_capacity);
+
+    if (vector->connections == NULL)
+        return NBN_ERROR;
+
+    for (unsigned int i = 0; i < new_capacity - vector->capacity; i++)
+        vector->connections[vector->capacity + i] = NULL;
+
+    vector->capacity = new_capacity;
+
+    return 0;
+}
+
+#pragma endregion // NBN_ConnectionVector
+
+#pragma region Memory management
+
+NBN_MemoryManager __mem_manager;
+
+static void MemoryManager_Init(void);
+static void MemoryManager_Deinit(void);
+static void *MemoryManager_Alloc(unsigned int);
+static void MemoryManager_Dealloc(void *, unsigned int);
+
+#if !defined(NBN_DISABLE_MEMORY_POOLING)
+
+static void MemPool_Init(NBN_MemPool *, size_t, unsigned int);
+static void MemPool_Deinit(NBN_MemPool *);
+static void MemPool_Grow(NBN_MemPool *, unsigned int);
+static void *MemPool_Alloc(NBN_MemPool *);
+static void MemPool_Dealloc(NBN_MemPool *, void *);
+
+#endif /* NBN_DISABLE_MEMORY_POOLING */
+
+static void MemoryManager_Init(void)
+{
+#ifdef NBN_DISABLE_MEMORY_POOLING
+    NBN_LogDebug("MemoryManager_Init without pooling!");
+
+    __mem_manager.mem_sizes[NBN_MEM_MESSAGE_CHUNK] = sizeof(NBN_MessageChunk);
+    __mem_manager.mem_sizes[NBN_MEM_BYTE_ARRAY_MESSAGE] = sizeof(NBN_ByteArrayMessage);
+    __mem_manager.mem_sizes[NBN_MEM_CONNECTION] = sizeof(NBN_Connection);
+
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    __mem_manager.mem_sizes[NBN_MEM_PACKET_SIMULATOR_ENTRY] = sizeof(NBN_PacketSimulatorEntry);
+#endif
+#else
+    NBN_LogDebug("MemoryManager_Init with pooling!");
+
+    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_MESSAGE_CHUNK], sizeof(NBN_MessageChunk), 256);
+    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_BYTE_ARRAY_MESSAGE], sizeof(NBN_ByteArrayMessage), 256);
+    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_CONNECTION], sizeof(NBN_Connection), 16);
+
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_PACKET_SIMULATOR_ENTRY], sizeof(NBN_PacketSimulatorEntry), 32);
+#endif
+#endif /* NBN_DISABLE_MEMORY_POOLING */
+}
+
+static void MemoryManager_Deinit(void)
+{
+#if !defined(NBN_DISABLE_MEMORY_POOLING)
+    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_MESSAGE_CHUNK]);
+    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_BYTE_ARRAY_MESSAGE]);
+    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_CONNECTION]);
+
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_PACKET_SIMULATOR_ENTRY]);
+#endif
+#endif /* NBN_DISABLE_MEMORY_POOLING */
+}
+
+static void *MemoryManager_Alloc(unsigned int mem_tag)
+{
+#ifdef NBN_DISABLE_MEMORY_POOLING
+    return NBN_Allocator(__mem_manager.mem_sizes[mem_tag]);
+#else
+    return MemPool_Alloc(&__mem_manager.mem_pools[mem_tag]);
+#endif /* NBN_DISABLE_MEMORY_POOLING */
+}
+
+static void MemoryManager_Dealloc(void *ptr, unsigned int mem_tag)
+{
+#ifdef NBN_DISABLE_MEMORY_POOLING
+    (void)mem_tag;
+
+    NBN_Deallocator(ptr);
+#else
+    MemPool_Dealloc(&__mem_manager.mem_pools[mem_tag], ptr);
+#endif /* NBN_DISABLE_MEMORY_POOLING */
+}
+
+#if !defined(NBN_DISABLE_MEMORY_POOLING)
+
+static void MemPool_Init(NBN_MemPool *pool, size_t block_size, unsigned int initial_block_count)
+{
+    pool->block_size = MAX(block_size, sizeof(NBN_MemPoolFreeBlock));
+    pool->block_idx = 0;
+    pool->block_count = 0;
+    pool->free = NULL;
+    pool->blocks = NULL;
+
+    MemPool_Grow(pool, initial_block_count);
+}
+
+static void MemPool_Deinit(NBN_MemPool *pool)
+{
+    for (unsigned int i = 0; i < pool->block_count; i++)
+        NBN_Deallocator(pool->blocks[i]);
+
+    NBN_Deallocator(pool->blocks);
+}
+
+static void *MemPool_Alloc(NBN_MemPool *pool)
+{
+    if (pool->free)
+    {
+        void *block = pool->free;
+
+        pool->free = pool->free->next;
+
+        return block;
+    }
+
+    if (pool->block_idx == pool->block_count)
+        MemPool_Grow(pool, pool->block_count * 2);
+
+    void *block = pool->blocks[pool->block_idx];
+
+    pool->block_idx++;
+
+    return block;
+}
+
+static void MemPool_Dealloc(NBN_MemPool *pool, void *ptr)
+{
+    NBN_MemPoolFreeBlock *free = pool->free;
+
+    pool->free = (NBN_MemPoolFreeBlock*)ptr;
+    pool->free->next = free;
+}
+
+static void MemPool_Grow(NBN_MemPool *pool, unsigned int block_count)
+{
+    pool->blocks = (uint8_t**)NBN_Reallocator(pool->blocks, sizeof(uint8_t *) * block_count);
+
+    for (unsigned int i = 0; i < block_count - pool->block_count; i++)
+        pool->blocks[pool->block_idx + i] = (uint8_t*)NBN_Allocator(pool->block_size);
+
+    pool->block_count = block_count;
+}
+
+#endif /* NBN_DISABLE_MEMORY_POOLING */
+
+#pragma endregion /* Memory management */
+
+#pragma region Serialization
+
+static unsigned int GetRequiredNumberOfBitsFor(unsigned int v)
+{
+    unsigned int a = v | (v >> 1);
+    unsigned int b = a | (a >> 2);
+    unsigned int c = b | (b >> 4);
+    unsigned int d = c | (c >> 8);
+    unsigned int e = d | (d >> 16);
+    unsigned int f = e >> 1;
+
+    unsigned int i = f - ((f >> 1) & 0x55555555);
+    unsigned int j = (((i >> 2) & 0x33333333) + (i & 0x33333333));
+    unsigned int k = (((j >> 4) + j) & 0x0f0f0f0f);
+    unsigned int l = k + (k >> 8);
+    unsigned int m = l + (l >> 16);
+
+    return (m & 0x0000003f) + 1;
+}
+
+#pragma region NBN_BitReader
+
+static void BitReader_ReadFromBuffer(NBN_BitReader *);
+
+void NBN_BitReader_Init(NBN_BitReader *bit_reader, uint8_t *buffer, unsigned int size)
+{
+    bit_reader->size = size;
+    bit_reader->buffer = buffer;
+    bit_reader->scratch = 0;
+    bit_reader->scratch_bits_count = 0;
+    bit_reader->byte_cursor = 0;
+}
+
+int NBN_BitReader_Read(NBN_BitReader *bit_reader, Word *word, unsigned int number_of_bits)
+{
+    *word = 0;
+
+    if (number_of_bits > bit_reader->scratch_bits_count)
+    {
+        unsigned int needed_bytes = (number_of_bits - bit_reader->scratch_bits_count - 1) / 8 + 1;
+
+        if (bit_reader->byte_cursor + needed_bytes > bit_reader->size)
+            return NBN_ERROR;
+
+        BitReader_ReadFromBuffer(bit_reader);
+    }
+
+    *word |= (bit_reader->scratch & (((uint64_t)1 << number_of_bits) - 1));
+    bit_reader->scratch >>= number_of_bits;
+    bit_reader->scratch_bits_count -= number_of_bits;
+
+    return 0;
+}
+
+static void BitReader_ReadFromBuffer(NBN_BitReader *bit_reader)
+{
+    unsigned int bytes_count = MIN(bit_reader->size - bit_reader->byte_cursor, WORD_BYTES);
+    Word word = 0;
+
+    memcpy(&word, bit_reader->buffer + bit_reader->byte_cursor, bytes_count);
+
+    bit_reader->scratch |= (uint64_t)word << bit_reader->scratch_bits_count;
+    bit_reader->scratch_bits_count += bytes_count * 8;
+    bit_reader->byte_cursor += bytes_count;
+}
+
+#pragma endregion /* NBN_BitReader */
+
+#pragma region NBN_BitWriter
+
+static int BitWriter_FlushScratchBits(NBN_BitWriter *, unsigned int);
+
+void NBN_BitWriter_Init(NBN_BitWriter *bit_writer, uint8_t *buffer, unsigned int size)
+{
+    bit_writer->size = size;
+    bit_writer->buffer = buffer;
+    bit_writer->scratch = 0;
+    bit_writer->scratch_bits_count = 0;
+    bit_writer->byte_cursor = 0;
+}
+
+int NBN_BitWriter_Write(NBN_BitWriter *bit_writer, Word value, unsigned int number_of_bits)
+{
+    bit_writer->scratch |= ((uint64_t)value << bit_writer->scratch_bits_count);
+
+    if ((bit_writer->scratch_bits_count += number_of_bits) >= WORD_BITS)
+        return BitWriter_FlushScratchBits(bit_writer, WORD_BITS);
+
+    return 0;
+}
+
+int NBN_BitWriter_Flush(NBN_BitWriter *bit_writer)
+{
+    return BitWriter_FlushScratchBits(bit_writer, bit_writer->scratch_bits_count);
+}
+
+static int BitWriter_FlushScratchBits(NBN_BitWriter *bit_writer, unsigned int number_of_bits)
+{
+    if (bit_writer->scratch_bits_count < 1)
+        return 0;
+
+    unsigned int bytes_count = (number_of_bits - 1) / 8 + 1;
+
+    assert(bytes_count <= WORD_BYTES);
+
+    if (bit_writer->byte_cursor + bytes_count > bit_writer->size)
+        return NBN_ERROR;
+
+    Word word = 0 | (bit_writer->scratch & (((uint64_t)1 << number_of_bits) - 1));
+
+    memcpy(bit_writer->buffer + bit_writer->byte_cursor, &word, bytes_count);
+
+    bit_writer->scratch >>= number_of_bits;
+    bit_writer->scratch_bits_count -= number_of_bits;
+    bit_writer->byte_cursor += bytes_count;
+
+    return 0;
+}
+
+#pragma endregion /* NBN_BitWriter */
+
+#pragma region NBN_ReadStream
+
+void NBN_ReadStream_Init(NBN_ReadStream *read_stream, uint8_t *buffer, unsigned int size)
+{
+    read_stream->base.type = NBN_STREAM_READ;
+    read_stream->base.serialize_uint_func = (NBN_Stream_SerializUint)NBN_ReadStream_SerializeUint;
+    read_stream->base.serialize_int_func = (NBN_Stream_SerializeInt)NBN_ReadStream_SerializeInt;
+    read_stream->base.serialize_float_func = (NBN_Stream_SerializeFloat)NBN_ReadStream_SerializeFloat;
+    read_stream->base.serialize_bool_func = (NBN_Stream_SerializeBool)NBN_ReadStream_SerializeBool;
+    read_stream->base.serialize_padding_func = (NBN_Stream_SerializePadding)NBN_ReadStream_SerializePadding;
+    read_stream->base.serialize_bytes_func = (NBN_Stream_SerializeBytes)NBN_ReadStream_SerializeBytes;
+
+    NBN_BitReader_Init(&read_stream->bit_reader, buffer, size);
+}
+
+int NBN_ReadStream_SerializeUint(NBN_ReadStream *read_stream, unsigned int *value, unsigned int min, unsigned int max)
+{
+    assert(min <= max);
+
+    if (NBN_BitReader_Read(&read_stream->bit_reader, value, BITS_REQUIRED(min, max)) < 0)
+        return NBN_ERROR;
+
+    *value += min;
+
+#ifdef NBN_DEBUG
+    assert(*value >= min && *value <= max);
+#else
+    if (*value < min || *value > max)
+        return NBN_ERROR;
+#endif
+
+    return 0;
+}
+
+int NBN_ReadStream_SerializeInt(NBN_ReadStream *read_stream, int *value, int min, int max)
+{
+    assert(min <= max);
+
+    bool isNegative = 0;
+    unsigned int abs_min = MIN(abs(min), abs(max));
+    unsigned int abs_max = MAX(abs(min), abs(max));
+
+    isNegative = *value < 0; /* TODO: useless, remove this ? */
+    *value = abs(*value);
+
+    if (NBN_ReadStream_SerializeBool(read_stream, &isNegative) < 0)
+        return NBN_ERROR;
+
+    if (NBN_ReadStream_SerializeUint(
+                read_stream, (unsigned int *)value, (min < 0 && max > 0) ? 0 : abs_min, abs_max) < 0)
+        return NBN_ERROR;
+
+    if (isNegative)
+        *value *= -1;
+
+    return 0;
+}
+
+int NBN_ReadStream_SerializeFloat(NBN_ReadStream *read_stream, float *value, float min, float max, int precision)
+{
+    assert(min <= max);
+
+    unsigned int mult = pow(10, precision);
+    int i_min = min * mult;
+    int i_max = max * mult;
+    int i_val;
+
+    if (NBN_ReadStream_SerializeInt(read_stream, &i_val, i_min, i_max) < 0)
+        return NBN_ERROR;
+
+    *value = (float)i_val / mult;
+
+    return 0;
+}
+
+int NBN_ReadStream_SerializeBool(NBN_ReadStream *read_stream, bool *value)
+{
+    Word v;
+
+    if (NBN_BitReader_Read(&read_stream->bit_reader, &v, 1) < 0)
+        return NBN_ERROR;
+
+    if (v < 0 || v > 1)
+        return NBN_ERROR;
+
+    *value = v;
+
+    return 0;
+}
+
+int NBN_ReadStream_SerializePadding(NBN_ReadStream *read_stream)
+{
+    // if we are at the beginning of a new byte, no need to pad
+    if (read_stream->bit_reader.scratch_bits_count % 8 == 0)
+        return 0;
+
+    Word value;
+    unsigned int padding = read_stream->bit_reader.scratch_bits_count % 8;
+    int ret = NBN_BitReader_Read(&read_stream->bit_reader, &value, padding);
+
+#ifdef NBN_DEBUG
+    assert(value == 0);
+#else
+    if (value != 0)
+        return NBN_ERROR;
+#endif
+
+    return ret;
+}
+
+int NBN_ReadStream_SerializeBytes(NBN_ReadStream *read_stream, uint8_t *bytes, unsigned int length)
+{
+    if (length == 0)
+        return NBN_ERROR;
+
+    if (NBN_ReadStream_SerializePadding(read_stream) < 0)
+        return NBN_ERROR;
+
+    NBN_BitReader *bit_reader = &read_stream->bit_reader;
+
+    // make sure we are at the start of a new byte after applying padding
+    assert(bit_reader->scratch_bits_count % 8 == 0);
+
+    if (length * 8 <= bit_reader->scratch_bits_count)
+    {
+        // the byte array is fully contained inside the read word
+
+        Word word;
+
+        if (NBN_BitReader_Read(bit_reader, &word, length * 8) < 0)
+            return NBN_ERROR;
+
+        memcpy(bytes, &word, length);
+    }
+    else
+    {
+        // reading is done word by word and in this case, the start of byte array has already been read
+        // therefore we need to "roll back" the byte cursor so it is at the very begining of the byte array
+        // inside the buffer
+
+        bit_reader->byte_cursor -= (bit_reader->scratch_bits_count / 8);
+        bit_reader->scratch_bits_count = 0;
+        bit_reader->scratch = 0;
+
+        memcpy(bytes, bit_reader->buffer + bit_reader->byte_cursor, length);
+
+        bit_reader->byte_cursor += length;
+    }
+
+    return 0;
+}
+
+#pragma endregion /* NBN_ReadStream */
+
+#pragma region NBN_WriteStream
+
+void NBN_WriteStream_Init(NBN_WriteStream *write_stream, uint8_t *buffer, unsigned int size)
+{
+    write_stream->base.type = NBN_STREAM_WRITE;
+    write_stream->base.serialize_uint_func = (NBN_Stream_SerializUint)NBN_WriteStream_SerializeUint;
+    write_stream->base.serialize_int_func = (NBN_Stream_SerializeInt)NBN_WriteStream_SerializeInt;
+    write_stream->base.serialize_float_func = (NBN_Stream_SerializeFloat)NBN_WriteStream_SerializeFloat;
+    write_stream->base.serialize_bool_func = (NBN_Stream_SerializeBool)NBN_WriteStream_SerializeBool;
+    write_stream->base.serialize_padding_func = (NBN_Stream_SerializePadding)NBN_WriteStream_SerializePadding;
+    write_stream->base.serialize_bytes_func = (NBN_Stream_SerializeBytes)NBN_WriteStream_SerializeBytes;
+
+    NBN_BitWriter_Init(&write_stream->bit_writer, buffer, size);
+}
+
+int NBN_WriteStream_SerializeUint(
+        NBN_WriteStream *write_stream, unsigned int *value, unsigned int min, unsigned int max)
+{
+    assert(min <= max);
+    assert(*value >= min && *value <= max);
+
+    if (NBN_BitWriter_Write(&write_stream->bit_writer, *value - min, BITS_REQUIRED(min, max)) < 0)
+        return NBN_ERROR;
+
+    return 0;
+}
+
+int NBN_WriteStream_SerializeInt(NBN_WriteStream *write_stream, int *value, int min, int max)
+{
+    assert(min <= max);
+
+    unsigned int isNegative = 0;
+    unsigned int abs_min = MIN(abs(min), abs(max));
+    unsigned int abs_max = MAX(abs(min), abs(max));
+
+    isNegative = *value < 0;
+    *value = abs(*value);
+
+    if (NBN_WriteStream_SerializeUint(write_stream, &isNegative, 0, 1) < 0)
+        return NBN_ERROR;
+
+    if (NBN_WriteStream_SerializeUint(
+                write_stream, (unsigned int *)value, (min < 0 && max > 0) ? 0 : abs_min, abs_max) < 0)
+        return NBN_ERROR;
+
+    if (isNegative)
+        *value *= -1;
+
+    return 0;
+}
+
+int NBN_WriteStream_SerializeFloat(NBN_WriteStream *write_stream, float *value, float min, float max, int precision)
+{
+    assert(min <= max);
+
+    unsigned int mult = pow(10, precision);
+    int i_min = min * mult;
+    int i_max = max * mult;
+    int i_val = *value * mult;
+
+    if (NBN_WriteStream_SerializeInt(write_stream, &i_val, i_min, i_max) < 0)
+        return NBN_ERROR;
+
+    return 0;
+}
+
+int NBN_WriteStream_SerializeBool(NBN_WriteStream *write_stream, bool *value)
+{
+    int v = *value;
+
+    assert(v >= 0 && v <= 1);
+
+    if (NBN_BitWriter_Write(&write_stream->bit_writer, v, 1) < 0)
+        return NBN_ERROR;
+
+    return 0;
+}
+
+int NBN_WriteStream_SerializePadding(NBN_WriteStream *write_stream)
+{
+    // if we are at the beginning of a new byte, no need to pad
+    if (write_stream->bit_writer.scratch_bits_count % 8 == 0) 
+        return 0;
+
+    unsigned int padding = 8 - (write_stream->bit_writer.scratch_bits_count % 8);
+
+    return NBN_BitWriter_Write(&write_stream->bit_writer, 0, padding);
+}
+
+int NBN_WriteStream_SerializeBytes(NBN_WriteStream *write_stream, uint8_t *bytes, unsigned int length)
+{
+    if (length == 0)
+        return NBN_ERROR;
+
+    if (NBN_WriteStream_SerializePadding(write_stream) < 0)
+        return NBN_ERROR;
+
+    NBN_BitWriter *bit_writer = &write_stream->bit_writer;
+
+    // make sure we are at the start of a new byte after applying padding
+    assert(bit_writer->scratch_bits_count % 8 == 0);
+
+    if (NBN_WriteStream_Flush(write_stream) < 0)
+        return NBN_ERROR;
+
+    // make sure everything has been flushed to the buffer before writing the byte array
+    assert(bit_writer->scratch_bits_count == 0);
+
+    if (bit_writer->byte_cursor + length > bit_writer->size)
+        return NBN_ERROR;
+
+    memcpy(bit_writer->buffer + bit_writer->byte_cursor, bytes, length);
+
+    bit_writer->byte_cursor += length;
+
+    return 0;
+}
+
+int NBN_WriteStream_Flush(NBN_WriteStream *write_stream)
+{
+    return NBN_BitWriter_Flush(&write_stream->bit_writer);
+}
+
+#pragma endregion /* NBN_WriteStream */
+
+#pragma region NBN_MeasureStream
+
+void NBN_MeasureStream_Init(NBN_MeasureStream *measure_stream)
+{
+    measure_stream->base.type = NBN_STREAM_MEASURE;
+    measure_stream->base.serialize_uint_func = (NBN_Stream_SerializUint)NBN_MeasureStream_SerializeUint;
+    measure_stream->base.serialize_int_func = (NBN_Stream_SerializeInt)NBN_MeasureStream_SerializeInt;
+    measure_stream->base.serialize_float_func = (NBN_Stream_SerializeFloat)NBN_MeasureStream_SerializeFloat;
+    measure_stream->base.serialize_bool_func = (NBN_Stream_SerializeBool)NBN_MeasureStream_SerializeBool;
+    measure_stream->base.serialize_padding_func = (NBN_Stream_SerializePadding)NBN_MeasureStream_SerializePadding;
+    measure_stream->base.serialize_bytes_func = (NBN_Stream_SerializeBytes)NBN_MeasureStream_SerializeBytes;
+
+    measure_stream->number_of_bits = 0;
+}
+
+int NBN_MeasureStream_SerializeUint(
+        NBN_MeasureStream *measure_stream, unsigned int *value, unsigned int min, unsigned int max)
+{
+    (void)*value;
+
+    assert(min <= max);
+    // assert(*value >= min && *value <= max);
+
+    unsigned int number_of_bits = BITS_REQUIRED(min, max);
+
+    measure_stream->number_of_bits += number_of_bits;
+
+    return number_of_bits;
+}
+
+int NBN_MeasureStream_SerializeInt(NBN_MeasureStream *measure_stream, int *value, int min, int max)
+{
+    assert(min <= max);
+    assert(*value >= min && *value <= max);
+
+    unsigned int abs_min = MIN(abs(min), abs(max));
+    unsigned int abs_max = MAX(abs(min), abs(max));
+    unsigned int abs_value = abs(*value);
+    unsigned number_of_bits = NBN_MeasureStream_SerializeUint(
+            measure_stream, &abs_value, (min < 0 && max > 0) ? 0 : abs_min, abs_max);
+
+    measure_stream->number_of_bits++; // +1 for int sign
+
+    return number_of_bits + 1;
+}
+
+int NBN_MeasureStream_SerializeFloat(
+        NBN_MeasureStream *measure_stream, float *value, float min, float max, int precision)
+{
+    assert(min <= max);
+    assert(*value >= min && *value <= max);
+
+    unsigned int mult = pow(10, precision);
+    int i_min = min * mult;
+    int i_max = max * mult;
+    int i_val = *value * mult;
+
+    return NBN_MeasureStream_SerializeInt(measure_stream, &i_val, i_min, i_max);
+}
+
+int NBN_MeasureStream_SerializeBool(NBN_MeasureStream *measure_stream, bool *value)
+{
+    (void)value;
+
+    measure_stream->number_of_bits++;
+
+    return 1;
+}
+
+int NBN_MeasureStream_SerializePadding(NBN_MeasureStream *measure_stream)
+{
+    if (measure_stream->number_of_bits % 8 == 0)
+        return 0;
+
+    unsigned int padding = 8 - (measure_stream->number_of_bits % 8);
+
+    measure_stream->number_of_bits += padding;
+
+    return padding;
+}
+
+int NBN_MeasureStream_SerializeBytes(NBN_MeasureStream *measure_stream, uint8_t *bytes, unsigned int length)
+{
+    (void)bytes;
+
+    NBN_MeasureStream_SerializePadding(measure_stream);
+
+    unsigned int bits = length * 8;
+
+    measure_stream->number_of_bits += bits;
+
+    return bits;
+}
+
+void NBN_MeasureStream_Reset(NBN_MeasureStream *measure_stream)
+{
+    measure_stream->number_of_bits = 0;
+}
+
+#pragma endregion /* NBN_MeasureStream */
+
+#pragma endregion /* Serialization */
+
+#pragma region NBN_Packet
+
+static int Packet_SerializeHeader(NBN_PacketHeader *, NBN_Stream *);
+
+static void AES_init_ctx_iv(struct AES_ctx*, const uint8_t*, const uint8_t*);
+static void AES_CBC_encrypt_buffer(struct AES_ctx *,uint8_t*, uint32_t);
+static void AES_CBC_decrypt_buffer(struct AES_ctx*, uint8_t*, uint32_t);
+
+void poly1305_auth(uint8_t out[POLY1305_TAGLEN], const uint8_t *m, size_t inlen,
+                   const uint8_t key[POLY1305_KEYLEN])
+#ifndef _MSC_VER
+    __attribute__((__bounded__(__minbytes__, 1, POLY1305_TAGLEN)))
+    __attribute__((__bounded__(__buffer__, 2, 3)))
+    __attribute__((__bounded__(__minbytes__, 4, POLY1305_KEYLEN)))
+#endif
+;
+
+void NBN_Packet_InitWrite(
+        NBN_Packet *packet, uint32_t protocol_id, uint16_t seq_number, uint16_t ack, uint32_t ack_bits)
+{
+    packet->header.protocol_id = protocol_id;
+    packet->header.messages_count = 0;
+    packet->header.seq_number = seq_number;
+    packet->header.ack = ack;
+    packet->header.ack_bits = ack_bits;
+    packet->header.time = NBN_PACKET_NO_TIME;
+    packet->header.ack_delay = NBN_PACKET_NO_ACK_DELAY;
+    packet->header.input_ack = 0;
+
+    packet->mode = NBN_PACKET_MODE_WRITE;
+    packet->sender = NULL;
+    packet->is_reliable = false;
+    packet->size = 0;
+    packet->sealed = false;
+    packet->m_stream.number_of_bits = 0;
+
+    NBN_WriteStream_Init(&packet->w_stream, packet->buffer + NBN_PACKET_HEADER_SIZE, NBN_PACKET_MAX_USER_DATA_SIZE);
+    NBN_MeasureStream_Init(&packet->m_stream);
+}
+
+int NBN_Packet_InitRead(
+        NBN_Packet *packet, NBN_Connection *sender, uint8_t buffer[NBN_PACKET_MAX_SIZE], unsigned int size)
+{
+    packet->mode = NBN_PACKET_MODE_READ;
+    packet->sender = sender;
+    packet->recv_time = -1;
+    packet->size = size;
+    packet->sealed = false;
+
+    memcpy(packet->buffer, buffer, size);
+
+    NBN_ReadStream header_r_stream;
+
+    NBN_ReadStream_Init(&header_r_stream, packet->buffer, NBN_PACKET_HEADER_SIZE);
+
+    if (Packet_SerializeHeader(&packet->header, (NBN_Stream *)&header_r_stream) < 0)
+        return NBN_ERROR;
+
+    if (sender->endpoint->config.is_encryption_enabled && packet->header.is_encrypted)
+    {
+        if (!sender->can_decrypt)
+        {
+            NBN_LogError("Discard encrypted packet %d", packet->header.seq_number);
+
+            return NBN_ERROR;
+        }
+
+        NBN_Packet_ComputeIV(packet, packet->sender);
+
+        if (!NBN_Packet_CheckAuthentication(packet, packet->sender))
+        {
+            NBN_LogError("Authentication check failed for packet %d", packet->header.seq_number);
+
+            return NBN_ERROR;
+        }
+
+        NBN_Packet_Decrypt(packet, packet->sender);
+    }
+
+    NBN_ReadStream_Init(&packet->r_stream, packet->buffer + NBN_PACKET_HEADER_SIZE, packet->size);
+
+    return 0;
+}
+
+uint32_t NBN_Packet_ReadProtocolId(uint8_t buffer[NBN_PACKET_MAX_SIZE], unsigned int size)
+{
+    if (size < NBN_PACKET_HEADER_SIZE)
+        return 0;
+
+    NBN_ReadStream r_stream;
+
+    NBN_ReadStream_Init(&r_stream, buffer, NBN_PACKET_HEADER_SIZE);
+
+    NBN_PacketHeader header;
+
+    if (Packet_SerializeHeader(&header, (NBN_Stream *)&r_stream) < 0)
+        return 0;
+
+    return header.protocol_id;
+}
+
+int NBN_Packet_WriteMessage(NBN_Packet *packet, NBN_Message *message, NBN_MessageSerializer msg_serializer)
+{
+    if (packet->mode != NBN_PACKET_MODE_WRITE || packet->sealed)
+        return NBN_PACKET_WRITE_ERROR;
+
+    int current_number_of_bits = packet->m_stream.number_of_bits;
+
+    if (NBN_Message_Measure(message, &packet->m_stream, msg_serializer) < 0)
+        return NBN_PACKET_WRITE_ERROR;
+
+    if (
+            packet->header.messages_count >= NBN_MAX_MESSAGES_PER_PACKET ||
+            packet->m_stream.number_of_bits > NBN_PACKET_MAX_USER_DATA_SIZE * 8)
+    {
+        packet->m_stream.number_of_bits = current_number_of_bits;
+
+        return NBN_PACKET_WRITE_NO_SPACE;
+    }
+
+    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)&packet->w_stream) < 0)
+        return NBN_PACKET_WRITE_ERROR;
+
+    if (NBN_Message_SerializeData(message, (NBN_Stream *)&packet->w_stream, msg_serializer) < 0)
+        return NBN_PACKET_WRITE_ERROR;
+
+    packet->size = (packet->m_stream.number_of_bits - 1) / 8 + 1;
+    packet->header.messages_count++;
+
+    return NBN_PACKET_WRITE_OK;
+}
+
+int NBN_Packet_Seal(NBN_Packet *packet, NBN_Connection *connection)
+{
+    if (packet->mode != NBN_PACKET_MODE_WRITE)
+        return NBN_ERROR;
+
+    if (NBN_WriteStream_Flush(&packet->w_stream) < 0)
+        return NBN_ERROR;
+
+    bool is_encrypted = connection->endpoint->config.is_encryption_enabled && connection->can_encrypt;
+
+    packet->header.is_encrypted = is_encrypted;
+    packet->size += NBN_PACKET_HEADER_SIZE;
+
+    if (is_encrypted)
+    {
+        NBN_Packet_ComputeIV(packet, connection);
+        NBN_Packet_Encrypt(packet, connection);
+        NBN_Packet_Authenticate(packet, connection);
+    }
+
+    NBN_WriteStream header_w_stream;
+
+    NBN_WriteStream_Init(&header_w_stream, packet->buffer, NBN_PACKET_HEADER_SIZE);
+
+    if (Packet_SerializeHeader(&packet->header, (NBN_Stream *)&header_w_stream) < 0)
+        return NBN_ERROR;
+
+    if (NBN_WriteStream_Flush(&header_w_stream) < 0)
+        return NBN_ERROR;
+
+    packet->sealed = true;
+
+    return 0;
+}
+
+static int Packet_SerializeHeader(NBN_PacketHeader *header, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, &header->protocol_id, sizeof(header->protocol_id));
+    NBN_SerializeBytes(stream, &header->seq_number, sizeof(header->seq_number));
+    NBN_SerializeBytes(stream, &header->ack, sizeof(header->ack));
+    NBN_SerializeBytes(stream, &header->ack_bits, sizeof(header->ack_bits));
+    NBN_SerializeBytes(stream, &header->messages_count, sizeof(header->messages_count));
+    NBN_SerializeBytes(stream, &header->time, sizeof(header->time));
+    NBN_SerializeBytes(stream, &header->ack_delay, sizeof(header->ack_delay));
+    NBN_SerializeBytes(stream, &header->input_ack, sizeof(header->input_ack));
+    NBN_SerializeBytes(stream, &header->is_encrypted, sizeof(header->is_encrypted));
+
+    /* Do not serialize authentication tag when packet is not encrypted to save some bandwith */
+    if (header->is_encrypted)
+        NBN_SerializeBytes(stream, &header->auth_tag, sizeof(header->auth_tag));
+
+    return 0;
+}
+
+void NBN_Packet_Encrypt(NBN_Packet *packet, NBN_Connection *connection)
+{
+    struct AES_ctx aes_ctx;
+
+    AES_init_ctx_iv(&aes_ctx, connection->keys1.shared_key, packet->aes_iv);
+
+    unsigned int bytes_to_encrypt = packet->size - NBN_PACKET_HEADER_SIZE;
+    unsigned int added_bytes = (bytes_to_encrypt % AES_BLOCKLEN == 0) ? 0 : (AES_BLOCKLEN - bytes_to_encrypt % AES_BLOCKLEN);
+
+    bytes_to_encrypt += added_bytes;
+
+    assert(bytes_to_encrypt % AES_BLOCKLEN == 0);
+    assert(bytes_to_encrypt < NBN_PACKET_MAX_DATA_SIZE);
+
+    packet->size = NBN_PACKET_HEADER_SIZE + bytes_to_encrypt;
+
+    assert(packet->size < NBN_PACKET_MAX_SIZE); 
+
+    memset((packet->buffer + packet->size) - added_bytes, 0, added_bytes);
+
+    AES_CBC_encrypt_buffer(&aes_ctx, packet->buffer + NBN_PACKET_HEADER_SIZE, bytes_to_encrypt);
+
+    NBN_LogTrace("Encrypted packet %d (%d bytes)", packet->header.seq_number, packet->size);  
+}
+
+void NBN_Packet_Decrypt(NBN_Packet *packet, NBN_Connection *connection)
+{
+    struct AES_ctx aes_ctx;
+
+    AES_init_ctx_iv(&aes_ctx, connection->keys1.shared_key, packet->aes_iv);
+
+    unsigned int bytes_to_decrypt = packet->size - NBN_PACKET_HEADER_SIZE;
+
+    assert(bytes_to_decrypt % AES_BLOCKLEN == 0);
+    assert(bytes_to_decrypt < NBN_PACKET_MAX_DATA_SIZE);
+
+    AES_CBC_decrypt_buffer(&aes_ctx, packet->buffer + NBN_PACKET_HEADER_SIZE, bytes_to_decrypt);
+
+    NBN_LogTrace("Decrypted packet %d (%d bytes)", packet->header.seq_number, packet->size);
+}
+
+void NBN_Packet_ComputeIV(NBN_Packet *packet, NBN_Connection *connection)
+{
+    struct AES_ctx aes_ctx;
+
+    AES_init_ctx_iv(&aes_ctx, connection->keys2.shared_key, connection->aes_iv);
+
+    memset(packet->aes_iv, 0, AES_BLOCKLEN);
+    memcpy(packet->aes_iv, (uint8_t *)&packet->header.seq_number, sizeof(packet->header.seq_number));
+
+    AES_CBC_encrypt_buffer(&aes_ctx, packet->aes_iv, AES_BLOCKLEN);
+}
+
+void NBN_Packet_Authenticate(NBN_Packet *packet, NBN_Connection *connection)
+{ 
+    uint8_t poly1305_key[POLY1305_KEYLEN] = {0};
+
+    NBN_Packet_ComputePoly1305Key(packet, connection, poly1305_key);
+
+    memset(packet->header.auth_tag, 0, POLY1305_TAGLEN);
+
+    poly1305_auth(
+            packet->header.auth_tag,
+            packet->buffer + NBN_PACKET_HEADER_SIZE,
+            packet->size - NBN_PACKET_HEADER_SIZE,
+            poly1305_key);
+}
+
+bool NBN_Packet_CheckAuthentication(NBN_Packet *packet, NBN_Connection *connection)
+{
+    uint8_t poly1305_key[POLY1305_KEYLEN] = {0};
+    uint8_t auth_tag[POLY1305_TAGLEN] = {0};
+
+    NBN_Packet_ComputePoly1305Key(packet, connection, poly1305_key);
+
+    poly1305_auth(
+            auth_tag,
+            packet->buffer + NBN_PACKET_HEADER_SIZE,
+            packet->size - NBN_PACKET_HEADER_SIZE,
+            poly1305_key);
+
+    return memcmp(packet->header.auth_tag, auth_tag, POLY1305_TAGLEN) == 0;
+}
+
+void NBN_Packet_ComputePoly1305Key(NBN_Packet *packet, NBN_Connection *connection, uint8_t *poly1305_key)
+{
+    struct AES_ctx aes_ctx;
+
+    memcpy(poly1305_key, (uint8_t *)&packet->header.seq_number, sizeof(packet->header.seq_number));
+
+    AES_init_ctx_iv(&aes_ctx, connection->keys3.shared_key, connection->aes_iv);
+    AES_CBC_encrypt_buffer(&aes_ctx, poly1305_key, POLY1305_KEYLEN);
+}
+
+#pragma endregion /* NBN_Packet */
+
+#pragma region NBN_Message
+
+int NBN_Message_SerializeHeader(NBN_MessageHeader *message_header, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, &message_header->id, sizeof(message_header->id));
+    NBN_SerializeBytes(stream, &message_header->type, sizeof(message_header->type));
+    NBN_SerializeBytes(stream, &message_header->channel_id, sizeof(message_header->channel_id));
+
+    return 0;
+}
+
+int NBN_Message_Measure(NBN_Message *message, NBN_MeasureStream *m_stream, NBN_MessageSerializer msg_serializer)
+{
+    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)m_stream) < 0)
+        return NBN_ERROR;
+
+    if (NBN_Message_SerializeData(message, (NBN_Stream *)m_stream, msg_serializer) < 0)
+        return NBN_ERROR;
+
+    return m_stream->number_of_bits;
+}
+
+int NBN_Message_SerializeData(NBN_Message *message, NBN_Stream *stream, NBN_MessageSerializer msg_serializer)
+{
+    return msg_serializer(message->data, stream);
+}
+
+#pragma endregion /* NBN_Message */
+
+#pragma region NBN_MessageChunk
+
+NBN_MessageChunk *NBN_MessageChunk_Create(void)
+{
+    NBN_MessageChunk *chunk = (NBN_MessageChunk*)MemoryManager_Alloc(NBN_MEM_MESSAGE_CHUNK);
+
+    chunk->outgoing_msg = NULL;
+
+    return chunk;
+}
+
+void NBN_MessageChunk_Destroy(NBN_MessageChunk *chunk)
+{
+    MemoryManager_Dealloc(chunk, NBN_MEM_MESSAGE_CHUNK);
+}
+
+int NBN_MessageChunk_Serialize(NBN_MessageChunk *msg, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, &msg->id, 1);
+    NBN_SerializeBytes(stream, &msg->total, 1);
+    NBN_SerializeBytes(stream, msg->data, NBN_MESSAGE_CHUNK_SIZE);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_MessageChunk */
+
+#pragma region NBN_ClientClosedMessage
+
+NBN_ClientClosedMessage *NBN_ClientClosedMessage_Create(void)
+{
+    return (NBN_ClientClosedMessage*)NBN_Allocator(sizeof(NBN_ClientClosedMessage));
+}
+
+void NBN_ClientClosedMessage_Destroy(NBN_ClientClosedMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_ClientClosedMessage_Serialize(NBN_ClientClosedMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeInt(stream, msg->code, SHRT_MIN, SHRT_MAX);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_ClientClosedMessage */
+
+#pragma region NBN_ClientAcceptedMessage
+
+NBN_ClientAcceptedMessage *NBN_ClientAcceptedMessage_Create(void)
+{
+    return (NBN_ClientAcceptedMessage*)NBN_Allocator(sizeof(NBN_ClientAcceptedMessage));
+}
+
+void NBN_ClientAcceptedMessage_Destroy(NBN_ClientAcceptedMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_ClientAcceptedMessage_Serialize(NBN_ClientAcceptedMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, &msg->start_time, sizeof(msg->start_time));
+    NBN_SerializeBytes(stream, msg->data, NBN_ACCEPT_DATA_MAX_SIZE);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_ClientAcceptedMessage */
+
+#pragma region NBN_ByteArrayMessage
+
+NBN_ByteArrayMessage *NBN_ByteArrayMessage_Create(void)
+{
+    return (NBN_ByteArrayMessage*)MemoryManager_Alloc(NBN_MEM_BYTE_ARRAY_MESSAGE);
+}
+
+void NBN_ByteArrayMessage_Destroy(NBN_ByteArrayMessage *msg)
+{
+    MemoryManager_Dealloc(msg, NBN_MEM_BYTE_ARRAY_MESSAGE);
+}
+
+int NBN_ByteArrayMessage_Serialize(NBN_ByteArrayMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->length, 0, NBN_BYTE_ARRAY_MAX_SIZE);
+    NBN_SerializeBytes(stream, msg->bytes, msg->length);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_ByteArrayMessage */
+
+#pragma region NBN_PublicCryptoInfoMessage
+
+NBN_PublicCryptoInfoMessage *NBN_PublicCryptoInfoMessage_Create(void)
+{
+    return (NBN_PublicCryptoInfoMessage*)NBN_Allocator(sizeof(NBN_PublicCryptoInfoMessage));
+}
+
+void NBN_PublicCryptoInfoMessage_Destroy(NBN_PublicCryptoInfoMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_PublicCryptoInfoMessage_Serialize(NBN_PublicCryptoInfoMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, msg->pub_key1, ECC_PUB_KEY_SIZE);
+    NBN_SerializeBytes(stream, msg->pub_key2, ECC_PUB_KEY_SIZE);
+    NBN_SerializeBytes(stream, msg->pub_key3, ECC_PUB_KEY_SIZE);
+    NBN_SerializeBytes(stream, msg->aes_iv, AES_BLOCKLEN);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_PublicCryptoInfoMessage */
+
+#pragma region NBN_StartEncryptMessage
+
+void *NBN_StartEncryptMessage_Create(void)
+{
+    return NULL;
+}
+
+void NBN_StartEncryptMessage_Destroy(void *msg)
+{
+    (void)msg;
+}
+
+int NBN_StartEncryptMessage_Serialize(void *msg, NBN_Stream *stream)
+{
+    (void)msg;
+    (void)stream;
+
+    return 0;
+}
+
+#pragma endregion /* NBN_StartEncryptMessage */
+
+#pragma region NBN_DisconnectMessage
+
+void *NBN_DisconnectionMessage_Create(void)
+{
+    return NULL;
+}
+
+void NBN_DisconnectionMessage_Destroy(void *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_DisconnectionMessage_Serialize(void *msg, NBN_Stream *stream)
+{
+    (void)msg;
+    (void)stream;
+
+    return 0;
+}
+
+#pragma endregion /* NBN_DisconnectMessage */
+
+#pragma region NBN_ConnectionRequestMessage
+
+NBN_ConnectionRequestMessage *NBN_ConnectionRequestMessage_Create(void)
+{
+    return (NBN_ConnectionRequestMessage *)NBN_Allocator(sizeof(NBN_ConnectionRequestMessage));
+}
+
+void NBN_ConnectionRequestMessage_Destroy(NBN_ConnectionRequestMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_ConnectionRequestMessage_Serialize(NBN_ConnectionRequestMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, msg->data, NBN_CONNECTION_DATA_MAX_SIZE);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_ConnectionRequestMessage */
+
+#pragma region NBN_FECParityMessage
+
+NBN_FECParityMessage *NBN_FECParityMessage_Create(void)
+{
+    return (NBN_FECParityMessage *)NBN_Allocator(sizeof(NBN_FECParityMessage));
+}
+
+void NBN_FECParityMessage_Destroy(NBN_FECParityMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_FECParityMessage_Serialize(NBN_FECParityMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, &msg->first_seq_number, sizeof(msg->first_seq_number));
+    NBN_SerializeBytes(stream, &msg->packet_mask, sizeof(msg->packet_mask));
+    NBN_SerializeBytes(stream, &msg->length, sizeof(msg->length));
+    NBN_SerializeBytes(stream, &msg->ack, sizeof(msg->ack));
+    NBN_SerializeBytes(stream, &msg->ack_bits, sizeof(msg->ack_bits));
+    NBN_SerializeBytes(stream, &msg->messages_count, sizeof(msg->messages_count));
+    NBN_SerializeUInt(stream, msg->data_length, 1, NBN_FEC_MAX_PAYLOAD_SIZE);
+    NBN_SerializeBytes(stream, msg->data, msg->data_length);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_FECParityMessage */
+
+#pragma region NBN_ReplicationMessage
+
+NBN_ReplicatedEntityType __replicated_entity_types[NBN_REPLICATION_MAX_ENTITY_TYPES];
+
+static unsigned int ReplicationMessage_GetFieldSize(NBN_ReplicationField *);
+static unsigned int ReplicationMessage_GetRecordDataSize(NBN_ReplicatedEntityType *, unsigned int);
+static int ReplicationMessage_SerializeField(NBN_ReplicationField *, uint8_t *, NBN_Stream *);
+static int ReplicationMessage_SerializeRecord(NBN_ReplicationMessage *, NBN_ReplicationRecord *, NBN_Stream *);
+
+int NBN_Replication_RegisterEntityType(uint8_t type_id, const NBN_ReplicationField *fields, unsigned int field_count)
+{
+    if (type_id >= NBN_REPLICATION_MAX_ENTITY_TYPES)
+    {
+        NBN_LogError("Invalid replicated entity type: %d", type_id);
+
+        return NBN_ERROR;
+    }
+
+    if (field_count == 0 || field_count > NBN_REPLICATION_MAX_FIELDS)
+    {
+        NBN_LogError("Invalid number of fields for replicated entity type %d: %d", type_id, field_count);
+
+        return NBN_ERROR;
+    }
+
+    NBN_ReplicatedEntityType *entity_type = &__replicated_entity_types[type_id];
+
+    memcpy(entity_type->fields, fields, sizeof(NBN_ReplicationField) * field_count);
+
+    entity_type->field_count = field_count;
+    entity_type->is_registered = true;
+
+    if (ReplicationMessage_GetRecordDataSize(entity_type, 0xFFFFFFFF) > NBN_REPLICATION_MESSAGE_DATA_SIZE)
+    {
+        NBN_LogError("Replicated entity type %d is too big", type_id);
+
+        entity_type->is_registered = false;
+
+        return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+NBN_ReplicationMessage *NBN_ReplicationMessage_Create(void)
+{
+    NBN_ReplicationMessage *msg = (NBN_ReplicationMessage *)NBN_Allocator(sizeof(NBN_ReplicationMessage));
+
+    msg->sequence = 0;
+    msg->record_count = 0;
+    msg->data_length = 0;
+
+    return msg;
+}
+
+void NBN_ReplicationMessage_Destroy(NBN_ReplicationMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_ReplicationMessage_Serialize(NBN_ReplicationMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeBytes(stream, &msg->sequence, sizeof(msg->sequence));
+    NBN_SerializeUInt(stream, msg->record_count, 0, NBN_REPLICATION_MAX_RECORDS);
+
+    if (stream->type == NBN_STREAM_READ)
+        msg->data_length = 0;
+
+    for (unsigned int i = 0; i < msg->record_count; i++)
+    {
+        if (ReplicationMessage_SerializeRecord(msg, &msg->records[i], stream) < 0)
+            return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+/* Number of bytes taken by a field's value in a message's data buffer (values are kept aligned) */
+static unsigned int ReplicationMessage_GetFieldSize(NBN_ReplicationField *field)
+{
+    unsigned int size;
+
+    switch (field->type)
+    {
+        case NBN_REPLICATION_FIELD_UINT:
+            size = sizeof(unsigned int);
+            break;
+
+        case NBN_REPLICATION_FIELD_INT:
+            size = sizeof(int);
+            break;
+
+        case NBN_REPLICATION_FIELD_FLOAT:
+            size = sizeof(float);
+            break;
+
+        case NBN_REPLICATION_FIELD_BOOL:
+            size = sizeof(bool);
+            break;
+
+        default:
+            size = field->length;
+            break;
+    }
+
+    return (size + sizeof(unsigned int) - 1) & ~(sizeof(unsigned int) - 1);
+}
+
+static unsigned int ReplicationMessage_GetRecordDataSize(NBN_ReplicatedEntityType *entity_type, unsigned int field_mask)
+{
+    unsigned int size = 0;
+
+    for (unsigned int i = 0; i < entity_type->field_count; i++)
+    {
+        if (field_mask & (1u << i))
+            size += ReplicationMessage_GetFieldSize(&entity_type->fields[i]);
+    }
+
+    return size;
+}
+
+static int ReplicationMessage_SerializeField(NBN_ReplicationField *field, uint8_t *value, NBN_Stream *stream)
+{
+    switch (field->type)
+    {
+        case NBN_REPLICATION_FIELD_UINT:
+            NBN_SerializeUInt(stream, *(unsigned int *)value, (unsigned int)field->min, (unsigned int)field->max);
+            break;
+
+        case NBN_REPLICATION_FIELD_INT:
+            NBN_SerializeInt(stream, *(int *)value, (int)field->min, (int)field->max);
+            break;
+
+        case NBN_REPLICATION_FIELD_FLOAT:
+            NBN_SerializeFloat(stream, *(float *)value, (float)field->min, (float)field->max, field->precision);
+            break;
+
+        case NBN_REPLICATION_FIELD_BOOL:
+            NBN_SerializeBool(stream, *(bool *)value);
+            break;
+
+        case NBN_REPLICATION_FIELD_BYTES:
+            NBN_SerializeBytes(stream, value, field->length);
+            break;
+
+        default:
+            return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+static int ReplicationMessage_SerializeRecord(NBN_ReplicationMessage *msg, NBN_ReplicationRecord *record, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, record->entity_id, 0, NBN_REPLICATION_MAX_ENTITIES - 1);
+    NBN_SerializeUInt(stream, record->flags, 0, NBN_REPLICATION_RECORD_CREATE | NBN_REPLICATION_RECORD_DESTROY);
+
+    /* identifies the incarnation of the entity that is created or destroyed */
+    if (record->flags)
+        NBN_SerializeBytes(stream, &record->spawn_sequence, sizeof(record->spawn_sequence));
+
+    if (record->flags & NBN_REPLICATION_RECORD_DESTROY)
+        return 0;
+
+    NBN_SerializeUInt(stream, record->entity_type, 0, NBN_REPLICATION_MAX_ENTITY_TYPES - 1);
+
+    NBN_ReplicatedEntityType *entity_type = &__replicated_entity_types[record->entity_type];
+
+    if (!entity_type->is_registered)
+    {
+        NBN_LogError("Replicated entity type %d is not registered", record->entity_type);
+
+        return NBN_ERROR;
+    }
+
+    unsigned int max_field_mask = entity_type->field_count == 32 ? 0xFFFFFFFF : (1u << entity_type->field_count) - 1;
+
+    NBN_SerializeUInt(stream, record->field_mask, 0, max_field_mask);
+
+    if (stream->type == NBN_STREAM_READ)
+    {
+        unsigned int data_size = ReplicationMessage_GetRecordDataSize(entity_type, record->field_mask);
+
+        if (msg->data_length + data_size > NBN_REPLICATION_MESSAGE_DATA_SIZE)
+            return NBN_ERROR;
+
+        record->data_offset = msg->data_length;
+        msg->data_length += data_size;
+    }
+
+    uint8_t *value = msg->data + record->data_offset;
+
+    for (unsigned int i = 0; i < entity_type->field_count; i++)
+    {
+        if (record->field_mask & (1u << i))
+        {
+            NBN_ReplicationField *field = &entity_type->fields[i];
+
+            if (ReplicationMessage_SerializeField(field, value, stream) < 0)
+                return NBN_ERROR;
+
+            value += ReplicationMessage_GetFieldSize(field);
+        }
+    }
+
+    return 0;
+}
+
+#pragma endregion /* NBN_ReplicationMessage */
+
+#pragma region NBN_SnapshotMessage
+
+NBN_SnapshotEntityType __snapshot_entity_type;
+
+void NBN_Snapshot_RegisterEntitySerializer(NBN_SnapshotEntitySerializer serializer, size_t size)
+{
+    __snapshot_entity_type.serializer = serializer;
+    __snapshot_entity_type.size = size;
+}
+
+void *NBN_SnapshotMessage_GetEntity(NBN_SnapshotMessage *msg, unsigned int index)
+{
+    assert(index < msg->entity_count);
+
+    return msg->states + index * __snapshot_entity_type.size;
+}
+
+NBN_SnapshotMessage *NBN_SnapshotMessage_Create(void)
+{
+    NBN_SnapshotMessage *msg = (NBN_SnapshotMessage *)NBN_Allocator(sizeof(NBN_SnapshotMessage));
+
+    msg->tick = 0;
+    msg->entity_count = 0;
+    msg->states = NULL;
+
+    return msg;
+}
+
+void NBN_SnapshotMessage_Destroy(NBN_SnapshotMessage *msg)
+{
+    NBN_Deallocator(msg->states);
+    NBN_Deallocator(msg);
+}
+
+int NBN_SnapshotMessage_Serialize(NBN_SnapshotMessage *msg, NBN_Stream *stream)
+{
+    if (__snapshot_entity_type.serializer == NULL)
+    {
+        NBN_LogError("No snapshot entity serializer is registered");
+
+        return NBN_ERROR;
+    }
+
+    NBN_SerializeBytes(stream, &msg->tick, sizeof(msg->tick));
+    NBN_SerializeUInt(stream, msg->entity_count, 0, NBN_SNAPSHOT_MAX_ENTITIES);
+
+    /* the states are allocated by the snapshot builder on the sending side */
+    if (stream->type == NBN_STREAM_READ && msg->entity_count > 0)
+    {
+        size_t states_size = msg->entity_count * __snapshot_entity_type.size;
+
+        msg->states = (uint8_t *)NBN_Allocator(states_size);
+
+        memset(msg->states, 0, states_size);
+    }
+
+    for (unsigned int i = 0; i < msg->entity_count; i++)
+    {
+        NBN_SerializeUInt(stream, msg->entity_ids[i], 0, NBN_SNAPSHOT_MAX_ENTITY_IDS - 1);
+
+        if (__snapshot_entity_type.serializer(NBN_SnapshotMessage_GetEntity(msg, i), stream) < 0)
+            return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+#pragma endregion /* NBN_SnapshotMessage */
+
+#pragma region NBN_InputMessage
+
+NBN_InputType __input_type;
+
+void NBN_Input_RegisterSerializer(NBN_InputSerializer serializer, size_t size)
+{
+    __input_type.serializer = serializer;
+    __input_type.size = size;
+}
+
+NBN_InputMessage *NBN_InputMessage_Create(void)
+{
+    NBN_InputMessage *msg = (NBN_InputMessage *)NBN_Allocator(sizeof(NBN_InputMessage));
+
+    msg->first_frame = 0;
+    msg->frame_count = 0;
+    msg->inputs = NULL;
+
+    return msg;
+}
+
+void NBN_InputMessage_Destroy(NBN_InputMessage *msg)
+{
+    NBN_Deallocator(msg->inputs);
+    NBN_Deallocator(msg);
+}
+
+int NBN_InputMessage_Serialize(NBN_InputMessage *msg, NBN_Stream *stream)
+{
+    if (__input_type.serializer == NULL)
+    {
+        NBN_LogError("No input serializer is registered");
+
+        return NBN_ERROR;
+    }
+
+    NBN_SerializeBytes(stream, &msg->first_frame, sizeof(msg->first_frame));
+    NBN_SerializeUInt(stream, msg->frame_count, 1, NBN_INPUT_MAX_FRAMES);
+
+    /* the inputs are allocated by the input sender on the sending side */
+    if (stream->type == NBN_STREAM_READ)
+    {
+        size_t inputs_size = msg->frame_count * __input_type.size;
+
+        msg->inputs = (uint8_t *)NBN_Allocator(inputs_size);
+
+        memset(msg->inputs, 0, inputs_size);
+    }
+
+    for (unsigned int i = 0; i < msg->frame_count; i++)
+    {
+        if (__input_type.serializer(msg->inputs + i * __input_type.size, stream) < 0)
+            return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+#pragma endregion /* NBN_InputMessage */
+
+#pragma region NBN_AckRangesMessage
+
+NBN_AckRangesMessage *NBN_AckRangesMessage_Create(void)
+{
+    return (NBN_AckRangesMessage *)NBN_Allocator(sizeof(NBN_AckRangesMessage));
+}
+
+void NBN_AckRangesMessage_Destroy(NBN_AckRangesMessage *msg)
+{
+    NBN_Deallocator(msg);
+}
+
+int NBN_AckRangesMessage_Serialize(NBN_AckRangesMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->run_count, 1, NBN_ACK_RANGES_MAX_RUNS);
+
+    for (unsigned int i = 0; i < msg->run_count; i++)
+        NBN_SerializeUInt(stream, msg->runs[i], 0, NBN_PACKET_RECV_WINDOW_SIZE - NBN_PACKET_HEADER_ACK_COUNT);
+
+    return 0;
+}
+
+#pragma endregion /* NBN_AckRangesMessage */
+
+#pragma region Hooks
+
+#ifdef NBN_DISABLE_HOOKS
+#define NBN_HasHook(endpoint, type) false
+#else
+#define NBN_HasHook(endpoint, type) ((endpoint)->hooks[type].callback != NULL)
+#endif
+
+#define NBN_EmitHook(endpoint, type, connection, data) \
+    do { \
+        if (NBN_HasHook(endpoint, type)) \
+            (endpoint)->hooks[type].callback(type, connection, data, (endpoint)->hooks[type].user_data); \
+    } while (0)
+
+#pragma endregion /* Hooks */
+
+#pragma region NBN_Connection
+
+static uint32_t Connection_BuildPacketAckBits(NBN_Connection *);
+static int Connection_DecodePacketHeader(NBN_Connection *, NBN_Packet *);
+static int Connection_AckPacket(NBN_Connection *, uint16_t);
+static int Connection_AckPacketMessages(NBN_Connection *, NBN_PacketEntry *);
+static int Connection_OnPacketSent(NBN_Connection *, NBN_PacketEntry *, int);
+static void Connection_SetMessagesSentReliably(NBN_Connection *, NBN_PacketEntry *, bool);
+static void Replicator_OnMessageAcked(NBN_Replicator *, NBN_Connection *, uint16_t);
+static void Connection_InitOutgoingPacket(NBN_Connection *, NBN_Packet *, NBN_PacketEntry **);
+static NBN_PacketEntry *Connection_InsertOutgoingPacketEntry(NBN_Connection *, uint16_t);
+static bool Connection_InsertReceivedPacketEntry(NBN_Connection *, uint16_t);
+static void Connection_ShiftReceivedPacketWindow(NBN_Connection *, unsigned int);
+static unsigned int Connection_GetReceivedPacketRunLength(NBN_Connection *, unsigned int, unsigned int, bool);
+static void Connection_UpdateDueAck(NBN_Connection *, uint16_t);
+static int Connection_WriteAckRanges(NBN_Connection *, NBN_Packet *, NBN_PacketEntry *);
+static int Connection_ReadAckRanges(NBN_Connection *, uint16_t, NBN_AckRangesMessage *);
+static NBN_PacketEntry *Connection_FindSendPacketEntry(NBN_Connection *, uint16_t);
+static bool Connection_IsPacketReceived(NBN_Connection *, uint16_t);
+static int Connection_SendPacket(NBN_Connection *, NBN_Packet *, NBN_PacketEntry *);
+static int Connection_TransmitPacket(NBN_Connection *, NBN_Packet *, NBN_PacketEntry *);
+static bool Connection_ShouldSendEmptyPacket(NBN_Connection *);
+static void Connection_CancelOutgoingPacket(NBN_Connection *, NBN_Packet *);
+static void Connection_UpdateFECEncoder(NBN_Connection *);
+static int Connection_CreateFECDecoder(NBN_Connection *);
+static void Connection_AddPacketToFECGroup(NBN_Connection *, NBN_Packet *);
+static bool Connection_IsFECGroupComplete(NBN_Connection *);
+static int Connection_SendFECParityPacket(NBN_Connection *);
+static void Connection_StoreFECPacket(NBN_Connection *, NBN_Packet *);
+static int Connection_RecoverFECPacket(NBN_Connection *, NBN_FECParityMessage *);
+static int Connection_ReadNextMessageFromStream(NBN_Connection *, NBN_ReadStream *, NBN_Message *);
+static int Connection_ReadNextMessageFromPacket(NBN_Connection *, NBN_Packet *, NBN_Message *);
+static int Connection_RecycleMessage(NBN_Connection *, NBN_Message *);
+static void Connection_UpdateAveragePing(NBN_Connection *, double);
+static void Connection_UpdateAveragePacketLoss(NBN_Connection *, uint16_t);
+static void Connection_UpdateAverageUploadBandwidth(NBN_Connection *, float);
+static void Connection_UpdateAverageDownloadBandwidth(NBN_Connection *);
+static void Connection_AddClockSample(NBN_Connection *, NBN_Packet *, double);
+static double Connection_UnwrapRemoteTime(NBN_Connection *, uint32_t);
+static void Connection_UpdateClockEstimate(NBN_ClockSync *);
+static void InputSender_Destroy(NBN_InputSender *);
+static void InputSender_OnAck(NBN_InputSender *, uint16_t);
+static void InputReceiver_Destroy(NBN_InputReceiver *);
+static NBN_InputSender *InputSender_Create(void);
+static NBN_InputMessage *InputSender_AddInput(NBN_InputSender *, void *, uint32_t *);
+static NBN_InputReceiver *InputReceiver_Create(void);
+static void InputReceiver_AddMessage(NBN_InputReceiver *, NBN_InputMessage *);
+static int InputReceiver_ReadInput(NBN_InputReceiver *, void *, uint32_t *);
+
+/* Encryption related functions */
+
+static int Connection_GenerateKeys(NBN_Connection *);
+static int Connection_GenerateKeySet(NBN_ConnectionKeySet *, CSPRNG *);
+static int Connection_BuildSharedKey(NBN_ConnectionKeySet *, uint8_t *);
+static void Connection_StartEncryption(NBN_Connection *);
+
+static int ecdh_generate_keys(uint8_t*, uint8_t*);
+static int ecdh_shared_secret(const uint8_t*, const uint8_t*, uint8_t*);
+
+static CSPRNG csprng_create();
+static CSPRNG csprng_destroy(CSPRNG object);
+static int csprng_get(CSPRNG, void*, unsigned long long);
+
+NBN_Connection *NBN_Connection_Create(uint32_t id, uint32_t protocol_id, NBN_Endpoint *endpoint, void *driver_data)
+{
+    NBN_Connection *connection = (NBN_Connection*)MemoryManager_Alloc(NBN_MEM_CONNECTION);
+
+    if (connection == NULL)
+    {
+        NBN_LogError("Failed to allocate connection %d", id);
+
+        return NULL;
+    }
+
+    connection->id = id;
+    connection->protocol_id = protocol_id;
+    connection->user_data = NULL;
+    connection->endpoint = endpoint;
+    connection->last_recv_packet_time = 0;
+    connection->next_packet_seq_number = 1;
+    connection->last_received_packet_seq_number = 0;
+    connection->last_received_ack = 0;
+    connection->received_ack_window = 0;
+    connection->delivered_ack = 0;
+    connection->due_ack = 0;
+    connection->next_due_packet_seq_number = 1;
+    connection->last_flush_time = 0;
+    connection->last_send_packet_time = 0;
+    connection->ack_pending_time = 0;
+    connection->is_ack_pending = false;
+    connection->send_interval = 1;
+    connection->slot = 0;
+    connection->send_countdown = 0;
+    connection->last_read_packets_time = 0;
+    connection->downloaded_bytes = 0;
+    connection->time = 0;
+    connection->is_accepted = false;
+    connection->is_stale = false;
+    connection->is_closed = false;
+    connection->fec_encoder = NULL;
+    connection->fec_decoder = NULL;
+    connection->last_received_packet_clock_time = -1;
+    connection->start_time = NBN_Endpoint_GetTime(endpoint);
+    connection->remote_start_time = 0;
+    connection->last_remote_timestamp = 0;
+    connection->last_remote_time = 0;
+    connection->input_sender = NULL;
+    connection->input_receiver = NULL;
+
+    memset(&connection->clock_sync, 0, sizeof(NBN_ClockSync));
+    memset(connection->packet_recv_window, 0, sizeof(connection->packet_recv_window));
+
+    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+        connection->channels[i] = NULL;
+
+    unsigned int max_packet_entries = endpoint->config.max_packet_entries;
+
+    connection->max_packet_entries = max_packet_entries;
+    connection->packet_send_seq_buffer = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * max_packet_entries);
+    connection->packet_send_buffer = (NBN_PacketEntry *)NBN_Allocator(sizeof(NBN_PacketEntry) * max_packet_entries);
+
+    if (connection->packet_send_seq_buffer == NULL || connection->packet_send_buffer == NULL)
+    {
+        NBN_LogError("Failed to allocate the packet buffers of connection %d", id);
+
+        NBN_Connection_Destroy(connection);
+
+        return NULL;
+    }
+
+    for (unsigned int i = 0; i < max_packet_entries; i++)
+        connection->packet_send_seq_buffer[i] = 0xFFFFFFFF;
+
+    NBN_ConnectionStats stats = { 0 };
+
+    connection->stats = stats;
+    connection->driver_data = driver_data;
+    connection->can_decrypt = false;
+    connection->can_encrypt = false;
+
+    if (endpoint->config.is_encryption_enabled)
+    {
+        if (Connection_GenerateKeys(connection)  < 0)
+        {
+            NBN_LogError("Failed to generate keys");
+
+            NBN_Connection_Destroy(connection);
+
+            return NULL;
+        }
+    }
+
+    /* FEC state is created with the connection so that the first packets sent and received are protected */
+    Connection_UpdateFECEncoder(connection);
+
+    memset(connection->accept_data, 0, NBN_ACCEPT_DATA_MAX_SIZE);
+
+    if (connection->endpoint->is_server)
+        NBN_WriteStream_Init(
+            &connection->accept_data_w_stream, (uint8_t*)connection->accept_data, NBN_ACCEPT_DATA_MAX_SIZE);
+    else
+        NBN_ReadStream_Init(
+            &connection->accept_data_r_stream, (uint8_t *)connection->accept_data, NBN_ACCEPT_DATA_MAX_SIZE);
+
+    return connection;
+}
+
+void NBN_Connection_Destroy(NBN_Connection *connection)
+{
+    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+    {
+        if (connection->channels[i])
+        {
+            NBN_Deallocator(connection->channels[i]->read_chunk_buffer);
+            NBN_Deallocator(connection->channels[i]);
+        }
+    }
+
+    if (connection->fec_encoder)
+        NBN_Deallocator(connection->fec_encoder);
+
+    if (connection->fec_decoder)
+        NBN_Deallocator(connection->fec_decoder);
+
+    if (connection->input_sender)
+        InputSender_Destroy(connection->input_sender);
+
+    if (connection->input_receiver)
+        InputReceiver_Destroy(connection->input_receiver);
+
+    if (connection->packet_send_seq_buffer)
+        NBN_Deallocator(connection->packet_send_seq_buffer);
+
+    if (connection->packet_send_buffer)
+        NBN_Deallocator(connection->packet_send_buffer);
+
+    MemoryManager_Dealloc(connection, NBN_MEM_CONNECTION);
+}
+
+int NBN_Connection_ProcessReceivedPacket(NBN_Connection *connection, NBN_Packet *packet)
+{
+    if (Connection_DecodePacketHeader(connection, packet) < 0)
+    {
+        NBN_LogError("Failed to decode packet %d header", packet->header.seq_number);
+
+        return NBN_ERROR;
+    }
+
+    Connection_UpdateAveragePacketLoss(connection, packet->header.ack);
+
+    bool is_most_recent = SEQUENCE_NUMBER_GT(packet->header.seq_number, connection->last_received_packet_seq_number);
+
+    if (!Connection_InsertReceivedPacketEntry(connection, packet->header.seq_number))
+        return 0;
+
+    NBN_EmitHook(connection->endpoint, NBN_HOOK_PACKET_RECEIVED, connection, packet);
+
+    if (is_most_recent)
+    {
+        /* packets may have waited in the socket for a while, prefer the reception time given by the driver */
+        double clock_time = packet->recv_time >= 0 ?
+            packet->recv_time - connection->endpoint->start_time : NBN_Endpoint_GetTime(connection->endpoint);
+
+        connection->last_received_packet_clock_time = clock_time;
+
+        Connection_AddClockSample(connection, packet, clock_time);
+    }
+
+    if (connection->input_sender)
+        InputSender_OnAck(connection->input_sender, packet->header.input_ack);
+
+    if (connection->fec_decoder)
+        Connection_StoreFECPacket(connection, packet);
+
+    for (int i = 0; i < packet->header.messages_count; i++)
+    {
+        NBN_Message message;
+
+        message.outgoing_msg = NULL;
+
+        if (Connection_ReadNextMessageFromPacket(connection, packet, &message) < 0)
+        {
+            NBN_LogError("Failed to read message from packet");
+
+            return NBN_ERROR;
+        }
+
+        if (message.header.type == NBN_FEC_PARITY_MESSAGE_TYPE)
+        {
+            int ret = Connection_RecoverFECPacket(connection, (NBN_FECParityMessage *)message.data);
+
+            Connection_RecycleMessage(connection, &message);
+
+            if (ret < 0)
+                return NBN_ERROR;
+
+            continue;
+        }
+
+        if (message.header.type == NBN_ACK_RANGES_MESSAGE_TYPE)
+        {
+            int ret = Connection_ReadAckRanges(connection, packet->header.ack, (NBN_AckRangesMessage *)message.data);
+
+            Connection_RecycleMessage(connection, &message);
+
+            if (ret < 0)
+                return NBN_ERROR;
+
+            continue;
+        }
+
+        /*
+         * Only packets carrying channel messages need to be acked, acking packets that only carry ack ranges
+         * or parity data would just have peers bounce acks back and forth
+         */
+        if (!connection->is_ack_pending)
+        {
+            connection->is_ack_pending = true;
+            connection->ack_pending_time = connection->time;
+        }
+
+        NBN_Channel *channel = connection->channels[message.header.channel_id];
+
+        if (channel->AddReceivedMessage(channel, &message))
+        {
+            NBN_LogTrace("Received message %d on channel %d : added to recv queue", message.header.id, channel->id);
+
+            NBN_EmitHook(connection->endpoint, NBN_HOOK_MESSAGE_ADDED_TO_RECV_QUEUE, connection, &message);
+        }
+        else
+        {
+            NBN_LogTrace("Received message %d : discarded", message.header.id);
+
+            Connection_RecycleMessage(connection, &message);
+        }
+    }
+
+    return 0;
+}
+
+int NBN_Connection_EnqueueOutgoingMessage(NBN_Connection *connection, NBN_Channel *channel, NBN_Message *message)
+{
+    assert(!connection->is_closed || message->header.type == NBN_CLIENT_CLOSED_MESSAGE_TYPE);
+    assert(!connection->is_stale);
+
+    NBN_LogTrace("Enqueue message of type %d on channel %d", message->header.type, channel->id);
+
+    if (!channel->AddOutgoingMessage(channel, message))
+    {
+        NBN_LogError("Failed to enqueue outgoing message of type %d on channel %d",
+                message->header.type, message->header.channel_id);
+
+        return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+int NBN_Connection_FlushSendQueue(NBN_Connection *connection)
+{
+    NBN_LogTrace("Flushing the send queue");
+
+    NBN_Packet packet;
+    NBN_PacketEntry *packet_entry;
+    unsigned int sent_packet_count = 0;
+    unsigned int sent_bytes = 0;
+
+    Connection_UpdateFECEncoder(connection);
+    Connection_InitOutgoingPacket(connection, &packet, &packet_entry);
+
+    if (Connection_WriteAckRanges(connection, &packet, packet_entry) < 0)
+    {
+        NBN_LogError("Failed to write ack ranges to packet %d", packet.header.seq_number);
+
+        return NBN_ERROR;
+    }
+
+    for (unsigned int i = 0; i < NBN_MAX_CHANNELS; i++)
+    {
+        NBN_Channel *channel = connection->channels[i];
+
+        if (channel == NULL)
+            continue;
+
+        NBN_LogTrace("Flushing channel %d (message count: %d)", channel->id, channel->outgoing_message_count);
+
+        NBN_Message *message;
+
+        while (
+                sent_packet_count < connection->endpoint->config.max_sent_packet_count &&
+                (message = channel->GetNextOutgoingMessage(channel)) != NULL
+              )
+        {
+            bool message_sent = false;
+            NBN_MessageSerializer msg_serializer = connection->endpoint->message_serializers[message->header.type];
+
+            assert(msg_serializer);
+
+            int ret = NBN_Packet_WriteMessage(&packet, message, msg_serializer);
+
+            if (ret == NBN_PACKET_WRITE_OK)
+            {
+                message_sent = true;
+            }
+            else if (ret == NBN_PACKET_WRITE_NO_SPACE)
+            {
+                if (Connection_SendPacket(connection, &packet, packet_entry) < 0)
+                {
+                    NBN_LogError("Failed to send packet %d", packet.header.seq_number);
+
+                    return NBN_ERROR;
+                }
+
+                sent_packet_count++;
+                sent_bytes += packet.size;
+
+                Connection_InitOutgoingPacket(connection, &packet, &packet_entry);
+
+                int ret = NBN_Packet_WriteMessage(&packet, message, msg_serializer);
+
+                if (ret != NBN_PACKET_WRITE_OK)
+                {
+                    NBN_LogError("Failed to send packet %d", packet.header.seq_number);
+
+                    return NBN_ERROR;
+                }
+
+                message_sent = true;
+            }
+            else if (ret == NBN_PACKET_WRITE_ERROR)
+            {
+                NBN_LogError("Failed to write message %d of type %d to packet %d",
+                        message->header.id, message->header.type, packet.header.seq_number);
+
+                return NBN_ERROR;
+            }
+
+            if (message_sent)
+            {
+                NBN_LogTrace("Message %d added to packet %d", message->header.id, packet.header.seq_number);
+
+                if (NBN_HasHook(connection->endpoint, NBN_HOOK_MESSAGE_RESENT) &&
+                        channel->type == NBN_CHANNEL_TYPE_RELIABLE_ORDERED &&
+                        channel->outgoing_message_slot_buffer[message->header.id % channel->buffer_size].last_send_time >= 0)
+                    NBN_EmitHook(connection->endpoint, NBN_HOOK_MESSAGE_RESENT, connection, message);
+
+                NBN_Channel_UpdateMessageLastSendTime(channel, message, connection->time);
+
+                NBN_MessageEntry e = { message->header.id, channel->id };
+
+                /* a packet is reliable as long as all its messages are from reliable channels */
+                packet.is_reliable = (packet_entry->messages_count == 0 || packet.is_reliable) &&
+                    channel->type == NBN_CHANNEL_TYPE_RELIABLE_ORDERED;
+
+                packet_entry->messages[packet_entry->messages_count++] = e;
+
+                if (channel->OnOutgoingMessageSent && channel->OnOutgoingMessageSent(channel, message) < 0)
+                    return NBN_ERROR;
+            }
+        }
+    }
+
+    /* ack ranges alone are not worth a packet, they go along with messages, acks or keep alives */
+    if (packet_entry->messages_count > 0 || Connection_ShouldSendEmptyPacket(connection))
+    {
+        if (Connection_SendPacket(connection, &packet, packet_entry) < 0)
+        {
+            NBN_LogError("Failed to send packet %d", packet.header.seq_number);
+
+            return NBN_ERROR;
+        }
+
+        sent_bytes += packet.size;
+        sent_packet_count++;
+    }
+    else
+    {
+        Connection_CancelOutgoingPacket(connection, &packet);
+    }
+
+    if (Connection_IsFECGroupComplete(connection))
+    {
+        int ret = Connection_SendFECParityPacket(connection);
+
+        if (ret < 0)
+        {
+            NBN_LogError("Failed to send parity packet");
+
+            return NBN_ERROR;
+        }
+
+        sent_bytes += ret;
+    }
+
+    double t = connection->time - connection->last_flush_time;
+
+    if (t > 0)
+        Connection_UpdateAverageUploadBandwidth(connection, sent_bytes / t);
+
+    connection->last_flush_time = connection->time;
+
+    return 0;
+}
+
+int NBN_Connection_CreateChannel(NBN_Connection *connection, NBN_ChannelType type, uint8_t id)
+{
+    if (id > NBN_MAX_CHANNELS - 1)
+        return NBN_ERROR;
+
+    NBN_Channel *channel;
+    unsigned int buffer_size = connection->endpoint->config.channel_buffer_size;
+
+    switch (type)
+    {
+        case NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED:
+            channel = (NBN_Channel *)NBN_UnreliableOrderedChannel_Create(buffer_size);
+            break;
+
+        case NBN_CHANNEL_TYPE_RELIABLE_ORDERED:
+            channel = (NBN_Channel *)NBN_ReliableOrderedChannel_Create(buffer_size);
+            break;
+
+        case NBN_CHANNEL_TYPE_UNRELIABLE_REDUNDANT:
+            channel = (NBN_Channel *)NBN_UnreliableRedundantChannel_Create(buffer_size);
+            break;
+
+        case NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED:
+            channel = (NBN_Channel *)NBN_UnreliableUnorderedChannel_Create(buffer_size);
+            break;
+
+        default:
+            NBN_LogError("Unsupported message channel type: %d", type);
+
+            return NBN_ERROR;
+    }
+
+    if (channel == NULL)
+    {
+        NBN_LogError("Failed to allocate channel %d", id);
+
+        return NBN_ERROR;
+    }
+
+    channel->id = id;
+    channel->type = type;
+    channel->connection = connection;
+
+    channel->read_chunk_buffer = (uint8_t*)NBN_Allocator(NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE);
+
+    if (channel->read_chunk_buffer == NULL)
+    {
+        NBN_LogError("Failed to allocate the chunk buffer of channel %d", id);
+
+        NBN_Deallocator(channel);
+
+        return NBN_ERROR;
+    }
+
+    channel->read_chunk_buffer_size = NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE;
+    channel->next_outgoing_chunked_message = 0;
+    channel->next_outgoing_message_id = 0;
+    channel->next_recv_message_id = 0;
+    channel->outgoing_message_count = 0;
+    channel->chunk_count = 0;
+    channel->last_received_chunk_id = -1;
+    channel->time = 0;
+
+    for (unsigned int i = 0; i < buffer_size; i++)
+    {
+        channel->recved_message_slot_buffer[i].free = true;
+        channel->outgoing_message_slot_buffer[i].free = true;
+    }
+
+    for (int i = 0; i < NBN_CHANNEL_CHUNKS_BUFFER_SIZE; i++)
+        channel->recv_chunk_buffer[i] = NULL;
+
+    connection->channels[id] = channel;
+
+    return 0;
+}
+
+bool NBN_Connection_CheckIfStale(NBN_Connection *connection)
+{
+#if defined(NBN_DEBUG) && defined(NBN_DISABLE_STALE_CONNECTION_DETECTION)
+    /* When testing under bad network conditions (in soak test for instance), we don't want to deal
+       with stale connections */
+    return false;
+#else
+    return connection->time - connection->last_recv_packet_time > connection->endpoint->config.stale_time_threshold;
+#endif
+}
+
+double NBN_Connection_GetRemoteTime(NBN_Connection *connection)
+{
+    NBN_ClockSync *clock_sync = &connection->clock_sync;
+
+    if (!clock_sync->is_synced)
+        return -1;
+
+    double time = NBN_Endpoint_GetTime(connection->endpoint);
+
+    return connection->remote_start_time +
+        time + clock_sync->offset + clock_sync->drift * (time - clock_sync->reference_time);
+}
+
+void NBN_Connection_AddTime(NBN_Connection *connection, double time)
+{
+    connection->time += time;
+
+    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+    {
+        NBN_Channel *channel = connection->channels[i];
+
+        if (channel != NULL)
+            NBN_Channel_AddTime(channel, time);
+    }
+}
+
+static int Connection_DecodePacketHeader(NBN_Connection *connection, NBN_Packet *packet)
+{
+    uint16_t ack = packet->header.ack;
+    uint64_t acks = ((uint64_t)packet->header.ack_bits << 1) | 1; /* Bit n: ack - n */
+    uint64_t previous_acks; /* Acks read from previous headers, aligned on ack */
+
+    if (SEQUENCE_NUMBER_GTE(ack, connection->last_received_ack))
+    {
+        uint16_t shift = ack - connection->last_received_ack;
+
+        previous_acks = shift < 64 ? connection->received_ack_window << shift : 0;
+
+        connection->last_received_ack = ack;
+        connection->received_ack_window = previous_acks | acks;
+    }
+    else
+    {
+        /* Header of a packet received out of order */
+        uint16_t shift = connection->last_received_ack - ack;
+
+        previous_acks = shift < 64 ? connection->received_ack_window >> shift : 0;
+
+        if (shift < 64)
+            connection->received_ack_window |= acks << shift;
+    }
+
+    uint64_t new_acks = acks & ~previous_acks;
+
+    while (new_acks)
+    {
+        if (Connection_AckPacket(connection, ack - B_CTZ64(new_acks)) < 0)
+        {
+            NBN_LogError("Failed to ack packet %d", packet->header.seq_number);
+
+            return NBN_ERROR;
+        }
+
+        new_acks &= new_acks - 1; /* Clear the lowest set bit */
+    }
+
+    return 0;
+}
+
+static uint32_t Connection_BuildPacketAckBits(NBN_Connection *connection)
+{
+    /* the 32 packets received before the most recent one */
+    return (uint32_t)(connection->packet_recv_window[0] >> 1);
+}
+
+static int Connection_AckPacket(NBN_Connection *connection, uint16_t ack_packet_seq_number)
+{
+    NBN_PacketEntry *packet_entry = Connection_FindSendPacketEntry(connection, ack_packet_seq_number);
+
+    if (packet_entry == NULL)
+        return 0;
+
+    /* the remote peer got the acks carried by the packet */
+    if (SEQUENCE_NUMBER_GT(packet_entry->ack, connection->delivered_ack))
+        connection->delivered_ack = packet_entry->ack;
+
+    if (!packet_entry->acked)
+    {
+        NBN_LogTrace("Packet %d acked (connection: %d)", ack_packet_seq_number, connection->id);
+
+        packet_entry->acked = true;
+
+        Connection_UpdateAveragePing(connection, connection->time - packet_entry->send_time);
+
+        return Connection_AckPacketMessages(connection, packet_entry);
+    }
+
+    return 0;
+}
+
+static int Connection_AckPacketMessages(NBN_Connection *connection, NBN_PacketEntry *packet_entry)
+{
+    for (unsigned int i = 0; i < packet_entry->messages_count; i++)
+    {
+        NBN_MessageEntry *msg_entry = &packet_entry->messages[i];
+        NBN_Channel *channel = connection->channels[msg_entry->channel_id];
+
+        assert(channel != NULL);
+
+        if (channel->OnOutgoingMessageAcked)
+        {
+            if (channel->OnOutgoingMessageAcked(channel, msg_entry->id) < 0)
+                return NBN_ERROR;
+        }
+
+        NBN_Replicator *replicator = connection->endpoint->replicator;
+
+        if (replicator && msg_entry->channel_id == replicator->channel_id)
+            Replicator_OnMessageAcked(replicator, connection, msg_entry->id);
+    }
+
+    return 0;
+}
+
+/* Handle the value returned by the driver send function */
+static int Connection_OnPacketSent(NBN_Connection *connection, NBN_PacketEntry *packet_entry, int ret)
+{
+    if (ret != NBN_DRIVER_PACKET_SENT_RELIABLY)
+        return ret;
+
+    /* the transport delivers the packet, its messages are released by the packet ack but never resent */
+    Connection_SetMessagesSentReliably(connection, packet_entry, true);
+
+    return 0;
+}
+
+static void Connection_SetMessagesSentReliably(NBN_Connection *connection, NBN_PacketEntry *packet_entry, bool value)
+{
+    for (unsigned int i = 0; i < packet_entry->messages_count; i++)
+    {
+        NBN_MessageEntry *msg_entry = &packet_entry->messages[i];
+        NBN_Channel *channel = connection->channels[msg_entry->channel_id];
+        NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_entry->id % channel->buffer_size];
+
+        if (!slot->free && slot->message.header.id == msg_entry->id)
+            slot->is_sent_reliably = value;
+    }
+}
+
+static void Connection_InitOutgoingPacket(
+        NBN_Connection *connection, NBN_Packet *outgoing_packet, NBN_PacketEntry **packet_entry)
+{
+    NBN_Packet_InitWrite(
+            outgoing_packet,
+            connection->protocol_id,
+            connection->next_packet_seq_number++,
+            connection->last_received_packet_seq_number,
+            Connection_BuildPacketAckBits(connection));
+
+    *packet_entry = Connection_InsertOutgoingPacketEntry(connection, outgoing_packet->header.seq_number);
+    (*packet_entry)->ack = outgoing_packet->header.ack;
+}
+
+static NBN_PacketEntry *Connection_InsertOutgoingPacketEntry(NBN_Connection *connection, uint16_t seq_number)
+{
+    uint16_t index = seq_number % connection->max_packet_entries;
+    NBN_PacketEntry entry = { 0 };
+
+    /*
+     * Packets older than the receiver's window (or than the tracked packets) cannot be acked anymore: when the acks
+     * of a packet sent reliably were lost, its messages go back to nbnet reliability rather than staying in flight
+     */
+    unsigned int ack_reach = MIN(NBN_PACKET_RECV_WINDOW_SIZE, connection->max_packet_entries);
+    NBN_PacketEntry *unackable_entry = Connection_FindSendPacketEntry(connection, (uint16_t)(seq_number - ack_reach));
+
+    if (unackable_entry && !unackable_entry->acked)
+        Connection_SetMessagesSentReliably(connection, unackable_entry, false);
+
+    connection->packet_send_seq_buffer[index] = seq_number;
+    connection->packet_send_buffer[index] = entry;
+
+    return &connection->packet_send_buffer[index];
+}
+
+static bool Connection_InsertReceivedPacketEntry(NBN_Connection *connection, uint16_t seq_number)
+{
+    uint64_t *window = connection->packet_recv_window;
+
+    if (SEQUENCE_NUMBER_GT(seq_number, connection->last_received_packet_seq_number))
+    {
+        /* Slide the window, the packets in between are not received (yet) */
+        Connection_ShiftReceivedPacketWindow(
+                connection, (uint16_t)(seq_number - connection->last_received_packet_seq_number));
+
+        connection->last_received_packet_seq_number = seq_number;
+        window[0] |= 1;
+
+        return true;
+    }
+
+    uint16_t n = connection->last_received_packet_seq_number - seq_number;
+
+    /* Too old to know whether it's a duplicate (not every channel discards the messages it already received) */
+    if (n >= NBN_PACKET_RECV_WINDOW_SIZE)
+    {
+        NBN_LogTrace("Received packet %d is out of the received packet window, drop it (connection: %d)",
+                seq_number, connection->id);
+
+        return false;
+    }
+
+    uint64_t mask = (uint64_t)1 << (n % 64);
+
+    /* Ignore duplicated packets */
+    if (window[n / 64] & mask)
+        return false;
+
+    window[n / 64] |= mask;
+
+    return true;
+}
+
+static void Connection_ShiftReceivedPacketWindow(NBN_Connection *connection, unsigned int n)
+{
+    uint64_t *window = connection->packet_recv_window;
+    unsigned int word_shift = n / 64;
+    unsigned int bit_shift = n % 64;
+
+    for (int i = NBN_PACKET_RECV_WINDOW_WORDS - 1; i >= 0; i--)
+    {
+        int src = i - (int)MIN(word_shift, NBN_PACKET_RECV_WINDOW_WORDS);
+        uint64_t word = 0;
+
+        if (src >= 0)
+        {
+            word = window[src] << bit_shift;
+
+            if (bit_shift > 0 && src > 0)
+                word |= window[src - 1] >> (64 - bit_shift);
+        }
+
+        window[i] = word;
+    }
+}
+
+static NBN_PacketEntry *Connection_FindSendPacketEntry(NBN_Connection *connection, uint16_t seq_number)
+{
+    uint16_t index = seq_number % connection->max_packet_entries;
+
+    if (connection->packet_send_seq_buffer[index] == seq_number)
+        return &connection->packet_send_buffer[index];
+
+    return NULL;
+}
+
+static bool Connection_IsPacketReceived(NBN_Connection *connection, uint16_t packet_seq_number)
+{
+    if (SEQUENCE_NUMBER_GT(packet_seq_number, connection->last_received_packet_seq_number))
+        return false;
+
+    uint16_t n = connection->last_received_packet_seq_number - packet_seq_number;
+
+    if (n >= NBN_PACKET_RECV_WINDOW_SIZE)
+        return false;
+
+    return (connection->packet_recv_window[n / 64] >> (n % 64)) & 1;
+}
+
+/* Length of the run of received (or not received) packets starting n packets before the most recent one */
+static unsigned int Connection_GetReceivedPacketRunLength(
+        NBN_Connection *connection, unsigned int n, unsigned int end, bool received)
+{
+    unsigned int start = n;
+
+    while (n < end)
+    {
+        uint64_t word = connection->packet_recv_window[n / 64] >> (n % 64);
+        unsigned int word_bits = 64 - n % 64;
+
+        if (received)
+            word = ~word;
+
+        /* index of the first packet that ends the run, if any in this word */
+        unsigned int length = word ? MIN(B_CTZ64(word), word_bits) : word_bits;
+
+        n += length;
+
+        if (length < word_bits)
+            break;
+    }
+
+    return MIN(n, end) - start;
+}
+
+/* Update the most recent ack carried by the packets sent before seq_number that should have been acked by now */
+static void Connection_UpdateDueAck(NBN_Connection *connection, uint16_t seq_number)
+{
+    double timeout = MAX(NBN_MESSAGE_RESEND_DELAY, connection->stats.ping * 2);
+
+    while (connection->next_due_packet_seq_number != seq_number)
+    {
+        NBN_PacketEntry *packet_entry = Connection_FindSendPacketEntry(connection, connection->next_due_packet_seq_number);
+
+        if (packet_entry)
+        {
+            if (connection->time - packet_entry->send_time < timeout)
+                break;
+
+            if (SEQUENCE_NUMBER_GT(packet_entry->ack, connection->due_ack))
+                connection->due_ack = packet_entry->ack;
+        }
+
+        connection->next_due_packet_seq_number++;
+    }
+}
+
+/* Ack again the received packets the remote peer may not know about (see NBN_AckRangesMessage) */
+static int Connection_WriteAckRanges(NBN_Connection *connection, NBN_Packet *packet, NBN_PacketEntry *packet_entry)
+{
+    NBN_PacketEntry *previous_entry = Connection_FindSendPacketEntry(connection, packet->header.seq_number - 1);
+    uint16_t known_ack = connection->delivered_ack;
+
+    Connection_UpdateDueAck(connection, packet->header.seq_number);
+
+    /*
+     * As long as the sent packets are acked in time, their headers are assumed to be received: only the packets
+     * received since the previous header that it could not ack are left
+     */
+    if (previous_entry && !SEQUENCE_NUMBER_GT(connection->due_ack, connection->delivered_ack))
+        known_ack = previous_entry->ack;
+
+    uint16_t unknown_count = connection->last_received_packet_seq_number - known_ack;
+
+    if (unknown_count <= NBN_PACKET_HEADER_ACK_COUNT)
+        return 0;
+
+    NBN_AckRangesMessage ranges;
+    unsigned int n = NBN_PACKET_HEADER_ACK_COUNT;
+    unsigned int end = MIN(unknown_count, NBN_PACKET_RECV_WINDOW_SIZE);
+    bool received = true;
+
+    ranges.run_count = 0;
+
+    while (n < end && ranges.run_count < NBN_ACK_RANGES_MAX_RUNS)
+    {
+        unsigned int length = Connection_GetReceivedPacketRunLength(connection, n, end, received);
+
+        ranges.runs[ranges.run_count++] = length;
+        n += length;
+        received = !received;
+    }
+
+    /* a trailing run of packets that were not received does not ack anything */
+    if (ranges.run_count % 2 == 0)
+        ranges.run_count--;
+
+    if (ranges.run_count == 1 && ranges.runs[0] == 0)
+        return 0;
+
+    NBN_Message message;
+
+    message.header.id = 0;
+    message.header.type = NBN_ACK_RANGES_MESSAGE_TYPE;
+    message.header.channel_id = NBN_CHANNEL_RESERVED_UNRELIABLE;
+    message.outgoing_msg = NULL;
+    message.data = &ranges;
+
+    NBN_LogTrace("Write %d ack ranges to packet %d (connection: %d)",
+            ranges.run_count, packet->header.seq_number, connection->id);
+
+    if (NBN_Packet_WriteMessage(
+                packet, &message, (NBN_MessageSerializer)NBN_AckRangesMessage_Serialize) != NBN_PACKET_WRITE_OK)
+        return NBN_ERROR;
+
+    /* The message is not part of any channel so it's not recorded in the packet entry messages */
+    packet_entry->has_ack_ranges = true;
+
+    return 0;
+}
+
+static int Connection_ReadAckRanges(NBN_Connection *connection, uint16_t ack, NBN_AckRangesMessage *ranges)
+{
+    unsigned int n = NBN_PACKET_HEADER_ACK_COUNT;
+
+    for (unsigned int i = 0; i < ranges->run_count; i++)
+    {
+        unsigned int end = n + ranges->runs[i];
+
+        if (end > NBN_PACKET_RECV_WINDOW_SIZE)
+        {
+            NBN_LogError("Invalid ack ranges (connection: %d)", connection->id);
+
+            return NBN_ERROR;
+        }
+
+        if (i % 2 == 0)
+        {
+            for (; n < end; n++)
+            {
+                NBN_PacketEntry *packet_entry = Connection_FindSendPacketEntry(connection, ack - n);
+
+                /* most of them were already acked by packet headers */
+                if (packet_entry == NULL || packet_entry->acked)
+                    continue;
+
+                if (Connection_AckPacket(connection, ack - n) < 0)
+                    return NBN_ERROR;
+            }
+        }
+
+        n = end;
+    }
+
+    return 0;
+}
+
+static int Connection_SendPacket(NBN_Connection *connection, NBN_Packet *packet, NBN_PacketEntry *packet_entry)
+{
+    NBN_LogTrace("Send packet %d to connection %d (messages count: %d)",
+            packet->header.seq_number, connection->id, packet->header.messages_count);
+
+    assert(packet_entry->messages_count + packet_entry->has_ack_ranges == packet->header.messages_count);
+
+    if (connection->fec_encoder)
+    {
+        /* parity is computed over the plain packet data, make sure all of it has been written to the buffer */
+        if (NBN_WriteStream_Flush(&packet->w_stream) < 0)
+            return NBN_ERROR;
+
+        Connection_AddPacketToFECGroup(connection, packet);
+    }
+
+    return Connection_TransmitPacket(connection, packet, packet_entry);
+}
+
+static int Connection_TransmitPacket(NBN_Connection *connection, NBN_Packet *packet, NBN_PacketEntry *packet_entry)
+{
+    double clock_time = NBN_Endpoint_GetTime(connection->endpoint);
+
+    /* wrap around rather than overflow (after about 5 days), the receiver only looks at differences */
+    packet->header.time = (uint32_t)(uint64_t)((clock_time - connection->start_time) * 10000);
+    packet->header.ack_delay = NBN_PACKET_NO_ACK_DELAY;
+
+    if (connection->last_received_packet_clock_time >= 0)
+    {
+        double ack_delay = (clock_time - connection->last_received_packet_clock_time) * 10000;
+
+        /* the remote endpoint cannot use the timestamp of a packet that acks a too old one */
+        if (ack_delay < NBN_PACKET_NO_ACK_DELAY)
+            packet->header.ack_delay = (uint16_t)ack_delay;
+    }
+
+    packet_entry->clock_send_time = clock_time;
+
+    if (connection->input_receiver)
+        packet->header.input_ack = (uint16_t)(connection->input_receiver->next_frame - 1);
+
+    if (NBN_Packet_Seal(packet, connection) < 0)
+    {
+        NBN_LogError("Failed to seal packet");
+
+        return NBN_ERROR;
+    }
+
+    packet_entry->send_time = connection->time;
+    connection->last_send_packet_time = connection->time;
+    connection->is_ack_pending = false; /* every packet carries the acks */
+
+    NBN_EmitHook(connection->endpoint, NBN_HOOK_PACKET_SENT, connection, packet);
+
+    if (connection->endpoint->is_server)
+    {
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+        return Connection_OnPacketSent(connection, packet_entry,
+                NBN_PacketSimulator_EnqueuePacket(&__game_server.endpoint.packet_simulator, packet, connection));
+#else
+        if (connection->is_stale)
+            return 0;
+
+        return Connection_OnPacketSent(connection, packet_entry, NBN_Driver_GServ_SendPacketTo(packet, connection));
+#endif
+    }
+    else
+    {
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+        return Connection_OnPacketSent(connection, packet_entry,
+                NBN_PacketSimulator_EnqueuePacket(&__game_client.endpoint.packet_simulator, packet, connection));
+#else
+        return Connection_OnPacketSent(connection, packet_entry, NBN_Driver_GCli_SendPacket(packet));
+#endif
+    }
+}
+
+static bool Connection_ShouldSendEmptyPacket(NBN_Connection *connection)
+{
+    if (connection->is_ack_pending && connection->time - connection->ack_pending_time >= NBN_CONNECTION_ACK_DELAY)
+        return true;
+
+    return connection->time - connection->last_send_packet_time >= NBN_CONNECTION_KEEP_ALIVE_INTERVAL;
+}
+
+/* Give back the sequence number of the last initialized outgoing packet, used when it ends up not being sent */
+static void Connection_CancelOutgoingPacket(NBN_Connection *connection, NBN_Packet *packet)
+{
+    assert((uint16_t)(connection->next_packet_seq_number - 1) == packet->header.seq_number);
+
+    connection->packet_send_seq_buffer[packet->header.seq_number % connection->max_packet_entries] = 0xFFFFFFFF;
+    connection->next_packet_seq_number--;
+}
+
+static void Connection_UpdateFECEncoder(NBN_Connection *connection)
+{
+    if (connection->endpoint->config.is_fec_enabled && connection->fec_encoder == NULL)
+    {
+        /* The peer's first group is protected as well, start keeping track of received packets right away */
+        if (connection->fec_decoder == NULL && Connection_CreateFECDecoder(connection) < 0)
+            return;
+
+        connection->fec_encoder = (NBN_FECEncoder *)NBN_Allocator(sizeof(NBN_FECEncoder));
+
+        if (connection->fec_encoder == NULL)
+        {
+            NBN_LogError("Failed to allocate FEC encoder (connection: %d)", connection->id);
+
+            return;
+        }
+
+        connection->fec_encoder->packet_count = 0;
+        connection->fec_encoder->group_size = NBN_FEC_MAX_GROUP_SIZE;
+    }
+    else if (!connection->endpoint->config.is_fec_enabled && connection->fec_encoder)
+    {
+        NBN_Deallocator(connection->fec_encoder);
+
+        connection->fec_encoder = NULL;
+    }
+}
+
+static void Connection_AddPacketToFECGroup(NBN_Connection *connection, NBN_Packet *packet)
+{
+    NBN_FECEncoder *encoder = connection->fec_encoder;
+    NBN_FECParityMessage *parity = &encoder->parity;
+    unsigned int length = packet->size;
+
+    /* encrypted packets are padded with zeros up to the AES block size, this is the size the receiver will see */
+    if (connection->endpoint->config.is_encryption_enabled && connection->can_encrypt && length % AES_BLOCKLEN != 0)
+        length += AES_BLOCKLEN - length % AES_BLOCKLEN;
+
+    /* Packets without messages have nothing to recover and big packets do not fit in a parity message */
+    if (packet->header.messages_count == 0 || length > NBN_FEC_MAX_PAYLOAD_SIZE)
+        return;
+
+    /* Group is complete, the packet won't be protected until the parity packet is sent */
+    if (encoder->packet_count >= encoder->group_size)
+        return;
+
+    uint16_t offset = packet->header.seq_number - parity->first_seq_number;
+
+    if (encoder->packet_count > 0 && offset >= NBN_FEC_MAX_GROUP_SPAN)
+    {
+        NBN_LogDebug("Dropped FEC group starting at packet %d (span is too large)", parity->first_seq_number);
+
+        encoder->packet_count = 0;
+    }
+
+    if (encoder->packet_count == 0)
+    {
+        memset(parity, 0, sizeof(NBN_FECParityMessage));
+
+        parity->first_seq_number = packet->header.seq_number;
+        offset = 0;
+
+        /*
+           Aim for no more than one lost packet per group on average, that's the most a XOR parity can rebuild.
+           The measured packet loss only accounts for packets that could not be recovered, so the group size
+           settles where the residual loss stays low.
+           */
+        float packet_loss = connection->stats.packet_loss;
+
+        if (packet_loss * 2 * NBN_FEC_MAX_GROUP_SIZE <= 1)
+            encoder->group_size = NBN_FEC_MAX_GROUP_SIZE;
+        else
+            encoder->group_size = MAX((unsigned int)(1 / (2 * packet_loss)), NBN_FEC_MIN_GROUP_SIZE);
+    }
+
+    uint8_t *data = packet->buffer + NBN_PACKET_HEADER_SIZE;
+
+    for (unsigned int i = 0; i < packet->size; i++)
+        parity->data[i] ^= data[i];
+
+    B_SET(parity->packet_mask, offset);
+
+    parity->length ^= length;
+    parity->ack ^= packet->header.ack;
+    parity->ack_bits ^= packet->header.ack_bits;
+    parity->messages_count ^= packet->header.messages_count;
+    parity->data_length = MAX(parity->data_length, length);
+
+    encoder->packet_count++;
+}
+
+static bool Connection_IsFECGroupComplete(NBN_Connection *connection)
+{
+    NBN_FECEncoder *encoder = connection->fec_encoder;
+
+    if (encoder == NULL || encoder->packet_count == 0)
+        return false;
+
+    if (encoder->packet_count >= encoder->group_size)
+        return true;
+
+    /* Close the group early when the next flush could push it past the maximum span */
+    uint16_t span = connection->next_packet_seq_number - encoder->parity.first_seq_number;
+
+    return span + connection->endpoint->config.max_sent_packet_count + 2 >= NBN_FEC_MAX_GROUP_SPAN;
+}
+
+/* Return the number of bytes sent or NBN_ERROR */
+static int Connection_SendFECParityPacket(NBN_Connection *connection)
+{
+    NBN_FECEncoder *encoder = connection->fec_encoder;
+    NBN_Packet packet;
+    NBN_PacketEntry *packet_entry;
+    NBN_Message message;
+
+    message.header.id = 0;
+    message.header.type = NBN_FEC_PARITY_MESSAGE_TYPE;
+    message.header.channel_id = NBN_CHANNEL_RESERVED_UNRELIABLE;
+    message.outgoing_msg = NULL;
+    message.data = &encoder->parity;
+
+    Connection_InitOutgoingPacket(connection, &packet, &packet_entry);
+
+    if (NBN_Packet_WriteMessage(
+                &packet, &message, (NBN_MessageSerializer)NBN_FECParityMessage_Serialize) != NBN_PACKET_WRITE_OK)
+        return NBN_ERROR;
+
+    NBN_LogTrace("Send parity packet %d (first packet: %d, packet count: %d)",
+            packet.header.seq_number, encoder->parity.first_seq_number, encoder->packet_count);
+
+    encoder->packet_count = 0;
+
+    /* The parity message is not part of any channel so it's not recorded in the packet entry */
+    if (Connection_TransmitPacket(connection, &packet, packet_entry) < 0)
+        return NBN_ERROR;
+
+    return packet.size;
+}
+
+static void Connection_StoreFECPacket(NBN_Connection *connection, NBN_Packet *packet)
+{
+    unsigned int length = packet->size - NBN_PACKET_HEADER_SIZE;
+
+    if (packet->header.messages_count == 0 || length > NBN_FEC_MAX_PAYLOAD_SIZE)
+        return;
+
+    NBN_FECPacketEntry *entry =
+        &connection->fec_decoder->packets[packet->header.seq_number % NBN_FEC_RECV_BUFFER_SIZE];
+
+    entry->seq_number = packet->header.seq_number;
+    entry->length = length;
+    entry->ack = packet->header.ack;
+    entry->ack_bits = packet->header.ack_bits;
+    entry->messages_count = packet->header.messages_count;
+
+    memcpy(entry->data, packet->buffer + NBN_PACKET_HEADER_SIZE, length);
+}
+
+static int Connection_CreateFECDecoder(NBN_Connection *connection)
+{
+    connection->fec_decoder = (NBN_FECDecoder *)NBN_Allocator(sizeof(NBN_FECDecoder));
+
+    if (connection->fec_decoder == NULL)
+    {
+        NBN_LogError("Failed to allocate FEC decoder (connection: %d)", connection->id);
+
+        return NBN_ERROR;
+    }
+
+    for (int i = 0; i < NBN_FEC_RECV_BUFFER_SIZE; i++)
+        connection->fec_decoder->packets[i].seq_number = 0xFFFFFFFF;
+
+    return 0;
+}
+
+static int Connection_RecoverFECPacket(NBN_Connection *connection, NBN_FECParityMessage *parity)
+{
+    if (connection->fec_decoder == NULL)
+    {
+        /*
+         * First parity received from a peer while FEC is disabled on this end, start keeping track of received
+         * packets for the next groups
+         */
+        return Connection_CreateFECDecoder(connection);
+    }
+
+    NBN_Packet packet;
+    uint16_t lost_seq_number = 0;
+    unsigned int lost_packet_count = 0;
+    uint16_t length = parity->length;
+    uint16_t ack = parity->ack;
+    uint32_t ack_bits = parity->ack_bits;
+    uint8_t messages_count = parity->messages_count;
+    uint8_t *data = packet.buffer + NBN_PACKET_HEADER_SIZE;
+
+    memcpy(data, parity->data, parity->data_length);
+
+    for (unsigned int i = 0; i < NBN_FEC_MAX_GROUP_SPAN; i++)
+    {
+        if (B_IS_UNSET(parity->packet_mask, i))
+            continue;
+
+        uint16_t seq_number = parity->first_seq_number + i;
+
+        if (!Connection_IsPacketReceived(connection, seq_number))
+        {
+            /* Only one packet per group can be rebuilt */
+            if (++lost_packet_count > 1)
+                return 0;
+
+            lost_seq_number = seq_number;
+
+            continue;
+        }
+
+        NBN_FECPacketEntry *entry = &connection->fec_decoder->packets[seq_number % NBN_FEC_RECV_BUFFER_SIZE];
+
+        /* Received before we started keeping track of packets */
+        if (entry->seq_number != seq_number)
+            return 0;
+
+        for (unsigned int j = 0; j < entry->length; j++)
+            data[j] ^= entry->data[j];
+
+        length ^= entry->length;
+        ack ^= entry->ack;
+        ack_bits ^= entry->ack_bits;
+        messages_count ^= entry->messages_count;
+    }
+
+    if (lost_packet_count == 0)
+        return 0;
+
+    if (length > parity->data_length)
+    {
+        NBN_LogError("Invalid parity for packets %d to %d", parity->first_seq_number, lost_seq_number);
+
+        return NBN_ERROR;
+    }
+
+    packet.header.protocol_id = connection->protocol_id;
+    packet.header.seq_number = lost_seq_number;
+    packet.header.ack = ack;
+    packet.header.ack_bits = ack_bits;
+    packet.header.messages_count = messages_count;
+    packet.header.time = NBN_PACKET_NO_TIME; /* the send time of a rebuilt packet is unknown */
+    packet.header.ack_delay = NBN_PACKET_NO_ACK_DELAY;
+    packet.header.input_ack = 0;
+    packet.header.is_encrypted = false;
+    packet.mode = NBN_PACKET_MODE_READ;
+    packet.sender = connection;
+    packet.recv_time = -1;
+    packet.size = NBN_PACKET_HEADER_SIZE + length;
+    packet.sealed = false;
+
+    NBN_ReadStream_Init(&packet.r_stream, data, length);
+
+    NBN_LogDebug("Recovered packet %d from parity (connection: %d)", lost_seq_number, connection->id);
+
+    return NBN_Connection_ProcessReceivedPacket(connection, &packet);
+}
+
+static int Connection_ReadNextMessageFromStream(
+        NBN_Connection *connection, NBN_ReadStream *r_stream, NBN_Message *message)
+{
+    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)r_stream) < 0)
+    {
+        NBN_LogError("Failed to read message header");
+
+        return NBN_ERROR;
+    }
+    
+    uint8_t msg_type = message->header.type;
+    NBN_MessageBuilder msg_builder = connection->endpoint->message_builders[msg_type];
+
+    if (msg_builder == NULL)
+    {
+        NBN_LogError("No message builder is registered for messages of type %d", msg_type);
+
+        return NBN_ERROR;
+    }
+
+    NBN_MessageSerializer msg_serializer = connection->endpoint->message_serializers[msg_type];
+
+    if (msg_serializer == NULL)
+    {
+        NBN_LogError("No message serializer attached to message of type %d", msg_type);
+
+        return NBN_ERROR;
+    }
+
+    NBN_Channel *channel = connection->channels[message->header.channel_id];
+
+    if (channel == NULL)
+    {
+        NBN_LogError("Channel %d does not exist", message->header.channel_id);
+
+        return NBN_ERROR;
+    }
+
+    message->data = msg_builder();
+
+    if (msg_serializer(message->data, (NBN_Stream *)r_stream) < 0)
+    {
+        NBN_LogError("Failed to read message body");
+
+        return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+static int Connection_ReadNextMessageFromPacket(NBN_Connection *connection, NBN_Packet *packet, NBN_Message *message)
+{
+    return Connection_ReadNextMessageFromStream(connection, &packet->r_stream, message);
+}
+
+static int Connection_RecycleMessage(NBN_Connection *connection, NBN_Message *message)
+{
+    assert(message->outgoing_msg == NULL || message->outgoing_msg->ref_count > 0);
+
+    if (message->outgoing_msg == NULL || --message->outgoing_msg->ref_count == 0)
+    {
+        if (message->header.type == NBN_MESSAGE_CHUNK_TYPE)
+        {
+            NBN_MessageChunk *chunk = (NBN_MessageChunk*)message->data;
+
+            if (chunk->outgoing_msg)
+            {
+                assert(chunk->outgoing_msg->ref_count > 0);
+
+                if (--chunk->outgoing_msg->ref_count == 0)
+                {
+                    NBN_MessageDestructor msg_destructor =
+                        connection->endpoint->message_destructors[chunk->outgoing_msg->type];
+
+                    if (msg_destructor)
+                        msg_destructor(chunk->outgoing_msg->data);
+                }
+            }
+        }
+
+        NBN_MessageDestructor msg_destructor = connection->endpoint->message_destructors[message->header.type];
+
+        if (msg_destructor)
+            msg_destructor(message->data);
+    }
+
+    return 0;
+}
+
+static void Connection_UpdateAveragePing(NBN_Connection *connection, double ping)
+{
+    /* exponential smoothing with a factor of 0.05 */
+    connection->stats.ping = connection->stats.ping + .05f * (ping - connection->stats.ping);
+}
+
+static void Connection_UpdateAveragePacketLoss(NBN_Connection *connection, uint16_t seq)
+{
+    unsigned int lost_packet_count = 0;
+    uint16_t start_seq = seq - 64;
+
+    for (int i = 0; i < 100; i++)
+    {
+        uint16_t s = start_seq - i;
+        NBN_PacketEntry *entry = Connection_FindSendPacketEntry(connection, s);
+
+        if (entry && !entry->acked)
+            lost_packet_count++;
+    }
+
+    float packet_loss = lost_packet_count / 100.f;
+
+    /* exponential smoothing with a factor of 0.1 */
+    connection->stats.packet_loss = connection->stats.packet_loss + .1f * (packet_loss - connection->stats.packet_loss);
+}
+
+static void Connection_UpdateAverageUploadBandwidth(NBN_Connection *connection, float bytes_per_sec)
+{
+    /* exponential smoothing with a factor of 0.1 */
+    connection->stats.upload_bandwidth =
+        connection->stats.upload_bandwidth + .1f * (bytes_per_sec - connection->stats.upload_bandwidth);
+}
+
+static void Connection_UpdateAverageDownloadBandwidth(NBN_Connection *connection)
+{
+    double t = connection->time - connection->last_read_packets_time;
+
+    if (t == 0)
+        return;
+
+    float bytes_per_sec = connection->downloaded_bytes / t;
+
+    /* exponential smoothing with a factor of 0.1 */
+    connection->stats.download_bandwidth =
+        connection->stats.download_bandwidth + .1f * (bytes_per_sec - connection->stats.download_bandwidth);
+
+    connection->downloaded_bytes = 0;
+}
+
+static void Connection_AddClockSample(NBN_Connection *connection, NBN_Packet *packet, double recv_time)
+{
+    if (packet->header.time == NBN_PACKET_NO_TIME || packet->header.ack_delay == NBN_PACKET_NO_ACK_DELAY)
+        return;
+
+    NBN_PacketEntry *packet_entry = Connection_FindSendPacketEntry(connection, packet->header.ack);
+
+    if (packet_entry == NULL)
+        return;
+
+    /*
+     * NTP-like exchange: the acked packet was sent at t0 (local clock), received at t1 (remote clock),
+     * the remote endpoint replied at t2 (remote clock) and the reply was received at t3 (local clock)
+     */
+    double t0 = packet_entry->clock_send_time;
+    double t2 = Connection_UnwrapRemoteTime(connection, packet->header.time);
+    double t1 = t2 - packet->header.ack_delay / 10000.0;
+    double t3 = recv_time;
+    double rtt = (t3 - t0) - (t2 - t1);
+
+    if (rtt < 0)
+        return;
+
+    NBN_ClockSync *clock_sync = &connection->clock_sync;
+    NBN_ClockSample *sample = &clock_sync->samples[clock_sync->next_sample];
+
+    sample->local_time = t3;
+    sample->offset = ((t1 - t0) + (t2 - t3)) / 2;
+    sample->rtt = rtt;
+
+    clock_sync->next_sample = (clock_sync->next_sample + 1) % NBN_CLOCK_SYNC_SAMPLES;
+    clock_sync->sample_count = MIN(clock_sync->sample_count + 1, NBN_CLOCK_SYNC_SAMPLES);
+
+    Connection_UpdateClockEstimate(clock_sync);
+}
+
+/* Remote time (in seconds, since the remote connection start) of a packet header timestamp */
+static double Connection_UnwrapRemoteTime(NBN_Connection *connection, uint32_t timestamp)
+{
+    /* timestamps wrap around, they are read as a signed difference with the most recent one */
+    double time = connection->last_remote_time + (int32_t)(timestamp - connection->last_remote_timestamp) / 10000.0;
+
+    if (time > connection->last_remote_time)
+    {
+        connection->last_remote_timestamp = timestamp;
+        connection->last_remote_time = time;
+    }
+
+    return time;
+}
+
+static void Connection_UpdateClockEstimate(NBN_ClockSync *clock_sync)
+{
+    double min_rtt = clock_sync->samples[0].rtt;
+
+    for (unsigned int i = 1; i < clock_sync->sample_count; i++)
+        min_rtt = MIN(min_rtt, clock_sync->samples[i].rtt);
+
+    /*
+     * Samples delayed by queuing are asymmetric and bias the offset: only keep the ones whose
+     * round trip time is close to the lowest one of the window
+     */
+    double max_rtt = min_rtt + NBN_CLOCK_SYNC_RTT_TOLERANCE;
+    unsigned int count = 0;
+    double mean_time = 0;
+    double mean_offset = 0;
+    double min_time = 0;
+    double max_time = 0;
+
+    for (unsigned int i = 0; i < clock_sync->sample_count; i++)
+    {
+        NBN_ClockSample *sample = &clock_sync->samples[i];
+
+        if (sample->rtt > max_rtt)
+            continue;
+
+        min_time = count == 0 ? sample->local_time : MIN(min_time, sample->local_time);
+        max_time = count == 0 ? sample->local_time : MAX(max_time, sample->local_time);
+        mean_time += sample->local_time;
+        mean_offset += sample->offset;
+        count++;
+    }
+
+    assert(count > 0);
+
+    mean_time /= count;
+    mean_offset /= count;
+
+    /* least squares fit of the offset over time, only when the samples span enough time to be meaningful */
+    double drift = 0;
+
+    if (max_time - min_time >= NBN_CLOCK_SYNC_MIN_DRIFT_SPAN)
+    {
+        double num = 0;
+        double den = 0;
+
+        for (unsigned int i = 0; i < clock_sync->sample_count; i++)
+        {
+            NBN_ClockSample *sample = &clock_sync->samples[i];
+
+            if (sample->rtt > max_rtt)
+                continue;
+
+            num += (sample->local_time - mean_time) * (sample->offset - mean_offset);
+            den += (sample->local_time - mean_time) * (sample->local_time - mean_time);
+        }
+
+        drift = MAX(-NBN_CLOCK_SYNC_MAX_DRIFT, MIN(num / den, NBN_CLOCK_SYNC_MAX_DRIFT));
+    }
+
+    clock_sync->offset = mean_offset;
+    clock_sync->drift = drift;
+    clock_sync->reference_time = mean_time;
+    clock_sync->is_synced = true;
+}
+
+static int Connection_GenerateKeys(NBN_Connection *connection)
+{
+    CSPRNG prng = csprng_create();
+
+    if (!prng)
+    {
+        NBN_LogError("Failed to initialize pseudo random number generator");
+
+        return NBN_ERROR;
+    }
+
+    if (Connection_GenerateKeySet(&connection->keys1, &prng) < 0)
+        return NBN_ERROR;
+
+    if (Connection_GenerateKeySet(&connection->keys2, &prng) < 0)
+        return NBN_ERROR;
+
+    if (Connection_GenerateKeySet(&connection->keys3, &prng) < 0)
+        return NBN_ERROR;
+
+    csprng_get(prng, connection->aes_iv, AES_BLOCKLEN);
+    csprng_destroy(prng);
+
+    return 0;
+}
+
+static int Connection_GenerateKeySet(NBN_ConnectionKeySet *key_set, CSPRNG *prng)
+{
+    /* Generate a random private key */
+    csprng_get(prng, key_set->prv_key, ECC_PRV_KEY_SIZE);
+
+    if (!ecdh_generate_keys(key_set->pub_key, key_set->prv_key))
+    {
+        NBN_LogError("Failed to generate public and private keys");
+
+        return NBN_ERROR;
+    }
+
+    return 0;
+}
+
+static int Connection_BuildSharedKey(NBN_ConnectionKeySet *key_set, uint8_t *pub_key)
+{
+    if (!ecdh_shared_secret(key_set->prv_key, pub_key, key_set->shared_key))
+        return NBN_ERROR;
+
+    return 0;
+}
+
+static void Connection_StartEncryption(NBN_Connection *connection)
+{
+    connection->can_encrypt = true;
+    
+    NBN_LogDebug("Encryption started for connection %d", connection->id);
+
+    NBN_EmitHook(connection->endpoint, NBN_HOOK_ENCRYPTION_STARTED, connection, NULL);
+}
+
+#pragma endregion /* NBN_Connection */
+
+#pragma region NBN_Channel
+
+/*
+ * Allocate a channel of the given type along with its message buffers (and extra_size bytes after them) in a
+ * single block, so that channels can still be released with a single NBN_Deallocator call.
+ */
+static void *Channel_Allocate(size_t channel_size, unsigned int buffer_size, size_t extra_size)
+{
+    size_t buffers_size = sizeof(NBN_MessageSlot) * buffer_size;
+    NBN_Channel *channel = (NBN_Channel *)NBN_Allocator(channel_size + buffers_size * 2 + extra_size);
+
+    if (channel == NULL)
+        return NULL;
+
+    channel->buffer_size = buffer_size;
+    channel->outgoing_message_slot_buffer = (NBN_MessageSlot *)((uint8_t *)channel + channel_size);
+    channel->recved_message_slot_buffer = channel->outgoing_message_slot_buffer + buffer_size;
+
+    return channel;
+}
+
+void NBN_Channel_Destroy(NBN_Channel *channel)
+{
+    for (unsigned int i = 0; i < channel->buffer_size; i++)
+    {
+        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[i];
+
+        if (!slot->free)
+            Connection_RecycleMessage(channel->connection, &slot->message);
+
+        slot = &channel->outgoing_message_slot_buffer[i];
+
+        if (!slot->free)
+            Connection_RecycleMessage(channel->connection, &slot->message);
+    }
+
+    NBN_Deallocator(channel);
+}
+
+void NBN_Channel_AddTime(NBN_Channel *channel, double time)
+{
+    channel->time += time;
+}
+
+bool NBN_Channel_AddChunk(NBN_Channel *channel, NBN_Message *chunk_msg)
+{
+    assert(chunk_msg->header.type == NBN_MESSAGE_CHUNK_TYPE);
+
+    NBN_MessageChunk *chunk = (NBN_MessageChunk*)chunk_msg->data;
+
+    NBN_LogTrace("Add chunk %d to channel %d (current chunk count: %d, last recved chunk id: %d)",
+            chunk->id, channel->id, channel->chunk_count, channel->last_received_chunk_id);
+
+    if (chunk->id == channel->last_received_chunk_id + 1)
+    {
+        assert(channel->recv_chunk_buffer[chunk->id] == NULL);
+
+        channel->recv_chunk_buffer[chunk->id] = chunk;
+        channel->last_received_chunk_id++;
+        channel->chunk_count++;
+
+        NBN_LogTrace("Chunk added (%d/%d)", channel->chunk_count, chunk->total);
+
+        if (channel->chunk_count == chunk->total)
+        {
+            channel->last_received_chunk_id = -1;
+
+            return true;
+        }
+
+        return false;
+    }
+    else
+    {
+        NBN_LogTrace("Chunk ignored");
+    }
+
+    /* Clear the chunks buffer */
+    for (unsigned int i = 0; i < channel->chunk_count; i++)
+    {
+        assert(channel->recv_chunk_buffer[i] != NULL);
+
+        NBN_MessageChunk_Destroy(channel->recv_chunk_buffer[i]);
+
+        channel->recv_chunk_buffer[i] = NULL;
+    }
+
+    channel->chunk_count = 0;
+    channel->last_received_chunk_id = -1;
+
+    if (chunk->id == 0)
+        return NBN_Channel_AddChunk(channel, chunk_msg);
+
+    return false;
+}
+
+int NBN_Channel_ReconstructMessageFromChunks(
+        NBN_Channel *channel, NBN_Connection *connection, NBN_Message *message)
+{
+    unsigned int message_size = channel->chunk_count * NBN_MESSAGE_CHUNK_SIZE;
+
+    if (message_size > channel->read_chunk_buffer_size)
+        NBN_Channel_ResizeReadChunkBuffer(channel, message_size);
+
+    NBN_LogTrace("Reconstructing message (chunk count: %d, size: %d) from channel %d",
+            channel->chunk_count, message_size, channel->id);
+
+    for (unsigned int i = 0; i < channel->chunk_count; i++)
+    {
+        NBN_MessageChunk *chunk = channel->recv_chunk_buffer[i];
+
+        memcpy(channel->read_chunk_buffer + i * NBN_MESSAGE_CHUNK_SIZE, chunk->data, NBN_MESSAGE_CHUNK_SIZE);
+
+        NBN_MessageChunk_Destroy(chunk);
+
+        channel->recv_chunk_buffer[i] = NULL;
+    }
+
+    channel->chunk_count = 0;
+
+    NBN_ReadStream r_stream;
+
+    NBN_ReadStream_Init(&r_stream, channel->read_chunk_buffer, message_size);
+
+    if (Connection_ReadNextMessageFromStream(connection, &r_stream, message) < 0)
+        return NBN_ERROR;
+
+    NBN_LogTrace("Reconstructed message %d of type %d", message->header.id, message->header.type);
+
+    NBN_EmitHook(connection->endpoint, NBN_HOOK_CHUNKS_COMPLETED, connection, message);
+
+    return 0;
+}
+
+void NBN_Channel_ResizeReadChunkBuffer(NBN_Channel *channel, unsigned int size)
+{
+    channel->read_chunk_buffer = (uint8_t*)NBN_Reallocator(channel->read_chunk_buffer, size);
+
+    channel->read_chunk_buffer_size = size;
+}
+
+void NBN_Channel_UpdateMessageLastSendTime(NBN_Channel *channel, NBN_Message *message, double time)
+{
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[message->header.id % channel->buffer_size];
+
+    assert(slot->message.header.id == message->header.id);
+
+    slot->last_send_time = time;
+}
+
+/* Unreliable ordered */
+
+static bool UnreliableOrderedChannel_AddReceivedMessage(NBN_Channel *, NBN_Message *);
+static bool UnreliableOrderedChannel_AddOutgoingMessage(NBN_Channel *, NBN_Message *);
+static NBN_Message *UnreliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *);
+static NBN_Message *UnreliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *);
+static int UnreliableOrderedChannel_OnOutgoingMessageSent(NBN_Channel *, NBN_Message *);
+
+NBN_UnreliableOrderedChannel *NBN_UnreliableOrderedChannel_Create(unsigned int buffer_size)
+{
+    NBN_UnreliableOrderedChannel *channel = (NBN_UnreliableOrderedChannel *)Channel_Allocate(sizeof(NBN_UnreliableOrderedChannel), buffer_size, 0);
+
+    if (channel == NULL)
+        return NULL;
+
+    channel->base.AddReceivedMessage = UnreliableOrderedChannel_AddReceivedMessage;
+    channel->base.AddOutgoingMessage = UnreliableOrderedChannel_AddOutgoingMessage;
+    channel->base.GetNextRecvedMessage = UnreliableOrderedChannel_GetNextRecvedMessage;
+    channel->base.GetNextOutgoingMessage = UnreliableOrderedChannel_GetNextOutgoingMessage;
+    channel->base.OnOutgoingMessageAcked = NULL;
+    channel->base.OnOutgoingMessageSent = UnreliableOrderedChannel_OnOutgoingMessageSent;
+
+    channel->last_received_message_id = 0;
+    channel->next_outgoing_message_slot = 0;
+
+    return channel;
+}
+
+static bool UnreliableOrderedChannel_AddReceivedMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    NBN_UnreliableOrderedChannel *unreliable_ordered_channel = (NBN_UnreliableOrderedChannel *)channel; 
+
+    if (SEQUENCE_NUMBER_GT(message->header.id, unreliable_ordered_channel->last_received_message_id))
+    {
+        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[message->header.id % channel->buffer_size];
+
+        memcpy(&slot->message, message, sizeof(NBN_Message));
+
+        slot->free = false;
+
+        unreliable_ordered_channel->last_received_message_id = message->header.id;
+
+        return true;
+    }
+
+    return false;
+}
+
+static bool UnreliableOrderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    uint16_t msg_id = channel->next_outgoing_message_id;
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->message.header.id = msg_id;
+    slot->free = false;
+
+    channel->next_outgoing_message_id++;
+    channel->outgoing_message_count++;
+
+    return true;
+}
+
+static NBN_Message *UnreliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *channel)
+{
+    NBN_UnreliableOrderedChannel *unreliable_ordered_channel = (NBN_UnreliableOrderedChannel *)channel;
+
+    while (SEQUENCE_NUMBER_LT(channel->next_recv_message_id, unreliable_ordered_channel->last_received_message_id))
+    {
+        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[channel->next_recv_message_id % channel->buffer_size];
+
+        if (!slot->free && slot->message.header.id == channel->next_recv_message_id)
+        {
+            slot->free = true;
+
+            return &slot->message;
+        }
+
+        channel->next_recv_message_id++;
+    }
+
+    return NULL;
+}
+
+static NBN_Message *UnreliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *channel)
+{
+    NBN_UnreliableOrderedChannel *unreliable_ordered_channel = (NBN_UnreliableOrderedChannel *)channel;
+
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[unreliable_ordered_channel->next_outgoing_message_slot];
+
+    if (slot->free)
+        return NULL;
+
+    slot->free = true;
+
+    unreliable_ordered_channel->next_outgoing_message_slot =
+        (unreliable_ordered_channel->next_outgoing_message_slot + 1) % channel->buffer_size;
+
+    return &slot->message;
+}
+
+static int UnreliableOrderedChannel_OnOutgoingMessageSent(NBN_Channel *channel, NBN_Message *message)
+{
+    /* Unreliable messages are sent only once so we can release them right away */
+    return Connection_RecycleMessage(channel->connection, message);
+}
+
+/* Reliable ordered */
+
+static bool ReliableOrderedChannel_AddReceivedMessage(NBN_Channel *, NBN_Message *);
+static bool ReliableOrderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *);
+static NBN_Message *ReliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *);
+static NBN_Message *ReliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *);
+static int ReliableOrderedChannel_OnOutgoingMessageAcked(NBN_Channel *, uint16_t);
+
+NBN_ReliableOrderedChannel *NBN_ReliableOrderedChannel_Create(unsigned int buffer_size)
+{
+    NBN_ReliableOrderedChannel *channel = (NBN_ReliableOrderedChannel *)Channel_Allocate(sizeof(NBN_ReliableOrderedChannel), buffer_size, sizeof(bool) * buffer_size);
+
+    if (channel == NULL)
+        return NULL;
+
+    channel->base.AddReceivedMessage = ReliableOrderedChannel_AddReceivedMessage;
+    channel->base.AddOutgoingMessage = ReliableOrderedChannel_AddOutgoingMessage;
+    channel->base.GetNextRecvedMessage = ReliableOrderedChannel_GetNextRecvedMessage;
+    channel->base.GetNextOutgoingMessage = ReliableOrderedChannel_GetNextOutgoingMessage;
+    channel->base.OnOutgoingMessageAcked = ReliableOrderedChannel_OnOutgoingMessageAcked;
+    channel->base.OnOutgoingMessageSent = NULL;
+
+    /* the acks buffer is allocated after the message buffers (see Channel_Allocate) */
+    channel->ack_buffer = (bool *)(channel->base.recved_message_slot_buffer + buffer_size);
+
+    memset(channel->base.recved_message_slot_buffer, 0, sizeof(NBN_MessageSlot) * buffer_size);
+
+    for (unsigned int i = 0; i < buffer_size; i++)
+        channel->ack_buffer[i] = false;
+
+    channel->oldest_unacked_message_id = 0;
+    channel->most_recent_message_id = 0;
+
+    return channel;
+}
+
+static unsigned int ReliableOrderedChannel_ComputeMessageIdDelta(uint16_t id1, uint16_t id2)
+{
+    if (SEQUENCE_NUMBER_GT(id1, id2))
+        return (id1 >= id2) ? id1 - id2 : ((0xFFFF + 1) - id2) + id1;
+    else
+        return (id2 >= id1) ? id2 - id1 : (((0xFFFF + 1) - id1) + id2) % 0xFFFF;
+}
+
+static bool ReliableOrderedChannel_AddReceivedMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    NBN_ReliableOrderedChannel *reliable_ordered_channel = (NBN_ReliableOrderedChannel *)channel;
+    unsigned int dt = ReliableOrderedChannel_ComputeMessageIdDelta(
+        message->header.id, reliable_ordered_channel->most_recent_message_id);
+
+    NBN_LogTrace("Add recved message %d of type %d to channel %d (most recent msg id: %d, dt: %d)",
+            message->header.id, message->header.type, channel->id, reliable_ordered_channel->most_recent_message_id, dt);
+
+    if (SEQUENCE_NUMBER_GT(message->header.id, reliable_ordered_channel->most_recent_message_id))
+    {
+        assert(dt < channel->buffer_size);
+
+        reliable_ordered_channel->most_recent_message_id = message->header.id;
+    }
+    else
+    {
+        /* This is an old message that has already been received, probably coming from
+           an out of order late packet. */
+        if (dt >= channel->buffer_size)
+            return false;
+    }
+
+    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[message->header.id % channel->buffer_size]; 
+
+    if (!slot->free)
+        Connection_RecycleMessage(channel->connection, &slot->message);
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->free = false;
+
+    return true;
+}
+
+static bool ReliableOrderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    uint16_t msg_id = channel->next_outgoing_message_id;
+    int index = msg_id % channel->buffer_size;
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[index];
+
+    if (!slot->free)
+    {
+        NBN_LogTrace("Slot %d is not free on channel %d (slot msg id: %d, outgoing message count: %d)",
+                index, channel->id, slot->message.header.id, channel->outgoing_message_count);
+
+        return false;
+    }
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->message.header.id = msg_id;
+    slot->last_send_time = -1;
+    slot->is_sent_reliably = false;
+    slot->free = false;
+
+    channel->next_outgoing_message_id++;
+    channel->outgoing_message_count++;
+
+    NBN_LogTrace("Added outgoing message %d of type %d to channel %d (index: %d)",
+            slot->message.header.id, slot->message.header.type, channel->id, index);
+
+    return true;
+}
+
+static NBN_Message *ReliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *channel)
+{
+    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[channel->next_recv_message_id % channel->buffer_size];
+
+    if (!slot->free && slot->message.header.id == channel->next_recv_message_id)
+    {
+        slot->free = true;
+        channel->next_recv_message_id++;
+
+        return &slot->message;
+    }
+
+    return NULL;
+}
+
+static NBN_Message *ReliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *channel)
+{
+    NBN_ReliableOrderedChannel *reliable_ordered_channel = (NBN_ReliableOrderedChannel *)channel;
+
+    int max_message_id = (reliable_ordered_channel->oldest_unacked_message_id + (channel->buffer_size - 1)) % (0xFFFF + 1);
+
+    if (SEQUENCE_NUMBER_LT(channel->next_outgoing_message_id, max_message_id))
+        max_message_id = channel->next_outgoing_message_id;
+
+    uint16_t msg_id = reliable_ordered_channel->oldest_unacked_message_id;
+
+    while (SEQUENCE_NUMBER_LT(msg_id, max_message_id))
+    {
+        NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+        if (
+                !slot->free && !slot->is_sent_reliably &&
+                (slot->last_send_time < 0 || channel->time - slot->last_send_time >= NBN_MESSAGE_RESEND_DELAY)
+           )
+        {
+            return &slot->message;
+        }
+
+        msg_id++;
+    }
+
+    return NULL;
+}
+
+static int ReliableOrderedChannel_OnOutgoingMessageAcked(NBN_Channel *channel, uint16_t msg_id)
+{
+    NBN_ReliableOrderedChannel *reliable_ordered_channel = (NBN_ReliableOrderedChannel *)channel;
+    NBN_MessageSlot *slot = &reliable_ordered_channel->base.outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+    if (slot->free || slot->message.header.id != msg_id)
+        return 0;
+
+    slot->free = true;
+
+    NBN_LogTrace("Message %d acked on channel %d (buffer index: %d, oldest unacked: %d)",
+        msg_id, channel->id, msg_id % channel->buffer_size, reliable_ordered_channel->oldest_unacked_message_id);
+
+    reliable_ordered_channel->ack_buffer[msg_id % channel->buffer_size] = true;
+    channel->outgoing_message_count--;
+
+    NBN_EmitHook(channel->connection->endpoint, NBN_HOOK_MESSAGE_ACKED, channel->connection, &slot->message);
+
+    if (msg_id == reliable_ordered_channel->oldest_unacked_message_id)
+    {
+        for (unsigned int i = 0; i < channel->buffer_size; i++)
+        {
+            uint16_t ack_msg_id = msg_id + i;
+            int index = ack_msg_id % channel->buffer_size;
+
+            if (reliable_ordered_channel->ack_buffer[index])
+            {
+                reliable_ordered_channel->ack_buffer[index] = false;
+                reliable_ordered_channel->oldest_unacked_message_id++;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        NBN_LogTrace("Updated oldest unacked message id on channel %d: %d",
+                channel->id, reliable_ordered_channel->oldest_unacked_message_id);
+    }
+
+    return Connection_RecycleMessage(channel->connection, &slot->message);
+}
+
+/* Unreliable redundant */
+
+static bool UnreliableRedundantChannel_AddReceivedMessage(NBN_Channel *, NBN_Message *);
+static bool UnreliableRedundantChannel_AddOutgoingMessage(NBN_Channel *, NBN_Message *);
+static NBN_Message *UnreliableRedundantChannel_GetNextRecvedMessage(NBN_Channel *);
+static NBN_Message *UnreliableRedundantChannel_GetNextOutgoingMessage(NBN_Channel *);
+static int UnreliableRedundantChannel_OnOutgoingMessageAcked(NBN_Channel *, uint16_t);
+static int UnreliableRedundantChannel_OnOutgoingMessageSent(NBN_Channel *, NBN_Message *);
+static int UnreliableRedundantChannel_ReleaseOutgoingMessage(NBN_Channel *, NBN_MessageSlot *);
+
+NBN_UnreliableRedundantChannel *NBN_UnreliableRedundantChannel_Create(unsigned int buffer_size)
+{
+    NBN_UnreliableRedundantChannel *channel =
+        (NBN_UnreliableRedundantChannel *)Channel_Allocate(sizeof(NBN_UnreliableRedundantChannel), buffer_size, 0);
+
+    if (channel == NULL)
+        return NULL;
+
+    channel->base.AddReceivedMessage = UnreliableRedundantChannel_AddReceivedMessage;
+    channel->base.AddOutgoingMessage = UnreliableRedundantChannel_AddOutgoingMessage;
+    channel->base.GetNextRecvedMessage = UnreliableRedundantChannel_GetNextRecvedMessage;
+    channel->base.GetNextOutgoingMessage = UnreliableRedundantChannel_GetNextOutgoingMessage;
+    channel->base.OnOutgoingMessageAcked = UnreliableRedundantChannel_OnOutgoingMessageAcked;
+    channel->base.OnOutgoingMessageSent = UnreliableRedundantChannel_OnOutgoingMessageSent;
+
+    channel->oldest_pending_message_id = 0;
+    channel->most_recent_message_id = 0xFFFF; /* so that message 0 is the next expected one */
+
+    return channel;
+}
+
+static bool UnreliableRedundantChannel_AddReceivedMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    NBN_UnreliableRedundantChannel *redundant_channel = (NBN_UnreliableRedundantChannel *)channel;
+
+    /* Message has already been delivered or skipped */
+    if (SEQUENCE_NUMBER_LT(message->header.id, channel->next_recv_message_id))
+        return false;
+
+    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[message->header.id % channel->buffer_size];
+
+    if (!slot->free)
+    {
+        /* Redundant copy of a message that is already in the recv queue */
+        if (slot->message.header.id == message->header.id)
+            return false;
+
+        Connection_RecycleMessage(channel->connection, &slot->message);
+    }
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->free = false;
+
+    if (SEQUENCE_NUMBER_GT(message->header.id, redundant_channel->most_recent_message_id))
+        redundant_channel->most_recent_message_id = message->header.id;
+
+    return true;
+}
+
+static bool UnreliableRedundantChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    uint16_t msg_id = channel->next_outgoing_message_id;
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+    /* The channel is unreliable, when running out of slots the oldest pending message is simply dropped */
+    if (!slot->free && UnreliableRedundantChannel_ReleaseOutgoingMessage(channel, slot) < 0)
+        return false;
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->message.header.id = msg_id;
+    slot->last_send_time = -1;
+    slot->send_count = 0;
+    slot->free = false;
+
+    channel->next_outgoing_message_id++;
+    channel->outgoing_message_count++;
+
+    return true;
+}
+
+static NBN_Message *UnreliableRedundantChannel_GetNextRecvedMessage(NBN_Channel *channel)
+{
+    NBN_UnreliableRedundantChannel *redundant_channel = (NBN_UnreliableRedundantChannel *)channel;
+
+    while (!SEQUENCE_NUMBER_GT(channel->next_recv_message_id, redundant_channel->most_recent_message_id))
+    {
+        uint16_t msg_id = channel->next_recv_message_id++;
+        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[msg_id % channel->buffer_size];
+
+        if (!slot->free && slot->message.header.id == msg_id)
+        {
+            slot->free = true;
+
+            return &slot->message;
+        }
+    }
+
+    return NULL;
+}
+
+static NBN_Message *UnreliableRedundantChannel_GetNextOutgoingMessage(NBN_Channel *channel)
+{
+    NBN_UnreliableRedundantChannel *redundant_channel = (NBN_UnreliableRedundantChannel *)channel;
+    uint16_t msg_id = redundant_channel->oldest_pending_message_id;
+
+    while (SEQUENCE_NUMBER_LT(msg_id, channel->next_outgoing_message_id))
+    {
+        NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+        if (!slot->free && slot->message.header.id == msg_id)
+        {
+            /* A message is included at most once per flush */
+            if (slot->last_send_time < 0 || channel->time > slot->last_send_time)
+                return &slot->message;
+        }
+        else if (msg_id == redundant_channel->oldest_pending_message_id)
+        {
+            redundant_channel->oldest_pending_message_id++;
+        }
+
+        msg_id++;
+    }
+
+    return NULL;
+}
+
+static int UnreliableRedundantChannel_OnOutgoingMessageAcked(NBN_Channel *channel, uint16_t msg_id)
+{
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+    if (slot->free || slot->message.header.id != msg_id)
+        return 0;
+
+    NBN_LogTrace("Redundant message %d acked on channel %d (send count: %d)", msg_id, channel->id, slot->send_count);
+
+    return UnreliableRedundantChannel_ReleaseOutgoingMessage(channel, slot);
+}
+
+static int UnreliableRedundantChannel_OnOutgoingMessageSent(NBN_Channel *channel, NBN_Message *message)
+{
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[message->header.id % channel->buffer_size];
+
+    assert(!slot->free && slot->message.header.id == message->header.id);
+
+    slot->last_send_time = channel->time;
+
+    if (++slot->send_count < NBN_CHANNEL_REDUNDANT_SEND_COUNT)
+        return 0;
+
+    NBN_LogTrace("Redundant message %d expired on channel %d", message->header.id, channel->id);
+
+    return UnreliableRedundantChannel_ReleaseOutgoingMessage(channel, slot);
+}
+
+static int UnreliableRedundantChannel_ReleaseOutgoingMessage(NBN_Channel *channel, NBN_MessageSlot *slot)
+{
+    slot->free = true;
+    channel->outgoing_message_count--;
+
+    return Connection_RecycleMessage(channel->connection, &slot->message);
+}
+
+/* Unreliable unordered */
+
+static bool UnreliableUnorderedChannel_AddReceivedMessage(NBN_Channel *, NBN_Message *);
+static bool UnreliableUnorderedChannel_AddOutgoingMessage(NBN_Channel *, NBN_Message *);
+static NBN_Message *UnreliableUnorderedChannel_GetNextRecvedMessage(NBN_Channel *);
+static NBN_Message *UnreliableUnorderedChannel_GetNextOutgoingMessage(NBN_Channel *);
+static int UnreliableUnorderedChannel_OnOutgoingMessageSent(NBN_Channel *, NBN_Message *);
+
+NBN_UnreliableUnorderedChannel *NBN_UnreliableUnorderedChannel_Create(unsigned int buffer_size)
+{
+    NBN_UnreliableUnorderedChannel *channel =
+        (NBN_UnreliableUnorderedChannel *)Channel_Allocate(sizeof(NBN_UnreliableUnorderedChannel), buffer_size, 0);
+
+    if (channel == NULL)
+        return NULL;
+
+    channel->base.AddReceivedMessage = UnreliableUnorderedChannel_AddReceivedMessage;
+    channel->base.AddOutgoingMessage = UnreliableUnorderedChannel_AddOutgoingMessage;
+    channel->base.GetNextRecvedMessage = UnreliableUnorderedChannel_GetNextRecvedMessage;
+    channel->base.GetNextOutgoingMessage = UnreliableUnorderedChannel_GetNextOutgoingMessage;
+    channel->base.OnOutgoingMessageAcked = NULL;
+    channel->base.OnOutgoingMessageSent = UnreliableUnorderedChannel_OnOutgoingMessageSent;
+
+    channel->next_outgoing_message_slot = 0;
+    channel->next_recv_message_slot = 0;
+    channel->recved_message_count = 0;
+
+    return channel;
+}
+
+static bool UnreliableUnorderedChannel_AddReceivedMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    NBN_UnreliableUnorderedChannel *unordered_channel = (NBN_UnreliableUnorderedChannel *)channel;
+
+    /* The recv queue is full, the channel is unreliable so the message is simply dropped */
+    if (unordered_channel->recved_message_count >= channel->buffer_size)
+        return false;
+
+    unsigned int index =
+        (unordered_channel->next_recv_message_slot + unordered_channel->recved_message_count) % channel->buffer_size;
+    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[index];
+
+    assert(slot->free);
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->free = false;
+    unordered_channel->recved_message_count++;
+
+    return true;
+}
+
+static bool UnreliableUnorderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *message)
+{
+    NBN_UnreliableUnorderedChannel *unordered_channel = (NBN_UnreliableUnorderedChannel *)channel;
+    uint16_t msg_id = channel->next_outgoing_message_id;
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % channel->buffer_size];
+
+    /* The channel is unreliable, when the buffer is full the oldest message not sent yet is simply dropped */
+    if (!slot->free)
+    {
+        assert(msg_id % channel->buffer_size == unordered_channel->next_outgoing_message_slot);
+
+        slot->free = true;
+        channel->outgoing_message_count--;
+
+        unordered_channel->next_outgoing_message_slot =
+            (unordered_channel->next_outgoing_message_slot + 1) % channel->buffer_size;
+
+        if (Connection_RecycleMessage(channel->connection, &slot->message) < 0)
+            return false;
+    }
+
+    memcpy(&slot->message, message, sizeof(NBN_Message));
+
+    slot->message.header.id = msg_id;
+    slot->free = false;
+
+    channel->next_outgoing_message_id++;
+    channel->outgoing_message_count++;
+
+    return true;
+}
+
+static NBN_Message *UnreliableUnorderedChannel_GetNextRecvedMessage(NBN_Channel *channel)
+{
+    NBN_UnreliableUnorderedChannel *unordered_channel = (NBN_UnreliableUnorderedChannel *)channel;
+
+    if (unordered_channel->recved_message_count == 0)
+        return NULL;
+
+    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[unordered_channel->next_recv_message_slot];
+
+    slot->free = true;
+
+    unordered_channel->next_recv_message_slot = (unordered_channel->next_recv_message_slot + 1) % channel->buffer_size;
+    unordered_channel->recved_message_count--;
+
+    return &slot->message;
+}
+
+static NBN_Message *UnreliableUnorderedChannel_GetNextOutgoingMessage(NBN_Channel *channel)
+{
+    NBN_UnreliableUnorderedChannel *unordered_channel = (NBN_UnreliableUnorderedChannel *)channel;
+
+    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[unordered_channel->next_outgoing_message_slot];
+
+    if (slot->free)
+        return NULL;
+
+    slot->free = true;
+    channel->outgoing_message_count--;
+
+    unordered_channel->next_outgoing_message_slot =
+        (unordered_channel->next_outgoing_message_slot + 1) % channel->buffer_size;
+
+    return &slot->message;
+}
+
+static int UnreliableUnorderedChannel_OnOutgoingMessageSent(NBN_Channel *channel, NBN_Message *message)
+{
+    return Connection_RecycleMessage(channel->connection, message);
+}
+
+#pragma endregion /* NBN_MessageChannel */
+
+#pragma region NBN_EventQueue
+
+int NBN_EventQueue_Init(NBN_EventQueue *event_queue, unsigned int capacity)
+{
+    event_queue->events = (NBN_Event *)NBN_Allocator(sizeof(NBN_Event) * capacity);
+
+    if (event_queue->events == NULL)
+        return NBN_ERROR;
+
+    event_queue->capacity = capacity;
+    event_queue->head = 0;
+    event_queue->tail = 0;
+    event_queue->count = 0;
+
+    return 0;
+}
+
+void NBN_EventQueue_Deinit(NBN_EventQueue *event_queue)
+{
+    NBN_Deallocator(event_queue->events);
+
+    event_queue->events = NULL;
+    event_queue->capacity = 0;
+    event_queue->count = 0;
+}
+
+bool NBN_EventQueue_Enqueue(NBN_EventQueue *event_queue, NBN_Event ev)
+{
+    if (event_queue->count >= event_queue->capacity)
+        return false;
+
+    event_queue->events[event_queue->tail] = ev;
+
+    event_queue->tail = (event_queue->tail + 1) % event_queue->capacity;
+    event_queue->count++;
+
+    return true;
+}
+
+bool NBN_EventQueue_Dequeue(NBN_EventQueue *event_queue, NBN_Event *ev)
+{
+    if (NBN_EventQueue_IsEmpty(event_queue))
+        return false;
+
+    memcpy(ev, &event_queue->events[event_queue->head], sizeof(NBN_Event));
+    event_queue->head = (event_queue->head + 1) % event_queue->capacity;
+    event_queue->count--;
+
+    return true;
+}
+
+bool NBN_EventQueue_IsEmpty(NBN_EventQueue *event_queue)
+{
+    return event_queue->count == 0;
+}
+
+#pragma endregion /* NBN_EventQueue */
+
+#pragma region NBN_Endpoint
+
+static uint32_t Endpoint_BuildProtocolId(const char *);
+static int Endpoint_ProcessReceivedPacket(NBN_Endpoint *, NBN_Packet *, NBN_Connection *);
+static NBN_OutgoingMessage *Endpoint_CreateOutgoingMessage(NBN_Endpoint *, uint8_t, void *);
+static int Endpoint_EnqueueOutgoingMessage(NBN_Endpoint *, NBN_Connection *, NBN_OutgoingMessage *, uint8_t);
+static int Endpoint_PrepareOutgoingMessage(NBN_Endpoint *, NBN_OutgoingMessage *, uint8_t, NBN_OutgoingMessage **);
+static int Endpoint_EnqueuePreparedMessage(
+        NBN_Connection *, NBN_OutgoingMessage *, uint8_t, NBN_OutgoingMessage **, int);
+static int Endpoint_SplitMessageIntoChunks(
+        NBN_Endpoint *, NBN_Message *, NBN_OutgoingMessage *, NBN_MessageSerializer, unsigned int, NBN_MessageChunk **);
+static void Endpoint_RecordMessage(NBN_Endpoint *, NBN_Connection *, uint8_t, uint8_t, void *, NBN_RecordDirection);
+static int Endpoint_ApplyConfig(NBN_Endpoint *, NBN_Config);
+
+int NBN_Endpoint_Init(NBN_Endpoint *endpoint, NBN_Config config, bool is_server)
+{
+    if (Endpoint_ApplyConfig(endpoint, config) < 0)
+        return NBN_ERROR;
+
+    endpoint->outgoing_message_buffer = (NBN_OutgoingMessage *)NBN_Allocator(
+            sizeof(NBN_OutgoingMessage) * endpoint->config.outgoing_message_buffer_size);
+
+    if (endpoint->outgoing_message_buffer == NULL)
+        return NBN_ERROR;
+
+    if (NBN_EventQueue_Init(&endpoint->event_queue, endpoint->config.event_queue_capacity) < 0)
+    {
+        NBN_Deallocator(endpoint->outgoing_message_buffer);
+
+        return NBN_ERROR;
+    }
+
+    endpoint->write_chunk_buffer = (uint8_t *)NBN_Allocator(NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE);
+    endpoint->write_chunk_buffer_size = NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE;
+
+    if (endpoint->write_chunk_buffer == NULL)
+    {
+        NBN_EventQueue_Deinit(&endpoint->event_queue);
+        NBN_Deallocator(endpoint->outgoing_message_buffer);
+
+        return NBN_ERROR;
+    }
+
+    MemoryManager_Init();
+
+    endpoint->is_server = is_server;
+    endpoint->next_outgoing_message = 0;
+    endpoint->start_time = NBN_Clock_GetTime();
+    endpoint->replicator = NULL;
+    endpoint->recorder = NULL;
+
+    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+        endpoint->channels[i] = NBN_CHANNEL_TYPE_UNDEFINED;
+
+    for (int i = 0; i < NBN_MAX_MESSAGE_TYPES; i++)
+    {
+        endpoint->message_builders[i] = NULL;
+        endpoint->message_destructors[i] = NULL;
+        endpoint->message_serializers[i] = NULL;
+    }
+
+    /* Register library reserved channels */
+    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED, NBN_CHANNEL_RESERVED_UNRELIABLE);
+    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_RELIABLE_ORDERED, NBN_CHANNEL_RESERVED_RELIABLE);
+    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_RELIABLE_ORDERED, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES);
+    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED, NBN_CHANNEL_RESERVED_INPUTS);
+
+    /* Register NBN_MessageChunk library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_MessageChunk_Create, NBN_MESSAGE_CHUNK_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_MessageChunk_Serialize, NBN_MESSAGE_CHUNK_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_MessageChunk_Destroy, NBN_MESSAGE_CHUNK_TYPE);
+
+    /* Register NBN_ClientClosedMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_ClientClosedMessage_Create, NBN_CLIENT_CLOSED_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_ClientClosedMessage_Serialize, NBN_CLIENT_CLOSED_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_ClientClosedMessage_Destroy, NBN_CLIENT_CLOSED_MESSAGE_TYPE);
+
+    /* Register NBN_ClientAcceptedMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_ClientAcceptedMessage_Create, NBN_CLIENT_ACCEPTED_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_ClientAcceptedMessage_Serialize, NBN_CLIENT_ACCEPTED_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_ClientAcceptedMessage_Destroy, NBN_CLIENT_ACCEPTED_MESSAGE_TYPE);
+
+    /* Register NBN_ByteArrayMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_ByteArrayMessage_Create, NBN_BYTE_ARRAY_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_ByteArrayMessage_Serialize, NBN_BYTE_ARRAY_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_ByteArrayMessage_Destroy, NBN_BYTE_ARRAY_MESSAGE_TYPE);
+
+    /* Register NBN_PublicCryptoInfoMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_PublicCryptoInfoMessage_Create, NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_PublicCryptoInfoMessage_Serialize, NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_PublicCryptoInfoMessage_Destroy, NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
+
+    /* Register NBN_StartEncryptMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_StartEncryptMessage_Create, NBN_START_ENCRYPT_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_StartEncryptMessage_Serialize, NBN_START_ENCRYPT_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_StartEncryptMessage_Destroy, NBN_START_ENCRYPT_MESSAGE_TYPE);
+
+    /* Register NBN_DisconnectionMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_DisconnectionMessage_Create, NBN_DISCONNECTION_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_DisconnectionMessage_Serialize, NBN_DISCONNECTION_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_DisconnectionMessage_Destroy, NBN_DISCONNECTION_MESSAGE_TYPE);
+
+    /* Register NBN_ConnectionRequestMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_ConnectionRequestMessage_Create, NBN_CONNECTION_REQUEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_ConnectionRequestMessage_Serialize, NBN_CONNECTION_REQUEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_ConnectionRequestMessage_Destroy, NBN_CONNECTION_REQUEST_MESSAGE_TYPE);
+
+    /* Register NBN_FECParityMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_FECParityMessage_Create, NBN_FEC_PARITY_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_FECParityMessage_Serialize, NBN_FEC_PARITY_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_FECParityMessage_Destroy, NBN_FEC_PARITY_MESSAGE_TYPE);
+
+    /* Register NBN_ReplicationMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_ReplicationMessage_Create, NBN_REPLICATION_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_ReplicationMessage_Serialize, NBN_REPLICATION_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_ReplicationMessage_Destroy, NBN_REPLICATION_MESSAGE_TYPE);
+
+    /* Register NBN_SnapshotMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_SnapshotMessage_Create, NBN_SNAPSHOT_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_SnapshotMessage_Serialize, NBN_SNAPSHOT_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_SnapshotMessage_Destroy, NBN_SNAPSHOT_MESSAGE_TYPE);
+
+    /* Register NBN_InputMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_InputMessage_Create, NBN_INPUT_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_InputMessage_Serialize, NBN_INPUT_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_InputMessage_Destroy, NBN_INPUT_MESSAGE_TYPE);
+
+    /* Register NBN_AckRangesMessage library message */
+    NBN_Endpoint_RegisterMessageBuilder(
+            endpoint, (NBN_MessageBuilder)NBN_AckRangesMessage_Create, NBN_ACK_RANGES_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(
+            endpoint, (NBN_MessageSerializer)NBN_AckRangesMessage_Serialize, NBN_ACK_RANGES_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(
+            endpoint, (NBN_MessageDestructor)NBN_AckRangesMessage_Destroy, NBN_ACK_RANGES_MESSAGE_TYPE);
+
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    NBN_PacketSimulator_Init(&endpoint->packet_simulator);
+    NBN_PacketSimulator_Start(&endpoint->packet_simulator);
+#endif
+
+    return 0;
+}
+
+void NBN_Endpoint_Deinit(NBN_Endpoint *endpoint)
+{
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    NBN_PacketSimulator_Stop(&endpoint->packet_simulator);
+#endif
+
+    /* hooks are not reset by NBN_Endpoint_Init so they can be installed before the endpoint is started */
+    memset(endpoint->hooks, 0, sizeof(endpoint->hooks));
+
+    NBN_EventQueue_Deinit(&endpoint->event_queue);
+    NBN_Deallocator(endpoint->outgoing_message_buffer);
+    NBN_Deallocator(endpoint->write_chunk_buffer);
+
+    endpoint->outgoing_message_buffer = NULL;
+    endpoint->write_chunk_buffer = NULL;
+
+    MemoryManager_Deinit();
+}
+
+void NBN_Endpoint_SetHook(NBN_Endpoint *endpoint, NBN_HookType type, NBN_Hook hook, void *user_data)
+{
+    assert(type < NBN_HOOK_COUNT);
+
+    endpoint->hooks[type].callback = hook;
+    endpoint->hooks[type].user_data = user_data;
+}
+
+#ifdef NBN_DEBUG
+
+/* Adapts the legacy debug callback (stored in the hook user data) to the hook signature */
+static void Endpoint_CallDebugCallback(NBN_HookType type, NBN_Connection *connection, void *data, void *cb)
+{
+    (void)type;
+
+    ((void (*)(NBN_Connection *, NBN_Message *))cb)(connection, (NBN_Message *)data);
+}
+
+#endif /* NBN_DEBUG */
+
+void NBN_Endpoint_RegisterMessageBuilder(NBN_Endpoint *endpoint, NBN_MessageBuilder msg_builder, uint8_t msg_type)
+{
+    endpoint->message_builders[msg_type] = msg_builder;
+}
+
+void NBN_Endpoint_RegisterMessageDestructor(NBN_Endpoint *endpoint, NBN_MessageDestructor msg_destructor, uint8_t msg_type)
+{
+    endpoint->message_destructors[msg_type] = msg_destructor;
+}
+
+void NBN_Endpoint_RegisterMessageSerializer(
+        NBN_Endpoint *endpoint, NBN_MessageSerializer msg_serializer, uint8_t msg_type)
+{
+    endpoint->message_serializers[msg_type] = msg_serializer;
+}
+
+void NBN_Endpoint_RegisterChannel(NBN_Endpoint *endpoint, NBN_ChannelType type, uint8_t id)
+{
+    assert(endpoint->channels[id] == NBN_CHANNEL_TYPE_UNDEFINED);
+
+    endpoint->channels[id] = type;
+}
+
+NBN_Connection *NBN_Endpoint_CreateConnection(NBN_Endpoint *endpoint, uint32_t id, void *driver_data)
+{
+    NBN_Connection *connection = NBN_Connection_Create(
+            id, Endpoint_BuildProtocolId(endpoint->config.protocol_name), endpoint, driver_data);
+
+    if (connection == NULL)
+        return NULL;
+
+    for (int chan_id = 0; chan_id < NBN_MAX_CHANNELS; chan_id++)
+    {
+        NBN_ChannelType channel_type = endpoint->channels[chan_id];
+
+        if (channel_type == NBN_CHANNEL_TYPE_UNDEFINED)
+            continue;
+
+        if (NBN_Connection_CreateChannel(connection, channel_type, chan_id) < 0)
+        {
+            NBN_LogError("Failed to create channel %d of connection %d", chan_id, id);
+
+            NBN_Connection_Destroy(connection);
+
+            return NULL;
+        }
+    }
+
+    return connection;
+}
+
+double NBN_Endpoint_GetTime(NBN_Endpoint *endpoint)
+{
+    return NBN_Clock_GetTime() - endpoint->start_time;
+}
+
+static uint32_t Endpoint_BuildProtocolId(const char *protocol_name)
+{
+    uint32_t protocol_id = 2166136261;
+
+    for (unsigned int i = 0; i < strlen(protocol_name); i++)
+    {
+        protocol_id *= 16777619;
+        protocol_id ^= protocol_name[i];
+    }
+
+    return protocol_id;
+}
+
+static int Endpoint_ProcessReceivedPacket(NBN_Endpoint *endpoint, NBN_Packet *packet, NBN_Connection *connection)
+{
+    (void)endpoint;
+
+    NBN_LogTrace("Received packet %d (conn id: %d, ack: %d, messages count: %d)", packet->header.seq_number,
+            connection->id, packet->header.ack, packet->header.messages_count);
+
+    if (NBN_Connection_ProcessReceivedPacket(connection, packet) < 0)
+        return NBN_ERROR;
+
+    connection->last_recv_packet_time = connection->time;
+    connection->downloaded_bytes += packet->size;
+
+    return 0;
+}
+
+static NBN_OutgoingMessage *Endpoint_CreateOutgoingMessage(NBN_Endpoint *endpoint, uint8_t msg_type, void *data)
+{
+    if (endpoint->message_serializers[msg_type] == NULL)
+    {
+        NBN_LogError("No message serializer is registered for messages of type %d", msg_type);
+
+        return NULL;
+    }
+
+    NBN_OutgoingMessage *outgoing_message = &endpoint->outgoing_message_buffer[endpoint->next_outgoing_message];
+
+    outgoing_message->type = msg_type;
+    outgoing_message->data = data;
+    outgoing_message->ref_count = 0;
+
+    endpoint->next_outgoing_message = (endpoint->next_outgoing_message + 1) % endpoint->config.outgoing_message_buffer_size;
+
+    return outgoing_message;
+}
+
+static int Endpoint_EnqueueOutgoingMessage(
+        NBN_Endpoint *endpoint, NBN_Connection *connection, NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
+{
+    NBN_Channel *channel = connection->channels[channel_id];
+
+    if (channel == NULL)
+    {
+        NBN_LogError("Channel %d does not exist", channel_id);
+
+        return NBN_ERROR;
+    }
+
+    NBN_OutgoingMessage *chunk_msgs[NBN_CHANNEL_CHUNKS_BUFFER_SIZE];
+    int chunk_count = Endpoint_PrepareOutgoingMessage(endpoint, outgoing_msg, channel_id, chunk_msgs);
+
+    if (chunk_count < 0)
+        return NBN_ERROR;
+
+    return Endpoint_EnqueuePreparedMessage(connection, outgoing_msg, channel_id, chunk_msgs, chunk_count);
+}
+
+/*
+ * Measure an outgoing message and split it into chunks when it does not fit in a single packet.
+ *
+ * The result can be enqueued to any number of connections with Endpoint_EnqueuePreparedMessage, the chunks
+ * are shared by all of them.
+ *
+ * Return the number of chunks (0 when the message is not split) or NBN_ERROR.
+ */
+static int Endpoint_PrepareOutgoingMessage(
+        NBN_Endpoint *endpoint,
+        NBN_OutgoingMessage *outgoing_msg,
+        uint8_t channel_id,
+        NBN_OutgoingMessage **chunk_msgs)
+{
+    NBN_MessageSerializer msg_serializer = endpoint->message_serializers[outgoing_msg->type];
+
+    assert(msg_serializer); 
+
+    NBN_Message message = {
+        { 0, outgoing_msg->type, channel_id },
+        NULL,
+        outgoing_msg,
+        outgoing_msg->data
+    };
+
+    NBN_MeasureStream m_stream;
+
+    NBN_MeasureStream_Init(&m_stream);
+
+    unsigned int message_size = (NBN_Message_Measure(&message, &m_stream, msg_serializer) - 1) / 8 + 1;
+
+    if (message_size <= NBN_PACKET_MAX_USER_DATA_SIZE)
+        return 0;
+
+    if (endpoint->channels[channel_id] == NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED)
+    {
+        NBN_LogError("Message of type %d is too big for unordered channel %d (%d bytes)",
+                outgoing_msg->type, channel_id, message_size);
+
+        return NBN_ERROR;
+    }
+
+    NBN_MessageChunk *chunks[NBN_CHANNEL_CHUNKS_BUFFER_SIZE];
+    int chunk_count = Endpoint_SplitMessageIntoChunks(
+            endpoint, &message, outgoing_msg, msg_serializer, message_size, chunks);
+
+    assert(chunk_count <= NBN_CHANNEL_CHUNKS_BUFFER_SIZE);
+
+    if (chunk_count < 0)
+    {
+        NBN_LogError("Failed to split message into chunks");
+
+        return NBN_ERROR;
+    }
+
+    /* The message is released once all of its chunks have been released */
+    outgoing_msg->ref_count += chunk_count;
+
+    for (int i = 0; i < chunk_count; i++)
+    {
+        chunk_msgs[i] = Endpoint_CreateOutgoingMessage(endpoint, NBN_MESSAGE_CHUNK_TYPE, chunks[i]);
+
+        if (chunk_msgs[i] == NULL)
+            return NBN_ERROR;
+    }
+
+    return chunk_count;
+}
+
+static int Endpoint_EnqueuePreparedMessage(
+        NBN_Connection *connection,
+        NBN_OutgoingMessage *outgoing_msg,
+        uint8_t channel_id,
+        NBN_OutgoingMessage **chunk_msgs,
+        int chunk_count)
+{
+    NBN_Channel *channel = connection->channels[channel_id];
+
+    if (channel == NULL)
+    {
+        NBN_LogError("Channel %d does not exist", channel_id);
+
+        return NBN_ERROR;
+    }
+
+    if (connection->endpoint->recorder)
+    {
+        Endpoint_RecordMessage(
+                connection->endpoint, connection, channel_id, outgoing_msg->type, outgoing_msg->data, NBN_RECORD_SENT);
+    }
+
+    if (chunk_count == 0)
+    {
+        NBN_Message message = {
+            { 0, outgoing_msg->type, channel_id },
+            NULL,
+            outgoing_msg,
+            outgoing_msg->data
+        };
+
+        outgoing_msg->ref_count++;
+
+        if (NBN_Connection_EnqueueOutgoingMessage(connection, channel, &message) < 0)
+        {
+            outgoing_msg->ref_count--;
+
+            return NBN_ERROR;
+        }
+
+        return 0;
+    }
+
+    for (int i = 0; i < chunk_count; i++)
+    {
+        NBN_Message chunk_message = {
+            { 0, NBN_MESSAGE_CHUNK_TYPE, channel_id },
+            NULL,
+            chunk_msgs[i],
+            chunk_msgs[i]->data
+        };
+
+        chunk_msgs[i]->ref_count++;
+
+        if (NBN_Connection_EnqueueOutgoingMessage(connection, channel, &chunk_message) < 0)
+        {
+            NBN_LogError("Failed to enqueue message chunk");
+
+            chunk_msgs[i]->ref_count--;
+
+            return NBN_ERROR;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Record a message sent to or received from a connection, messages are recorded once, before being split into
+ * chunks or after being reconstructed from chunks.
+ *
+ * Recording is a debugging tool: when it fails, the recording is stopped (keeping the messages recorded so far)
+ * and the message is still sent or received.
+ */
+static void Endpoint_RecordMessage(
+        NBN_Endpoint *endpoint,
+        NBN_Connection *connection,
+        uint8_t channel_id,
+        uint8_t msg_type,
+        void *data,
+        NBN_RecordDirection direction)
+{
+    if (NBN_Recorder_RecordMessage(
+                endpoint->recorder,
+                NBN_Endpoint_GetTime(endpoint),
+                connection->id,
+                channel_id,
+                msg_type,
+                data,
+                endpoint->message_serializers[msg_type],
+                direction) < 0)
+    {
+        NBN_Recorder *recorder = endpoint->recorder;
+
+        NBN_LogError("Failed to record message of type %d, stopped recording (%d messages)",
+                msg_type, recorder->record_count);
+
+        endpoint->recorder = NULL;
+
+        NBN_Recorder_Destroy(recorder);
+    }
+}
+
+/* Replace the limits left to 0 by their default value and check them */
+static int Endpoint_ApplyConfig(NBN_Endpoint *endpoint, NBN_Config config)
+{
+    if (config.channel_buffer_size == 0)
+        config.channel_buffer_size = NBN_CHANNEL_BUFFER_SIZE;
+
+    if (config.max_packet_entries == 0)
+        config.max_packet_entries = NBN_MAX_PACKET_ENTRIES;
+
+    if (config.event_queue_capacity == 0)
+        config.event_queue_capacity = NBN_EVENT_QUEUE_CAPACITY;
+
+    if (config.outgoing_message_buffer_size == 0)
+        config.outgoing_message_buffer_size = NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE;
+
+    if (config.max_sent_packet_count == 0)
+        config.max_sent_packet_count = NBN_CONNECTION_MAX_SENT_PACKET_COUNT;
+
+    if (config.stale_time_threshold == 0)
+        config.stale_time_threshold = NBN_CONNECTION_STALE_TIME_THRESHOLD;
+
+    /* message ids and packet sequence numbers are 16 bits, the buffers must divide and cover at most half of their range */
+    if (!IS_POWER_OF_TWO(config.channel_buffer_size) || config.channel_buffer_size > 0x8000)
+    {
+        NBN_LogError("Channel buffer size must be a power of two lower or equal to 32768 (%d)", config.channel_buffer_size);
+
+        return NBN_ERROR;
+    }
+
+    /* packets are acked up to 32 packets behind the last received one */
+    if (!IS_POWER_OF_TWO(config.max_packet_entries) || config.max_packet_entries < 64 || config.max_packet_entries > 0x8000)
+    {
+        NBN_LogError("Max packet entries must be a power of two between 64 and 32768 (%d)", config.max_packet_entries);
+
+        return NBN_ERROR;
+    }
+
+    if (config.max_sent_packet_count > NBN_CONNECTION_MAX_SENT_PACKET_COUNT_LIMIT)
+    {
+        NBN_LogError("Max sent packet count cannot exceed %d (%d)",
+                NBN_CONNECTION_MAX_SENT_PACKET_COUNT_LIMIT, config.max_sent_packet_count);
+
+        return NBN_ERROR;
+    }
+
+    /* a FEC group must still fit a couple of packets once a full flush is accounted for in its span */
+    if (config.is_fec_enabled && config.max_sent_packet_count > NBN_FEC_MAX_GROUP_SPAN - NBN_FEC_MIN_GROUP_SIZE - 2)
+    {
+        NBN_LogError("Max sent packet count cannot exceed %d when FEC is enabled (%d)",
+                NBN_FEC_MAX_GROUP_SPAN - NBN_FEC_MIN_GROUP_SIZE - 2, config.max_sent_packet_count);
+
+        return NBN_ERROR;
+    }
+
+    if (!IS_POWER_OF_TWO(config.event_queue_capacity) || config.event_queue_capacity < 16 || config.event_queue_capacity > 0x10000)
+    {
+        NBN_LogError("Event queue capacity must be a power of two between 16 and 65536 (%d)", config.event_queue_capacity);
+
+        return NBN_ERROR;
+    }
+
+    if (!IS_POWER_OF_TWO(config.outgoing_message_buffer_size) ||
+            config.outgoing_message_buffer_size < 16 || config.outgoing_message_buffer_size > 0x10000)
+    {
+        NBN_LogError("Outgoing message buffer size must be a power of two between 16 and 65536 (%d)",
+                config.outgoing_message_buffer_size);
+
+        return NBN_ERROR;
+    }
+
+    if (config.stale_time_threshold <= NBN_CONNECTION_KEEP_ALIVE_INTERVAL)
+    {
+        NBN_LogError("Stale time threshold must be greater than the keep alive interval (%f)", config.stale_time_threshold);
+
+        return NBN_ERROR;
+    }
+
+    endpoint->config = config;
+
+    return 0;
+}
+
+static int Endpoint_SplitMessageIntoChunks(
+        NBN_Endpoint *endpoint,
+        NBN_Message *message,
+        NBN_OutgoingMessage *outgoing_msg,
+        NBN_MessageSerializer msg_serializer,
+        unsigned int message_size,
+        NBN_MessageChunk **chunks)
+{
+    unsigned int chunk_count = ((message_size - 1) / NBN_MESSAGE_CHUNK_SIZE) + 1;
 
-#ifndef ABS
-#define ABS(v) (((v) > 0) ? (v) : -(v))
-#endif
+    NBN_LogTrace("Split message into %d chunks (message size: %d)", chunk_count, message_size);
 
-#define SEQUENCE_NUMBER_GT(seq1, seq2) \
-    ((seq1 > seq2 && (seq1 - seq2) <= 32767) || (seq1 < seq2 && (seq2 - seq1) >= 32767))
-#define SEQUENCE_NUMBER_GTE(seq1, seq2) \
-    ((seq1 >= seq2 && (seq1 - seq2) <= 32767) || (seq1 <= seq2 && (seq2 - seq1) >= 32767))
-#define SEQUENCE_NUMBER_LT(seq1, seq2) \
-    ((seq1 < seq2 && (seq2 - seq1) <= 32767) || (seq1 > seq2 && (seq1 - seq2) >= 32767))
+    if (chunk_count > NBN_CHANNEL_CHUNKS_BUFFER_SIZE)
+    {
+        NBN_LogError("The maximum number of chunks is 255");
 
-#pragma endregion /* Utils */
+        return NBN_ERROR;
+    }
 
-#pragma endregion /* Declarations */
+    if (message_size > endpoint->write_chunk_buffer_size)
+    {
+        uint8_t *write_chunk_buffer = (uint8_t *)NBN_Reallocator(endpoint->write_chunk_buffer, message_size);
 
-#endif /* NBNET_H */
+        if (write_chunk_buffer == NULL)
+        {
+            NBN_LogError("Failed to grow the chunk write buffer");
 
-#pragma region Implementations
+            return NBN_ERROR;
+        }
 
-#ifdef NBNET_IMPL
+        endpoint->write_chunk_buffer = write_chunk_buffer;
+        endpoint->write_chunk_buffer_size = message_size;
+    }
 
-#pragma region NBN_ConnectionVector
+    NBN_WriteStream w_stream;
 
-static int NBN_ConnectionVector_Grow(NBN_ConnectionVector *vector, unsigned int new_capacity);
+    NBN_WriteStream_Init(&w_stream, endpoint->write_chunk_buffer, message_size);
 
-static NBN_ConnectionVector *NBN_ConnectionVector_Create(void)
+    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)&w_stream) < 0)
+        return NBN_ERROR;
+
+    if (NBN_Message_SerializeData(message, (NBN_Stream *)&w_stream, msg_serializer) < 0)
+        return NBN_ERROR;
+
+    for (unsigned int i = 0; i < chunk_count; i++)
+    {
+        NBN_MessageChunk *chunk = NBN_MessageChunk_Create();
+
+        chunk->id = i;
+        chunk->total = chunk_count;
+        chunk->outgoing_msg = outgoing_msg;
+
+        unsigned int offset = i * NBN_MESSAGE_CHUNK_SIZE;
+        unsigned int chunk_size = MIN(NBN_MESSAGE_CHUNK_SIZE, message_size - offset); 
+
+        assert(chunk_size <= NBN_MESSAGE_CHUNK_SIZE);
+
+        memcpy(chunk->data, endpoint->write_chunk_buffer + offset, chunk_size);
+
+        NBN_LogTrace("Enqueue chunk %d (size: %d, total: %d) for message %d of type %d",
+                chunk->id, chunk_size, chunk->total, message->header.id, message->header.type);
+
+        chunks[i] = chunk;
+    }
+
+    return chunk_count;
+}
+
+#pragma endregion /* NBN_Endpoint */
+
+#pragma region NBN_GameClient
+
+NBN_GameClient __game_client;
+
+NBN_Event client_last_event;
+static uint8_t client_last_received_message_type;
+static int client_closed_code = -1;
+
+static int GameClient_ProcessReceivedMessage(NBN_Message *, NBN_Connection *);
+static int GameClient_HandleEvent(void);
+static int GameClient_HandleMessageReceivedEvent(void);
+static int GameClient_SendCryptoPublicInfo(void);
+static void GameClient_StartEncryption(void);
+
+int NBN_GameClient_Start(const char *protocol_name, const char *ip_address, uint16_t port, bool encryption, uint8_t *connection_data)
 {
-    NBN_ConnectionVector *vector = NBN_Allocator(sizeof(NBN_ConnectionVector));
+    NBN_Config config = {0};
 
-    vector->connections = NULL;
-    vector->capacity = 0;
-    vector->count = 0;
+    config.protocol_name = protocol_name;
+    config.ip_address = ip_address;
+    config.port = port;
+    config.is_encryption_enabled = encryption;
 
-    if (NBN_ConnectionVector_Grow(vector, NBN_CONNECTION_VECTOR_INITIAL_CAPACITY) < 0)
-        return NULL;
+    return NBN_GameClient_StartWithConfig(config, connection_data);
+}
 
-    return vector;
+int NBN_GameClient_StartWithConfig(NBN_Config config, uint8_t *connection_data)
+{
+    if (NBN_Endpoint_Init(&__game_client.endpoint, config, false) < 0)
+        return NBN_ERROR;
+
+    __game_client.server_connection = NULL;
+    __game_client.is_connected = false;
+
+    if (NBN_Driver_GCli_Start(Endpoint_BuildProtocolId(config.protocol_name), config.ip_address, config.port) < 0)
+        return NBN_ERROR;
+
+    NBN_ConnectionRequestMessage *msg = NBN_ConnectionRequestMessage_Create();
+
+    if (connection_data)
+        memcpy(msg->data, connection_data, NBN_CONNECTION_DATA_MAX_SIZE);
+
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_CONNECTION_REQUEST_MESSAGE_TYPE, msg);
+
+    if (outgoing_msg == NULL)
+        return NBN_ERROR;
+
+    if (NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES) < 0)
+        return NBN_ERROR;
+
+    NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CONNECTION_REQUESTED, __game_client.server_connection, NULL);
+
+    NBN_LogInfo("Started");
+
+    return 0;
+}
+
+int NBN_GameClient_Disconnect(void)
+{
+    NBN_LogInfo("Disconnecting...");
+
+    if (__game_client.server_connection->is_closed || __game_client.server_connection->is_stale)
+    {
+        NBN_LogInfo("Not connected");
+
+        return 0;
+    }
+
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_DISCONNECTION_MESSAGE_TYPE, NULL);
+
+    if (outgoing_msg == NULL)
+        return NBN_ERROR;
+
+    if (NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES) < 0)
+        return NBN_ERROR;
+
+    if (NBN_GameClient_SendPackets() < 0)
+        return NBN_ERROR;
+
+    __game_client.server_connection->is_closed = true;
+
+    NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CONNECTION_CLOSED, __game_client.server_connection, NULL);
+
+    NBN_LogInfo("Disconnected");
+
+    return 0;
+}
+
+void NBN_GameClient_Stop(void)
+{
+    NBN_GameClient_Poll(); /* Poll one last time to clear remaining events */
+
+    if (__game_client.server_connection)
+        NBN_Connection_Destroy(__game_client.server_connection);
+
+    NBN_Endpoint_Deinit(&__game_client.endpoint);
+    NBN_Driver_GCli_Stop();
+
+    NBN_LogInfo("Stopped");
+}
+
+void NBN_GameClient_RegisterMessage(
+        uint8_t msg_type,
+        NBN_MessageBuilder msg_builder,
+        NBN_MessageDestructor msg_destructor,
+        NBN_MessageSerializer msg_serializer)
+{
+    if (NBN_IsReservedMessage(msg_type))
+    {
+        NBN_LogError("Message type %d is reserved by the library", msg_type);
+        NBN_Abort();
+    }
+
+    NBN_Endpoint_RegisterMessageBuilder(&__game_client.endpoint, msg_builder, msg_type);
+    NBN_Endpoint_RegisterMessageDestructor(&__game_client.endpoint, msg_destructor, msg_type);
+    NBN_Endpoint_RegisterMessageSerializer(&__game_client.endpoint, msg_serializer, msg_type);
+}
+
+void NBN_GameClient_RegisterChannel(uint8_t type, uint8_t id)
+{
+    if (NBN_IsReservedChannel(id))
+    {
+        NBN_LogError("Channel id %d is reserved by the library", type);
+        NBN_Abort();
+    }
+
+    NBN_Endpoint_RegisterChannel(&__game_client.endpoint, (NBN_ChannelType)type, id);
+
+    /* some drivers create the server connection as soon as the client is started */
+    if (__game_client.server_connection)
+    {
+        if (NBN_Connection_CreateChannel(__game_client.server_connection, (NBN_ChannelType)type, id) < 0)
+        {
+            NBN_LogError("Failed to create channel %d on the server connection", id);
+            NBN_Abort();
+        }
+    }
+}
+
+void NBN_GameClient_AddTime(double time)
+{
+    NBN_Connection_AddTime(__game_client.server_connection, time);
+
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    NBN_PacketSimulator_AddTime(&__game_client.endpoint.packet_simulator, time);
+#endif
 }
 
-static void NBN_ConnectionVector_Destroy(NBN_ConnectionVector *vector)
-{
-    for (unsigned int i = 0; i < vector->count; i++)
-        NBN_Connection_Destroy(vector->connections[i]);
+int NBN_GameClient_Poll(void)
+{
+    if (__game_client.server_connection->is_stale)
+        return NBN_NO_EVENT;
+
+    if (NBN_EventQueue_IsEmpty(&__game_client.endpoint.event_queue))
+    {
+        if (NBN_Connection_CheckIfStale(__game_client.server_connection))
+        {
+            __game_client.server_connection->is_stale = true;
+            __game_client.is_connected = false;
+
+            NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CONNECTION_STALE, __game_client.server_connection, NULL);
+
+            NBN_LogInfo("Server connection is stale. Disconnected.");
+
+            NBN_Event e;
+
+            e.type = NBN_DISCONNECTED;
+            e.data.connection = (NBN_Connection*)NULL;
+
+            if (!NBN_EventQueue_Enqueue(&__game_client.endpoint.event_queue, e))
+                return NBN_ERROR;
+        }
+        else
+        {
+            if (NBN_Driver_GCli_RecvPackets() < 0)
+                return NBN_ERROR;
+
+            for (unsigned int i = 0; i < NBN_MAX_CHANNELS; i++)
+            {
+                NBN_Channel *channel = __game_client.server_connection->channels[i];
+
+                if (channel)
+                {
+                    NBN_Message *msg;
+
+                    while ((msg = channel->GetNextRecvedMessage(channel)) != NULL)
+                    {
+                        NBN_LogTrace("Got message %d of type %d from the recv queue", msg->header.id, msg->header.type);
+
+                        if (GameClient_ProcessReceivedMessage(msg, __game_client.server_connection) < 0)
+                        {
+                            NBN_LogError("Failed to process received message");
+
+                            return NBN_ERROR;
+                        }
+                    }
+                }
+            }
+
+            Connection_UpdateAverageDownloadBandwidth(__game_client.server_connection);
+
+            __game_client.server_connection->last_read_packets_time = __game_client.server_connection->time;
+        }
+    }
+
+    bool ret = NBN_EventQueue_Dequeue(&__game_client.endpoint.event_queue, &client_last_event);
 
-    NBN_Deallocator(vector->connections);
-    NBN_Deallocator(vector);
+    return ret ? GameClient_HandleEvent() : NBN_NO_EVENT;
 }
 
-static int NBN_ConnectionVector_Add(NBN_ConnectionVector *vector, NBN_Connection *conn)
+int NBN_GameClient_SendPackets(void)
 {
-    if (vector->count >= vector->capacity)
-    {
-        if (NBN_ConnectionVector_Grow(vector, vector->capacity * 2) < 0)
-            return NBN_ERROR;
-    }
-
-    if (vector->connections[vector->count])
+    if (NBN_Connection_FlushSendQueue(__game_client.server_connection) < 0)
         return NBN_ERROR;
 
-    vector->connections[vector->count] = conn;
-    vector->count++;
+#if defined(NBN_DRIVER_HAS_FLUSH) && defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    /* the packet simulator thread hands the packets to the driver with its queue locked */
+    NBN_PacketSimulator_Lock(&__game_client.endpoint.packet_simulator);
+
+    int ret = NBN_Driver_GCli_FlushPackets();
 
+    NBN_PacketSimulator_Unlock(&__game_client.endpoint.packet_simulator);
+
+    return ret;
+#elif defined(NBN_DRIVER_HAS_FLUSH)
+    return NBN_Driver_GCli_FlushPackets();
+#else
     return 0;
+#endif
 }
 
-static void NBN_ConnectionVector_Remove(NBN_ConnectionVector *vector, NBN_Connection *conn)
+void NBN_GameClient_SetContext(void *context)
 {
-    unsigned int idx = 0;
-
-    for (; idx < vector->count && vector->connections[idx] != conn; idx++);
-
-    if (idx == vector->count) return; // not found
+    __game_client.context = context;
+}
 
-    for (unsigned int i = idx; i < vector->count - 1; i++)
-        vector->connections[i] = vector->connections[i + 1];
+void *NBN_GameClient_GetContext(void)
+{
+    return __game_client.context;
+}
 
-    vector->connections[vector->count - 1] = NULL;
-    vector->count--;
+NBN_OutgoingMessage *NBN_GameClient_CreateMessage(uint8_t msg_type, void *msg_data)
+{
+    return Endpoint_CreateOutgoingMessage(&__game_client.endpoint, msg_type, msg_data);
 }
 
-static int NBN_ConnectionVector_Grow(NBN_ConnectionVector *vector, unsigned int new_capacity)
+int NBN_GameClient_SendMessage(NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
 {
-    vector->connections = NBN_Reallocator(vector->connections, sizeof(NBN_Connection *) * new_capacity);
+    if (Endpoint_EnqueueOutgoingMessage(
+                &__game_client.endpoint, __game_client.server_connection, outgoing_msg, channel_id) < 0)
+    {
+        NBN_LogError("Failed to create outgoing message");
 
-    if (vector->connections == NULL)
         return NBN_ERROR;
-
-    for (unsigned int i = 0; i < new_capacity - vector->capacity; i++)
-        vector->connections[vector->capacity + i] = NULL;
-
-    vector->capacity = new_capacity;
+    }
 
     return 0;
 }
 
-#pragma endregion // NBN_ConnectionVector
-
-#pragma region Memory management
+NBN_OutgoingMessage *NBN_GameClient_CreateByteArrayMessage(uint8_t *bytes, unsigned int length)
+{
+    if (length > NBN_BYTE_ARRAY_MAX_SIZE)
+    {
+        NBN_LogError("Byte array cannot exceed %d bytes", NBN_BYTE_ARRAY_MAX_SIZE);
 
-NBN_MemoryManager __mem_manager;
+        return NULL;
+    }
 
-static void MemoryManager_Init(void);
-static void MemoryManager_Deinit(void);
-static void *MemoryManager_Alloc(unsigned int);
-static void MemoryManager_Dealloc(void *, unsigned int);
+    NBN_ByteArrayMessage *msg = NBN_ByteArrayMessage_Create();
 
-#if !defined(NBN_DISABLE_MEMORY_POOLING)
+    memcpy(msg->bytes, bytes, length);
 
-static void MemPool_Init(NBN_MemPool *, size_t, unsigned int);
-static void MemPool_Deinit(NBN_MemPool *);
-static void MemPool_Grow(NBN_MemPool *, unsigned int);
-static void *MemPool_Alloc(NBN_MemPool *);
-static void MemPool_Dealloc(NBN_MemPool *, void *);
+    msg->length = length;
 
-#endif /* NBN_DISABLE_MEMORY_POOLING */
+    return NBN_GameClient_CreateMessage(NBN_BYTE_ARRAY_MESSAGE_TYPE, msg);
+}
 
-static void MemoryManager_Init(void)
+int NBN_GameClient_SendUnreliableMessage(NBN_OutgoingMessage *outgoing_msg)
 {
-#ifdef NBN_DISABLE_MEMORY_POOLING
-    NBN_LogDebug("MemoryManager_Init without pooling!");
-
-    __mem_manager.mem_sizes[NBN_MEM_MESSAGE_CHUNK] = sizeof(NBN_MessageChunk);
-    __mem_manager.mem_sizes[NBN_MEM_BYTE_ARRAY_MESSAGE] = sizeof(NBN_ByteArrayMessage);
-    __mem_manager.mem_sizes[NBN_MEM_CONNECTION] = sizeof(NBN_Connection);
-
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    __mem_manager.mem_sizes[NBN_MEM_PACKET_SIMULATOR_ENTRY] = sizeof(NBN_PacketSimulatorEntry);
-#endif
-#else
-    NBN_LogDebug("MemoryManager_Init with pooling!");
-
-    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_MESSAGE_CHUNK], sizeof(NBN_MessageChunk), 256);
-    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_BYTE_ARRAY_MESSAGE], sizeof(NBN_ByteArrayMessage), 256);
-    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_CONNECTION], sizeof(NBN_Connection), 16);
-
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    MemPool_Init(&__mem_manager.mem_pools[NBN_MEM_PACKET_SIMULATOR_ENTRY], sizeof(NBN_PacketSimulatorEntry), 32);
-#endif
-#endif /* NBN_DISABLE_MEMORY_POOLING */
+    return NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_UNRELIABLE);
 }
 
-static void MemoryManager_Deinit(void)
+int NBN_GameClient_SendReliableMessage(NBN_OutgoingMessage *outgoing_msg)
 {
-#if !defined(NBN_DISABLE_MEMORY_POOLING)
-    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_MESSAGE_CHUNK]);
-    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_BYTE_ARRAY_MESSAGE]);
-    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_CONNECTION]);
-
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    MemPool_Deinit(&__mem_manager.mem_pools[NBN_MEM_PACKET_SIMULATOR_ENTRY]);
-#endif
-#endif /* NBN_DISABLE_MEMORY_POOLING */
+    return NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_RELIABLE);
 }
 
-static void *MemoryManager_Alloc(unsigned int mem_tag)
+NBN_Connection *NBN_GameClient_CreateServerConnection(void *driver_data)
 {
-#ifdef NBN_DISABLE_MEMORY_POOLING
-    return NBN_Allocator(__mem_manager.mem_sizes[mem_tag]);
-#else
-    return MemPool_Alloc(&__mem_manager.mem_pools[mem_tag]);
-#endif /* NBN_DISABLE_MEMORY_POOLING */
+    NBN_Connection *server_connection = NBN_Endpoint_CreateConnection(&__game_client.endpoint, 0, driver_data);
+
+    __game_client.server_connection = server_connection;
+
+    return server_connection;
 }
 
-static void MemoryManager_Dealloc(void *ptr, unsigned int mem_tag)
+NBN_MessageInfo NBN_GameClient_GetMessageInfo(void)
 {
-#ifdef NBN_DISABLE_MEMORY_POOLING
-    (void)mem_tag;
+    assert(client_last_event.type == NBN_MESSAGE_RECEIVED);
 
-    NBN_Deallocator(ptr);
-#else
-    MemPool_Dealloc(&__mem_manager.mem_pools[mem_tag], ptr);
-#endif /* NBN_DISABLE_MEMORY_POOLING */
+    return client_last_event.data.message_info;
 }
 
-#if !defined(NBN_DISABLE_MEMORY_POOLING)
-
-static void MemPool_Init(NBN_MemPool *pool, size_t block_size, unsigned int initial_block_count)
+NBN_ConnectionStats NBN_GameClient_GetStats(void)
 {
-    pool->block_size = MAX(block_size, sizeof(NBN_MemPoolFreeBlock));
-    pool->block_idx = 0;
-    pool->block_count = 0;
-    pool->free = NULL;
-    pool->blocks = NULL;
-
-    MemPool_Grow(pool, initial_block_count);
+    return __game_client.server_connection->stats;
 }
 
-static void MemPool_Deinit(NBN_MemPool *pool)
+double NBN_GameClient_GetServerTime(void)
 {
-    for (unsigned int i = 0; i < pool->block_count; i++)
-        NBN_Deallocator(pool->blocks[i]);
+    if (!__game_client.server_connection)
+        return -1;
 
-    NBN_Deallocator(pool->blocks);
+    return NBN_Connection_GetRemoteTime(__game_client.server_connection);
 }
 
-static void *MemPool_Alloc(NBN_MemPool *pool)
+int NBN_GameClient_SendInput(void *input, uint32_t *frame)
 {
-    if (pool->free)
-    {
-        void *block = pool->free;
+    NBN_Connection *server_connection = __game_client.server_connection;
 
-        pool->free = pool->free->next;
+    if (__input_type.serializer == NULL)
+    {
+        NBN_LogError("Cannot send an input: no input serializer is registered (see NBN_Input_RegisterSerializer)");
 
-        return block;
+        return NBN_ERROR;
     }
 
-    if (pool->block_idx == pool->block_count)
-        MemPool_Grow(pool, pool->block_count * 2);
-
-    void *block = pool->blocks[pool->block_idx];
+    if (!server_connection->input_sender)
+        server_connection->input_sender = InputSender_Create();
 
-    pool->block_idx++;
+    NBN_InputMessage *msg = InputSender_AddInput(server_connection->input_sender, input, frame);
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_INPUT_MESSAGE_TYPE, msg);
 
-    return block;
-}
+    if (outgoing_msg == NULL)
+    {
+        NBN_InputMessage_Destroy(msg);
 
-static void MemPool_Dealloc(NBN_MemPool *pool, void *ptr)
-{
-    NBN_MemPoolFreeBlock *free = pool->free;
+        return NBN_ERROR;
+    }
 
-    pool->free = (NBN_MemPoolFreeBlock*)ptr;
-    pool->free->next = free;
+    return NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_INPUTS);
 }
 
-static void MemPool_Grow(NBN_MemPool *pool, unsigned int block_count)
+void NBN_GameClient_SetInputAckCallback(NBN_InputAckCallback ack_callback, void *user_data)
 {
-    pool->blocks = (uint8_t**)NBN_Reallocator(pool->blocks, sizeof(uint8_t *) * block_count);
+    NBN_Connection *server_connection = __game_client.server_connection;
 
-    for (unsigned int i = 0; i < block_count - pool->block_count; i++)
-        pool->blocks[pool->block_idx + i] = (uint8_t*)NBN_Allocator(pool->block_size);
+    if (!server_connection->input_sender)
+        server_connection->input_sender = InputSender_Create();
 
-    pool->block_count = block_count;
+    server_connection->input_sender->ack_callback = ack_callback;
+    server_connection->input_sender->ack_callback_user_data = user_data;
 }
 
-#endif /* NBN_DISABLE_MEMORY_POOLING */
-
-#pragma endregion /* Memory management */
-
-#pragma region Serialization
-
-static unsigned int GetRequiredNumberOfBitsFor(unsigned int v)
+uint32_t NBN_GameClient_GetLastAckedInputFrame(void)
 {
-    unsigned int a = v | (v >> 1);
-    unsigned int b = a | (a >> 2);
-    unsigned int c = b | (b >> 4);
-    unsigned int d = c | (c >> 8);
-    unsigned int e = d | (d >> 16);
-    unsigned int f = e >> 1;
-
-    unsigned int i = f - ((f >> 1) & 0x55555555);
-    unsigned int j = (((i >> 2) & 0x33333333) + (i & 0x33333333));
-    unsigned int k = (((j >> 4) + j) & 0x0f0f0f0f);
-    unsigned int l = k + (k >> 8);
-    unsigned int m = l + (l >> 16);
+    NBN_InputSender *input_sender = __game_client.server_connection->input_sender;
 
-    return (m & 0x0000003f) + 1;
+    return input_sender ? input_sender->acked_frame : 0;
 }
 
-#pragma region NBN_BitReader
-
-static void BitReader_ReadFromBuffer(NBN_BitReader *);
+int NBN_GameClient_GetServerCloseCode(void)
+{
+    return client_closed_code;
+}
 
-void NBN_BitReader_Init(NBN_BitReader *bit_reader, uint8_t *buffer, unsigned int size)
+NBN_Stream *NBN_GameClient_GetAcceptDataReadStream(void)
 {
-    bit_reader->size = size;
-    bit_reader->buffer = buffer;
-    bit_reader->scratch = 0;
-    bit_reader->scratch_bits_count = 0;
-    bit_reader->byte_cursor = 0;
+    return (NBN_Stream *)&__game_client.server_connection->accept_data_r_stream;
 }
 
-int NBN_BitReader_Read(NBN_BitReader *bit_reader, Word *word, unsigned int number_of_bits)
+bool NBN_GameClient_IsConnected(void)
 {
-    *word = 0;
+    return __game_client.is_connected;
+}
 
-    if (number_of_bits > bit_reader->scratch_bits_count)
-    {
-        unsigned int needed_bytes = (number_of_bits - bit_reader->scratch_bits_count - 1) / 8 + 1;
+bool NBN_GameClient_IsEncryptionEnabled(void)
+{
+    return __game_client.endpoint.config.is_encryption_enabled;
+}
 
-        if (bit_reader->byte_cursor + needed_bytes > bit_reader->size)
-            return NBN_ERROR;
+void NBN_GameClient_SetFECEnabled(bool enabled)
+{
+    __game_client.endpoint.config.is_fec_enabled = enabled;
+}
 
-        BitReader_ReadFromBuffer(bit_reader);
-    }
+void NBN_GameClient_SetHook(NBN_HookType type, NBN_Hook hook, void *user_data)
+{
+    NBN_Endpoint_SetHook(&__game_client.endpoint, type, hook, user_data);
+}
 
-    *word |= (bit_reader->scratch & (((uint64_t)1 << number_of_bits) - 1));
-    bit_reader->scratch >>= number_of_bits;
-    bit_reader->scratch_bits_count -= number_of_bits;
+#ifdef NBN_DEBUG
 
-    return 0;
+void NBN_GameClient_Debug_RegisterCallback(NBN_ConnectionDebugCallback cb_type, void *cb)
+{
+    switch (cb_type)
+    {
+        case NBN_DEBUG_CB_MSG_ADDED_TO_RECV_QUEUE:
+            NBN_Endpoint_SetHook(&__game_client.endpoint, NBN_HOOK_MESSAGE_ADDED_TO_RECV_QUEUE, Endpoint_CallDebugCallback, cb);
+            break;
+    }
 }
 
-static void BitReader_ReadFromBuffer(NBN_BitReader *bit_reader)
+#endif /* NBN_DEBUG */
+
+static int GameClient_ProcessReceivedMessage(NBN_Message *message, NBN_Connection *server_connection)
 {
-    unsigned int bytes_count = MIN(bit_reader->size - bit_reader->byte_cursor, WORD_BYTES);
-    Word word = 0;
+    assert(__game_client.server_connection == server_connection);
 
-    memcpy(&word, bit_reader->buffer + bit_reader->byte_cursor, bytes_count);
+    NBN_Event ev;
 
-    bit_reader->scratch |= (uint64_t)word << bit_reader->scratch_bits_count;
-    bit_reader->scratch_bits_count += bytes_count * 8;
-    bit_reader->byte_cursor += bytes_count;
-}
+    ev.type = NBN_MESSAGE_RECEIVED;
 
-#pragma endregion /* NBN_BitReader */
+    if (message->header.type == NBN_MESSAGE_CHUNK_TYPE)
+    {
+        NBN_Channel *channel = server_connection->channels[message->header.channel_id];
 
-#pragma region NBN_BitWriter
+        if (!NBN_Channel_AddChunk(channel, message))
+            return 0;
 
-static int BitWriter_FlushScratchBits(NBN_BitWriter *, unsigned int);
+        NBN_Message complete_message;
 
-void NBN_BitWriter_Init(NBN_BitWriter *bit_writer, uint8_t *buffer, unsigned int size)
-{
-    bit_writer->size = size;
-    bit_writer->buffer = buffer;
-    bit_writer->scratch = 0;
-    bit_writer->scratch_bits_count = 0;
-    bit_writer->byte_cursor = 0;
-}
+        if (NBN_Channel_ReconstructMessageFromChunks(channel, server_connection, &complete_message) < 0)
+        {
+            NBN_LogError("Failed to reconstruct message from chunks");
 
-int NBN_BitWriter_Write(NBN_BitWriter *bit_writer, Word value, unsigned int number_of_bits)
-{
-    bit_writer->scratch |= ((uint64_t)value << bit_writer->scratch_bits_count);
+            return NBN_ERROR;
+        }
 
-    if ((bit_writer->scratch_bits_count += number_of_bits) >= WORD_BITS)
-        return BitWriter_FlushScratchBits(bit_writer, WORD_BITS);
+        NBN_MessageInfo msg_info = { complete_message.header.type, complete_message.data, NULL };
+
+        ev.data.message_info = msg_info;
+    }
+    else
+    {
+        NBN_MessageInfo msg_info = { message->header.type, message->data, NULL };
+
+        ev.data.message_info = msg_info;
+    }
+
+    if (!NBN_EventQueue_Enqueue(&__game_client.endpoint.event_queue, ev))
+        return NBN_ERROR;
 
     return 0;
 }
 
-int NBN_BitWriter_Flush(NBN_BitWriter *bit_writer)
+static int GameClient_HandleEvent(void)
 {
-    return BitWriter_FlushScratchBits(bit_writer, bit_writer->scratch_bits_count);
+    switch (client_last_event.type)
+    {
+        case NBN_MESSAGE_RECEIVED:
+            return GameClient_HandleMessageReceivedEvent();
+
+        default:
+            return client_last_event.type;
+    }
 }
 
-static int BitWriter_FlushScratchBits(NBN_BitWriter *bit_writer, unsigned int number_of_bits)
+static int GameClient_HandleMessageReceivedEvent(void)
 {
-    if (bit_writer->scratch_bits_count < 1)
-        return 0;
+    NBN_MessageInfo message_info = client_last_event.data.message_info;
 
-    unsigned int bytes_count = (number_of_bits - 1) / 8 + 1;
+    int ret = NBN_NO_EVENT;
 
-    assert(bytes_count <= WORD_BYTES);
+    if (message_info.type == NBN_CLIENT_CLOSED_MESSAGE_TYPE)
+    {
+        __game_client.is_connected = false;
+        client_closed_code = ((NBN_ClientClosedMessage *)message_info.data)->code;
 
-    if (bit_writer->byte_cursor + bytes_count > bit_writer->size)
-        return NBN_ERROR;
+        NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CONNECTION_CLOSED, __game_client.server_connection, NULL);
 
-    Word word = 0 | (bit_writer->scratch & (((uint64_t)1 << number_of_bits) - 1));
+        ret = NBN_DISCONNECTED;
+    }
+    else if (message_info.type == NBN_CLIENT_ACCEPTED_MESSAGE_TYPE)
+    {
+        __game_client.is_connected = true;
 
-    memcpy(bit_writer->buffer + bit_writer->byte_cursor, &word, bytes_count);
+        memcpy(__game_client.server_connection->accept_data,
+               ((NBN_ClientAcceptedMessage *)message_info.data)->data,
+               NBN_ACCEPT_DATA_MAX_SIZE);
 
-    bit_writer->scratch >>= number_of_bits;
-    bit_writer->scratch_bits_count -= number_of_bits;
-    bit_writer->byte_cursor += bytes_count;
+        /* header timestamps are relative to the connection start, this turns them into server clock times */
+        __game_client.server_connection->remote_start_time =
+            ((NBN_ClientAcceptedMessage *)message_info.data)->start_time;
 
-    return 0;
-}
+        NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CONNECTION_ACCEPTED, __game_client.server_connection, NULL);
 
-#pragma endregion /* NBN_BitWriter */
+        ret = NBN_CONNECTED;
+    }
+    else if (NBN_GameClient_IsEncryptionEnabled() && message_info.type == NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE)
+    {
+        NBN_LogDebug("Received server's crypto public info");
 
-#pragma region NBN_ReadStream
+        NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CRYPTO_INFO_RECEIVED, __game_client.server_connection, NULL);
 
-void NBN_ReadStream_Init(NBN_ReadStream *read_stream, uint8_t *buffer, unsigned int size)
-{
-    read_stream->base.type = NBN_STREAM_READ;
-    read_stream->base.serialize_uint_func = (NBN_Stream_SerializUint)NBN_ReadStream_SerializeUint;
-    read_stream->base.serialize_int_func = (NBN_Stream_SerializeInt)NBN_ReadStream_SerializeInt;
-    read_stream->base.serialize_float_func = (NBN_Stream_SerializeFloat)NBN_ReadStream_SerializeFloat;
-    read_stream->base.serialize_bool_func = (NBN_Stream_SerializeBool)NBN_ReadStream_SerializeBool;
-    read_stream->base.serialize_padding_func = (NBN_Stream_SerializePadding)NBN_ReadStream_SerializePadding;
-    read_stream->base.serialize_bytes_func = (NBN_Stream_SerializeBytes)NBN_ReadStream_SerializeBytes;
+        if (GameClient_SendCryptoPublicInfo() < 0)
+        {
+            NBN_LogError("Failed to send public key to server");
+            NBN_Abort();
+        }
 
-    NBN_BitReader_Init(&read_stream->bit_reader, buffer, size);
-}
+        NBN_PublicCryptoInfoMessage *pub_crypto_msg = (NBN_PublicCryptoInfoMessage*)message_info.data;
 
-int NBN_ReadStream_SerializeUint(NBN_ReadStream *read_stream, unsigned int *value, unsigned int min, unsigned int max)
-{
-    assert(min <= max);
+        if (Connection_BuildSharedKey(&__game_client.server_connection->keys1, pub_crypto_msg->pub_key1) < 0)
+        {
+            NBN_LogError("Failed to build shared key (first key)");
+            NBN_Abort();
+        }
 
-    if (NBN_BitReader_Read(&read_stream->bit_reader, value, BITS_REQUIRED(min, max)) < 0)
-        return NBN_ERROR;
+        if (Connection_BuildSharedKey(&__game_client.server_connection->keys2, pub_crypto_msg->pub_key2) < 0)
+        {
+            NBN_LogError("Failed to build shared key (second key)");
+            NBN_Abort();
+        }
 
-    *value += min;
+        if (Connection_BuildSharedKey(&__game_client.server_connection->keys3, pub_crypto_msg->pub_key3) < 0)
+        {
+            NBN_LogError("Failed to build shared key (third key)");
+            NBN_Abort();
+        }
 
-#ifdef NBN_DEBUG
-    assert(*value >= min && *value <= max);
-#else
-    if (*value < min || *value > max)
-        return NBN_ERROR;
-#endif
+        NBN_LogTrace("Client can now decrypt packets");
 
-    return 0;
+        memcpy(__game_client.server_connection->aes_iv, pub_crypto_msg->aes_iv, AES_BLOCKLEN);
+        __game_client.server_connection->can_decrypt = true;
+    }
+    else if (NBN_GameClient_IsEncryptionEnabled() && message_info.type == NBN_START_ENCRYPT_MESSAGE_TYPE)
+    {
+        GameClient_StartEncryption();
+    }
+    else
+    {
+        ret = NBN_MESSAGE_RECEIVED;
+    }
+
+    return ret;
 }
 
-int NBN_ReadStream_SerializeInt(NBN_ReadStream *read_stream, int *value, int min, int max)
+static int GameClient_SendCryptoPublicInfo(void)
 {
-    assert(min <= max);
+    assert(__game_client.server_connection);
 
-    bool isNegative = 0;
-    unsigned int abs_min = MIN(abs(min), abs(max));
-    unsigned int abs_max = MAX(abs(min), abs(max));
+    NBN_PublicCryptoInfoMessage *msg = NBN_PublicCryptoInfoMessage_Create(); 
 
-    isNegative = *value < 0; /* TODO: useless, remove this ? */
-    *value = abs(*value);
+    memcpy(msg->pub_key1, __game_client.server_connection->keys1.pub_key, ECC_PUB_KEY_SIZE);
+    memcpy(msg->pub_key2, __game_client.server_connection->keys2.pub_key, ECC_PUB_KEY_SIZE);
+    memcpy(msg->pub_key3, __game_client.server_connection->keys3.pub_key, ECC_PUB_KEY_SIZE);
 
-    if (NBN_ReadStream_SerializeBool(read_stream, &isNegative) < 0)
+    /* Client does not send an AES IV to the server */
+    uint8_t zero_aes_iv[AES_BLOCKLEN] = {0};
+
+    memcpy(msg->aes_iv, zero_aes_iv, AES_BLOCKLEN);
+
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE, msg);
+
+    if (outgoing_msg == NULL)
         return NBN_ERROR;
 
-    if (NBN_ReadStream_SerializeUint(
-                read_stream, (unsigned int *)value, (min < 0 && max > 0) ? 0 : abs_min, abs_max) < 0)
+    if (NBN_GameClient_SendReliableMessage(outgoing_msg) < 0)
         return NBN_ERROR;
 
-    if (isNegative)
-        *value *= -1;
+    NBN_LogDebug("Sent client's public key to the server");
+
+    NBN_EmitHook(&__game_client.endpoint, NBN_HOOK_CRYPTO_INFO_SENT, __game_client.server_connection, NULL);
 
     return 0;
 }
 
-int NBN_ReadStream_SerializeFloat(NBN_ReadStream *read_stream, float *value, float min, float max, int precision)
+static void GameClient_StartEncryption(void)
 {
-    assert(min <= max);
+    Connection_StartEncryption(__game_client.server_connection);
+}
 
-    unsigned int mult = pow(10, precision);
-    int i_min = min * mult;
-    int i_max = max * mult;
-    int i_val;
+#pragma endregion /* NBN_GameClient */
 
-    if (NBN_ReadStream_SerializeInt(read_stream, &i_val, i_min, i_max) < 0)
-        return NBN_ERROR;
+#pragma region Game client driver
 
-    *value = (float)i_val / mult;
+static void Driver_GCli_OnConnected(void);
+static void Driver_GCli_OnPacketReceived(NBN_Packet *packet);
 
-    return 0;
+void NBN_Driver_GCli_RaiseEvent(NBN_Driver_GCli_EventType ev, void *data)
+{
+    switch (ev)
+    {
+        case NBN_DRIVER_GCLI_CONNECTED:
+            Driver_GCli_OnConnected();
+            break;
+
+        case NBN_DRIVER_GCLI_SERVER_PACKET_RECEIVED:
+            Driver_GCli_OnPacketReceived((NBN_Packet*)data);
+            break;
+    }
 }
 
-int NBN_ReadStream_SerializeBool(NBN_ReadStream *read_stream, bool *value)
+static void Driver_GCli_OnConnected(void)
 {
-    Word v;
+}
 
-    if (NBN_BitReader_Read(&read_stream->bit_reader, &v, 1) < 0)
-        return NBN_ERROR;
+static void Driver_GCli_OnPacketReceived(NBN_Packet *packet)
+{
+    int ret = Endpoint_ProcessReceivedPacket(&__game_client.endpoint, packet, __game_client.server_connection);
 
-    if (v < 0 || v > 1)
-        return NBN_ERROR;
+    /* packets from server should always be valid */
+    assert(ret == 0);
+}
 
-    *value = v;
+#pragma endregion /* Game Client driver */
 
-    return 0;
-}
+#pragma region NBN_GameServer
 
-int NBN_ReadStream_SerializePadding(NBN_ReadStream *read_stream)
-{
-    // if we are at the beginning of a new byte, no need to pad
-    if (read_stream->bit_reader.scratch_bits_count % 8 == 0)
-        return 0;
+NBN_GameServer __game_server;
+
+static NBN_Event server_last_event;
+
+static int GameServer_AddClient(NBN_Connection *);
+static void GameServer_RemoveClientFromAllGroups(NBN_Connection *);
+static int GameServer_BroadcastMessageToClients(NBN_Connection **, unsigned int, NBN_OutgoingMessage *, uint8_t);
+static int GameServer_CloseClientWithCode(NBN_Connection *client, int code, bool disconnection);
+static unsigned int GameServer_GetClientCount(void);
+static int GameServer_ProcessReceivedMessage(NBN_Message *, NBN_Connection *);
+static int GameServer_CloseStaleClientConnections(void);
+static void GameServer_RemoveClosedClientConnections(void);
+static int GameServer_HandleEvent(void);
+static int GameServer_HandleMessageReceivedEvent(void);
+static int GameServer_SendCryptoPublicInfoTo(NBN_Connection *);
+static int GameServer_StartEncryption(NBN_Connection *);
 
-    Word value;
-    unsigned int padding = read_stream->bit_reader.scratch_bits_count % 8;
-    int ret = NBN_BitReader_Read(&read_stream->bit_reader, &value, padding);
+int NBN_GameServer_Start(const char *protocol_name, uint16_t port, bool encryption)
+{
+    NBN_Config config = {0};
 
-#ifdef NBN_DEBUG
-    assert(value == 0);
-#else
-    if (value != 0)
-        return NBN_ERROR;
-#endif
+    config.protocol_name = protocol_name;
+    config.port = port;
+    config.is_encryption_enabled = encryption;
 
-    return ret;
+    return NBN_GameServer_StartWithConfig(config);
 }
 
-int NBN_ReadStream_SerializeBytes(NBN_ReadStream *read_stream, uint8_t *bytes, unsigned int length)
+int NBN_GameServer_StartWithConfig(NBN_Config config)
 {
-    if (length == 0)
-        return NBN_ERROR;
-
-    if (NBN_ReadStream_SerializePadding(read_stream) < 0)
+    if (NBN_Endpoint_Init(&__game_server.endpoint, config, true) < 0)
         return NBN_ERROR;
 
-    NBN_BitReader *bit_reader = &read_stream->bit_reader;
-
-    // make sure we are at the start of a new byte after applying padding
-    assert(bit_reader->scratch_bits_count % 8 == 0);
-
-    if (length * 8 <= bit_reader->scratch_bits_count)
+    if ((__game_server.clients = NBN_ConnectionVector_Create()) == NULL)
     {
-        // the byte array is fully contained inside the read word
-
-        Word word;
-
-        if (NBN_BitReader_Read(bit_reader, &word, length * 8) < 0)
-            return NBN_ERROR;
+        NBN_LogError("Failed to create connections vector");
 
-        memcpy(bytes, &word, length);
+        return NBN_ERROR;
     }
-    else
-    {
-        // reading is done word by word and in this case, the start of byte array has already been read
-        // therefore we need to "roll back" the byte cursor so it is at the very begining of the byte array
-        // inside the buffer
 
-        bit_reader->byte_cursor -= (bit_reader->scratch_bits_count / 8);
-        bit_reader->scratch_bits_count = 0;
-        bit_reader->scratch = 0;
+    memset(__game_server.client_slots, 0, sizeof(__game_server.client_slots));
+    memset(__game_server.groups, 0, sizeof(__game_server.groups));
 
-        memcpy(bytes, bit_reader->buffer + bit_reader->byte_cursor, length);
+    if (NBN_Driver_GServ_Start(Endpoint_BuildProtocolId(config.protocol_name), config.port) < 0)
+    {
+        NBN_LogError("Failed to start network driver");
 
-        bit_reader->byte_cursor += length;
+        return NBN_ERROR;
     }
 
+    NBN_LogInfo("Started");
+
     return 0;
 }
 
-#pragma endregion /* NBN_ReadStream */
+void NBN_GameServer_Stop(void)
+{
+    NBN_GameServer_Poll(); /* Poll one last time to clear remaining events */
 
-#pragma region NBN_WriteStream
+    if (__game_server.endpoint.recorder)
+        NBN_GameServer_StopRecording();
 
-void NBN_WriteStream_Init(NBN_WriteStream *write_stream, uint8_t *buffer, unsigned int size)
-{
-    write_stream->base.type = NBN_STREAM_WRITE;
-    write_stream->base.serialize_uint_func = (NBN_Stream_SerializUint)NBN_WriteStream_SerializeUint;
-    write_stream->base.serialize_int_func = (NBN_Stream_SerializeInt)NBN_WriteStream_SerializeInt;
-    write_stream->base.serialize_float_func = (NBN_Stream_SerializeFloat)NBN_WriteStream_SerializeFloat;
-    write_stream->base.serialize_bool_func = (NBN_Stream_SerializeBool)NBN_WriteStream_SerializeBool;
-    write_stream->base.serialize_padding_func = (NBN_Stream_SerializePadding)NBN_WriteStream_SerializePadding;
-    write_stream->base.serialize_bytes_func = (NBN_Stream_SerializeBytes)NBN_WriteStream_SerializeBytes;
+    /* connections have to be destroyed before the endpoint releases its memory pools */
+    NBN_ConnectionVector_Destroy(__game_server.clients);
+    NBN_Endpoint_Deinit(&__game_server.endpoint);
 
-    NBN_BitWriter_Init(&write_stream->bit_writer, buffer, size);
+    NBN_Driver_GServ_Stop();
+
+    NBN_LogInfo("Stopped");
 }
 
-int NBN_WriteStream_SerializeUint(
-        NBN_WriteStream *write_stream, unsigned int *value, unsigned int min, unsigned int max)
+void NBN_GameServer_RegisterMessage(
+        uint8_t msg_type,
+        NBN_MessageBuilder msg_builder,
+        NBN_MessageDestructor msg_destructor,
+        NBN_MessageSerializer msg_serializer)
 {
-    assert(min <= max);
-    assert(*value >= min && *value <= max);
+    if (NBN_IsReservedMessage(msg_type))
+    {
+        NBN_LogError("Message type %d is reserved by the library", msg_type);
+        NBN_Abort();
+    }
 
-    if (NBN_BitWriter_Write(&write_stream->bit_writer, *value - min, BITS_REQUIRED(min, max)) < 0)
-        return NBN_ERROR;
+    NBN_Endpoint_RegisterMessageBuilder(&__game_server.endpoint, msg_builder, msg_type);
+    NBN_Endpoint_RegisterMessageDestructor(&__game_server.endpoint, msg_destructor, msg_type);
+    NBN_Endpoint_RegisterMessageSerializer(&__game_server.endpoint, msg_serializer, msg_type);
+}
 
-    return 0;
+void NBN_GameServer_RegisterChannel(uint8_t type, uint8_t id)
+{
+    if (NBN_IsReservedChannel(id))
+    {
+        NBN_LogError("Channel id %d is reserved by the library", type);
+        NBN_Abort();
+    }
+
+    NBN_Endpoint_RegisterChannel(&__game_server.endpoint, (NBN_ChannelType)type, id);
 }
 
-int NBN_WriteStream_SerializeInt(NBN_WriteStream *write_stream, int *value, int min, int max)
+void NBN_GameServer_AddTime(double time)
 {
-    assert(min <= max);
+    for (unsigned int i = 0; i < __game_server.clients->count; i++)
+        NBN_Connection_AddTime(__game_server.clients->connections[i], time);
 
-    unsigned int isNegative = 0;
-    unsigned int abs_min = MIN(abs(min), abs(max));
-    unsigned int abs_max = MAX(abs(min), abs(max));
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    NBN_PacketSimulator_AddTime(&__game_server.endpoint.packet_simulator, time);
+#endif
+}
 
-    isNegative = *value < 0;
-    *value = abs(*value);
+int NBN_GameServer_Poll(void)
+{
+    if (NBN_EventQueue_IsEmpty(&__game_server.endpoint.event_queue))
+    {
+        if (GameServer_CloseStaleClientConnections() < 0)
+            return NBN_ERROR;
 
-    if (NBN_WriteStream_SerializeUint(write_stream, &isNegative, 0, 1) < 0)
-        return NBN_ERROR;
+        if (NBN_Driver_GServ_RecvPackets() < 0)
+            return NBN_ERROR;
 
-    if (NBN_WriteStream_SerializeUint(
-                write_stream, (unsigned int *)value, (min < 0 && max > 0) ? 0 : abs_min, abs_max) < 0)
-        return NBN_ERROR;
+        __game_server.stats.download_bandwidth = 0;
 
-    if (isNegative)
-        *value *= -1;
+        for (unsigned int i = 0; i < __game_server.clients->count; i++)
+        {
+            NBN_Connection *client = __game_server.clients->connections[i];
 
-    return 0;
-}
+            for (unsigned int i = 0; i < NBN_MAX_CHANNELS; i++)
+            {
+                NBN_Channel *channel = client->channels[i];
 
-int NBN_WriteStream_SerializeFloat(NBN_WriteStream *write_stream, float *value, float min, float max, int precision)
-{
-    assert(min <= max);
+                if (channel)
+                {
+                    NBN_Message *msg;
 
-    unsigned int mult = pow(10, precision);
-    int i_min = min * mult;
-    int i_max = max * mult;
-    int i_val = *value * mult;
+                    while ((msg = channel->GetNextRecvedMessage(channel)) != NULL)
+                    {
+                        if (GameServer_ProcessReceivedMessage(msg, client) < 0)
+                        {
+                            NBN_LogError("Failed to process received message");
 
-    if (NBN_WriteStream_SerializeInt(write_stream, &i_val, i_min, i_max) < 0)
-        return NBN_ERROR;
+                            return NBN_ERROR;
+                        }
+                    }
+                }
+            }
 
-    return 0;
-}
+            if (!client->is_closed)
+                Connection_UpdateAverageDownloadBandwidth(client);
 
-int NBN_WriteStream_SerializeBool(NBN_WriteStream *write_stream, bool *value)
-{
-    int v = *value;
+            __game_server.stats.download_bandwidth += client->stats.download_bandwidth;
+            client->last_read_packets_time = client->time;
+        }
 
-    assert(v >= 0 && v <= 1);
+        GameServer_RemoveClosedClientConnections();
+    }
 
-    if (NBN_BitWriter_Write(&write_stream->bit_writer, v, 1) < 0)
-        return NBN_ERROR;
 
-    return 0;
-}
+    while (true)
+    {
+        bool ret = NBN_EventQueue_Dequeue(&__game_server.endpoint.event_queue, &server_last_event);
 
-int NBN_WriteStream_SerializePadding(NBN_WriteStream *write_stream)
-{
-    // if we are at the beginning of a new byte, no need to pad
-    if (write_stream->bit_writer.scratch_bits_count % 8 == 0) 
-        return 0;
+        if (!ret)
+            return NBN_NO_EVENT;
 
-    unsigned int padding = 8 - (write_stream->bit_writer.scratch_bits_count % 8);
+        int ev = GameServer_HandleEvent();
 
-    return NBN_BitWriter_Write(&write_stream->bit_writer, 0, padding);
+        if (ev != NBN_SKIP_EVENT)
+            return ev;
+    }
 }
 
-int NBN_WriteStream_SerializeBytes(NBN_WriteStream *write_stream, uint8_t *bytes, unsigned int length)
+int NBN_GameServer_SendPackets(void)
 {
-    if (length == 0)
-        return NBN_ERROR;
-
-    if (NBN_WriteStream_SerializePadding(write_stream) < 0)
-        return NBN_ERROR;
+    __game_server.stats.upload_bandwidth = 0;
 
-    NBN_BitWriter *bit_writer = &write_stream->bit_writer;
+    for (unsigned int i = 0; i < __game_server.clients->count; i++)
+    {
+        NBN_Connection *client = __game_server.clients->connections[i];
 
-    // make sure we are at the start of a new byte after applying padding
-    assert(bit_writer->scratch_bits_count % 8 == 0);
+        /* Closed clients are always flushed so they get notified as soon as possible */
+        if (client->send_countdown > 0 && !client->is_closed)
+        {
+            client->send_countdown--;
+        }
+        else
+        {
+            client->send_countdown = client->send_interval - 1;
 
-    if (NBN_WriteStream_Flush(write_stream) < 0)
-        return NBN_ERROR;
+            if (!client->is_stale && NBN_Connection_FlushSendQueue(client) < 0)
+                return NBN_ERROR;
+        }
 
-    // make sure everything has been flushed to the buffer before writing the byte array
-    assert(bit_writer->scratch_bits_count == 0);
+        __game_server.stats.upload_bandwidth += client->stats.upload_bandwidth;
+    }
 
-    if (bit_writer->byte_cursor + length > bit_writer->size)
-        return NBN_ERROR;
+#if defined(NBN_DRIVER_HAS_FLUSH) && defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+    /* the packet simulator thread hands the packets to the driver with its queue locked */
+    NBN_PacketSimulator_Lock(&__game_server.endpoint.packet_simulator);
 
-    memcpy(bit_writer->buffer + bit_writer->byte_cursor, bytes, length);
+    int ret = NBN_Driver_GServ_FlushPackets();
 
-    bit_writer->byte_cursor += length;
+    NBN_PacketSimulator_Unlock(&__game_server.endpoint.packet_simulator);
 
+    return ret;
+#elif defined(NBN_DRIVER_HAS_FLUSH)
+    return NBN_Driver_GServ_FlushPackets();
+#else
     return 0;
+#endif
 }
 
-int NBN_WriteStream_Flush(NBN_WriteStream *write_stream)
+void NBN_GameServer_SetClientSendInterval(NBN_Connection *client, unsigned int interval)
 {
-    return NBN_BitWriter_Flush(&write_stream->bit_writer);
-}
-
-#pragma endregion /* NBN_WriteStream */
-
-#pragma region NBN_MeasureStream
+    assert(interval > 0);
 
-void NBN_MeasureStream_Init(NBN_MeasureStream *measure_stream)
-{
-    measure_stream->base.type = NBN_STREAM_MEASURE;
-    measure_stream->base.serialize_uint_func = (NBN_Stream_SerializUint)NBN_MeasureStream_SerializeUint;
-    measure_stream->base.serialize_int_func = (NBN_Stream_SerializeInt)NBN_MeasureStream_SerializeInt;
-    measure_stream->base.serialize_float_func = (NBN_Stream_SerializeFloat)NBN_MeasureStream_SerializeFloat;
-    measure_stream->base.serialize_bool_func = (NBN_Stream_SerializeBool)NBN_MeasureStream_SerializeBool;
-    measure_stream->base.serialize_padding_func = (NBN_Stream_SerializePadding)NBN_MeasureStream_SerializePadding;
-    measure_stream->base.serialize_bytes_func = (NBN_Stream_SerializeBytes)NBN_MeasureStream_SerializeBytes;
+    client->send_interval = MAX(interval, 1);
 
-    measure_stream->number_of_bits = 0;
+    /* Spread the flushes of clients sharing the same interval */
+    client->send_countdown = client->id % client->send_interval;
 }
 
-int NBN_MeasureStream_SerializeUint(
-        NBN_MeasureStream *measure_stream, unsigned int *value, unsigned int min, unsigned int max)
+void NBN_GameServer_SetContext(void *context)
 {
-    (void)*value;
-
-    assert(min <= max);
-    // assert(*value >= min && *value <= max);
-
-    unsigned int number_of_bits = BITS_REQUIRED(min, max);
-
-    measure_stream->number_of_bits += number_of_bits;
-
-    return number_of_bits;
+    __game_server.context = context;
 }
 
-int NBN_MeasureStream_SerializeInt(NBN_MeasureStream *measure_stream, int *value, int min, int max)
+void *NBN_GameServer_GetContext(void)
 {
-    assert(min <= max);
-    assert(*value >= min && *value <= max);
+    return __game_server.context;
+}
 
-    unsigned int abs_min = MIN(abs(min), abs(max));
-    unsigned int abs_max = MAX(abs(min), abs(max));
-    unsigned int abs_value = abs(*value);
-    unsigned number_of_bits = NBN_MeasureStream_SerializeUint(
-            measure_stream, &abs_value, (min < 0 && max > 0) ? 0 : abs_min, abs_max);
+NBN_Connection *NBN_GameServer_CreateClientConnection(uint32_t id, void *driver_data)
+{
+    NBN_Connection *client = NBN_Endpoint_CreateConnection(&__game_server.endpoint, id, driver_data);
 
-    measure_stream->number_of_bits++; // +1 for int sign
+    return client;
+}
 
-    return number_of_bits + 1;
+int NBN_GameServer_CloseClientWithCode(NBN_Connection *client, int code)
+{ 
+    return GameServer_CloseClientWithCode(client, code, false);
 }
 
-int NBN_MeasureStream_SerializeFloat(
-        NBN_MeasureStream *measure_stream, float *value, float min, float max, int precision)
+int NBN_GameServer_CloseClient(NBN_Connection *client)
 {
-    assert(min <= max);
-    assert(*value >= min && *value <= max);
-
-    unsigned int mult = pow(10, precision);
-    int i_min = min * mult;
-    int i_max = max * mult;
-    int i_val = *value * mult;
+    return GameServer_CloseClientWithCode(client, -1, false);
+}
 
-    return NBN_MeasureStream_SerializeInt(measure_stream, &i_val, i_min, i_max);
+NBN_OutgoingMessage *NBN_GameServer_CreateMessage(uint8_t msg_type, void *msg_data)
+{
+    return Endpoint_CreateOutgoingMessage(&__game_server.endpoint, msg_type, msg_data);
 }
 
-int NBN_MeasureStream_SerializeBool(NBN_MeasureStream *measure_stream, bool *value)
+NBN_OutgoingMessage *NBN_GameServer_CreateByteArrayMessage(uint8_t *bytes, unsigned int length)
 {
-    (void)value;
+    if (length > NBN_BYTE_ARRAY_MAX_SIZE)
+    {
+        NBN_LogError("Byte array cannot exceed %d bytes", NBN_BYTE_ARRAY_MAX_SIZE);
 
-    measure_stream->number_of_bits++;
+        return NULL;
+    }
 
-    return 1;
+    NBN_ByteArrayMessage *msg = NBN_ByteArrayMessage_Create();
+
+    memcpy(msg->bytes, bytes, length);
+
+    msg->length = length;
+
+    return NBN_GameServer_CreateMessage(NBN_BYTE_ARRAY_MESSAGE_TYPE, msg);
 }
 
-int NBN_MeasureStream_SerializePadding(NBN_MeasureStream *measure_stream)
+int NBN_GameServer_SendMessageTo(NBN_Connection *client, NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
 {
-    if (measure_stream->number_of_bits % 8 == 0)
-        return 0;
+    /* The only message type we can send to an unaccepted client is a NBN_ClientAcceptedMessage message
+     * or a NBN_PublicCryptoInfoMessage */
+    assert(client->is_accepted ||
+            outgoing_msg->type == NBN_CLIENT_ACCEPTED_MESSAGE_TYPE || NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
 
-    unsigned int padding = 8 - (measure_stream->number_of_bits % 8);
+    if (Endpoint_EnqueueOutgoingMessage(&__game_server.endpoint, client, outgoing_msg, channel_id) < 0)
+    {
+        NBN_LogError("Failed to create outgoing message for client %d");
 
-    measure_stream->number_of_bits += padding;
+        /* Do not close the client if we failed to send the close client message to avoid infinite loops */
+        if (outgoing_msg->type != NBN_CLIENT_CLOSED_MESSAGE_TYPE)
+        {
+            GameServer_CloseClientWithCode(client, -1, false);
 
-    return padding;
+            return NBN_ERROR;
+        }
+    }
+
+    return 0;
 }
 
-int NBN_MeasureStream_SerializeBytes(NBN_MeasureStream *measure_stream, uint8_t *bytes, unsigned int length)
+int NBN_GameServer_SendUnreliableMessageTo(NBN_Connection *client, NBN_OutgoingMessage *outgoing_msg)
 {
-    (void)bytes;
+    return NBN_GameServer_SendMessageTo(client, outgoing_msg, NBN_CHANNEL_RESERVED_UNRELIABLE);
+}
 
-    NBN_MeasureStream_SerializePadding(measure_stream);
+int NBN_GameServer_SendReliableMessageTo(NBN_Connection *client, NBN_OutgoingMessage *outgoing_msg)
+{
+    return NBN_GameServer_SendMessageTo(client, outgoing_msg, NBN_CHANNEL_RESERVED_RELIABLE);
+}
 
-    unsigned int bits = length * 8;
+int NBN_GameServer_BroadcastMessage(NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
+{
+    NBN_Connection *clients[NBN_MAX_CLIENTS];
+    unsigned int count = 0;
 
-    measure_stream->number_of_bits += bits;
+    for (unsigned int i = 0; i < __game_server.clients->count; i++)
+    {
+        NBN_Connection *client = __game_server.clients->connections[i];
 
-    return bits;
+        if (!client->is_closed && !client->is_stale && client->is_accepted)
+            clients[count++] = client;
+    }
+
+    return GameServer_BroadcastMessageToClients(clients, count, outgoing_msg, channel_id);
 }
 
-void NBN_MeasureStream_Reset(NBN_MeasureStream *measure_stream)
+int NBN_GameServer_BroadcastUnreliableMessage(NBN_OutgoingMessage *outgoing_msg)
 {
-    measure_stream->number_of_bits = 0;
+    return NBN_GameServer_BroadcastMessage(outgoing_msg, NBN_CHANNEL_RESERVED_UNRELIABLE);
 }
 
-#pragma endregion /* NBN_MeasureStream */
-
-#pragma endregion /* Serialization */
+int NBN_GameServer_BroadcastReliableMessage(NBN_OutgoingMessage *outgoing_msg)
+{
+    return NBN_GameServer_BroadcastMessage(outgoing_msg, NBN_CHANNEL_RESERVED_RELIABLE);
+}
 
-#pragma region NBN_Packet
+void NBN_GameServer_AddClientToGroup(NBN_Connection *client, uint8_t group_id)
+{
+    assert(group_id < NBN_MAX_BROADCAST_GROUPS);
+    assert(__game_server.client_slots[client->slot] == client);
 
-static int Packet_SerializeHeader(NBN_PacketHeader *, NBN_Stream *);
+    NBN_BroadcastGroup *group = &__game_server.groups[group_id];
 
-static void AES_init_ctx_iv(struct AES_ctx*, const uint8_t*, const uint8_t*);
-static void AES_CBC_encrypt_buffer(struct AES_ctx *,uint8_t*, uint32_t);
-static void AES_CBC_decrypt_buffer(struct AES_ctx*, uint8_t*, uint32_t);
+    if (B_IS_SET(group->members[client->slot / 32], client->slot % 32))
+        return;
 
-void poly1305_auth(uint8_t out[POLY1305_TAGLEN], const uint8_t *m, size_t inlen,
-                   const uint8_t key[POLY1305_KEYLEN])
-#ifndef _MSC_VER
-    __attribute__((__bounded__(__minbytes__, 1, POLY1305_TAGLEN)))
-    __attribute__((__bounded__(__buffer__, 2, 3)))
-    __attribute__((__bounded__(__minbytes__, 4, POLY1305_KEYLEN)))
-#endif
-;
+    B_SET(group->members[client->slot / 32], client->slot % 32);
+    group->member_count++;
+}
 
-void NBN_Packet_InitWrite(
-        NBN_Packet *packet, uint32_t protocol_id, uint16_t seq_number, uint16_t ack, uint32_t ack_bits)
+void NBN_GameServer_RemoveClientFromGroup(NBN_Connection *client, uint8_t group_id)
 {
-    packet->header.protocol_id = protocol_id;
-    packet->header.messages_count = 0;
-    packet->header.seq_number = seq_number;
-    packet->header.ack = ack;
-    packet->header.ack_bits = ack_bits;
+    assert(group_id < NBN_MAX_BROADCAST_GROUPS);
 
-    packet->mode = NBN_PACKET_MODE_WRITE;
-    packet->sender = NULL;
-    packet->size = 0;
-    packet->sealed = false;
-    packet->m_stream.number_of_bits = 0;
+    NBN_BroadcastGroup *group = &__game_server.groups[group_id];
 
-    NBN_WriteStream_Init(&packet->w_stream, packet->buffer + NBN_PACKET_HEADER_SIZE, NBN_PACKET_MAX_USER_DATA_SIZE);
-    NBN_MeasureStream_Init(&packet->m_stream);
+    if (B_IS_UNSET(group->members[client->slot / 32], client->slot % 32))
+        return;
+
+    B_UNSET(group->members[client->slot / 32], client->slot % 32);
+    group->member_count--;
 }
 
-int NBN_Packet_InitRead(
-        NBN_Packet *packet, NBN_Connection *sender, uint8_t buffer[NBN_PACKET_MAX_SIZE], unsigned int size)
+bool NBN_GameServer_IsClientInGroup(NBN_Connection *client, uint8_t group_id)
 {
-    packet->mode = NBN_PACKET_MODE_READ;
-    packet->sender = sender;
-    packet->size = size;
-    packet->sealed = false;
-
-    memcpy(packet->buffer, buffer, size);
+    assert(group_id < NBN_MAX_BROADCAST_GROUPS);
 
-    NBN_ReadStream header_r_stream;
+    return B_IS_SET(__game_server.groups[group_id].members[client->slot / 32], client->slot % 32);
+}
 
-    NBN_ReadStream_Init(&header_r_stream, packet->buffer, NBN_PACKET_HEADER_SIZE);
+void NBN_GameServer_ClearGroup(uint8_t group_id)
+{
+    assert(group_id < NBN_MAX_BROADCAST_GROUPS);
 
-    if (Packet_SerializeHeader(&packet->header, (NBN_Stream *)&header_r_stream) < 0)
-        return NBN_ERROR;
+    memset(&__game_server.groups[group_id], 0, sizeof(NBN_BroadcastGroup));
+}
 
-    if (sender->endpoint->config.is_encryption_enabled && packet->header.is_encrypted)
-    {
-        if (!sender->can_decrypt)
-        {
-            NBN_LogError("Discard encrypted packet %d", packet->header.seq_number);
+int NBN_GameServer_BroadcastToGroup(NBN_OutgoingMessage *outgoing_msg, uint8_t group_id, uint8_t channel_id)
+{
+    assert(group_id < NBN_MAX_BROADCAST_GROUPS);
 
-            return NBN_ERROR;
-        }
+    NBN_BroadcastGroup *group = &__game_server.groups[group_id];
+    NBN_Connection *clients[NBN_MAX_CLIENTS];
+    unsigned int count = 0;
 
-        NBN_Packet_ComputeIV(packet, packet->sender);
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS / 32 && count < group->member_count; i++)
+    {
+        uint32_t word = group->members[i];
 
-        if (!NBN_Packet_CheckAuthentication(packet, packet->sender))
+        while (word)
         {
-            NBN_LogError("Authentication check failed for packet %d", packet->header.seq_number);
+            NBN_Connection *client = __game_server.client_slots[i * 32 + B_CTZ(word)];
 
-            return NBN_ERROR;
-        }
+            word &= word - 1;
 
-        NBN_Packet_Decrypt(packet, packet->sender);
+            if (!client->is_closed && !client->is_stale && client->is_accepted)
+                clients[count++] = client;
+        }
     }
 
-    NBN_ReadStream_Init(&packet->r_stream, packet->buffer + NBN_PACKET_HEADER_SIZE, packet->size);
+    return GameServer_BroadcastMessageToClients(clients, count, outgoing_msg, channel_id);
+}
 
-    return 0;
+NBN_Stream *NBN_GameServer_GetConnectionAcceptDataWriteStream(NBN_Connection *client)
+{
+    return (NBN_Stream *)&client->accept_data_w_stream;
 }
 
-uint32_t NBN_Packet_ReadProtocolId(uint8_t buffer[NBN_PACKET_MAX_SIZE], unsigned int size)
+int NBN_GameServer_AcceptIncomingConnection(void)
 {
-    if (size < NBN_PACKET_HEADER_SIZE)
-        return 0;
+    assert(server_last_event.type == NBN_NEW_CONNECTION);
+    assert(server_last_event.data.connection != NULL);
 
-    NBN_ReadStream r_stream;
+    NBN_Connection *client = server_last_event.data.connection;
+    NBN_ClientAcceptedMessage *msg = NBN_ClientAcceptedMessage_Create();
 
-    NBN_ReadStream_Init(&r_stream, buffer, NBN_PACKET_HEADER_SIZE);
+    assert(msg != NULL);
 
-    NBN_PacketHeader header;
+    NBN_WriteStream_Flush(&client->accept_data_w_stream);
 
-    if (Packet_SerializeHeader(&header, (NBN_Stream *)&r_stream) < 0)
-        return 0;
+    memcpy(msg->data, client->accept_data, NBN_ACCEPT_DATA_MAX_SIZE);
 
-    return header.protocol_id;
-}
+    msg->start_time = client->start_time;
 
-int NBN_Packet_WriteMessage(NBN_Packet *packet, NBN_Message *message, NBN_MessageSerializer msg_serializer)
-{
-    if (packet->mode != NBN_PACKET_MODE_WRITE || packet->sealed)
-        return NBN_PACKET_WRITE_ERROR;
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(NBN_CLIENT_ACCEPTED_MESSAGE_TYPE, msg);
 
-    int current_number_of_bits = packet->m_stream.number_of_bits;
+    if (outgoing_msg == NULL)
+        return NBN_ERROR;
 
-    if (NBN_Message_Measure(message, &packet->m_stream, msg_serializer) < 0)
-        return NBN_PACKET_WRITE_ERROR;
+    if (NBN_GameServer_SendReliableMessageTo(client, outgoing_msg) < 0)
+        return NBN_ERROR;
 
-    if (
-            packet->header.messages_count >= NBN_MAX_MESSAGES_PER_PACKET ||
-            packet->m_stream.number_of_bits > NBN_PACKET_MAX_USER_DATA_SIZE * 8)
-    {
-        packet->m_stream.number_of_bits = current_number_of_bits;
+    client->is_accepted = true;
 
-        return NBN_PACKET_WRITE_NO_SPACE;
-    }
+    NBN_LogTrace("Client %d has been accepted", client->id);
 
-    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)&packet->w_stream) < 0)
-        return NBN_PACKET_WRITE_ERROR;
+    NBN_EmitHook(&__game_server.endpoint, NBN_HOOK_CONNECTION_ACCEPTED, client, NULL);
 
-    if (NBN_Message_SerializeData(message, (NBN_Stream *)&packet->w_stream, msg_serializer) < 0)
-        return NBN_PACKET_WRITE_ERROR;
+    return 0;
+}
 
-    packet->size = (packet->m_stream.number_of_bits - 1) / 8 + 1;
-    packet->header.messages_count++;
+int NBN_GameServer_RejectIncomingConnectionWithCode(int code)
+{
+    assert(server_last_event.type == NBN_NEW_CONNECTION);
+    assert(server_last_event.data.connection != NULL);
 
-    return NBN_PACKET_WRITE_OK;
+    return GameServer_CloseClientWithCode(server_last_event.data.connection, code, false);
 }
 
-int NBN_Packet_Seal(NBN_Packet *packet, NBN_Connection *connection)
+int NBN_GameServer_RejectIncomingConnection(void)
 {
-    if (packet->mode != NBN_PACKET_MODE_WRITE)
-        return NBN_ERROR;
-
-    if (NBN_WriteStream_Flush(&packet->w_stream) < 0)
-        return NBN_ERROR;
+    return NBN_GameServer_RejectIncomingConnectionWithCode(-1);
+}
 
-    bool is_encrypted = connection->endpoint->config.is_encryption_enabled && connection->can_encrypt;
+NBN_Connection *NBN_GameServer_GetIncomingConnection(void)
+{
+    assert(server_last_event.type == NBN_NEW_CONNECTION);
+    assert(server_last_event.data.connection != NULL);
 
-    packet->header.is_encrypted = is_encrypted;
-    packet->size += NBN_PACKET_HEADER_SIZE;
+    return server_last_event.data.connection;
+}
 
-    if (is_encrypted)
-    {
-        NBN_Packet_ComputeIV(packet, connection);
-        NBN_Packet_Encrypt(packet, connection);
-        NBN_Packet_Authenticate(packet, connection);
-    }
+uint8_t *NBN_GameServer_GetConnectionData(NBN_Connection *client)
+{
+    return client->connection_data;
+}
 
-    NBN_WriteStream header_w_stream;
+NBN_Connection *NBN_GameServer_GetDisconnectedClient(void)
+{
+    assert(server_last_event.type == NBN_CLIENT_DISCONNECTED);
 
-    NBN_WriteStream_Init(&header_w_stream, packet->buffer, NBN_PACKET_HEADER_SIZE);
+    return server_last_event.data.connection;
+}
 
-    if (Packet_SerializeHeader(&packet->header, (NBN_Stream *)&header_w_stream) < 0)
-        return NBN_ERROR;
+NBN_MessageInfo NBN_GameServer_GetMessageInfo(void)
+{
+    assert(server_last_event.type == NBN_CLIENT_MESSAGE_RECEIVED);
 
-    if (NBN_WriteStream_Flush(&header_w_stream) < 0)
-        return NBN_ERROR;
+    return server_last_event.data.message_info;
+}
 
-    packet->sealed = true;
+NBN_GameServerStats NBN_GameServer_GetStats(void)
+{
+    return __game_server.stats;
+}
 
-    return 0;
+double NBN_GameServer_GetTime(void)
+{
+    return NBN_Endpoint_GetTime(&__game_server.endpoint);
 }
 
-static int Packet_SerializeHeader(NBN_PacketHeader *header, NBN_Stream *stream)
+int NBN_GameServer_ReadInput(NBN_Connection *client, void *input, uint32_t *frame)
 {
-    NBN_SerializeBytes(stream, &header->protocol_id, sizeof(header->protocol_id));
-    NBN_SerializeBytes(stream, &header->seq_number, sizeof(header->seq_number));
-    NBN_SerializeBytes(stream, &header->ack, sizeof(header->ack));
-    NBN_SerializeBytes(stream, &header->ack_bits, sizeof(header->ack_bits));
-    NBN_SerializeBytes(stream, &header->messages_count, sizeof(header->messages_count));
-    NBN_SerializeBytes(stream, &header->is_encrypted, sizeof(header->is_encrypted));
+    if (!client->input_receiver)
+        return 0;
 
-    /* Do not serialize authentication tag when packet is not encrypted to save some bandwith */
-    if (header->is_encrypted)
-        NBN_SerializeBytes(stream, &header->auth_tag, sizeof(header->auth_tag));
+    return InputReceiver_ReadInput(client->input_receiver, input, frame);
+}
 
-    return 0;
+uint32_t NBN_GameServer_GetLastInputFrame(NBN_Connection *client)
+{
+    return client->input_receiver ? client->input_receiver->last_frame : 0;
 }
 
-void NBN_Packet_Encrypt(NBN_Packet *packet, NBN_Connection *connection)
+int NBN_GameServer_StartRecording(const char *path)
 {
-    struct AES_ctx aes_ctx;
+    if (__game_server.endpoint.recorder)
+    {
+        NBN_LogError("Messages are already being recorded");
 
-    AES_init_ctx_iv(&aes_ctx, connection->keys1.shared_key, packet->aes_iv);
+        return NBN_ERROR;
+    }
 
-    unsigned int bytes_to_encrypt = packet->size - NBN_PACKET_HEADER_SIZE;
-    unsigned int added_bytes = (bytes_to_encrypt % AES_BLOCKLEN == 0) ? 0 : (AES_BLOCKLEN - bytes_to_encrypt % AES_BLOCKLEN);
+    if ((__game_server.endpoint.recorder = NBN_Recorder_Create(path)) == NULL)
+        return NBN_ERROR;
 
-    bytes_to_encrypt += added_bytes;
+    NBN_LogInfo("Started recording messages to %s", path);
 
-    assert(bytes_to_encrypt % AES_BLOCKLEN == 0);
-    assert(bytes_to_encrypt < NBN_PACKET_MAX_DATA_SIZE);
+    return 0;
+}
 
-    packet->size = NBN_PACKET_HEADER_SIZE + bytes_to_encrypt;
+int NBN_GameServer_StopRecording(void)
+{
+    NBN_Recorder *recorder = __game_server.endpoint.recorder;
 
-    assert(packet->size < NBN_PACKET_MAX_SIZE); 
+    if (recorder == NULL)
+        return 0;
 
-    memset((packet->buffer + packet->size) - added_bytes, 0, added_bytes);
+    __game_server.endpoint.recorder = NULL;
 
-    AES_CBC_encrypt_buffer(&aes_ctx, packet->buffer + NBN_PACKET_HEADER_SIZE, bytes_to_encrypt);
+    NBN_LogInfo("Stopped recording messages (%d messages)", recorder->record_count);
 
-    NBN_LogTrace("Encrypted packet %d (%d bytes)", packet->header.seq_number, packet->size);  
+    return NBN_Recorder_Destroy(recorder);
 }
 
-void NBN_Packet_Decrypt(NBN_Packet *packet, NBN_Connection *connection)
+NBN_RecordReader *NBN_GameServer_OpenRecording(const char *path)
 {
-    struct AES_ctx aes_ctx;
+    return NBN_RecordReader_Open(path, &__game_server.endpoint);
+}
 
-    AES_init_ctx_iv(&aes_ctx, connection->keys1.shared_key, packet->aes_iv);
+bool NBN_GameServer_IsEncryptionEnabled(void)
+{
+    return __game_server.endpoint.config.is_encryption_enabled;
+}
 
-    unsigned int bytes_to_decrypt = packet->size - NBN_PACKET_HEADER_SIZE;
+void NBN_GameServer_SetFECEnabled(bool enabled)
+{
+    __game_server.endpoint.config.is_fec_enabled = enabled;
+}
 
-    assert(bytes_to_decrypt % AES_BLOCKLEN == 0);
-    assert(bytes_to_decrypt < NBN_PACKET_MAX_DATA_SIZE);
+void NBN_GameServer_SetHook(NBN_HookType type, NBN_Hook hook, void *user_data)
+{
+    NBN_Endpoint_SetHook(&__game_server.endpoint, type, hook, user_data);
+}
 
-    AES_CBC_decrypt_buffer(&aes_ctx, packet->buffer + NBN_PACKET_HEADER_SIZE, bytes_to_decrypt);
+#ifdef NBN_DEBUG
 
-    NBN_LogTrace("Decrypted packet %d (%d bytes)", packet->header.seq_number, packet->size);
+void NBN_GameServer_Debug_RegisterCallback(NBN_ConnectionDebugCallback cb_type, void *cb)
+{
+    switch (cb_type)
+    {
+        case NBN_DEBUG_CB_MSG_ADDED_TO_RECV_QUEUE:
+            NBN_Endpoint_SetHook(&__game_server.endpoint, NBN_HOOK_MESSAGE_ADDED_TO_RECV_QUEUE, Endpoint_CallDebugCallback, cb);
+            break;
+    }
 }
 
-void NBN_Packet_ComputeIV(NBN_Packet *packet, NBN_Connection *connection)
+#endif /* NBN_DEBUG */
+
+static int GameServer_AddClient(NBN_Connection *client)
 {
-    struct AES_ctx aes_ctx;
+    if (__game_server.clients->count >= NBN_MAX_CLIENTS)
+        return NBN_ERROR;
 
-    AES_init_ctx_iv(&aes_ctx, connection->keys2.shared_key, connection->aes_iv);
+    unsigned int slot = 0;
 
-    memset(packet->aes_iv, 0, AES_BLOCKLEN);
-    memcpy(packet->aes_iv, (uint8_t *)&packet->header.seq_number, sizeof(packet->header.seq_number));
+    for (; slot < NBN_MAX_CLIENTS && __game_server.client_slots[slot]; slot++);
 
-    AES_CBC_encrypt_buffer(&aes_ctx, packet->aes_iv, AES_BLOCKLEN);
-}
+    assert(slot < NBN_MAX_CLIENTS);
 
-void NBN_Packet_Authenticate(NBN_Packet *packet, NBN_Connection *connection)
-{ 
-    uint8_t poly1305_key[POLY1305_KEYLEN] = {0};
+    if (NBN_ConnectionVector_Add(__game_server.clients, client) < 0)
+        return NBN_ERROR;
 
-    NBN_Packet_ComputePoly1305Key(packet, connection, poly1305_key);
+    client->slot = slot;
+    __game_server.client_slots[slot] = client;
 
-    memset(packet->header.auth_tag, 0, POLY1305_TAGLEN);
+    return 0;
+}
 
-    poly1305_auth(
-            packet->header.auth_tag,
-            packet->buffer + NBN_PACKET_HEADER_SIZE,
-            packet->size - NBN_PACKET_HEADER_SIZE,
-            poly1305_key);
+static void GameServer_RemoveClientFromAllGroups(NBN_Connection *client)
+{
+    for (unsigned int i = 0; i < NBN_MAX_BROADCAST_GROUPS; i++)
+        NBN_GameServer_RemoveClientFromGroup(client, i);
 }
 
-bool NBN_Packet_CheckAuthentication(NBN_Packet *packet, NBN_Connection *connection)
+static int GameServer_BroadcastMessageToClients(
+        NBN_Connection **clients, unsigned int count, NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
 {
-    uint8_t poly1305_key[POLY1305_KEYLEN] = {0};
-    uint8_t auth_tag[POLY1305_TAGLEN] = {0};
+    if (count == 0)
+        return 0;
 
-    NBN_Packet_ComputePoly1305Key(packet, connection, poly1305_key);
+    if (__game_server.endpoint.channels[channel_id] == NBN_CHANNEL_TYPE_UNDEFINED)
+    {
+        NBN_LogError("Channel %d does not exist", channel_id);
 
-    poly1305_auth(
-            auth_tag,
-            packet->buffer + NBN_PACKET_HEADER_SIZE,
-            packet->size - NBN_PACKET_HEADER_SIZE,
-            poly1305_key);
+        return NBN_ERROR;
+    }
 
-    return memcmp(packet->header.auth_tag, auth_tag, POLY1305_TAGLEN) == 0;
-}
+    /* Measure and split the message only once for all clients */
+    NBN_OutgoingMessage *chunk_msgs[NBN_CHANNEL_CHUNKS_BUFFER_SIZE];
+    int chunk_count = Endpoint_PrepareOutgoingMessage(&__game_server.endpoint, outgoing_msg, channel_id, chunk_msgs);
 
-void NBN_Packet_ComputePoly1305Key(NBN_Packet *packet, NBN_Connection *connection, uint8_t *poly1305_key)
-{
-    struct AES_ctx aes_ctx;
+    if (chunk_count < 0)
+        return NBN_ERROR;
 
-    memcpy(poly1305_key, (uint8_t *)&packet->header.seq_number, sizeof(packet->header.seq_number));
+    int ret = 0;
 
-    AES_init_ctx_iv(&aes_ctx, connection->keys3.shared_key, connection->aes_iv);
-    AES_CBC_encrypt_buffer(&aes_ctx, poly1305_key, POLY1305_KEYLEN);
-}
+    for (unsigned int i = 0; i < count; i++)
+    {
+        NBN_Connection *client = clients[i];
 
-#pragma endregion /* NBN_Packet */
+        /* the other clients still get the message */
+        if (Endpoint_EnqueuePreparedMessage(client, outgoing_msg, channel_id, chunk_msgs, chunk_count) < 0)
+        {
+            NBN_LogError("Failed to broadcast message to client %d", client->id);
 
-#pragma region NBN_Message
+            GameServer_CloseClientWithCode(client, -1, false);
 
-int NBN_Message_SerializeHeader(NBN_MessageHeader *message_header, NBN_Stream *stream)
-{
-    NBN_SerializeBytes(stream, &message_header->id, sizeof(message_header->id));
-    NBN_SerializeBytes(stream, &message_header->type, sizeof(message_header->type));
-    NBN_SerializeBytes(stream, &message_header->channel_id, sizeof(message_header->channel_id));
+            ret = NBN_ERROR;
+        }
+    }
 
-    return 0;
+    return ret;
 }
 
-int NBN_Message_Measure(NBN_Message *message, NBN_MeasureStream *m_stream, NBN_MessageSerializer msg_serializer)
+static int GameServer_CloseClientWithCode(NBN_Connection *client, int code, bool disconnection)
 {
-    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)m_stream) < 0)
-        return NBN_ERROR;
+    NBN_LogTrace("Closing connection %d", client->id);
 
-    if (NBN_Message_SerializeData(message, (NBN_Stream *)m_stream, msg_serializer) < 0)
-        return NBN_ERROR;
+    if (!client->is_closed && client->is_accepted)
+    {
+        if (!disconnection)
+        {
+            NBN_Event e;
 
-    return m_stream->number_of_bits;
-}
+            e.type = NBN_CLIENT_DISCONNECTED;
+            e.data.connection = client;
 
-int NBN_Message_SerializeData(NBN_Message *message, NBN_Stream *stream, NBN_MessageSerializer msg_serializer)
-{
-    return msg_serializer(message->data, stream);
-}
+            if (!NBN_EventQueue_Enqueue(&__game_server.endpoint.event_queue, e))
+                return NBN_ERROR;
+        }
+    }
 
-#pragma endregion /* NBN_Message */
+    if (!client->is_closed)
+        NBN_EmitHook(&__game_server.endpoint, NBN_HOOK_CONNECTION_CLOSED, client, NULL);
 
-#pragma region NBN_MessageChunk
+    if (client->is_stale)
+    {
+        client->is_closed = true;
 
-NBN_MessageChunk *NBN_MessageChunk_Create(void)
-{
-    NBN_MessageChunk *chunk = (NBN_MessageChunk*)MemoryManager_Alloc(NBN_MEM_MESSAGE_CHUNK);
+        return 0;
+    }
 
-    chunk->outgoing_msg = NULL;
+    client->is_closed = true;
 
-    return chunk;
-}
+    if (!disconnection)
+    {
+        NBN_LogDebug("Send close message for client %d (code: %d)", client->id, code);
 
-void NBN_MessageChunk_Destroy(NBN_MessageChunk *chunk)
-{
-    MemoryManager_Dealloc(chunk, NBN_MEM_MESSAGE_CHUNK);
-}
+        NBN_ClientClosedMessage *msg = NBN_ClientClosedMessage_Create();
 
-int NBN_MessageChunk_Serialize(NBN_MessageChunk *msg, NBN_Stream *stream)
-{
-    NBN_SerializeBytes(stream, &msg->id, 1);
-    NBN_SerializeBytes(stream, &msg->total, 1);
-    NBN_SerializeBytes(stream, msg->data, NBN_MESSAGE_CHUNK_SIZE);
+        msg->code = code;
 
-    return 0;
-}
+        NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(NBN_CLIENT_CLOSED_MESSAGE_TYPE, msg);
 
-#pragma endregion /* NBN_MessageChunk */
+        if (outgoing_msg == NULL)
+            return NBN_ERROR;
 
-#pragma region NBN_ClientClosedMessage
+        NBN_GameServer_SendMessageTo(client, outgoing_msg, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES);
+    }
 
-NBN_ClientClosedMessage *NBN_ClientClosedMessage_Create(void)
-{
-    return (NBN_ClientClosedMessage*)NBN_Allocator(sizeof(NBN_ClientClosedMessage));
+    return 0;
 }
 
-void NBN_ClientClosedMessage_Destroy(NBN_ClientClosedMessage *msg)
+static unsigned int GameServer_GetClientCount(void)
 {
-    NBN_Deallocator(msg);
+    return __game_server.clients->count;
 }
 
-int NBN_ClientClosedMessage_Serialize(NBN_ClientClosedMessage *msg, NBN_Stream *stream)
+static int GameServer_ProcessReceivedMessage(NBN_Message *message, NBN_Connection *client)
 {
-    NBN_SerializeInt(stream, msg->code, SHRT_MIN, SHRT_MAX);
-
-    return 0;
-}
+    NBN_Event ev;
 
-#pragma endregion /* NBN_ClientClosedMessage */
+    ev.type = NBN_CLIENT_MESSAGE_RECEIVED;
 
-#pragma region NBN_ClientAcceptedMessage
+    if (message->header.type == NBN_MESSAGE_CHUNK_TYPE)
+    {
+        NBN_Channel *channel = client->channels[message->header.channel_id];
 
-NBN_ClientAcceptedMessage *NBN_ClientAcceptedMessage_Create(void)
-{
-    return (NBN_ClientAcceptedMessage*)NBN_Allocator(sizeof(NBN_ClientAcceptedMessage));
-}
+        if (!NBN_Channel_AddChunk(channel, message))
+            return 0;
 
-void NBN_ClientAcceptedMessage_Destroy(NBN_ClientAcceptedMessage *msg)
-{
-    NBN_Deallocator(msg);
-}
+        NBN_Message complete_message;
 
-int NBN_ClientAcceptedMessage_Serialize(NBN_ClientAcceptedMessage *msg, NBN_Stream *stream)
-{
-    NBN_SerializeBytes(stream, msg->data, NBN_ACCEPT_DATA_MAX_SIZE);
+        if (NBN_Channel_ReconstructMessageFromChunks(channel, client, &complete_message) < 0)
+        {
+            NBN_LogError("Failed to reconstruct message from chunks");
 
-    return 0;
-}
+            return NBN_ERROR;
+        }
 
-#pragma endregion /* NBN_ClientAcceptedMessage */
+        NBN_MessageInfo msg_info = { complete_message.header.type, complete_message.data, client };
 
-#pragma region NBN_ByteArrayMessage
+        ev.data.message_info = msg_info;
+    }
+    else
+    {
+        NBN_MessageInfo msg_info = { message->header.type, message->data, client };
 
-NBN_ByteArrayMessage *NBN_ByteArrayMessage_Create(void)
-{
-    return (NBN_ByteArrayMessage*)MemoryManager_Alloc(NBN_MEM_BYTE_ARRAY_MESSAGE);
-}
+        ev.data.message_info = msg_info;
+    }
 
-void NBN_ByteArrayMessage_Destroy(NBN_ByteArrayMessage *msg)
-{
-    MemoryManager_Dealloc(msg, NBN_MEM_BYTE_ARRAY_MESSAGE);
-}
+    if (__game_server.endpoint.recorder)
+    {
+        Endpoint_RecordMessage(
+                &__game_server.endpoint,
+                client,
+                message->header.channel_id,
+                ev.data.message_info.type,
+                ev.data.message_info.data,
+                NBN_RECORD_RECEIVED);
+    }
 
-int NBN_ByteArrayMessage_Serialize(NBN_ByteArrayMessage *msg, NBN_Stream *stream)
-{
-    NBN_SerializeUInt(stream, msg->length, 0, NBN_BYTE_ARRAY_MAX_SIZE);
-    NBN_SerializeBytes(stream, msg->bytes, msg->length);
+    if (!NBN_EventQueue_Enqueue(&__game_server.endpoint.event_queue, ev))
+        return NBN_ERROR;
 
     return 0;
 }
 
-#pragma endregion /* NBN_ByteArrayMessage */
+static int GameServer_CloseStaleClientConnections(void)
+{
+    for (unsigned int i = 0; i < __game_server.clients->count; i++)
+    {
+        NBN_Connection *client = __game_server.clients->connections[i];
 
-#pragma region NBN_PublicCryptoInfoMessage
+        if (!client->is_closed && !client->is_stale && NBN_Connection_CheckIfStale(client))
+        {
+            NBN_LogInfo("Client %d connection is stale, closing it.", client->id);
 
-NBN_PublicCryptoInfoMessage *NBN_PublicCryptoInfoMessage_Create(void)
-{
-    return (NBN_PublicCryptoInfoMessage*)NBN_Allocator(sizeof(NBN_PublicCryptoInfoMessage));
-}
+            client->is_stale = true;
 
-void NBN_PublicCryptoInfoMessage_Destroy(NBN_PublicCryptoInfoMessage *msg)
-{
-    NBN_Deallocator(msg);
-}
+            NBN_EmitHook(&__game_server.endpoint, NBN_HOOK_CONNECTION_STALE, client, NULL);
 
-int NBN_PublicCryptoInfoMessage_Serialize(NBN_PublicCryptoInfoMessage *msg, NBN_Stream *stream)
-{
-    NBN_SerializeBytes(stream, msg->pub_key1, ECC_PUB_KEY_SIZE);
-    NBN_SerializeBytes(stream, msg->pub_key2, ECC_PUB_KEY_SIZE);
-    NBN_SerializeBytes(stream, msg->pub_key3, ECC_PUB_KEY_SIZE);
-    NBN_SerializeBytes(stream, msg->aes_iv, AES_BLOCKLEN);
+            if (GameServer_CloseClientWithCode(client, -1, false) < 0)
+                return NBN_ERROR;
+        }
+    }
 
     return 0;
 }
 
-#pragma endregion /* NBN_PublicCryptoInfoMessage */
-
-#pragma region NBN_StartEncryptMessage
-
-void *NBN_StartEncryptMessage_Create(void)
+static void GameServer_RemoveClosedClientConnections(void)
 {
-    return NULL;
-}
+    unsigned int count = __game_server.clients->count;
 
-void NBN_StartEncryptMessage_Destroy(void *msg)
-{
-    (void)msg;
-}
+    for (unsigned int i = 0; i < count; i++)
+    {
+        NBN_Connection *client = __game_server.clients->connections[i];
 
-int NBN_StartEncryptMessage_Serialize(void *msg, NBN_Stream *stream)
-{
-    (void)msg;
-    (void)stream;
+        if (client && client->is_closed && client->is_stale)
+        {
+            NBN_LogDebug("Remove closed client connection (ID: %d)", client->id);
 
-    return 0;
-}
+            GameServer_RemoveClientFromAllGroups(client);
 
-#pragma endregion /* NBN_StartEncryptMessage */
+            if (__game_server.endpoint.replicator)
+                NBN_Replicator_RemoveClient(__game_server.endpoint.replicator, client);
 
-#pragma region NBN_DisconnectMessage
+            __game_server.client_slots[client->slot] = NULL;
 
-void *NBN_DisconnectionMessage_Create(void)
-{
-    return NULL;
+#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
+            /* the packet simulator thread may be sending a packet to that client */
+            NBN_PacketSimulator_Lock(&__game_server.endpoint.packet_simulator);
+            NBN_Driver_GServ_RemoveClientConnection(client);
+            NBN_PacketSimulator_Unlock(&__game_server.endpoint.packet_simulator);
+#else
+            NBN_Driver_GServ_RemoveClientConnection(client);
+#endif
+            NBN_ConnectionVector_Remove(__game_server.clients, client); // actually destroying the connection should be done in user code
+        }
+    }
 }
 
-void NBN_DisconnectionMessage_Destroy(void *msg)
+static int GameServer_HandleEvent(void)
 {
-    NBN_Deallocator(msg);
-}
+    switch (server_last_event.type)
+    {
+        case NBN_CLIENT_MESSAGE_RECEIVED:
+            return GameServer_HandleMessageReceivedEvent();
 
-int NBN_DisconnectionMessage_Serialize(void *msg, NBN_Stream *stream)
-{
-    (void)msg;
-    (void)stream;
+        default:
+            break;
+    }
 
-    return 0;
+    return server_last_event.type;
 }
 
-#pragma endregion /* NBN_DisconnectMessage */
-
-#pragma region NBN_ConnectionRequestMessage
-
-NBN_ConnectionRequestMessage *NBN_ConnectionRequestMessage_Create(void)
+static int GameServer_HandleMessageReceivedEvent(void)
 {
-    return (NBN_ConnectionRequestMessage *)NBN_Allocator(sizeof(NBN_ConnectionRequestMessage));
-}
+    NBN_MessageInfo message_info = server_last_event.data.message_info;
 
-void NBN_ConnectionRequestMessage_Destroy(NBN_ConnectionRequestMessage *msg)
-{
-    NBN_Deallocator(msg);
-}
+    // skip all events related to a closed or stale connection
+    if (message_info.sender->is_closed || message_info.sender->is_stale)
+        return NBN_SKIP_EVENT;
 
-int NBN_ConnectionRequestMessage_Serialize(NBN_ConnectionRequestMessage *msg, NBN_Stream *stream)
-{
-    NBN_SerializeBytes(stream, msg->data, NBN_CONNECTION_DATA_MAX_SIZE);
+    if (message_info.type == NBN_DISCONNECTION_MESSAGE_TYPE)
+    {
+        NBN_Connection *cli = server_last_event.data.message_info.sender;
 
-    return 0;
-}
+        NBN_LogInfo("Received disconnection message from client %d", cli->id);
 
-#pragma endregion /* NBN_ConnectionRequestMessage */
+        if (GameServer_CloseClientWithCode(cli, -1, true) < 0)
+            return NBN_ERROR;
 
-#pragma region NBN_Connection
+        cli->is_stale = true;
 
-static uint32_t Connection_BuildPacketAckBits(NBN_Connection *);
-static int Connection_DecodePacketHeader(NBN_Connection *, NBN_Packet *);
-static int Connection_AckPacket(NBN_Connection *, uint16_t);
-static void Connection_InitOutgoingPacket(NBN_Connection *, NBN_Packet *, NBN_PacketEntry **);
-static NBN_PacketEntry *Connection_InsertOutgoingPacketEntry(NBN_Connection *, uint16_t);
-static bool Connection_InsertReceivedPacketEntry(NBN_Connection *, uint16_t);
-static NBN_PacketEntry *Connection_FindSendPacketEntry(NBN_Connection *, uint16_t);
-static bool Connection_IsPacketReceived(NBN_Connection *, uint16_t);
-static int Connection_SendPacket(NBN_Connection *, NBN_Packet *, NBN_PacketEntry *);
-static int Connection_ReadNextMessageFromStream(NBN_Connection *, NBN_ReadStream *, NBN_Message *);
-static int Connection_ReadNextMessageFromPacket(NBN_Connection *, NBN_Packet *, NBN_Message *);
-static int Connection_RecycleMessage(NBN_Connection *, NBN_Message *);
-static void Connection_UpdateAveragePing(NBN_Connection *, double);
-static void Connection_UpdateAveragePacketLoss(NBN_Connection *, uint16_t);
-static void Connection_UpdateAverageUploadBandwidth(NBN_Connection *, float);
-static void Connection_UpdateAverageDownloadBandwidth(NBN_Connection *);
+        GameServer_RemoveClosedClientConnections();
 
-/* Encryption related functions */
+        server_last_event.type = NBN_CLIENT_DISCONNECTED;
+        server_last_event.data.connection = cli;
 
-static int Connection_GenerateKeys(NBN_Connection *);
-static int Connection_GenerateKeySet(NBN_ConnectionKeySet *, CSPRNG *);
-static int Connection_BuildSharedKey(NBN_ConnectionKeySet *, uint8_t *);
-static void Connection_StartEncryption(NBN_Connection *);
+        return NBN_CLIENT_DISCONNECTED;
+    }
 
-static int ecdh_generate_keys(uint8_t*, uint8_t*);
-static int ecdh_shared_secret(const uint8_t*, const uint8_t*, uint8_t*);
+    int ret = NBN_CLIENT_MESSAGE_RECEIVED;
+ 
+    if (NBN_GameServer_IsEncryptionEnabled() && message_info.type == NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE)
+    {
+        ret = NBN_NO_EVENT;
 
-static CSPRNG csprng_create();
-static CSPRNG csprng_destroy(CSPRNG object);
-static int csprng_get(CSPRNG, void*, unsigned long long);
+        NBN_PublicCryptoInfoMessage *pub_crypto_msg = (NBN_PublicCryptoInfoMessage*)message_info.data;
 
-NBN_Connection *NBN_Connection_Create(uint32_t id, uint32_t protocol_id, NBN_Endpoint *endpoint, void *driver_data)
-{
-    NBN_Connection *connection = (NBN_Connection*)MemoryManager_Alloc(NBN_MEM_CONNECTION);
+        if (Connection_BuildSharedKey(&message_info.sender->keys1, pub_crypto_msg->pub_key1) < 0)
+        {
+            NBN_LogError("Failed to build shared key (first key)");
+            NBN_Abort();
+        }
 
-    connection->id = id;
-    connection->protocol_id = protocol_id;
-    connection->user_data = NULL;
-    connection->endpoint = endpoint;
-    connection->last_recv_packet_time = 0;
-    connection->next_packet_seq_number = 1;
-    connection->last_received_packet_seq_number = 0;
-    connection->last_flush_time = 0;
-    connection->last_read_packets_time = 0;
-    connection->downloaded_bytes = 0;
-    connection->time = 0;
-    connection->is_accepted = false;
-    connection->is_stale = false;
-    connection->is_closed = false;
+        if (Connection_BuildSharedKey(&message_info.sender->keys2, pub_crypto_msg->pub_key2) < 0)
+        {
+            NBN_LogError("Failed to build shared key (second key)");
+            NBN_Abort();
+        }
 
-    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
-        connection->channels[i] = NULL;
+        if (Connection_BuildSharedKey(&message_info.sender->keys3, pub_crypto_msg->pub_key3) < 0)
+        {
+            NBN_LogError("Failed to build shared key (third key)");
+            NBN_Abort();
+        }
 
-    for (int i = 0; i < NBN_MAX_PACKET_ENTRIES; i++)
-    {
-        connection->packet_send_seq_buffer[i] = 0xFFFFFFFF;
-        connection->packet_recv_seq_buffer[i] = 0xFFFFFFFF;
-    }
+        NBN_LogDebug("Received public crypto info of client %d", message_info.sender->id);
 
-    NBN_ConnectionStats stats = { 0 };
+        NBN_EmitHook(&__game_server.endpoint, NBN_HOOK_CRYPTO_INFO_RECEIVED, message_info.sender, NULL);
 
-    connection->stats = stats;
-    connection->driver_data = driver_data;
-    connection->can_decrypt = false;
-    connection->can_encrypt = false;
+        if (GameServer_StartEncryption(message_info.sender))
+        {
+            NBN_LogError("Failed to start encryption of client %d", message_info.sender->id);
+            NBN_Abort();
+        }
 
-    if (endpoint->config.is_encryption_enabled)
+        message_info.sender->can_decrypt = true; 
+    }
+    else if (message_info.type == NBN_INPUT_MESSAGE_TYPE)
     {
-        if (Connection_GenerateKeys(connection)  < 0)
-        {
-            NBN_LogError("Failed to generate keys");
+        /* inputs are buffered until read with NBN_GameServer_ReadInput */
+        ret = NBN_SKIP_EVENT;
 
-            NBN_Deallocator(connection);
+        if (!message_info.sender->input_receiver)
+            message_info.sender->input_receiver = InputReceiver_Create();
 
-            return NULL;
-        }
+        InputReceiver_AddMessage(message_info.sender->input_receiver, (NBN_InputMessage *)message_info.data);
     }
+    else if (message_info.type == NBN_CONNECTION_REQUEST_MESSAGE_TYPE)
+    {
+        ret = NBN_NO_EVENT;
 
-    memset(connection->accept_data, 0, NBN_ACCEPT_DATA_MAX_SIZE);
+        NBN_ConnectionRequestMessage *msg = (NBN_ConnectionRequestMessage *)message_info.data;
 
-    if (connection->endpoint->is_server)
-        NBN_WriteStream_Init(
-            &connection->accept_data_w_stream, (uint8_t*)connection->accept_data, NBN_ACCEPT_DATA_MAX_SIZE);
-    else
-        NBN_ReadStream_Init(
-            &connection->accept_data_r_stream, (uint8_t *)connection->accept_data, NBN_ACCEPT_DATA_MAX_SIZE);
+        memcpy(message_info.sender->connection_data, msg->data, NBN_CONNECTION_DATA_MAX_SIZE);
 
-    return connection;
+        NBN_EmitHook(&__game_server.endpoint, NBN_HOOK_CONNECTION_REQUESTED, message_info.sender, NULL);
+
+        NBN_Event e;
+
+        e.type = NBN_NEW_CONNECTION;
+        e.data.connection = message_info.sender;
+
+        if (!NBN_EventQueue_Enqueue(&__game_server.endpoint.event_queue, e))
+            return NBN_ERROR;
+    }
+
+    return ret;
 }
 
-void NBN_Connection_Destroy(NBN_Connection *connection)
+#pragma endregion /* NBN_GameServer */
+
+#pragma region Game server driver
+
+static int Driver_GServ_OnClientConnected(NBN_Connection *);
+static int Driver_GServ_OnClientPacketReceived(NBN_Packet *);
+
+int NBN_Driver_GServ_RaiseEvent(NBN_Driver_GServ_EventType ev, void *data)
 {
-    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+    switch (ev)
     {
-        if (connection->channels[i])
-            NBN_Deallocator(connection->channels[i]);
+        case NBN_DRIVER_GSERV_CLIENT_CONNECTED:
+            return Driver_GServ_OnClientConnected((NBN_Connection*)data);
+
+        case NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED:
+            return Driver_GServ_OnClientPacketReceived((NBN_Packet*)data);
     }
 
-    MemoryManager_Dealloc(connection, NBN_MEM_CONNECTION);
+    return 0;
 }
 
-int NBN_Connection_ProcessReceivedPacket(NBN_Connection *connection, NBN_Packet *packet)
+static int Driver_GServ_OnClientConnected(NBN_Connection *client)
 {
-    if (Connection_DecodePacketHeader(connection, packet) < 0)
+    if (GameServer_AddClient(client) < 0)
     {
-        NBN_LogError("Failed to decode packet %d header", packet->header.seq_number);
+        NBN_LogError("Failed to add client");
 
         return NBN_ERROR;
     }
 
-    Connection_UpdateAveragePacketLoss(connection, packet->header.ack);
-
-    if (!Connection_InsertReceivedPacketEntry(connection, packet->header.seq_number))
-        return 0;
+    if (NBN_GameServer_IsEncryptionEnabled())
+    {
+        if (GameServer_SendCryptoPublicInfoTo(client) < 0)
+        {
+            NBN_LogError("Failed to send public key to client %d", client->id);
+            NBN_Abort();
+        }
+    }
 
-    if (SEQUENCE_NUMBER_GT(packet->header.seq_number, connection->last_received_packet_seq_number))
-        connection->last_received_packet_seq_number = packet->header.seq_number;
+    return 0;
+}
 
-    for (int i = 0; i < packet->header.messages_count; i++)
+static int Driver_GServ_OnClientPacketReceived(NBN_Packet *packet)
+{
+    if (Endpoint_ProcessReceivedPacket(&__game_server.endpoint, packet, packet->sender) < 0)
     {
-        NBN_Message message;
+        NBN_LogError("An error occured while processing packet from client %d, closing the client", packet->sender->id);
 
-        message.outgoing_msg = NULL;
+        return GameServer_CloseClientWithCode(packet->sender, -1, false);
+    }
 
-        if (Connection_ReadNextMessageFromPacket(connection, packet, &message) < 0)
-        {
-            NBN_LogError("Failed to read message from packet");
+    return 0;
+}
 
-            return NBN_ERROR;
-        }
+static int GameServer_SendCryptoPublicInfoTo(NBN_Connection *client)
+{
+    NBN_PublicCryptoInfoMessage *msg = NBN_PublicCryptoInfoMessage_Create();
 
-        NBN_Channel *channel = connection->channels[message.header.channel_id];
+    memcpy(msg->pub_key1, client->keys1.pub_key, ECC_PUB_KEY_SIZE);
+    memcpy(msg->pub_key2, client->keys2.pub_key, ECC_PUB_KEY_SIZE);
+    memcpy(msg->pub_key3, client->keys3.pub_key, ECC_PUB_KEY_SIZE);
+    memcpy(msg->aes_iv, client->aes_iv, AES_BLOCKLEN);
 
-        if (channel->AddReceivedMessage(channel, &message))
-        {
-            NBN_LogTrace("Received message %d on channel %d : added to recv queue", message.header.id, channel->id);
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE, msg);
 
-#ifdef NBN_DEBUG
-            if (connection->OnMessageAddedToRecvQueue)
-                connection->OnMessageAddedToRecvQueue(connection, &message);
-#endif
-        }
-        else
-        {
-            NBN_LogTrace("Received message %d : discarded", message.header.id);
+    if (outgoing_msg == NULL)
+        return NBN_ERROR;
 
-            Connection_RecycleMessage(connection, &message);
-        }
-    }
+    if (NBN_GameServer_SendReliableMessageTo(client, outgoing_msg) < 0)
+        return NBN_ERROR;
+
+    NBN_LogDebug("Sent server's public key to the client %d", client->id);
+
+    NBN_EmitHook(&__game_server.endpoint, NBN_HOOK_CRYPTO_INFO_SENT, client, NULL);
 
     return 0;
 }
 
-int NBN_Connection_EnqueueOutgoingMessage(NBN_Connection *connection, NBN_Channel *channel, NBN_Message *message)
+static int GameServer_StartEncryption(NBN_Connection *client)
 {
-    assert(!connection->is_closed || message->header.type == NBN_CLIENT_CLOSED_MESSAGE_TYPE);
-    assert(!connection->is_stale);
+    Connection_StartEncryption(client);
 
-    NBN_LogTrace("Enqueue message of type %d on channel %d", message->header.type, channel->id);
+    NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(
+            NBN_START_ENCRYPT_MESSAGE_TYPE, NBN_StartEncryptMessage_Create());
 
-    if (!channel->AddOutgoingMessage(channel, message))
-    {
-        NBN_LogError("Failed to enqueue outgoing message of type %d on channel %d",
-                message->header.type, message->header.channel_id);
+    if (outgoing_msg == NULL)
+        return NBN_ERROR;
 
+    if (NBN_GameServer_SendReliableMessageTo(client, outgoing_msg) < 0)
         return NBN_ERROR;
-    }
 
     return 0;
 }
 
-int NBN_Connection_FlushSendQueue(NBN_Connection *connection)
+#pragma endregion /* Game server driver */
+
+#pragma region NBN_InputStream
+
+static NBN_InputSender *InputSender_Create(void)
 {
-    NBN_LogTrace("Flushing the send queue");
+    NBN_InputSender *input_sender = (NBN_InputSender *)NBN_Allocator(sizeof(NBN_InputSender));
 
-    NBN_Packet packet;
-    NBN_PacketEntry *packet_entry;
-    unsigned int sent_packet_count = 0;
-    unsigned int sent_bytes = 0;
+    input_sender->next_frame = 1;
+    input_sender->acked_frame = 0;
+    input_sender->inputs = (uint8_t *)NBN_Allocator(NBN_INPUT_MAX_FRAMES * __input_type.size);
+    input_sender->ack_callback = NULL;
+    input_sender->ack_callback_user_data = NULL;
 
-    Connection_InitOutgoingPacket(connection, &packet, &packet_entry);
+    return input_sender;
+}
 
-    for (unsigned int i = 0; i < NBN_MAX_CHANNELS; i++)
-    {
-        NBN_Channel *channel = connection->channels[i];
+static void InputSender_Destroy(NBN_InputSender *input_sender)
+{
+    NBN_Deallocator(input_sender->inputs);
+    NBN_Deallocator(input_sender);
+}
 
-        if (channel == NULL)
-            continue;
+static NBN_InputMessage *InputSender_AddInput(NBN_InputSender *input_sender, void *input, uint32_t *frame)
+{
+    size_t input_size = __input_type.size;
 
-        NBN_LogTrace("Flushing channel %d (message count: %d)", channel->id, channel->outgoing_message_count);
+    *frame = input_sender->next_frame++;
 
-        NBN_Message *message;
+    memcpy(input_sender->inputs + (*frame % NBN_INPUT_MAX_FRAMES) * input_size, input, input_size);
 
-        while (
-                sent_packet_count < NBN_CONNECTION_MAX_SENT_PACKET_COUNT &&
-                (message = channel->GetNextOutgoingMessage(channel)) != NULL
-              )
-        {
-            bool message_sent = false;
-            NBN_MessageSerializer msg_serializer = connection->endpoint->message_serializers[message->header.type];
+    /* all the unacked inputs, the oldest ones are dropped when there are too many */
+    uint32_t first_frame = input_sender->acked_frame + 1;
 
-            assert(msg_serializer);
+    if (input_sender->next_frame - first_frame > NBN_INPUT_MAX_FRAMES)
+        first_frame = input_sender->next_frame - NBN_INPUT_MAX_FRAMES;
 
-            int ret = NBN_Packet_WriteMessage(&packet, message, msg_serializer);
+    NBN_InputMessage *msg = NBN_InputMessage_Create();
 
-            if (ret == NBN_PACKET_WRITE_OK)
-            {
-                message_sent = true;
-            }
-            else if (ret == NBN_PACKET_WRITE_NO_SPACE)
-            {
-                if (Connection_SendPacket(connection, &packet, packet_entry) < 0)
-                {
-                    NBN_LogError("Failed to send packet %d", packet.header.seq_number);
+    msg->first_frame = first_frame;
+    msg->frame_count = input_sender->next_frame - first_frame;
+    msg->inputs = (uint8_t *)NBN_Allocator(msg->frame_count * input_size);
 
-                    return NBN_ERROR;
-                }
+    for (unsigned int i = 0; i < msg->frame_count; i++)
+    {
+        memcpy(msg->inputs + i * input_size,
+                input_sender->inputs + ((first_frame + i) % NBN_INPUT_MAX_FRAMES) * input_size, input_size);
+    }
 
-                sent_packet_count++;
-                sent_bytes += packet.size;
+    return msg;
+}
 
-                Connection_InitOutgoingPacket(connection, &packet, &packet_entry);
+static void InputSender_OnAck(NBN_InputSender *input_sender, uint16_t input_ack)
+{
+    /* rebuild the full frame number from its lowest 16 bits, it can only be one of the sent frames */
+    uint32_t last_frame = input_sender->next_frame - 1;
+    uint16_t distance = (uint16_t)last_frame - input_ack;
 
-                int ret = NBN_Packet_WriteMessage(&packet, message, msg_serializer);
+    if (distance > 32767 || distance > last_frame)
+        return;
 
-                if (ret != NBN_PACKET_WRITE_OK)
-                {
-                    NBN_LogError("Failed to send packet %d", packet.header.seq_number);
+    uint32_t frame = last_frame - distance;
 
-                    return NBN_ERROR;
-                }
+    /* acks carried by packets received out of order are older than the last one */
+    if (frame <= input_sender->acked_frame)
+        return;
 
-                message_sent = true;
-            }
-            else if (ret == NBN_PACKET_WRITE_ERROR)
-            {
-                NBN_LogError("Failed to write message %d of type %d to packet %d",
-                        message->header.id, message->header.type, packet.header.seq_number);
+    input_sender->acked_frame = frame;
 
-                return NBN_ERROR;
-            }
+    if (input_sender->ack_callback)
+        input_sender->ack_callback(frame, input_sender->ack_callback_user_data);
+}
 
-            if (message_sent)
-            {
-                NBN_LogTrace("Message %d added to packet %d", message->header.id, packet.header.seq_number);
+static NBN_InputReceiver *InputReceiver_Create(void)
+{
+    NBN_InputReceiver *input_receiver = (NBN_InputReceiver *)NBN_Allocator(sizeof(NBN_InputReceiver));
 
-                NBN_Channel_UpdateMessageLastSendTime(channel, message, connection->time);
+    input_receiver->next_frame = 1;
+    input_receiver->last_frame = 0;
+    input_receiver->inputs = (uint8_t *)NBN_Allocator(NBN_INPUT_MAX_FRAMES * __input_type.size);
 
-                NBN_MessageEntry e = { message->header.id, channel->id };
+    memset(input_receiver->frames, 0, sizeof(input_receiver->frames));
 
-                packet_entry->messages[packet_entry->messages_count++] = e;
+    return input_receiver;
+}
 
-                if (channel->type == NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED)
-                    Connection_RecycleMessage(connection, message);
-            }
-        }
-    }
+static void InputReceiver_Destroy(NBN_InputReceiver *input_receiver)
+{
+    NBN_Deallocator(input_receiver->inputs);
+    NBN_Deallocator(input_receiver);
+}
+
+static void InputReceiver_AddMessage(NBN_InputReceiver *input_receiver, NBN_InputMessage *msg)
+{
+    size_t input_size = __input_type.size;
 
-    if (Connection_SendPacket(connection, &packet, packet_entry) < 0)
+    /*
+     * The client always sends its inputs from the oldest unacked one, a message starting after the next
+     * frame to read means the client gave up on the frames in between
+     */
+    if (msg->first_frame > input_receiver->next_frame)
     {
-        NBN_LogError("Failed to send packet %d", packet.header.seq_number);
+        NBN_LogDebug("Skipped inputs %d to %d", input_receiver->next_frame, msg->first_frame - 1);
 
-        return NBN_ERROR;
+        input_receiver->next_frame = msg->first_frame;
+        input_receiver->last_frame = MAX(input_receiver->last_frame, input_receiver->next_frame - 1);
     }
 
-    sent_bytes += packet.size;
-    sent_packet_count++;
+    for (unsigned int i = 0; i < msg->frame_count; i++)
+    {
+        uint32_t frame = msg->first_frame + i;
+
+        /* already read or too far ahead of the next frame to read */
+        if (frame < input_receiver->next_frame || frame >= input_receiver->next_frame + NBN_INPUT_MAX_FRAMES)
+            continue;
 
-    double t = connection->time - connection->last_flush_time;
+        unsigned int slot = frame % NBN_INPUT_MAX_FRAMES;
 
-    if (t > 0)
-        Connection_UpdateAverageUploadBandwidth(connection, sent_bytes / t);
+        input_receiver->frames[slot] = frame;
 
-    connection->last_flush_time = connection->time;
+        memcpy(input_receiver->inputs + slot * input_size, msg->inputs + i * input_size, input_size);
+    }
 
-    return 0;
+    while (input_receiver->frames[(input_receiver->last_frame + 1) % NBN_INPUT_MAX_FRAMES] == input_receiver->last_frame + 1)
+        input_receiver->last_frame++;
 }
 
-int NBN_Connection_CreateChannel(NBN_Connection *connection, NBN_ChannelType type, uint8_t id)
+static int InputReceiver_ReadInput(NBN_InputReceiver *input_receiver, void *input, uint32_t *frame)
 {
-    if (id > NBN_MAX_CHANNELS - 1)
-        return NBN_ERROR;
+    unsigned int slot = input_receiver->next_frame % NBN_INPUT_MAX_FRAMES;
 
-    NBN_Channel *channel;
+    if (input_receiver->frames[slot] != input_receiver->next_frame)
+        return 0;
 
-    switch (type)
-    {
-        case NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED:
-            channel = (NBN_Channel *)NBN_UnreliableOrderedChannel_Create();
-            break;
+    memcpy(input, input_receiver->inputs + slot * __input_type.size, __input_type.size);
 
-        case NBN_CHANNEL_TYPE_RELIABLE_ORDERED:
-            channel = (NBN_Channel *)NBN_ReliableOrderedChannel_Create();
-            break;
+    *frame = input_receiver->next_frame++;
 
-        default:
-            NBN_LogError("Unsupported message channel type: %d", type);
+    return 1;
+}
 
-            return NBN_ERROR;
-    }
+#pragma endregion /* NBN_InputStream */
 
-    channel->id = id;
-    channel->type = type;
-    channel->connection = connection;
+#pragma region NBN_InterestGrid
 
-    channel->read_chunk_buffer = (uint8_t*)NBN_Allocator(NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE);
-    channel->write_chunk_buffer = (uint8_t*)NBN_Allocator(NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE);
+static uint32_t InterestGrid_HashCell(NBN_InterestGrid *, int32_t, int32_t);
+static void InterestGrid_LinkEntity(NBN_InterestGrid *, uint32_t);
+static void InterestGrid_UnlinkEntity(NBN_InterestGrid *, uint32_t);
+static void InterestGrid_MarkEntityDirty(NBN_InterestGrid *, uint32_t);
+static unsigned int InterestGrid_QueryView(NBN_InterestGrid *, NBN_InterestClient *);
+static int InterestGrid_UpdateClient(NBN_InterestGrid *, NBN_InterestClient *);
+static int InterestGrid_GrowClient(NBN_InterestClient *, unsigned int);
 
-    channel->read_chunk_buffer_size = NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE;
-    channel->write_chunk_buffer_size = NBN_CHANNEL_RW_CHUNK_BUFFER_INITIAL_SIZE;
-    channel->next_outgoing_chunked_message = 0;
-    channel->next_outgoing_message_id = 0;
-    channel->next_recv_message_id = 0;
-    channel->outgoing_message_count = 0;
-    channel->chunk_count = 0;
-    channel->last_received_chunk_id = -1;
+NBN_InterestGrid *NBN_InterestGrid_Create(float cell_size, unsigned int entity_capacity)
+{
+    assert(cell_size > 0);
+    assert(entity_capacity > 0 && entity_capacity < NBN_INTEREST_INVALID_ENTITY);
+
+    NBN_InterestGrid *grid = (NBN_InterestGrid *)NBN_Allocator(sizeof(NBN_InterestGrid));
+
+    if (grid == NULL)
+        return NULL;
 
-    for (unsigned int i = 0; i < NBN_CHANNEL_BUFFER_SIZE; i++)
+    memset(grid, 0, sizeof(NBN_InterestGrid));
+
+    /* at least as many buckets as entities, rounded up to a power of two */
+    unsigned int bucket_count = 16;
+
+    while (bucket_count < entity_capacity)
+        bucket_count *= 2;
+
+    grid->cell_size = cell_size;
+    grid->entity_capacity = entity_capacity;
+    grid->bucket_mask = bucket_count - 1;
+    grid->stamp = 0;
+
+    grid->entities = (NBN_InterestEntity *)NBN_Allocator(sizeof(NBN_InterestEntity) * entity_capacity);
+    grid->buckets = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * bucket_count);
+    grid->free_entities = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+    grid->removed_entities = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+    grid->dirty_entities = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+    grid->visible_stamps = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+    grid->scratch = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+
+    if (grid->entities == NULL || grid->buckets == NULL || grid->free_entities == NULL ||
+            grid->removed_entities == NULL || grid->dirty_entities == NULL ||
+            grid->visible_stamps == NULL || grid->scratch == NULL)
     {
-        channel->recved_message_slot_buffer[i].free = true;
-        channel->outgoing_message_slot_buffer[i].free = true;
+        NBN_LogError("Failed to allocate interest grid");
+
+        NBN_InterestGrid_Destroy(grid);
+
+        return NULL;
     }
 
-    for (int i = 0; i < NBN_CHANNEL_CHUNKS_BUFFER_SIZE; i++)
-        channel->recv_chunk_buffer[i] = NULL;
+    memset(grid->entities, 0, sizeof(NBN_InterestEntity) * entity_capacity);
+    memset(grid->visible_stamps, 0, sizeof(uint32_t) * entity_capacity);
 
-    connection->channels[id] = channel;
+    for (unsigned int i = 0; i < bucket_count; i++)
+        grid->buckets[i] = NBN_INTEREST_INVALID_ENTITY;
 
-    return 0;
-}
+    /* lowest IDs are used first */
+    for (unsigned int i = 0; i < entity_capacity; i++)
+        grid->free_entities[i] = entity_capacity - 1 - i;
 
-bool NBN_Connection_CheckIfStale(NBN_Connection *connection)
-{
-#if defined(NBN_DEBUG) && defined(NBN_DISABLE_STALE_CONNECTION_DETECTION)
-    /* When testing under bad network conditions (in soak test for instance), we don't want to deal
-       with stale connections */
-    return false;
-#else
-    return connection->time - connection->last_recv_packet_time > NBN_CONNECTION_STALE_TIME_THRESHOLD;
-#endif
+    grid->free_count = entity_capacity;
+
+    return grid;
 }
 
-void NBN_Connection_AddTime(NBN_Connection *connection, double time)
+void NBN_InterestGrid_Destroy(NBN_InterestGrid *grid)
 {
-    connection->time += time;
-
-    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
     {
-        NBN_Channel *channel = connection->channels[i];
-
-        if (channel != NULL)
-            NBN_Channel_AddTime(channel, time);
+        NBN_InterestClient *client = &grid->clients[i];
+
+        NBN_Deallocator(client->visible_bits);
+        NBN_Deallocator(client->visible);
+        NBN_Deallocator(client->changes);
     }
+
+    NBN_Deallocator(grid->entities);
+    NBN_Deallocator(grid->buckets);
+    NBN_Deallocator(grid->free_entities);
+    NBN_Deallocator(grid->removed_entities);
+    NBN_Deallocator(grid->dirty_entities);
+    NBN_Deallocator(grid->visible_stamps);
+    NBN_Deallocator(grid->scratch);
+    NBN_Deallocator(grid);
 }
 
-static int Connection_DecodePacketHeader(NBN_Connection *connection, NBN_Packet *packet)
+uint32_t NBN_InterestGrid_AddEntity(NBN_InterestGrid *grid, float x, float y)
 {
-    if (Connection_AckPacket(connection, packet->header.ack) < 0)
+    if (grid->free_count == 0)
     {
-        NBN_LogError("Failed to ack packet %d", packet->header.seq_number);
+        NBN_LogError("Interest grid is full (capacity: %d)", grid->entity_capacity);
 
-        return NBN_ERROR;
+        return NBN_INTEREST_INVALID_ENTITY;
     }
 
-    for (unsigned int i = 0; i < 32; i++)
-    {
-        if (B_IS_UNSET(packet->header.ack_bits, i))
-            continue;
+    uint32_t entity_id = grid->free_entities[--grid->free_count];
+    NBN_InterestEntity *entity = &grid->entities[entity_id];
 
-        if (Connection_AckPacket(connection, packet->header.ack - (i + 1)) < 0)
-        {
-            NBN_LogError("Failed to ack packet %d", packet->header.seq_number);
+    entity->x = x;
+    entity->y = y;
+    entity->cell_x = (int32_t)floorf(x / grid->cell_size);
+    entity->cell_y = (int32_t)floorf(y / grid->cell_size);
+    entity->is_active = true;
+    entity->is_dirty = false;
 
-            return NBN_ERROR;
-        }
-    }
+    InterestGrid_LinkEntity(grid, entity_id);
 
-    return 0;
+    return entity_id;
 }
 
-static uint32_t Connection_BuildPacketAckBits(NBN_Connection *connection)
+void NBN_InterestGrid_RemoveEntity(NBN_InterestGrid *grid, uint32_t entity_id)
 {
-    uint32_t ack_bits = 0;
+    assert(entity_id < grid->entity_capacity);
 
-    for (int i = 0; i < 32; i++)
-    {
-        /* 
-           when last_received_packet_seq_number is lower than 32, the value of acked_packet_seq_number will eventually
-           wrap around, which means the packets from before the wrap around will naturally be acked
-           */
+    NBN_InterestEntity *entity = &grid->entities[entity_id];
+
+    if (!entity->is_active)
+        return;
 
-        uint16_t acked_packet_seq_number = connection->last_received_packet_seq_number - (i + 1);
+    InterestGrid_UnlinkEntity(grid, entity_id);
 
-        if (Connection_IsPacketReceived(connection, acked_packet_seq_number))
-            B_SET(ack_bits, i);
-    }
+    entity->is_active = false;
 
-    return ack_bits;
+    /* the ID will be released after the next update, once the entity has left the view of all clients */
+    grid->removed_entities[grid->removed_count++] = entity_id;
 }
 
-static int Connection_AckPacket(NBN_Connection *connection, uint16_t ack_packet_seq_number)
+void NBN_InterestGrid_SetEntityPosition(NBN_InterestGrid *grid, uint32_t entity_id, float x, float y)
 {
-    NBN_PacketEntry *packet_entry = Connection_FindSendPacketEntry(connection, ack_packet_seq_number);
+    assert(entity_id < grid->entity_capacity);
 
-    if (packet_entry && !packet_entry->acked)
-    {
-        NBN_LogTrace("Packet %d acked (connection: %d)", ack_packet_seq_number, connection->id);
+    NBN_InterestEntity *entity = &grid->entities[entity_id];
 
-        packet_entry->acked = true;
+    assert(entity->is_active);
 
-        Connection_UpdateAveragePing(connection, connection->time - packet_entry->send_time);
+    int32_t cell_x = (int32_t)floorf(x / grid->cell_size);
+    int32_t cell_y = (int32_t)floorf(y / grid->cell_size);
 
-        for (unsigned int i = 0; i < packet_entry->messages_count; i++)
-        {
-            NBN_MessageEntry *msg_entry = &packet_entry->messages[i];
-            NBN_Channel *channel = connection->channels[msg_entry->channel_id];
+    entity->x = x;
+    entity->y = y;
 
-            assert(channel != NULL);
+    if (cell_x != entity->cell_x || cell_y != entity->cell_y)
+    {
+        InterestGrid_UnlinkEntity(grid, entity_id);
 
-            if (channel->OnOutgoingMessageAcked)
-            {
-                if (channel->OnOutgoingMessageAcked(channel, msg_entry->id) < 0)
-                    return NBN_ERROR;
-            }
-        }
+        entity->cell_x = cell_x;
+        entity->cell_y = cell_y;
+
+        InterestGrid_LinkEntity(grid, entity_id);
     }
 
-    return 0;
+    InterestGrid_MarkEntityDirty(grid, entity_id);
 }
 
-static void Connection_InitOutgoingPacket(
-        NBN_Connection *connection, NBN_Packet *outgoing_packet, NBN_PacketEntry **packet_entry)
+void NBN_InterestGrid_MarkEntityDirty(NBN_InterestGrid *grid, uint32_t entity_id)
 {
-    NBN_Packet_InitWrite(
-            outgoing_packet,
-            connection->protocol_id,
-            connection->next_packet_seq_number++,
-            connection->last_received_packet_seq_number,
-            Connection_BuildPacketAckBits(connection));
+    assert(entity_id < grid->entity_capacity);
+    assert(grid->entities[entity_id].is_active);
 
-    *packet_entry = Connection_InsertOutgoingPacketEntry(connection, outgoing_packet->header.seq_number);
+    InterestGrid_MarkEntityDirty(grid, entity_id);
 }
 
-static NBN_PacketEntry *Connection_InsertOutgoingPacketEntry(NBN_Connection *connection, uint16_t seq_number)
+int NBN_InterestGrid_SetClientView(NBN_InterestGrid *grid, NBN_Connection *client, float x, float y, float radius)
 {
-    uint16_t index = seq_number % NBN_MAX_PACKET_ENTRIES;
-    NBN_PacketEntry entry = { false, 0, 0 };
+    assert(client->slot < NBN_MAX_CLIENTS);
+    assert(radius >= 0);
 
-    connection->packet_send_seq_buffer[index] = seq_number;
-    connection->packet_send_buffer[index] = entry;
+    NBN_InterestClient *interest_client = &grid->clients[client->slot];
 
-    return &connection->packet_send_buffer[index];
-}
+    if (!interest_client->is_active)
+    {
+        unsigned int word_count = (grid->entity_capacity + 31) / 32;
 
-static bool Connection_InsertReceivedPacketEntry(NBN_Connection *connection, uint16_t seq_number)
-{
-    uint16_t index = seq_number % NBN_MAX_PACKET_ENTRIES;
+        interest_client->visible_bits = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * word_count);
 
-    /* Ignore duplicated packets */
-    if (connection->packet_recv_seq_buffer[index] != 0xFFFFFFFF &&
-            connection->packet_recv_seq_buffer[index] == seq_number)
-        return false;
+        if (interest_client->visible_bits == NULL)
+            return NBN_ERROR;
 
-    /*
-       Clear entries between the previous highest sequence numbers and new highest one
-       to avoid entries staying inside the sequence buffer from before the sequence wrap around
-       and break the packet acking logic.
-       */
-    if (SEQUENCE_NUMBER_GT(seq_number, connection->last_received_packet_seq_number))
-    {
-        for (uint16_t seq = connection->last_received_packet_seq_number + 1; SEQUENCE_NUMBER_LT(seq, seq_number); seq++)
-            connection->packet_recv_seq_buffer[seq % NBN_MAX_PACKET_ENTRIES] = 0xFFFFFFFF;
+        memset(interest_client->visible_bits, 0, sizeof(uint32_t) * word_count);
+
+        interest_client->connection = client;
+        interest_client->visible_count = 0;
+        interest_client->enter_count = 0;
+        interest_client->leave_count = 0;
+        interest_client->update_count = 0;
+        interest_client->is_active = true;
     }
 
-    connection->packet_recv_seq_buffer[index] = seq_number;
+    assert(interest_client->connection == client);
 
-    return true;
+    interest_client->x = x;
+    interest_client->y = y;
+    interest_client->radius = radius;
+
+    return 0;
 }
 
-static NBN_PacketEntry *Connection_FindSendPacketEntry(NBN_Connection *connection, uint16_t seq_number)
+void NBN_InterestGrid_RemoveClient(NBN_InterestGrid *grid, NBN_Connection *client)
 {
-    uint16_t index = seq_number % NBN_MAX_PACKET_ENTRIES;
+    assert(client->slot < NBN_MAX_CLIENTS);
 
-    if (connection->packet_send_seq_buffer[index] == seq_number)
-        return &connection->packet_send_buffer[index];
+    NBN_InterestClient *interest_client = &grid->clients[client->slot];
 
-    return NULL;
-}
+    if (!interest_client->is_active || interest_client->connection != client)
+        return;
 
-static bool Connection_IsPacketReceived(NBN_Connection *connection, uint16_t packet_seq_number)
-{
-    uint16_t index = packet_seq_number % NBN_MAX_PACKET_ENTRIES;
+    NBN_Deallocator(interest_client->visible_bits);
+    NBN_Deallocator(interest_client->visible);
+    NBN_Deallocator(interest_client->changes);
 
-    return connection->packet_recv_seq_buffer[index] == packet_seq_number;
+    memset(interest_client, 0, sizeof(NBN_InterestClient));
 }
 
-static int Connection_SendPacket(NBN_Connection *connection, NBN_Packet *packet, NBN_PacketEntry *packet_entry)
+int NBN_InterestGrid_Update(NBN_InterestGrid *grid)
 {
-    NBN_LogTrace("Send packet %d to connection %d (messages count: %d)",
-            packet->header.seq_number, connection->id, packet->header.messages_count);
-
-    assert(packet_entry->messages_count == packet->header.messages_count);
-
-    if (NBN_Packet_Seal(packet, connection) < 0)
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
     {
-        NBN_LogError("Failed to seal packet");
+        NBN_InterestClient *client = &grid->clients[i];
 
-        return NBN_ERROR;
+        if (client->is_active && InterestGrid_UpdateClient(grid, client) < 0)
+            return NBN_ERROR;
     }
 
-    packet_entry->send_time = connection->time;
+    for (unsigned int i = 0; i < grid->dirty_count; i++)
+        grid->entities[grid->dirty_entities[i]].is_dirty = false;
 
-    if (connection->endpoint->is_server)
-    {
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-        return NBN_PacketSimulator_EnqueuePacket(&__game_server.endpoint.packet_simulator, packet, connection);
-#else
-        if (connection->is_stale)
-            return 0;
+    grid->dirty_count = 0;
 
-        return NBN_Driver_GServ_SendPacketTo(packet, connection);
-#endif
-    }
-    else
-    {
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-        return NBN_PacketSimulator_EnqueuePacket(&__game_client.endpoint.packet_simulator, packet, connection);
-#else
-        return NBN_Driver_GCli_SendPacket(packet);
-#endif
-    }
+    /* removed entities have left the view of all clients, their IDs can be reused */
+    for (unsigned int i = 0; i < grid->removed_count; i++)
+        grid->free_entities[grid->free_count++] = grid->removed_entities[i];
+
+    grid->removed_count = 0;
+
+    return 0;
 }
 
-static int Connection_ReadNextMessageFromStream(
-        NBN_Connection *connection, NBN_ReadStream *r_stream, NBN_Message *message)
+NBN_InterestChanges NBN_InterestGrid_GetClientChanges(NBN_InterestGrid *grid, NBN_Connection *client)
 {
-    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)r_stream) < 0)
-    {
-        NBN_LogError("Failed to read message header");
+    assert(client->slot < NBN_MAX_CLIENTS);
 
-        return NBN_ERROR;
-    }
-    
-    uint8_t msg_type = message->header.type;
-    NBN_MessageBuilder msg_builder = connection->endpoint->message_builders[msg_type];
+    NBN_InterestClient *interest_client = &grid->clients[client->slot];
+    NBN_InterestChanges changes;
 
-    if (msg_builder == NULL)
-    {
-        NBN_LogError("No message builder is registered for messages of type %d", msg_type);
+    memset(&changes, 0, sizeof(NBN_InterestChanges));
 
-        return NBN_ERROR;
-    }
+    if (!interest_client->is_active || interest_client->connection != client)
+        return changes;
 
-    NBN_MessageSerializer msg_serializer = connection->endpoint->message_serializers[msg_type];
+    changes.entered = interest_client->changes;
+    changes.left = interest_client->changes + interest_client->enter_count;
+    changes.updated = interest_client->changes + interest_client->enter_count + interest_client->leave_count;
+    changes.enter_count = interest_client->enter_count;
+    changes.leave_count = interest_client->leave_count;
+    changes.update_count = interest_client->update_count;
 
-    if (msg_serializer == NULL)
+    return changes;
+}
+
+int NBN_GameServer_SendInterestChanges(
+    NBN_InterestGrid *grid, NBN_InterestMessageBuilder builder, uint8_t channel_id, void *user_data)
+{
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
     {
-        NBN_LogError("No message serializer attached to message of type %d", msg_type);
+        NBN_InterestClient *client = &grid->clients[i];
 
-        return NBN_ERROR;
-    }
+        if (!client->is_active)
+            continue;
 
-    NBN_Channel *channel = connection->channels[message->header.channel_id];
+        NBN_Connection *connection = client->connection;
 
-    if (channel == NULL)
-    {
-        NBN_LogError("Channel %d does not exist", message->header.channel_id);
+        /* same clients as a broadcast, messages cannot be sent to the others */
+        if (connection->is_closed || connection->is_stale || !connection->is_accepted)
+            continue;
 
-        return NBN_ERROR;
-    }
+        unsigned int change_count = client->enter_count + client->leave_count + client->update_count;
 
-    message->data = msg_builder();
+        for (unsigned int j = 0; j < change_count; j++)
+        {
+            NBN_InterestEvent ev;
 
-    if (msg_serializer(message->data, (NBN_Stream *)r_stream) < 0)
-    {
-        NBN_LogError("Failed to read message body");
+            if (j < client->enter_count)
+                ev = NBN_INTEREST_ENTER;
+            else if (j < client->enter_count + client->leave_count)
+                ev = NBN_INTEREST_LEAVE;
+            else
+                ev = NBN_INTEREST_UPDATE;
 
-        return NBN_ERROR;
+            NBN_OutgoingMessage *outgoing_msg = builder(ev, client->changes[j], user_data);
+
+            if (outgoing_msg == NULL)
+                continue;
+
+            if (NBN_GameServer_SendMessageTo(connection, outgoing_msg, channel_id) < 0)
+                return NBN_ERROR;
+        }
     }
 
     return 0;
 }
 
-static int Connection_ReadNextMessageFromPacket(NBN_Connection *connection, NBN_Packet *packet, NBN_Message *message)
+static uint32_t InterestGrid_HashCell(NBN_InterestGrid *grid, int32_t cell_x, int32_t cell_y)
 {
-    return Connection_ReadNextMessageFromStream(connection, &packet->r_stream, message);
+    return (((uint32_t)cell_x * 73856093u) ^ ((uint32_t)cell_y * 19349663u)) & grid->bucket_mask;
 }
 
-static int Connection_RecycleMessage(NBN_Connection *connection, NBN_Message *message)
+static void InterestGrid_LinkEntity(NBN_InterestGrid *grid, uint32_t entity_id)
 {
-    assert(message->outgoing_msg == NULL || message->outgoing_msg->ref_count > 0);
-
-    if (message->outgoing_msg == NULL || --message->outgoing_msg->ref_count == 0)
-    {
-        if (message->header.type == NBN_MESSAGE_CHUNK_TYPE)
-        {
-            NBN_MessageChunk *chunk = (NBN_MessageChunk*)message->data;
+    NBN_InterestEntity *entity = &grid->entities[entity_id];
+    uint32_t bucket = InterestGrid_HashCell(grid, entity->cell_x, entity->cell_y);
+    uint32_t head = grid->buckets[bucket];
 
-            if (chunk->outgoing_msg)
-            {
-                assert(chunk->outgoing_msg->ref_count > 0);
+    entity->bucket = bucket;
+    entity->prev = NBN_INTEREST_INVALID_ENTITY;
+    entity->next = head;
 
-                if (--chunk->outgoing_msg->ref_count == 0)
-                {
-                    NBN_MessageDestructor msg_destructor =
-                        connection->endpoint->message_destructors[chunk->outgoing_msg->type];
+    if (head != NBN_INTEREST_INVALID_ENTITY)
+        grid->entities[head].prev = entity_id;
 
-                    if (msg_destructor)
-                        msg_destructor(chunk->outgoing_msg->data);
-                }
-            }
-        }
+    grid->buckets[bucket] = entity_id;
+}
 
-        NBN_MessageDestructor msg_destructor = connection->endpoint->message_destructors[message->header.type];
+static void InterestGrid_UnlinkEntity(NBN_InterestGrid *grid, uint32_t entity_id)
+{
+    NBN_InterestEntity *entity = &grid->entities[entity_id];
 
-        if (msg_destructor)
-            msg_destructor(message->data);
-    }
+    if (entity->prev != NBN_INTEREST_INVALID_ENTITY)
+        grid->entities[entity->prev].next = entity->next;
+    else
+        grid->buckets[entity->bucket] = entity->next;
 
-    return 0;
+    if (entity->next != NBN_INTEREST_INVALID_ENTITY)
+        grid->entities[entity->next].prev = entity->prev;
 }
 
-static void Connection_UpdateAveragePing(NBN_Connection *connection, double ping)
+static void InterestGrid_MarkEntityDirty(NBN_InterestGrid *grid, uint32_t entity_id)
 {
-    /* exponential smoothing with a factor of 0.05 */
-    connection->stats.ping = connection->stats.ping + .05f * (ping - connection->stats.ping);
+    NBN_InterestEntity *entity = &grid->entities[entity_id];
+
+    if (entity->is_dirty)
+        return;
+
+    entity->is_dirty = true;
+    grid->dirty_entities[grid->dirty_count++] = entity_id;
 }
 
-static void Connection_UpdateAveragePacketLoss(NBN_Connection *connection, uint16_t seq)
+/*
+ * Store the IDs of the entities inside the view of a client in the grid's scratch buffer and stamp them.
+ *
+ * Returns the number of visible entities.
+ */
+static unsigned int InterestGrid_QueryView(NBN_InterestGrid *grid, NBN_InterestClient *client)
 {
-    unsigned int lost_packet_count = 0;
-    uint16_t start_seq = seq - 64;
+    float radius_sq = client->radius * client->radius;
+    int32_t min_cell_x = (int32_t)floorf((client->x - client->radius) / grid->cell_size);
+    int32_t max_cell_x = (int32_t)floorf((client->x + client->radius) / grid->cell_size);
+    int32_t min_cell_y = (int32_t)floorf((client->y - client->radius) / grid->cell_size);
+    int32_t max_cell_y = (int32_t)floorf((client->y + client->radius) / grid->cell_size);
+    uint64_t cell_count = (uint64_t)(max_cell_x - min_cell_x + 1) * (uint64_t)(max_cell_y - min_cell_y + 1);
+    unsigned int count = 0;
 
-    for (int i = 0; i < 100; i++)
+    if (cell_count > (uint64_t)grid->bucket_mask + 1)
     {
-        uint16_t s = start_seq - i;
-        NBN_PacketEntry *entry = Connection_FindSendPacketEntry(connection, s);
+        /* the view covers more cells than there are buckets, faster to test every entity */
+        for (uint32_t id = 0; id < grid->entity_capacity; id++)
+        {
+            NBN_InterestEntity *entity = &grid->entities[id];
 
-        if (entry && !entry->acked)
-            lost_packet_count++;
+            if (!entity->is_active)
+                continue;
+
+            float dx = entity->x - client->x;
+            float dy = entity->y - client->y;
+
+            if (dx * dx + dy * dy <= radius_sq)
+            {
+                grid->visible_stamps[id] = grid->stamp;
+                grid->scratch[count++] = id;
+            }
+        }
+
+        return count;
     }
 
-    float packet_loss = lost_packet_count / 100.f;
+    for (int32_t cell_y = min_cell_y; cell_y <= max_cell_y; cell_y++)
+    {
+        for (int32_t cell_x = min_cell_x; cell_x <= max_cell_x; cell_x++)
+        {
+            uint32_t id = grid->buckets[InterestGrid_HashCell(grid, cell_x, cell_y)];
 
-    /* exponential smoothing with a factor of 0.1 */
-    connection->stats.packet_loss = connection->stats.packet_loss + .1f * (packet_loss - connection->stats.packet_loss);
-}
+            while (id != NBN_INTEREST_INVALID_ENTITY)
+            {
+                NBN_InterestEntity *entity = &grid->entities[id];
 
-static void Connection_UpdateAverageUploadBandwidth(NBN_Connection *connection, float bytes_per_sec)
-{
-    /* exponential smoothing with a factor of 0.1 */
-    connection->stats.upload_bandwidth =
-        connection->stats.upload_bandwidth + .1f * (bytes_per_sec - connection->stats.upload_bandwidth);
+                /* buckets are shared by all the cells with the same hash */
+                if (entity->cell_x == cell_x && entity->cell_y == cell_y)
+                {
+                    float dx = entity->x - client->x;
+                    float dy = entity->y - client->y;
+
+                    if (dx * dx + dy * dy <= radius_sq)
+                    {
+                        grid->visible_stamps[id] = grid->stamp;
+                        grid->scratch[count++] = id;
+                    }
+                }
+
+                id = entity->next;
+            }
+        }
+    }
+
+    return count;
 }
 
-static void Connection_UpdateAverageDownloadBandwidth(NBN_Connection *connection)
+static int InterestGrid_UpdateClient(NBN_InterestGrid *grid, NBN_InterestClient *client)
 {
-    double t = connection->time - connection->last_read_packets_time;
+    if (++grid->stamp == 0)
+    {
+        /* the stamp wrapped around, old stamps must not be mistaken for the new ones */
+        memset(grid->visible_stamps, 0, sizeof(uint32_t) * grid->entity_capacity);
 
-    if (t == 0)
-        return;
+        grid->stamp = 1;
+    }
 
-    float bytes_per_sec = connection->downloaded_bytes / t;
+    unsigned int visible_count = InterestGrid_QueryView(grid, client);
 
-    /* exponential smoothing with a factor of 0.1 */
-    connection->stats.download_bandwidth =
-        connection->stats.download_bandwidth + .1f * (bytes_per_sec - connection->stats.download_bandwidth);
+    if (InterestGrid_GrowClient(client, visible_count + client->visible_count) < 0)
+        return NBN_ERROR;
 
-    connection->downloaded_bytes = 0;
-}
+    uint32_t *changes = client->changes;
+    unsigned int enter_count = 0;
+    unsigned int leave_count = 0;
+    unsigned int update_count = 0;
 
-static int Connection_GenerateKeys(NBN_Connection *connection)
-{
-    CSPRNG prng = csprng_create();
+    /* entered: visible now but not at the previous update */
+    for (unsigned int i = 0; i < visible_count; i++)
+    {
+        uint32_t id = grid->scratch[i];
 
-    if (!prng)
+        if ((client->visible_bits[id / 32] & (1u << (id % 32))) == 0)
+            changes[enter_count++] = id;
+    }
+
+    /* left: visible at the previous update but not found by the query */
+    for (unsigned int i = 0; i < client->visible_count; i++)
     {
-        NBN_LogError("Failed to initialize pseudo random number generator");
+        uint32_t id = client->visible[i];
 
-        return NBN_ERROR;
+        if (grid->visible_stamps[id] != grid->stamp)
+        {
+            changes[enter_count + leave_count++] = id;
+            client->visible_bits[id / 32] &= ~(1u << (id % 32));
+        }
     }
 
-    if (Connection_GenerateKeySet(&connection->keys1, &prng) < 0)
-        return NBN_ERROR;
+    /* updated: still visible and dirty */
+    for (unsigned int i = 0; i < visible_count; i++)
+    {
+        uint32_t id = grid->scratch[i];
 
-    if (Connection_GenerateKeySet(&connection->keys2, &prng) < 0)
-        return NBN_ERROR;
+        if (grid->entities[id].is_dirty && (client->visible_bits[id / 32] & (1u << (id % 32))))
+            changes[enter_count + leave_count + update_count++] = id;
+    }
 
-    if (Connection_GenerateKeySet(&connection->keys3, &prng) < 0)
-        return NBN_ERROR;
+    for (unsigned int i = 0; i < enter_count; i++)
+        client->visible_bits[changes[i] / 32] |= 1u << (changes[i] % 32);
 
-    csprng_get(prng, connection->aes_iv, AES_BLOCKLEN);
-    csprng_destroy(prng);
+    memcpy(client->visible, grid->scratch, sizeof(uint32_t) * visible_count);
+
+    client->visible_count = visible_count;
+    client->enter_count = enter_count;
+    client->leave_count = leave_count;
+    client->update_count = update_count;
 
     return 0;
 }
 
-static int Connection_GenerateKeySet(NBN_ConnectionKeySet *key_set, CSPRNG *prng)
+static int InterestGrid_GrowClient(NBN_InterestClient *client, unsigned int capacity)
 {
-    /* Generate a random private key */
-    csprng_get(prng, key_set->prv_key, ECC_PRV_KEY_SIZE);
+    if (capacity <= client->capacity)
+        return 0;
+
+    unsigned int new_capacity = MAX(capacity, client->capacity * 2);
 
-    if (!ecdh_generate_keys(key_set->pub_key, key_set->prv_key))
+    /* on failure the buffers are left untouched, a grown buffer is just bigger than the capacity */
+    uint32_t *visible = (uint32_t *)NBN_Reallocator(client->visible, sizeof(uint32_t) * new_capacity);
+
+    if (visible == NULL)
     {
-        NBN_LogError("Failed to generate public and private keys");
+        NBN_LogError("Failed to grow interest client buffers");
 
         return NBN_ERROR;
     }
 
-    return 0;
-}
+    client->visible = visible;
+
+    uint32_t *changes = (uint32_t *)NBN_Reallocator(client->changes, sizeof(uint32_t) * new_capacity);
+
+    if (changes == NULL)
+    {
+        NBN_LogError("Failed to grow interest client buffers");
 
-static int Connection_BuildSharedKey(NBN_ConnectionKeySet *key_set, uint8_t *pub_key)
-{
-    if (!ecdh_shared_secret(key_set->prv_key, pub_key, key_set->shared_key))
         return NBN_ERROR;
+    }
+
+    client->changes = changes;
+    client->capacity = new_capacity;
 
     return 0;
 }
 
-static void Connection_StartEncryption(NBN_Connection *connection)
-{
-    connection->can_encrypt = true;
-    
-    NBN_LogDebug("Encryption started for connection %d", connection->id);
-}
+#pragma endregion /* NBN_InterestGrid */
 
-#pragma endregion /* NBN_Connection */
+#pragma region NBN_Replicator
 
-#pragma region NBN_Channel
+static NBN_ReplicatorClient *Replicator_GetClient(NBN_Replicator *, NBN_Connection *, bool);
+static void Replicator_DestroyClient(NBN_Replicator *, unsigned int);
+static int Replicator_AddScopeEntry(NBN_ReplicatorClient *, uint32_t);
+static void Replicator_DestroyScopeEntry(NBN_ReplicatorClient *, uint32_t);
+static void Replicator_FreeScopeEntry(NBN_ReplicatorClient *, uint32_t);
+static uint32_t Replicator_FindScopeEntry(NBN_ReplicatorClient *, uint32_t);
+static int Replicator_InsertScopeLookup(NBN_ReplicatorClient *, uint32_t);
+static void Replicator_RemoveScopeLookup(NBN_ReplicatorClient *, uint32_t);
+static int Replicator_SendToClient(NBN_Replicator *, NBN_ReplicatorClient *);
+static bool Replicator_BuildRecord(NBN_Replicator *, NBN_ReplicaScopeEntry *, NBN_ReplicationRecord *);
+static bool Replicator_AddRecord(NBN_Replicator *, NBN_ReplicationMessage *, unsigned int *, NBN_ReplicationRecord *);
+static NBN_ReplicationMessage *Replicator_CreateMessage(NBN_ReplicatorClient *);
+static int Replicator_SendMessage(NBN_Replicator *, NBN_ReplicatorClient *, NBN_ReplicationMessage *);
+static void Replicator_ReleaseOldestSentMessage(NBN_ReplicatorClient *);
+static void Replicator_ExpireSentMessages(NBN_ReplicatorClient *);
+static void Replicator_OnMessageAcked(NBN_Replicator *, NBN_Connection *, uint16_t);
+static void Replicator_OnMessageLost(NBN_ReplicatorClient *, NBN_ReplicatorSentMessage *);
 
-void NBN_Channel_Destroy(NBN_Channel *channel)
-{
-    for (int i = 0; i < NBN_CHANNEL_BUFFER_SIZE; i++)
-    {
-        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[i];
+#define REPLICATOR_LOOKUP_HASH(entity_id, capacity) (((entity_id) * 2654435761u) & ((capacity) - 1))
+#define REPLICATOR_INVALID_SCOPE_ENTRY 0xFFFFFFFF
 
-        if (!slot->free)
-            Connection_RecycleMessage(channel->connection, &slot->message);
+NBN_Replicator *NBN_Replicator_Create(uint8_t channel_id, unsigned int entity_capacity)
+{
+    assert(entity_capacity > 0 && entity_capacity <= NBN_REPLICATION_MAX_ENTITIES);
 
-        slot = &channel->outgoing_message_slot_buffer[i];
+    if (__game_server.endpoint.channels[channel_id] != NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED)
+    {
+        NBN_LogError("Replication channel %d must be an unreliable unordered channel", channel_id);
 
-        if (!slot->free)
-            Connection_RecycleMessage(channel->connection, &slot->message);
+        return NULL;
     }
 
-    NBN_Deallocator(channel);
-}
+    NBN_Replicator *replicator = (NBN_Replicator *)NBN_Allocator(sizeof(NBN_Replicator));
 
-void NBN_Channel_AddTime(NBN_Channel *channel, double time)
-{
-    channel->time += time;
-}
+    memset(replicator, 0, sizeof(NBN_Replicator));
 
-bool NBN_Channel_AddChunk(NBN_Channel *channel, NBN_Message *chunk_msg)
-{
-    assert(chunk_msg->header.type == NBN_MESSAGE_CHUNK_TYPE);
+    replicator->channel_id = channel_id;
+    replicator->entity_capacity = entity_capacity;
+    replicator->entities = (NBN_ReplicatedEntity *)NBN_Allocator(sizeof(NBN_ReplicatedEntity) * entity_capacity);
+    replicator->free_entities = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+    replicator->dirty_entities = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
 
-    NBN_MessageChunk *chunk = (NBN_MessageChunk*)chunk_msg->data;
+    memset(replicator->entities, 0, sizeof(NBN_ReplicatedEntity) * entity_capacity);
 
-    NBN_LogTrace("Add chunk %d to channel %d (current chunk count: %d, last recved chunk id: %d)",
-            chunk->id, channel->id, channel->chunk_count, channel->last_received_chunk_id);
+    /* lowest IDs are used first */
+    for (unsigned int i = 0; i < entity_capacity; i++)
+        replicator->free_entities[i] = entity_capacity - 1 - i;
 
-    if (chunk->id == channel->last_received_chunk_id + 1)
-    {
-        assert(channel->recv_chunk_buffer[chunk->id] == NULL);
+    replicator->free_count = entity_capacity;
 
-        channel->recv_chunk_buffer[chunk->id] = chunk;
-        channel->last_received_chunk_id++;
-        channel->chunk_count++;
+    __game_server.endpoint.replicator = replicator;
 
-        NBN_LogTrace("Chunk added (%d/%d)", channel->chunk_count, chunk->total);
+    return replicator;
+}
 
-        if (channel->chunk_count == chunk->total)
-        {
-            channel->last_received_chunk_id = -1;
+void NBN_Replicator_Destroy(NBN_Replicator *replicator)
+{
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
+    {
+        if (replicator->clients[i])
+            Replicator_DestroyClient(replicator, i);
+    }
 
-            return true;
-        }
+    if (__game_server.endpoint.replicator == replicator)
+        __game_server.endpoint.replicator = NULL;
 
-        return false;
-    }
-    else
+    NBN_Deallocator(replicator->entities);
+    NBN_Deallocator(replicator->free_entities);
+    NBN_Deallocator(replicator->dirty_entities);
+    NBN_Deallocator(replicator);
+}
+
+uint32_t NBN_Replicator_AddEntity(NBN_Replicator *replicator, uint8_t type, void *state)
+{
+    if (type >= NBN_REPLICATION_MAX_ENTITY_TYPES || !__replicated_entity_types[type].is_registered)
     {
-        NBN_LogTrace("Chunk ignored");
+        NBN_LogError("Replicated entity type %d is not registered", type);
+
+        return NBN_REPLICATION_MAX_ENTITIES;
     }
 
-    /* Clear the chunks buffer */
-    for (unsigned int i = 0; i < channel->chunk_count; i++)
+    if (replicator->free_count == 0)
     {
-        assert(channel->recv_chunk_buffer[i] != NULL);
+        NBN_LogError("Replicator is full (capacity: %d)", replicator->entity_capacity);
 
-        NBN_MessageChunk_Destroy(channel->recv_chunk_buffer[i]);
-
-        channel->recv_chunk_buffer[i] = NULL;
+        return NBN_REPLICATION_MAX_ENTITIES;
     }
 
-    channel->chunk_count = 0;
-    channel->last_received_chunk_id = -1;
+    uint32_t entity_id = replicator->free_entities[--replicator->free_count];
+    NBN_ReplicatedEntity *entity = &replicator->entities[entity_id];
 
-    if (chunk->id == 0)
-        return NBN_Channel_AddChunk(channel, chunk_msg);
+    entity->state = state;
+    entity->type = type;
+    entity->dirty_mask = 0;
+    entity->is_active = true;
 
-    return false;
+    return entity_id;
 }
 
-int NBN_Channel_ReconstructMessageFromChunks(
-        NBN_Channel *channel, NBN_Connection *connection, NBN_Message *message)
+void NBN_Replicator_RemoveEntity(NBN_Replicator *replicator, uint32_t entity_id)
 {
-    unsigned int message_size = channel->chunk_count * NBN_MESSAGE_CHUNK_SIZE;
+    assert(entity_id < replicator->entity_capacity);
 
-    if (message_size > channel->read_chunk_buffer_size)
-        NBN_Channel_ResizeReadChunkBuffer(channel, message_size);
+    NBN_ReplicatedEntity *entity = &replicator->entities[entity_id];
 
-    NBN_LogTrace("Reconstructing message (chunk count: %d, size: %d) from channel %d",
-            channel->chunk_count, message_size, channel->id);
+    if (!entity->is_active)
+        return;
 
-    for (unsigned int i = 0; i < channel->chunk_count; i++)
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
     {
-        NBN_MessageChunk *chunk = channel->recv_chunk_buffer[i];
+        NBN_ReplicatorClient *client = replicator->clients[i];
 
-        memcpy(channel->read_chunk_buffer + i * NBN_MESSAGE_CHUNK_SIZE, chunk->data, NBN_MESSAGE_CHUNK_SIZE);
+        if (client == NULL)
+            continue;
 
-        NBN_MessageChunk_Destroy(chunk);
+        uint32_t scope_index = Replicator_FindScopeEntry(client, entity_id);
 
-        channel->recv_chunk_buffer[i] = NULL;
+        if (scope_index != REPLICATOR_INVALID_SCOPE_ENTRY)
+            Replicator_DestroyScopeEntry(client, scope_index);
     }
 
-    channel->chunk_count = 0;
+    /* destroyed scope entries don't reference the entity anymore, the ID can be reused right away */
+    entity->is_active = false;
+    entity->state = NULL;
 
-    NBN_ReadStream r_stream;
+    replicator->free_entities[replicator->free_count++] = entity_id;
+}
 
-    NBN_ReadStream_Init(&r_stream, channel->read_chunk_buffer, message_size);
+void NBN_Replicator_MarkDirty(NBN_Replicator *replicator, uint32_t entity_id, uint32_t field_mask)
+{
+    assert(entity_id < replicator->entity_capacity);
 
-    if (Connection_ReadNextMessageFromStream(connection, &r_stream, message) < 0)
-        return NBN_ERROR;
+    NBN_ReplicatedEntity *entity = &replicator->entities[entity_id];
 
-    NBN_LogTrace("Reconstructed message %d of type %d", message->header.id, message->header.type);
+    assert(entity->is_active);
 
-    return 0;
+    if (entity->dirty_mask == 0 && field_mask)
+        replicator->dirty_entities[replicator->dirty_count++] = entity_id;
+
+    entity->dirty_mask |= field_mask;
 }
 
-void NBN_Channel_ResizeWriteChunkBuffer(NBN_Channel *channel, unsigned int size)
+int NBN_Replicator_SetEntityScope(NBN_Replicator *replicator, NBN_Connection *client, uint32_t entity_id, bool in_scope)
 {
-    channel->write_chunk_buffer = (uint8_t*)NBN_Reallocator(channel->write_chunk_buffer, size);
+    assert(entity_id < replicator->entity_capacity);
+    assert(replicator->entities[entity_id].is_active);
 
-    channel->write_chunk_buffer_size = size;
-}
+    NBN_ReplicatorClient *replicator_client = Replicator_GetClient(replicator, client, in_scope);
 
-void NBN_Channel_ResizeReadChunkBuffer(NBN_Channel *channel, unsigned int size)
-{
-    channel->read_chunk_buffer = (uint8_t*)NBN_Reallocator(channel->read_chunk_buffer, size);
+    if (replicator_client == NULL)
+        return in_scope ? NBN_ERROR : 0;
 
-    channel->read_chunk_buffer_size = size;
+    uint32_t scope_index = Replicator_FindScopeEntry(replicator_client, entity_id);
+
+    if (in_scope)
+    {
+        if (scope_index != REPLICATOR_INVALID_SCOPE_ENTRY)
+            return 0;
+
+        return Replicator_AddScopeEntry(replicator_client, entity_id);
+    }
+
+    if (scope_index != REPLICATOR_INVALID_SCOPE_ENTRY)
+        Replicator_DestroyScopeEntry(replicator_client, scope_index);
+
+    return 0;
 }
 
-void NBN_Channel_UpdateMessageLastSendTime(NBN_Channel *channel, NBN_Message *message, double time)
+void NBN_Replicator_RemoveClient(NBN_Replicator *replicator, NBN_Connection *client)
 {
-    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[message->header.id % NBN_CHANNEL_BUFFER_SIZE];
+    assert(client->slot < NBN_MAX_CLIENTS);
 
-    assert(slot->message.header.id == message->header.id);
+    NBN_ReplicatorClient *replicator_client = replicator->clients[client->slot];
 
-    slot->last_send_time = time;
+    if (replicator_client == NULL || replicator_client->connection != client)
+        return;
+
+    Replicator_DestroyClient(replicator, client->slot);
 }
 
-/* Unreliable ordered */
+int NBN_Replicator_Send(NBN_Replicator *replicator)
+{
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
+    {
+        NBN_ReplicatorClient *client = replicator->clients[i];
 
-static bool UnreliableOrderedChannel_AddReceivedMessage(NBN_Channel *, NBN_Message *);
-static bool UnreliableOrderedChannel_AddOutgoingMessage(NBN_Channel *, NBN_Message *);
-static NBN_Message *UnreliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *);
-static NBN_Message *UnreliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *);
+        if (client == NULL || client->connection->is_closed || !client->connection->is_accepted)
+            continue;
 
-NBN_UnreliableOrderedChannel *NBN_UnreliableOrderedChannel_Create(void)
-{
-    NBN_UnreliableOrderedChannel *channel = (NBN_UnreliableOrderedChannel*)NBN_Allocator(sizeof(NBN_UnreliableOrderedChannel));
+        if (Replicator_SendToClient(replicator, client) < 0)
+            return NBN_ERROR;
+    }
 
-    channel->base.AddReceivedMessage = UnreliableOrderedChannel_AddReceivedMessage;
-    channel->base.AddOutgoingMessage = UnreliableOrderedChannel_AddOutgoingMessage;
-    channel->base.GetNextRecvedMessage = UnreliableOrderedChannel_GetNextRecvedMessage;
-    channel->base.GetNextOutgoingMessage = UnreliableOrderedChannel_GetNextOutgoingMessage;
-    channel->base.OnOutgoingMessageAcked = NULL;
+    /* changes have been merged into the scope entries of all clients */
+    for (unsigned int i = 0; i < replicator->dirty_count; i++)
+        replicator->entities[replicator->dirty_entities[i]].dirty_mask = 0;
 
-    channel->last_received_message_id = 0;
-    channel->next_outgoing_message_slot = 0;
+    replicator->dirty_count = 0;
 
-    return channel;
+    return 0;
 }
 
-static bool UnreliableOrderedChannel_AddReceivedMessage(NBN_Channel *channel, NBN_Message *message)
+static NBN_ReplicatorClient *Replicator_GetClient(NBN_Replicator *replicator, NBN_Connection *client, bool create)
 {
-    NBN_UnreliableOrderedChannel *unreliable_ordered_channel = (NBN_UnreliableOrderedChannel *)channel; 
+    assert(client->slot < NBN_MAX_CLIENTS);
 
-    if (SEQUENCE_NUMBER_GT(message->header.id, unreliable_ordered_channel->last_received_message_id))
+    NBN_ReplicatorClient *replicator_client = replicator->clients[client->slot];
+
+    if (replicator_client || !create)
     {
-        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[message->header.id % NBN_CHANNEL_BUFFER_SIZE];
+        assert(replicator_client == NULL || replicator_client->connection == client);
 
-        memcpy(&slot->message, message, sizeof(NBN_Message));
+        return replicator_client;
+    }
 
-        slot->free = false;
+    replicator_client = (NBN_ReplicatorClient *)NBN_Allocator(sizeof(NBN_ReplicatorClient));
 
-        unreliable_ordered_channel->last_received_message_id = message->header.id;
+    if (replicator_client == NULL)
+        return NULL;
 
-        return true;
-    }
+    memset(replicator_client, 0, sizeof(NBN_ReplicatorClient));
 
-    return false;
-}
+    replicator_client->connection = client;
+    replicator_client->next_sequence = 1; /* 0 means "never sent" */
 
-static bool UnreliableOrderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *message)
-{
-    uint16_t msg_id = channel->next_outgoing_message_id;
-    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % NBN_CHANNEL_BUFFER_SIZE];
+    replicator->clients[client->slot] = replicator_client;
 
-    memcpy(&slot->message, message, sizeof(NBN_Message));
+    return replicator_client;
+}
 
-    slot->message.header.id = msg_id;
-    slot->free = false;
+static void Replicator_DestroyClient(NBN_Replicator *replicator, unsigned int slot)
+{
+    NBN_ReplicatorClient *client = replicator->clients[slot];
 
-    channel->next_outgoing_message_id++;
-    channel->outgoing_message_count++;
+    NBN_Deallocator(client->scope);
+    NBN_Deallocator(client->scope_lookup);
+    NBN_Deallocator(client->free_scope_entries);
+    NBN_Deallocator(client);
 
-    return true;
+    replicator->clients[slot] = NULL;
 }
 
-static NBN_Message *UnreliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *channel)
+static int Replicator_AddScopeEntry(NBN_ReplicatorClient *client, uint32_t entity_id)
 {
-    NBN_UnreliableOrderedChannel *unreliable_ordered_channel = (NBN_UnreliableOrderedChannel *)channel;
-
-    while (SEQUENCE_NUMBER_LT(channel->next_recv_message_id, unreliable_ordered_channel->last_received_message_id))
+    if (client->free_scope_count == 0 && client->scope_count >= client->scope_capacity)
     {
-        NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[channel->next_recv_message_id % NBN_CHANNEL_BUFFER_SIZE];
+        unsigned int new_capacity = client->scope_capacity ? client->scope_capacity * 2 : 64;
 
-        if (!slot->free && slot->message.header.id == channel->next_recv_message_id)
+        client->scope = (NBN_ReplicaScopeEntry *)NBN_Reallocator(
+                client->scope, sizeof(NBN_ReplicaScopeEntry) * new_capacity);
+        client->free_scope_entries = (uint32_t *)NBN_Reallocator(
+                client->free_scope_entries, sizeof(uint32_t) * new_capacity);
+
+        if (client->scope == NULL || client->free_scope_entries == NULL)
         {
-            slot->free = true;
+            NBN_LogError("Failed to grow replication scope");
 
-            return &slot->message;
+            return NBN_ERROR;
         }
 
-        channel->next_recv_message_id++;
+        client->scope_capacity = new_capacity;
     }
 
-    return NULL;
-}
-
-static NBN_Message *UnreliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *channel)
-{
-    NBN_UnreliableOrderedChannel *unreliable_ordered_channel = (NBN_UnreliableOrderedChannel *)channel;
-
-    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[unreliable_ordered_channel->next_outgoing_message_slot];
+    uint32_t scope_index;
 
-    if (slot->free)
-        return NULL;
+    if (client->free_scope_count > 0)
+    {
+        scope_index = client->free_scope_entries[--client->free_scope_count];
+    }
+    else
+    {
+        scope_index = client->scope_count++;
+        client->scope[scope_index].generation = 0;
+    }
 
-    slot->free = true;
+    NBN_ReplicaScopeEntry *entry = &client->scope[scope_index];
 
-    unreliable_ordered_channel->next_outgoing_message_slot =
-        (unreliable_ordered_channel->next_outgoing_message_slot + 1) % NBN_CHANNEL_BUFFER_SIZE;
+    entry->entity_id = entity_id;
+    entry->unacked_mask = 0xFFFFFFFF; /* all fields are sent along with the create record */
+    entry->in_flight_mask = 0;
+    entry->last_change_sequence = 0;
+    entry->spawn_sequence = 0;
+    entry->state = NBN_REPLICA_CREATING;
+    entry->is_record_in_flight = false;
 
-    return &slot->message;
+    return Replicator_InsertScopeLookup(client, scope_index);
 }
 
-/* Reliable ordered */
-
-static bool ReliableOrderedChannel_AddReceivedMessage(NBN_Channel *, NBN_Message *);
-static bool ReliableOrderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *);
-static NBN_Message *ReliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *);
-static NBN_Message *ReliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *);
-static int ReliableOrderedChannel_OnOutgoingMessageAcked(NBN_Channel *, uint16_t);
-
-NBN_ReliableOrderedChannel *NBN_ReliableOrderedChannel_Create(void)
+static void Replicator_DestroyScopeEntry(NBN_ReplicatorClient *client, uint32_t scope_index)
 {
-    NBN_ReliableOrderedChannel *channel = (NBN_ReliableOrderedChannel*)NBN_Allocator(sizeof(NBN_ReliableOrderedChannel));
+    NBN_ReplicaScopeEntry *entry = &client->scope[scope_index];
 
-    channel->base.AddReceivedMessage = ReliableOrderedChannel_AddReceivedMessage;
-    channel->base.AddOutgoingMessage = ReliableOrderedChannel_AddOutgoingMessage;
-    channel->base.GetNextRecvedMessage = ReliableOrderedChannel_GetNextRecvedMessage;
-    channel->base.GetNextOutgoingMessage = ReliableOrderedChannel_GetNextOutgoingMessage;
-    channel->base.OnOutgoingMessageAcked = ReliableOrderedChannel_OnOutgoingMessageAcked;
+    assert(entry->state == NBN_REPLICA_CREATING || entry->state == NBN_REPLICA_ALIVE);
 
-    memset(channel->base.recved_message_slot_buffer, 0, sizeof(channel->base.recved_message_slot_buffer));
+    Replicator_RemoveScopeLookup(client, scope_index);
 
-    for (int i = 0; i < NBN_CHANNEL_BUFFER_SIZE; i++)
-        channel->ack_buffer[i] = false;
+    /* the client has never heard of the entity */
+    if (entry->spawn_sequence == 0)
+    {
+        Replicator_FreeScopeEntry(client, scope_index);
 
-    channel->oldest_unacked_message_id = 0;
-    channel->most_recent_message_id = 0;
+        return;
+    }
 
-    return channel;
+    /* a create record still in flight does not matter anymore */
+    entry->state = NBN_REPLICA_DESTROYING;
+    entry->unacked_mask = 0;
+    entry->in_flight_mask = 0;
+    entry->is_record_in_flight = false;
 }
 
-static unsigned int ReliableOrderedChannel_ComputeMessageIdDelta(uint16_t id1, uint16_t id2)
+static void Replicator_FreeScopeEntry(NBN_ReplicatorClient *client, uint32_t scope_index)
 {
-    if (SEQUENCE_NUMBER_GT(id1, id2))
-        return (id1 >= id2) ? id1 - id2 : ((0xFFFF + 1) - id2) + id1;
-    else
-        return (id2 >= id1) ? id2 - id1 : (((0xFFFF + 1) - id1) + id2) % 0xFFFF;
+    NBN_ReplicaScopeEntry *entry = &client->scope[scope_index];
+
+    entry->state = NBN_REPLICA_FREE;
+    entry->generation++;
+
+    client->free_scope_entries[client->free_scope_count++] = scope_index;
 }
 
-static bool ReliableOrderedChannel_AddReceivedMessage(NBN_Channel *channel, NBN_Message *message)
+static uint32_t Replicator_FindScopeEntry(NBN_ReplicatorClient *client, uint32_t entity_id)
 {
-    NBN_ReliableOrderedChannel *reliable_ordered_channel = (NBN_ReliableOrderedChannel *)channel;
-    unsigned int dt = ReliableOrderedChannel_ComputeMessageIdDelta(
-        message->header.id, reliable_ordered_channel->most_recent_message_id);
+    if (client->lookup_capacity == 0)
+        return REPLICATOR_INVALID_SCOPE_ENTRY;
 
-    NBN_LogTrace("Add recved message %d of type %d to channel %d (most recent msg id: %d, dt: %d)",
-            message->header.id, message->header.type, channel->id, reliable_ordered_channel->most_recent_message_id, dt);
+    unsigned int i = REPLICATOR_LOOKUP_HASH(entity_id, client->lookup_capacity);
 
-    if (SEQUENCE_NUMBER_GT(message->header.id, reliable_ordered_channel->most_recent_message_id))
+    while (client->scope_lookup[i])
     {
-        assert(dt < NBN_CHANNEL_BUFFER_SIZE);
+        uint32_t scope_index = client->scope_lookup[i] - 1;
 
-        reliable_ordered_channel->most_recent_message_id = message->header.id;
-    }
-    else
-    {
-        /* This is an old message that has already been received, probably coming from
-           an out of order late packet. */
-        if (dt >= NBN_CHANNEL_BUFFER_SIZE)
-            return false;
+        if (client->scope[scope_index].entity_id == entity_id)
+            return scope_index;
+
+        i = (i + 1) & (client->lookup_capacity - 1);
     }
 
-    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[message->header.id % NBN_CHANNEL_BUFFER_SIZE]; 
+    return REPLICATOR_INVALID_SCOPE_ENTRY;
+}
 
-    if (!slot->free)
-        Connection_RecycleMessage(channel->connection, &slot->message);
+static int Replicator_InsertScopeLookup(NBN_ReplicatorClient *client, uint32_t scope_index)
+{
+    /* keep the table at most half full, rebuild it from the live scope entries when growing */
+    if (client->scope_capacity * 2 > client->lookup_capacity)
+    {
+        unsigned int new_capacity = client->scope_capacity * 2;
 
-    memcpy(&slot->message, message, sizeof(NBN_Message));
+        NBN_Deallocator(client->scope_lookup);
 
-    slot->free = false;
+        client->scope_lookup = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * new_capacity);
 
-    return true;
-}
+        if (client->scope_lookup == NULL)
+        {
+            NBN_LogError("Failed to grow replication scope lookup");
 
-static bool ReliableOrderedChannel_AddOutgoingMessage(NBN_Channel *channel, NBN_Message *message)
-{
-    uint16_t msg_id = channel->next_outgoing_message_id;
-    int index = msg_id % NBN_CHANNEL_BUFFER_SIZE;
-    NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[index];
+            return NBN_ERROR;
+        }
 
-    if (!slot->free)
-    {
-        NBN_LogTrace("Slot %d is not free on channel %d (slot msg id: %d, outgoing message count: %d)",
-                index, channel->id, slot->message.header.id, channel->outgoing_message_count);
+        memset(client->scope_lookup, 0, sizeof(uint32_t) * new_capacity);
 
-        return false;
-    }
+        client->lookup_capacity = new_capacity;
 
-    memcpy(&slot->message, message, sizeof(NBN_Message));
+        for (uint32_t i = 0; i < client->scope_count; i++)
+        {
+            NBN_ReplicaScopeEntry *entry = &client->scope[i];
 
-    slot->message.header.id = msg_id;
-    slot->last_send_time = -1;
-    slot->free = false;
+            if (i != scope_index && (entry->state == NBN_REPLICA_CREATING || entry->state == NBN_REPLICA_ALIVE))
+                Replicator_InsertScopeLookup(client, i);
+        }
+    }
 
-    channel->next_outgoing_message_id++;
-    channel->outgoing_message_count++;
+    unsigned int i = REPLICATOR_LOOKUP_HASH(client->scope[scope_index].entity_id, client->lookup_capacity);
 
-    NBN_LogTrace("Added outgoing message %d of type %d to channel %d (index: %d)",
-            slot->message.header.id, slot->message.header.type, channel->id, index);
+    while (client->scope_lookup[i])
+        i = (i + 1) & (client->lookup_capacity - 1);
 
-    return true;
+    client->scope_lookup[i] = scope_index + 1;
+
+    return 0;
 }
 
-static NBN_Message *ReliableOrderedChannel_GetNextRecvedMessage(NBN_Channel *channel)
+static void Replicator_RemoveScopeLookup(NBN_ReplicatorClient *client, uint32_t scope_index)
 {
-    NBN_MessageSlot *slot = &channel->recved_message_slot_buffer[channel->next_recv_message_id % NBN_CHANNEL_BUFFER_SIZE];
+    unsigned int mask = client->lookup_capacity - 1;
+    unsigned int i = REPLICATOR_LOOKUP_HASH(client->scope[scope_index].entity_id, client->lookup_capacity);
 
-    if (!slot->free && slot->message.header.id == channel->next_recv_message_id)
+    while (client->scope_lookup[i] != scope_index + 1)
     {
-        slot->free = true;
-        channel->next_recv_message_id++;
+        assert(client->scope_lookup[i]);
 
-        return &slot->message;
+        i = (i + 1) & mask;
     }
 
-    return NULL;
-}
-
-static NBN_Message *ReliableOrderedChannel_GetNextOutgoingMessage(NBN_Channel *channel)
-{
-    NBN_ReliableOrderedChannel *reliable_ordered_channel = (NBN_ReliableOrderedChannel *)channel;
+    client->scope_lookup[i] = 0;
 
-    int max_message_id = (reliable_ordered_channel->oldest_unacked_message_id + (NBN_CHANNEL_BUFFER_SIZE - 1)) % (0xFFFF + 1);
+    /* shift back the following entries of the probe sequence so that lookups don't stop on the hole */
+    unsigned int j = i;
 
-    if (SEQUENCE_NUMBER_LT(channel->next_outgoing_message_id, max_message_id))
-        max_message_id = channel->next_outgoing_message_id;
+    while (true)
+    {
+        j = (j + 1) & mask;
 
-    uint16_t msg_id = reliable_ordered_channel->oldest_unacked_message_id;
+        if (client->scope_lookup[j] == 0)
+            break;
 
-    while (SEQUENCE_NUMBER_LT(msg_id, max_message_id))
-    {
-        NBN_MessageSlot *slot = &channel->outgoing_message_slot_buffer[msg_id % NBN_CHANNEL_BUFFER_SIZE];
+        unsigned int k = REPLICATOR_LOOKUP_HASH(client->scope[client->scope_lookup[j] - 1].entity_id, client->lookup_capacity);
 
-        if (
-                !slot->free &&
-                (slot->last_send_time < 0 || channel->time - slot->last_send_time >= NBN_MESSAGE_RESEND_DELAY)
-           )
-        {
-            return &slot->message;
-        }
+        /* the entry at j stays where it is if its home slot k is cyclically in (i, j] */
+        if ((i < j) ? (k > i && k <= j) : (k > i || k <= j))
+            continue;
 
-        msg_id++;
+        client->scope_lookup[i] = client->scope_lookup[j];
+        client->scope_lookup[j] = 0;
+        i = j;
     }
-
-    return NULL;
 }
 
-static int ReliableOrderedChannel_OnOutgoingMessageAcked(NBN_Channel *channel, uint16_t msg_id)
+static int Replicator_SendToClient(NBN_Replicator *replicator, NBN_ReplicatorClient *client)
 {
-    NBN_ReliableOrderedChannel *reliable_ordered_channel = (NBN_ReliableOrderedChannel *)channel;
-    NBN_MessageSlot *slot = &reliable_ordered_channel->base.outgoing_message_slot_buffer[msg_id % NBN_CHANNEL_BUFFER_SIZE];
+    Replicator_ExpireSentMessages(client);
 
-    if (slot->free || slot->message.header.id != msg_id)
-        return 0;
+    /* merge the changes of the entities into the scope entries */
+    for (uint32_t i = 0; i < client->scope_count; i++)
+    {
+        NBN_ReplicaScopeEntry *entry = &client->scope[i];
 
-    slot->free = true;
+        if (entry->state != NBN_REPLICA_CREATING && entry->state != NBN_REPLICA_ALIVE)
+            continue;
 
-    NBN_LogTrace("Message %d acked on channel %d (buffer index: %d, oldest unacked: %d)",
-        msg_id, channel->id, msg_id % NBN_CHANNEL_BUFFER_SIZE, reliable_ordered_channel->oldest_unacked_message_id);
+        uint32_t dirty_mask = replicator->entities[entry->entity_id].dirty_mask;
 
-    reliable_ordered_channel->ack_buffer[msg_id % NBN_CHANNEL_BUFFER_SIZE] = true;
-    channel->outgoing_message_count--;
+        if (dirty_mask)
+        {
+            entry->unacked_mask |= dirty_mask;
+            entry->in_flight_mask &= ~dirty_mask;
+            entry->last_change_sequence = client->next_sequence;
+        }
+    }
 
-    if (msg_id == reliable_ordered_channel->oldest_unacked_message_id)
+    NBN_ReplicationMessage *msg = NULL;
+    unsigned int msg_bits = 0;
+    unsigned int message_count = 0;
+    uint32_t scope_count = client->scope_count;
+
+    for (uint32_t n = 0; n < scope_count; n++)
     {
-        for (int i = 0; i < NBN_CHANNEL_BUFFER_SIZE; i++)
+        uint32_t scope_index = (client->scope_cursor + n) % scope_count;
+        NBN_ReplicaScopeEntry *entry = &client->scope[scope_index];
+        NBN_ReplicationRecord record;
+
+        if (!Replicator_BuildRecord(replicator, entry, &record))
+            continue;
+
+        if (msg && !Replicator_AddRecord(replicator, msg, &msg_bits, &record))
         {
-            uint16_t ack_msg_id = msg_id + i;
-            int index = ack_msg_id % NBN_CHANNEL_BUFFER_SIZE;
+            if (Replicator_SendMessage(replicator, client, msg) < 0)
+                return NBN_ERROR;
 
-            if (reliable_ordered_channel->ack_buffer[index])
+            msg = NULL;
+        }
+
+        if (msg == NULL)
+        {
+            if (message_count >= NBN_REPLICATOR_MAX_MESSAGES_PER_SEND)
             {
-                reliable_ordered_channel->ack_buffer[index] = false;
-                reliable_ordered_channel->oldest_unacked_message_id++;
+                /* start from there on the next send so that all entities get their turn */
+                client->scope_cursor = scope_index;
+
+                return 0;
             }
-            else
+
+            if ((msg = Replicator_CreateMessage(client)) == NULL)
+                return NBN_ERROR;
+
+            NBN_MeasureStream m_stream;
+
+            NBN_MeasureStream_Init(&m_stream);
+            NBN_ReplicationMessage_Serialize(msg, (NBN_Stream *)&m_stream);
+
+            msg_bits = m_stream.number_of_bits;
+            message_count++;
+
+            if (!Replicator_AddRecord(replicator, msg, &msg_bits, &record))
             {
-                break;
+                NBN_LogError("Entity %d does not fit in a replication message", entry->entity_id);
+
+                continue;
             }
         }
 
-        NBN_LogTrace("Updated oldest unacked message id on channel %d: %d",
-                channel->id, reliable_ordered_channel->oldest_unacked_message_id);
-    }
+        NBN_ReplicatorSentMessage *sent_msg = &client->sent_messages[
+            (client->oldest_sent_message + client->sent_message_count) % NBN_REPLICATOR_MAX_PENDING_MESSAGES];
+        NBN_ReplicatorSentRecord sent_record = { scope_index, entry->generation, record.field_mask, record.flags };
 
-    return Connection_RecycleMessage(channel->connection, &slot->message);
-}
+        client->sent_records[client->next_sent_record] = sent_record;
+        client->next_sent_record = (client->next_sent_record + 1) % NBN_REPLICATOR_MAX_PENDING_RECORDS;
+        client->sent_record_count++;
+        sent_msg->record_count++;
 
-#pragma endregion /* NBN_MessageChannel */
+        entry->in_flight_mask |= record.field_mask;
 
-#pragma region NBN_EventQueue
+        if (record.flags)
+            entry->is_record_in_flight = true;
 
-void NBN_EventQueue_Init(NBN_EventQueue *event_queue)
-{
-    event_queue->head = 0;
-    event_queue->tail = 0;
-    event_queue->count = 0;
+        if (record.flags & NBN_REPLICATION_RECORD_CREATE)
+            entry->spawn_sequence = record.spawn_sequence;
+    }
+
+    if (msg && Replicator_SendMessage(replicator, client, msg) < 0)
+        return NBN_ERROR;
+
+    client->scope_cursor = 0;
+
+    return 0;
 }
 
-bool NBN_EventQueue_Enqueue(NBN_EventQueue *event_queue, NBN_Event ev)
+/*
+ * Fill the record of a scope entry (without the data offset and spawn sequence).
+ *
+ * Returns false when there is nothing to send for this entry.
+ */
+static bool Replicator_BuildRecord(NBN_Replicator *replicator, NBN_ReplicaScopeEntry *entry, NBN_ReplicationRecord *record)
 {
-    if (event_queue->count >= NBN_EVENT_QUEUE_CAPACITY)
-        return false;
+    record->entity_id = entry->entity_id;
+    record->entity_type = 0;
+    record->field_mask = 0;
+    record->spawn_sequence = 0;
+    record->data_offset = 0;
 
-    event_queue->events[event_queue->tail] = ev;
+    switch (entry->state)
+    {
+        case NBN_REPLICA_CREATING:
+            if (entry->is_record_in_flight)
+                return false;
 
-    event_queue->tail = (event_queue->tail + 1) % NBN_EVENT_QUEUE_CAPACITY;
-    event_queue->count++;
+            record->flags = NBN_REPLICATION_RECORD_CREATE;
+            record->entity_type = replicator->entities[entry->entity_id].type;
+            record->field_mask = entry->unacked_mask;
+            record->spawn_sequence = entry->spawn_sequence; /* 0 on the first send */
+            break;
 
-    return true;
-}
+        case NBN_REPLICA_ALIVE:
+            record->flags = 0;
+            record->entity_type = replicator->entities[entry->entity_id].type;
+            record->field_mask = entry->unacked_mask & ~entry->in_flight_mask;
 
-bool NBN_EventQueue_Dequeue(NBN_EventQueue *event_queue, NBN_Event *ev)
-{
-    if (NBN_EventQueue_IsEmpty(event_queue))
-        return false;
+            if (record->field_mask == 0)
+                return false;
+            break;
 
-    memcpy(ev, &event_queue->events[event_queue->head], sizeof(NBN_Event));
-    event_queue->head = (event_queue->head + 1) % NBN_EVENT_QUEUE_CAPACITY;
-    event_queue->count--;
+        case NBN_REPLICA_DESTROYING:
+            if (entry->is_record_in_flight)
+                return false;
+
+            record->flags = NBN_REPLICATION_RECORD_DESTROY;
+            record->spawn_sequence = entry->spawn_sequence;
+            break;
+
+        default:
+            return false;
+    }
+
+    if (record->flags != NBN_REPLICATION_RECORD_DESTROY)
+    {
+        unsigned int field_count = __replicated_entity_types[record->entity_type].field_count;
+
+        record->field_mask &= field_count == 32 ? 0xFFFFFFFF : (1u << field_count) - 1;
+    }
 
     return true;
 }
 
-bool NBN_EventQueue_IsEmpty(NBN_EventQueue *event_queue)
+/*
+ * Copy the fields of a record into a message, returns false when the record does not fit in the message
+ * (the message is left untouched).
+ */
+static bool Replicator_AddRecord(
+        NBN_Replicator *replicator, NBN_ReplicationMessage *msg, unsigned int *msg_bits, NBN_ReplicationRecord *record)
 {
-    return event_queue->count == 0;
-}
-
-#pragma endregion /* NBN_EventQueue */
+    if (msg->record_count >= NBN_REPLICATION_MAX_RECORDS)
+        return false;
 
-#pragma region NBN_Endpoint
+    unsigned int data_size = 0;
 
-static uint32_t Endpoint_BuildProtocolId(const char *);
-static int Endpoint_ProcessReceivedPacket(NBN_Endpoint *, NBN_Packet *, NBN_Connection *);
-static NBN_OutgoingMessage *Endpoint_CreateOutgoingMessage(NBN_Endpoint *, uint8_t, void *);
-static int Endpoint_EnqueueOutgoingMessage(NBN_Endpoint *, NBN_Connection *, NBN_OutgoingMessage *, uint8_t);
-static int Endpoint_SplitMessageIntoChunks(
-        NBN_Message *, NBN_OutgoingMessage *, NBN_Channel *, NBN_MessageSerializer, unsigned int, NBN_MessageChunk **);
+    if (record->flags != NBN_REPLICATION_RECORD_DESTROY)
+    {
+        NBN_ReplicatedEntityType *entity_type = &__replicated_entity_types[record->entity_type];
+        uint8_t *state = (uint8_t *)replicator->entities[record->entity_id].state;
 
-void NBN_Endpoint_Init(NBN_Endpoint *endpoint, NBN_Config config, bool is_server)
-{
-    MemoryManager_Init();
+        data_size = ReplicationMessage_GetRecordDataSize(entity_type, record->field_mask);
 
-    endpoint->config = config;
-    endpoint->is_server = is_server;
-    endpoint->next_outgoing_message = 0;
+        if (msg->data_length + data_size > NBN_REPLICATION_MESSAGE_DATA_SIZE)
+            return false;
 
-    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
-        endpoint->channels[i] = NBN_CHANNEL_TYPE_UNDEFINED;
+        uint8_t *value = msg->data + msg->data_length;
 
-    for (int i = 0; i < NBN_MAX_MESSAGE_TYPES; i++)
-    {
-        endpoint->message_builders[i] = NULL;
-        endpoint->message_destructors[i] = NULL;
-        endpoint->message_serializers[i] = NULL;
-    }
+        for (unsigned int i = 0; i < entity_type->field_count; i++)
+        {
+            if (record->field_mask & (1u << i))
+            {
+                NBN_ReplicationField *field = &entity_type->fields[i];
+                unsigned int size = ReplicationMessage_GetFieldSize(field);
 
-    NBN_EventQueue_Init(&endpoint->event_queue);
+                memcpy(value, state + field->offset, field->type == NBN_REPLICATION_FIELD_BOOL ? sizeof(bool) :
+                        (field->type == NBN_REPLICATION_FIELD_BYTES ? field->length : size));
 
-    /* Register library reserved channels */
-    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_ORDERED, NBN_CHANNEL_RESERVED_UNRELIABLE);
-    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_RELIABLE_ORDERED, NBN_CHANNEL_RESERVED_RELIABLE);
-    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_RELIABLE_ORDERED, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES);
+                value += size;
+            }
+        }
+    }
 
-    /* Register NBN_MessageChunk library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_MessageChunk_Create, NBN_MESSAGE_CHUNK_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_MessageChunk_Serialize, NBN_MESSAGE_CHUNK_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_MessageChunk_Destroy, NBN_MESSAGE_CHUNK_TYPE);
+    NBN_ReplicationRecord *msg_record = &msg->records[msg->record_count];
 
-    /* Register NBN_ClientClosedMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_ClientClosedMessage_Create, NBN_CLIENT_CLOSED_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_ClientClosedMessage_Serialize, NBN_CLIENT_CLOSED_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_ClientClosedMessage_Destroy, NBN_CLIENT_CLOSED_MESSAGE_TYPE);
+    *msg_record = *record;
+    msg_record->data_offset = msg->data_length;
 
-    /* Register NBN_ClientAcceptedMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_ClientAcceptedMessage_Create, NBN_CLIENT_ACCEPTED_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_ClientAcceptedMessage_Serialize, NBN_CLIENT_ACCEPTED_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_ClientAcceptedMessage_Destroy, NBN_CLIENT_ACCEPTED_MESSAGE_TYPE);
+    if ((record->flags & NBN_REPLICATION_RECORD_CREATE) && record->spawn_sequence == 0)
+        msg_record->spawn_sequence = msg->sequence;
 
-    /* Register NBN_ByteArrayMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_ByteArrayMessage_Create, NBN_BYTE_ARRAY_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_ByteArrayMessage_Serialize, NBN_BYTE_ARRAY_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_ByteArrayMessage_Destroy, NBN_BYTE_ARRAY_MESSAGE_TYPE);
+    NBN_MeasureStream m_stream;
 
-    /* Register NBN_PublicCryptoInfoMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_PublicCryptoInfoMessage_Create, NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_PublicCryptoInfoMessage_Serialize, NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_PublicCryptoInfoMessage_Destroy, NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
+    NBN_MeasureStream_Init(&m_stream);
 
-    /* Register NBN_StartEncryptMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_StartEncryptMessage_Create, NBN_START_ENCRYPT_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_StartEncryptMessage_Serialize, NBN_START_ENCRYPT_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_StartEncryptMessage_Destroy, NBN_START_ENCRYPT_MESSAGE_TYPE);
+    if (ReplicationMessage_SerializeRecord(msg, msg_record, (NBN_Stream *)&m_stream) < 0)
+        return false;
 
-    /* Register NBN_DisconnectionMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_DisconnectionMessage_Create, NBN_DISCONNECTION_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_DisconnectionMessage_Serialize, NBN_DISCONNECTION_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_DisconnectionMessage_Destroy, NBN_DISCONNECTION_MESSAGE_TYPE);
+    if (*msg_bits + m_stream.number_of_bits > NBN_REPLICATION_MAX_MESSAGE_SIZE * 8)
+        return false;
 
-    /* Register NBN_ConnectionRequestMessage library message */
-    NBN_Endpoint_RegisterMessageBuilder(
-            endpoint, (NBN_MessageBuilder)NBN_ConnectionRequestMessage_Create, NBN_CONNECTION_REQUEST_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageSerializer(
-            endpoint, (NBN_MessageSerializer)NBN_ConnectionRequestMessage_Serialize, NBN_CONNECTION_REQUEST_MESSAGE_TYPE);
-    NBN_Endpoint_RegisterMessageDestructor(
-            endpoint, (NBN_MessageDestructor)NBN_ConnectionRequestMessage_Destroy, NBN_CONNECTION_REQUEST_MESSAGE_TYPE);
+    *msg_bits += m_stream.number_of_bits;
+    *record = *msg_record;
 
-#ifdef NBN_DEBUG
-    endpoint->OnMessageAddedToRecvQueue = NULL;
-#endif
+    msg->record_count++;
+    msg->data_length += data_size;
 
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    NBN_PacketSimulator_Init(&endpoint->packet_simulator);
-    NBN_PacketSimulator_Start(&endpoint->packet_simulator);
-#endif
+    return true;
 }
 
-void NBN_Endpoint_Deinit(NBN_Endpoint *endpoint)
+static NBN_ReplicationMessage *Replicator_CreateMessage(NBN_ReplicatorClient *client)
 {
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    NBN_PacketSimulator_Stop(&endpoint->packet_simulator);
-#endif
+    /* make room for a full message, the oldest messages are considered lost */
+    while (client->sent_message_count >= NBN_REPLICATOR_MAX_PENDING_MESSAGES ||
+            client->sent_record_count + NBN_REPLICATION_MAX_RECORDS > NBN_REPLICATOR_MAX_PENDING_RECORDS)
+        Replicator_ReleaseOldestSentMessage(client);
 
-    MemoryManager_Deinit();
-}
+    NBN_ReplicationMessage *msg = NBN_ReplicationMessage_Create();
 
-void NBN_Endpoint_RegisterMessageBuilder(NBN_Endpoint *endpoint, NBN_MessageBuilder msg_builder, uint8_t msg_type)
-{
-    endpoint->message_builders[msg_type] = msg_builder;
+    if (msg == NULL)
+        return NULL;
+
+    msg->sequence = client->next_sequence++;
+
+    NBN_ReplicatorSentMessage *sent_msg = &client->sent_messages[
+        (client->oldest_sent_message + client->sent_message_count) % NBN_REPLICATOR_MAX_PENDING_MESSAGES];
+
+    sent_msg->sequence = msg->sequence;
+    sent_msg->first_record = client->next_sent_record;
+    sent_msg->record_count = 0;
+    sent_msg->is_pending = false; /* until actually sent */
+
+    return msg;
 }
 
-void NBN_Endpoint_RegisterMessageDestructor(NBN_Endpoint *endpoint, NBN_MessageDestructor msg_destructor, uint8_t msg_type)
+static int Replicator_SendMessage(NBN_Replicator *replicator, NBN_ReplicatorClient *client, NBN_ReplicationMessage *msg)
 {
-    endpoint->message_destructors[msg_type] = msg_destructor;
-}
+    NBN_Connection *connection = client->connection;
+    NBN_Channel *channel = connection->channels[replicator->channel_id];
+    NBN_ReplicatorSentMessage *sent_msg = &client->sent_messages[
+        (client->oldest_sent_message + client->sent_message_count) % NBN_REPLICATOR_MAX_PENDING_MESSAGES];
+
+    assert(channel && channel->type == NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED);
+    assert(sent_msg->sequence == msg->sequence);
+
+    msg->outgoing_msg.type = NBN_REPLICATION_MESSAGE_TYPE;
+    msg->outgoing_msg.ref_count = 0;
+    msg->outgoing_msg.data = msg;
+
+    /* the channel assigns IDs sequentially, this is how acked messages are matched with sent messages */
+    sent_msg->msg_id = channel->next_outgoing_message_id;
+    sent_msg->send_time = connection->time;
+    sent_msg->is_pending = true;
+
+    client->sent_message_count++;
+
+    if (NBN_GameServer_SendMessageTo(connection, &msg->outgoing_msg, replicator->channel_id) < 0)
+    {
+        if (msg->outgoing_msg.ref_count == 0)
+            NBN_ReplicationMessage_Destroy(msg);
+
+        return NBN_ERROR;
+    }
 
-void NBN_Endpoint_RegisterMessageSerializer(
-        NBN_Endpoint *endpoint, NBN_MessageSerializer msg_serializer, uint8_t msg_type)
-{
-    endpoint->message_serializers[msg_type] = msg_serializer;
+    return 0;
 }
 
-void NBN_Endpoint_RegisterChannel(NBN_Endpoint *endpoint, NBN_ChannelType type, uint8_t id)
+static void Replicator_ReleaseOldestSentMessage(NBN_ReplicatorClient *client)
 {
-    assert(endpoint->channels[id] == NBN_CHANNEL_TYPE_UNDEFINED);
+    assert(client->sent_message_count > 0);
 
-    endpoint->channels[id] = type;
+    NBN_ReplicatorSentMessage *sent_msg = &client->sent_messages[client->oldest_sent_message];
+
+    if (sent_msg->is_pending)
+        Replicator_OnMessageLost(client, sent_msg);
+
+    client->sent_record_count -= sent_msg->record_count;
+    client->sent_message_count--;
+    client->oldest_sent_message = (client->oldest_sent_message + 1) % NBN_REPLICATOR_MAX_PENDING_MESSAGES;
 }
 
-NBN_Connection *NBN_Endpoint_CreateConnection(NBN_Endpoint *endpoint, uint32_t id, void *driver_data)
+static void Replicator_ExpireSentMessages(NBN_ReplicatorClient *client)
 {
-    NBN_Connection *connection = NBN_Connection_Create(
-            id, Endpoint_BuildProtocolId(endpoint->config.protocol_name), endpoint, driver_data);
+    NBN_Connection *connection = client->connection;
 
-    for (int chan_id = 0; chan_id < NBN_MAX_CHANNELS; chan_id++)
+    /* a message is considered lost when it has not been acked after a couple of round trips */
+    double timeout = MAX(NBN_MESSAGE_RESEND_DELAY, connection->stats.ping * 2);
+
+    while (client->sent_message_count > 0)
     {
-        NBN_ChannelType channel_type = endpoint->channels[chan_id];
+        NBN_ReplicatorSentMessage *sent_msg = &client->sent_messages[client->oldest_sent_message];
 
-        if (channel_type != NBN_CHANNEL_TYPE_UNDEFINED)
-            NBN_Connection_CreateChannel(connection, channel_type, chan_id);
-    }
+        if (sent_msg->is_pending && connection->time - sent_msg->send_time < timeout)
+            break;
 
-    return connection;
+        Replicator_ReleaseOldestSentMessage(client);
+    }
 }
 
-static uint32_t Endpoint_BuildProtocolId(const char *protocol_name)
+static void Replicator_OnMessageAcked(NBN_Replicator *replicator, NBN_Connection *connection, uint16_t msg_id)
 {
-    uint32_t protocol_id = 2166136261;
+    NBN_ReplicatorClient *client = replicator->clients[connection->slot];
 
-    for (unsigned int i = 0; i < strlen(protocol_name); i++)
+    if (client == NULL || client->connection != connection || client->sent_message_count == 0)
+        return;
+
+    uint16_t oldest_msg_id = client->sent_messages[client->oldest_sent_message].msg_id;
+    uint16_t offset = msg_id - oldest_msg_id;
+
+    if (offset >= client->sent_message_count)
+        return;
+
+    NBN_ReplicatorSentMessage *sent_msg =
+        &client->sent_messages[(client->oldest_sent_message + offset) % NBN_REPLICATOR_MAX_PENDING_MESSAGES];
+
+    if (!sent_msg->is_pending || sent_msg->msg_id != msg_id)
+        return;
+
+    sent_msg->is_pending = false;
+
+    for (unsigned int i = 0; i < sent_msg->record_count; i++)
     {
-        protocol_id *= 16777619;
-        protocol_id ^= protocol_name[i];
-    }
+        NBN_ReplicatorSentRecord *sent_record =
+            &client->sent_records[(sent_msg->first_record + i) % NBN_REPLICATOR_MAX_PENDING_RECORDS];
+        NBN_ReplicaScopeEntry *entry = &client->scope[sent_record->scope_index];
 
-    return protocol_id;
-}
+        if (entry->generation != sent_record->generation)
+            continue;
 
-static int Endpoint_ProcessReceivedPacket(NBN_Endpoint *endpoint, NBN_Packet *packet, NBN_Connection *connection)
-{
-    (void)endpoint;
+        if (sent_record->flags & NBN_REPLICATION_RECORD_DESTROY)
+        {
+            Replicator_FreeScopeEntry(client, sent_record->scope_index);
 
-    NBN_LogTrace("Received packet %d (conn id: %d, ack: %d, messages count: %d)", packet->header.seq_number,
-            connection->id, packet->header.ack, packet->header.messages_count);
+            continue;
+        }
 
-    if (NBN_Connection_ProcessReceivedPacket(connection, packet) < 0)
-        return NBN_ERROR;
+        if ((sent_record->flags & NBN_REPLICATION_RECORD_CREATE) && entry->state == NBN_REPLICA_CREATING)
+        {
+            entry->state = NBN_REPLICA_ALIVE;
+            entry->is_record_in_flight = false;
+        }
 
-    connection->last_recv_packet_time = connection->time;
-    connection->downloaded_bytes += packet->size;
+        /* values that changed after the message was sent are still unacked */
+        if (sent_msg->sequence >= entry->last_change_sequence)
+            entry->unacked_mask &= ~sent_record->field_mask;
 
-    return 0;
+        entry->in_flight_mask &= ~sent_record->field_mask;
+    }
+
+    /* release the acked messages at the front */
+    while (client->sent_message_count > 0 && !client->sent_messages[client->oldest_sent_message].is_pending)
+        Replicator_ReleaseOldestSentMessage(client);
 }
 
-static NBN_OutgoingMessage *Endpoint_CreateOutgoingMessage(NBN_Endpoint *endpoint, uint8_t msg_type, void *data)
+static void Replicator_OnMessageLost(NBN_ReplicatorClient *client, NBN_ReplicatorSentMessage *sent_msg)
 {
-    if (endpoint->message_serializers[msg_type] == NULL)
+    sent_msg->is_pending = false;
+
+    for (unsigned int i = 0; i < sent_msg->record_count; i++)
     {
-        NBN_LogError("No message serializer is registered for messages of type %d", msg_type);
+        NBN_ReplicatorSentRecord *sent_record =
+            &client->sent_records[(sent_msg->first_record + i) % NBN_REPLICATOR_MAX_PENDING_RECORDS];
+        NBN_ReplicaScopeEntry *entry = &client->scope[sent_record->scope_index];
 
-        return NULL;
+        if (entry->generation != sent_record->generation)
+            continue;
+
+        if (((sent_record->flags & NBN_REPLICATION_RECORD_CREATE) && entry->state == NBN_REPLICA_CREATING) ||
+                ((sent_record->flags & NBN_REPLICATION_RECORD_DESTROY) && entry->state == NBN_REPLICA_DESTROYING))
+            entry->is_record_in_flight = false;
+
+        /* fields are sent again on the next send */
+        entry->in_flight_mask &= ~sent_record->field_mask;
     }
+}
 
-    NBN_OutgoingMessage *outgoing_message = &endpoint->outgoing_message_buffer[endpoint->next_outgoing_message];
+#pragma endregion /* NBN_Replicator */
 
-    outgoing_message->type = msg_type;
-    outgoing_message->data = data;
-    outgoing_message->ref_count = 0;
+#pragma region NBN_ReplicationReceiver
 
-    endpoint->next_outgoing_message = (endpoint->next_outgoing_message + 1) % NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE;
+static NBN_Replica *ReplicationReceiver_GetReplica(NBN_ReplicationReceiver *, uint32_t);
+static void ReplicationReceiver_ProcessRecord(NBN_ReplicationReceiver *, NBN_ReplicationMessage *, NBN_ReplicationRecord *);
 
-    return outgoing_message;
+NBN_ReplicationReceiver *NBN_ReplicationReceiver_Create(
+    NBN_ReplicaCreateCallback on_create, NBN_ReplicaUpdateCallback on_update, NBN_ReplicaDestroyCallback on_destroy, void *user_data)
+{
+    NBN_ReplicationReceiver *receiver = (NBN_ReplicationReceiver *)NBN_Allocator(sizeof(NBN_ReplicationReceiver));
+
+    receiver->replicas = NULL;
+    receiver->capacity = 0;
+    receiver->on_create = on_create;
+    receiver->on_update = on_update;
+    receiver->on_destroy = on_destroy;
+    receiver->user_data = user_data;
+
+    return receiver;
 }
 
-static int Endpoint_EnqueueOutgoingMessage(
-        NBN_Endpoint *endpoint, NBN_Connection *connection, NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
+void NBN_ReplicationReceiver_Destroy(NBN_ReplicationReceiver *receiver)
 {
-    NBN_Channel *channel = connection->channels[channel_id];
-
-    if (channel == NULL)
+    for (unsigned int i = 0; i < receiver->capacity; i++)
     {
-        NBN_LogError("Channel %d does not exist", channel_id);
+        NBN_Replica *replica = &receiver->replicas[i];
 
-        return NBN_ERROR;
+        if (replica->exists)
+            receiver->on_destroy(i, replica->state, receiver->user_data);
     }
 
-    NBN_MessageSerializer msg_serializer = endpoint->message_serializers[outgoing_msg->type];
-
-    assert(msg_serializer); 
+    NBN_Deallocator(receiver->replicas);
+    NBN_Deallocator(receiver);
+}
 
-    NBN_Message message = {
-        { 0, outgoing_msg->type, channel_id },
-        NULL,
-        outgoing_msg,
-        outgoing_msg->data
-    };
+int NBN_ReplicationReceiver_ProcessMessage(NBN_ReplicationReceiver *receiver, NBN_ReplicationMessage *msg)
+{
+    for (unsigned int i = 0; i < msg->record_count; i++)
+    {
+        NBN_ReplicationRecord *record = &msg->records[i];
 
-    NBN_MeasureStream m_stream;
+        if (ReplicationReceiver_GetReplica(receiver, record->entity_id) == NULL)
+            return NBN_ERROR;
 
-    NBN_MeasureStream_Init(&m_stream);
+        ReplicationReceiver_ProcessRecord(receiver, msg, record);
+    }
 
-    unsigned int message_size = (NBN_Message_Measure(&message, &m_stream, msg_serializer) - 1) / 8 + 1;
+    return 0;
+}
 
-    if (message_size > NBN_PACKET_MAX_USER_DATA_SIZE)
+static NBN_Replica *ReplicationReceiver_GetReplica(NBN_ReplicationReceiver *receiver, uint32_t entity_id)
+{
+    if (entity_id >= receiver->capacity)
     {
-        NBN_MessageChunk *chunks[NBN_CHANNEL_CHUNKS_BUFFER_SIZE];
-        int chunk_count = Endpoint_SplitMessageIntoChunks(
-                &message, outgoing_msg, channel, msg_serializer, message_size, chunks);
+        unsigned int new_capacity = receiver->capacity ? receiver->capacity : 256;
 
-        assert(chunk_count <= NBN_CHANNEL_CHUNKS_BUFFER_SIZE);
+        while (new_capacity <= entity_id)
+            new_capacity *= 2;
 
-        if (chunk_count < 0)
+        receiver->replicas = (NBN_Replica *)NBN_Reallocator(receiver->replicas, sizeof(NBN_Replica) * new_capacity);
+
+        if (receiver->replicas == NULL)
         {
-            NBN_LogError("Failed to split message into chunks");
+            NBN_LogError("Failed to grow replicas");
 
-            return NBN_ERROR;
+            return NULL;
         }
 
-        outgoing_msg->ref_count += chunk_count;
+        memset(receiver->replicas + receiver->capacity, 0, sizeof(NBN_Replica) * (new_capacity - receiver->capacity));
 
-        for (int i = 0; i < chunk_count; i++)
-        {
-            NBN_OutgoingMessage *chunk_outgoing_msg = Endpoint_CreateOutgoingMessage(
-                    endpoint, NBN_MESSAGE_CHUNK_TYPE, chunks[i]);
+        receiver->capacity = new_capacity;
+    }
 
-            if (chunk_outgoing_msg == NULL)
-                return NBN_ERROR;
+    return &receiver->replicas[entity_id];
+}
 
-            if (Endpoint_EnqueueOutgoingMessage(endpoint, connection, chunk_outgoing_msg, channel_id) < 0)
-            {
-                NBN_LogError("Failed to enqueue message chunk");
+static void ReplicationReceiver_ProcessRecord(
+        NBN_ReplicationReceiver *receiver, NBN_ReplicationMessage *msg, NBN_ReplicationRecord *record)
+{
+    NBN_Replica *replica = &receiver->replicas[record->entity_id];
 
-                return NBN_ERROR;
-            }
-        }
+    if (record->flags & NBN_REPLICATION_RECORD_DESTROY)
+    {
+        /* ignore destroy records of older incarnations of the entity */
+        if (record->spawn_sequence < replica->spawn_sequence)
+            return;
 
-        return 0;
+        if (replica->exists)
+            receiver->on_destroy(record->entity_id, replica->state, receiver->user_data);
+
+        /* keeping the spawn sequence prevents a late create record from bringing the entity back */
+        replica->exists = false;
+        replica->state = NULL;
+        replica->spawn_sequence = record->spawn_sequence;
+
+        return;
     }
-    else
+
+    if (record->flags & NBN_REPLICATION_RECORD_CREATE)
     {
-        outgoing_msg->ref_count++;
+        if (record->spawn_sequence > replica->spawn_sequence)
+        {
+            if (replica->exists)
+                receiver->on_destroy(record->entity_id, replica->state, receiver->user_data);
+
+            replica->state = receiver->on_create(record->entity_id, (uint8_t)record->entity_type, receiver->user_data);
+            replica->type = record->entity_type;
+            replica->spawn_sequence = record->spawn_sequence;
+            replica->exists = replica->state != NULL;
 
-        return NBN_Connection_EnqueueOutgoingMessage(connection, channel, &message);
+            memset(replica->field_sequences, 0, sizeof(replica->field_sequences));
+        }
+        else if (!replica->exists || record->spawn_sequence != replica->spawn_sequence)
+        {
+            /* outdated creation */
+            return;
+        }
     }
-}
 
-static int Endpoint_SplitMessageIntoChunks(
-        NBN_Message *message,
-        NBN_OutgoingMessage *outgoing_msg,
-        NBN_Channel *channel,
-        NBN_MessageSerializer msg_serializer,
-        unsigned int message_size,
-        NBN_MessageChunk **chunks)
-{
-    unsigned int chunk_count = ((message_size - 1) / NBN_MESSAGE_CHUNK_SIZE) + 1;
+    if (!replica->exists || msg->sequence < replica->spawn_sequence || record->entity_type != replica->type)
+        return;
 
-    NBN_LogTrace("Split message into %d chunks (message size: %d)", chunk_count, message_size);
+    NBN_ReplicatedEntityType *entity_type = &__replicated_entity_types[record->entity_type];
+    uint8_t *value = msg->data + record->data_offset;
+    uint8_t *state = (uint8_t *)replica->state;
+    uint32_t updated_mask = 0;
 
-    if (chunk_count > NBN_CHANNEL_CHUNKS_BUFFER_SIZE)
+    for (unsigned int i = 0; i < entity_type->field_count; i++)
     {
-        NBN_LogError("The maximum number of chunks is 255");
+        if ((record->field_mask & (1u << i)) == 0)
+            continue;
 
-        return NBN_ERROR;
+        NBN_ReplicationField *field = &entity_type->fields[i];
+        unsigned int size = ReplicationMessage_GetFieldSize(field);
+
+        /* discard values older than the one already written */
+        if (msg->sequence > replica->field_sequences[i])
+        {
+            memcpy(state + field->offset, value, field->type == NBN_REPLICATION_FIELD_BOOL ? sizeof(bool) :
+                    (field->type == NBN_REPLICATION_FIELD_BYTES ? field->length : size));
+
+            replica->field_sequences[i] = msg->sequence;
+            updated_mask |= 1u << i;
+        }
+
+        value += size;
     }
 
-    if (message_size > channel->write_chunk_buffer_size)
-        NBN_Channel_ResizeWriteChunkBuffer(channel, message_size);
+    if (updated_mask && receiver->on_update)
+        receiver->on_update(record->entity_id, replica->state, updated_mask, receiver->user_data);
+}
 
-    NBN_WriteStream w_stream;
+#pragma endregion /* NBN_ReplicationReceiver */
 
-    NBN_WriteStream_Init(&w_stream, channel->write_chunk_buffer, message_size);
+#pragma region NBN_SnapshotBuilder
 
-    if (NBN_Message_SerializeHeader(&message->header, (NBN_Stream *)&w_stream) < 0)
-        return NBN_ERROR;
+static NBN_SnapshotClient *SnapshotBuilder_GetClient(NBN_SnapshotBuilder *, NBN_Connection *);
+static void SnapshotBuilder_MeasureEntities(NBN_SnapshotBuilder *);
+static int SnapshotBuilder_SendToClient(
+    NBN_SnapshotBuilder *, NBN_SnapshotClient *, uint32_t, NBN_SnapshotPriorityCallback, void *);
+static int SnapshotBuilder_CompareCandidates(const void *, const void *);
 
-    if (NBN_Message_SerializeData(message, (NBN_Stream *)&w_stream, msg_serializer) < 0)
-        return NBN_ERROR;
+NBN_SnapshotBuilder *NBN_SnapshotBuilder_Create(uint8_t channel_id, unsigned int entity_capacity, unsigned int budget)
+{
+    assert(entity_capacity > 0 && entity_capacity <= NBN_SNAPSHOT_MAX_ENTITY_IDS);
 
-    for (unsigned int i = 0; i < chunk_count; i++)
+    if (__game_server.endpoint.channels[channel_id] == NBN_CHANNEL_TYPE_UNDEFINED)
     {
-        NBN_MessageChunk *chunk = NBN_MessageChunk_Create();
+        NBN_LogError("Channel %d does not exist", channel_id);
 
-        chunk->id = i;
-        chunk->total = chunk_count;
-        chunk->outgoing_msg = outgoing_msg;
+        return NULL;
+    }
 
-        unsigned int offset = i * NBN_MESSAGE_CHUNK_SIZE;
-        unsigned int chunk_size = MIN(NBN_MESSAGE_CHUNK_SIZE, message_size - offset); 
+    if (budget > NBN_SNAPSHOT_MAX_MESSAGE_SIZE)
+    {
+        NBN_LogError("Snapshot budget is too big (%d bytes, max: %d bytes)", budget, (int)NBN_SNAPSHOT_MAX_MESSAGE_SIZE);
 
-        assert(chunk_size <= NBN_MESSAGE_CHUNK_SIZE);
+        return NULL;
+    }
 
-        memcpy(chunk->data, channel->write_chunk_buffer + offset, chunk_size);
+    NBN_SnapshotBuilder *builder = (NBN_SnapshotBuilder *)NBN_Allocator(sizeof(NBN_SnapshotBuilder));
 
-        NBN_LogTrace("Enqueue chunk %d (size: %d, total: %d) for message %d of type %d",
-                chunk->id, chunk_size, chunk->total, message->header.id, message->header.type);
+    memset(builder, 0, sizeof(NBN_SnapshotBuilder));
 
-        chunks[i] = chunk;
+    builder->channel_id = channel_id;
+    builder->budget = budget;
+    builder->entity_capacity = entity_capacity;
+    builder->entities = (NBN_SnapshotEntity *)NBN_Allocator(sizeof(NBN_SnapshotEntity) * entity_capacity);
+    builder->active_entities = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * entity_capacity);
+    builder->candidates = (NBN_SnapshotCandidate *)NBN_Allocator(sizeof(NBN_SnapshotCandidate) * entity_capacity);
+
+    memset(builder->entities, 0, sizeof(NBN_SnapshotEntity) * entity_capacity);
+
+    return builder;
+}
+
+void NBN_SnapshotBuilder_Destroy(NBN_SnapshotBuilder *builder)
+{
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
+    {
+        NBN_SnapshotClient *client = builder->clients[i];
+
+        if (client)
+        {
+            NBN_Deallocator(client->accumulators);
+            NBN_Deallocator(client);
+        }
     }
 
-    return chunk_count;
+    NBN_Deallocator(builder->entities);
+    NBN_Deallocator(builder->active_entities);
+    NBN_Deallocator(builder->candidates);
+    NBN_Deallocator(builder);
 }
 
-#pragma endregion /* NBN_Endpoint */
+void NBN_SnapshotBuilder_SetEntity(NBN_SnapshotBuilder *builder, uint32_t entity_id, void *state, float priority)
+{
+    assert(entity_id < builder->entity_capacity);
 
-#pragma region NBN_GameClient
+    NBN_SnapshotEntity *entity = &builder->entities[entity_id];
 
-NBN_GameClient __game_client;
+    if (!entity->is_active)
+    {
+        entity->active_index = builder->active_count;
+        entity->is_active = true;
 
-NBN_Event client_last_event;
-static uint8_t client_last_received_message_type;
-static int client_closed_code = -1;
+        builder->active_entities[builder->active_count++] = entity_id;
+    }
 
-static int GameClient_ProcessReceivedMessage(NBN_Message *, NBN_Connection *);
-static int GameClient_HandleEvent(void);
-static int GameClient_HandleMessageReceivedEvent(void);
-static int GameClient_SendCryptoPublicInfo(void);
-static void GameClient_StartEncryption(void);
+    entity->state = state;
+    entity->priority = priority;
+}
 
-int NBN_GameClient_Start(const char *protocol_name, const char *ip_address, uint16_t port, bool encryption, uint8_t *connection_data)
+void NBN_SnapshotBuilder_RemoveEntity(NBN_SnapshotBuilder *builder, uint32_t entity_id)
 {
-    NBN_Config config = {
-        protocol_name,
-        ip_address,
-        port,
-        encryption};
+    assert(entity_id < builder->entity_capacity);
 
-    NBN_Endpoint_Init(&__game_client.endpoint, config, false);
+    NBN_SnapshotEntity *entity = &builder->entities[entity_id];
 
-    __game_client.server_connection = NULL;
-    __game_client.is_connected = false;
+    if (!entity->is_active)
+        return;
 
-    if (NBN_Driver_GCli_Start(Endpoint_BuildProtocolId(config.protocol_name), config.ip_address, config.port) < 0)
-        return NBN_ERROR;
+    /* move the last active entity into the hole */
+    uint32_t last_entity_id = builder->active_entities[--builder->active_count];
 
-    NBN_ConnectionRequestMessage *msg = NBN_ConnectionRequestMessage_Create();
+    builder->active_entities[entity->active_index] = last_entity_id;
+    builder->entities[last_entity_id].active_index = entity->active_index;
 
-    if (connection_data)
-        memcpy(msg->data, connection_data, NBN_CONNECTION_DATA_MAX_SIZE);
+    entity->is_active = false;
+    entity->state = NULL;
 
-    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_CONNECTION_REQUEST_MESSAGE_TYPE, msg);
+    /* the ID can be reused by another entity */
+    for (unsigned int i = 0; i < NBN_MAX_CLIENTS; i++)
+    {
+        if (builder->clients[i])
+            builder->clients[i]->accumulators[entity_id] = 0;
+    }
+}
 
-    if (outgoing_msg == NULL)
-        return NBN_ERROR;
+void NBN_SnapshotBuilder_RemoveClient(NBN_SnapshotBuilder *builder, NBN_Connection *client)
+{
+    assert(client->slot < NBN_MAX_CLIENTS);
 
-    if (NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES) < 0)
-        return NBN_ERROR;
+    NBN_SnapshotClient *snapshot_client = builder->clients[client->slot];
 
-    NBN_LogInfo("Started");
+    if (snapshot_client == NULL || snapshot_client->connection != client)
+        return;
 
-    return 0;
+    NBN_Deallocator(snapshot_client->accumulators);
+    NBN_Deallocator(snapshot_client);
+
+    builder->clients[client->slot] = NULL;
 }
 
-int NBN_GameClient_Disconnect(void)
+int NBN_SnapshotBuilder_Send(
+    NBN_SnapshotBuilder *builder, uint32_t tick, NBN_SnapshotPriorityCallback priority_cb, void *user_data)
 {
-    NBN_LogInfo("Disconnecting...");
+    /* entities are measured once for all clients */
+    SnapshotBuilder_MeasureEntities(builder);
 
-    if (__game_client.server_connection->is_closed || __game_client.server_connection->is_stale)
+    for (unsigned int i = 0; i < __game_server.clients->count; i++)
     {
-        NBN_LogInfo("Not connected");
-
-        return 0;
-    }
+        NBN_Connection *connection = __game_server.clients->connections[i];
 
-    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_DISCONNECTION_MESSAGE_TYPE, NULL);
-
-    if (outgoing_msg == NULL)
-        return NBN_ERROR;
-
-    if (NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES) < 0)
-        return NBN_ERROR;
+        if (connection == NULL || connection->is_closed || !connection->is_accepted)
+            continue;
 
-    if (NBN_GameClient_SendPackets() < 0)
-        return NBN_ERROR;
+        NBN_SnapshotClient *client = SnapshotBuilder_GetClient(builder, connection);
 
-    __game_client.server_connection->is_closed = true;
+        if (client == NULL)
+            return NBN_ERROR;
 
-    NBN_LogInfo("Disconnected");
+        if (SnapshotBuilder_SendToClient(builder, client, tick, priority_cb, user_data) < 0)
+            return NBN_ERROR;
+    }
 
     return 0;
 }
 
-void NBN_GameClient_Stop(void)
+static NBN_SnapshotClient *SnapshotBuilder_GetClient(NBN_SnapshotBuilder *builder, NBN_Connection *connection)
 {
-    NBN_GameClient_Poll(); /* Poll one last time to clear remaining events */
+    assert(connection->slot < NBN_MAX_CLIENTS);
 
-    if (__game_client.server_connection)
-        NBN_Connection_Destroy(__game_client.server_connection);
+    NBN_SnapshotClient *client = builder->clients[connection->slot];
 
-    NBN_Endpoint_Deinit(&__game_client.endpoint);
-    NBN_Driver_GCli_Stop();
+    if (client == NULL)
+    {
+        client = (NBN_SnapshotClient *)NBN_Allocator(sizeof(NBN_SnapshotClient));
 
-    NBN_LogInfo("Stopped");
-}
+        if (client == NULL)
+            return NULL;
 
-void NBN_GameClient_RegisterMessage(
-        uint8_t msg_type,
-        NBN_MessageBuilder msg_builder,
-        NBN_MessageDestructor msg_destructor,
-        NBN_MessageSerializer msg_serializer)
-{
-    if (NBN_IsReservedMessage(msg_type))
+        client->accumulators = (float *)NBN_Allocator(sizeof(float) * builder->entity_capacity);
+        client->connection = NULL;
+
+        builder->clients[connection->slot] = client;
+    }
+
+    /* new client or the slot of a disconnected client being reused */
+    if (client->connection != connection)
     {
-        NBN_LogError("Message type %d is reserved by the library", msg_type);
-        NBN_Abort();
+        memset(client->accumulators, 0, sizeof(float) * builder->entity_capacity);
+
+        client->connection = connection;
     }
 
-    NBN_Endpoint_RegisterMessageBuilder(&__game_client.endpoint, msg_builder, msg_type);
-    NBN_Endpoint_RegisterMessageDestructor(&__game_client.endpoint, msg_destructor, msg_type);
-    NBN_Endpoint_RegisterMessageSerializer(&__game_client.endpoint, msg_serializer, msg_type);
+    return client;
 }
 
-void NBN_GameClient_RegisterChannel(uint8_t type, uint8_t id)
+static void SnapshotBuilder_MeasureEntities(NBN_SnapshotBuilder *builder)
 {
-    if (id == NBN_CHANNEL_RESERVED_UNRELIABLE || id == NBN_CHANNEL_RESERVED_RELIABLE || id == NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES)
+    unsigned int id_bits = BITS_REQUIRED(0, NBN_SNAPSHOT_MAX_ENTITY_IDS - 1);
+
+    for (unsigned int i = 0; i < builder->active_count; i++)
     {
-        NBN_LogError("Channel id %d is reserved by the library", type);
-        NBN_Abort();
-    }
+        NBN_SnapshotEntity *entity = &builder->entities[builder->active_entities[i]];
+        NBN_MeasureStream m_stream;
 
-    NBN_Endpoint_RegisterChannel(&__game_client.endpoint, (NBN_ChannelType)type, id);
-}
+        NBN_MeasureStream_Init(&m_stream);
 
-void NBN_GameClient_AddTime(double time)
-{
-    NBN_Connection_AddTime(__game_client.server_connection, time);
+        __snapshot_entity_type.serializer(entity->state, (NBN_Stream *)&m_stream);
 
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    NBN_PacketSimulator_AddTime(&__game_client.endpoint.packet_simulator, time);
-#endif
+        entity->bits = id_bits + m_stream.number_of_bits;
+    }
 }
 
-int NBN_GameClient_Poll(void)
+static int SnapshotBuilder_SendToClient(NBN_SnapshotBuilder *builder, NBN_SnapshotClient *client, uint32_t tick,
+        NBN_SnapshotPriorityCallback priority_cb, void *user_data)
 {
-    if (__game_client.server_connection->is_stale)
-        return NBN_NO_EVENT;
+    unsigned int candidate_count = 0;
 
-    if (NBN_EventQueue_IsEmpty(&__game_client.endpoint.event_queue))
+    for (unsigned int i = 0; i < builder->active_count; i++)
     {
-        if (NBN_Connection_CheckIfStale(__game_client.server_connection))
-        {
-            __game_client.server_connection->is_stale = true;
-            __game_client.is_connected = false;
+        uint32_t entity_id = builder->active_entities[i];
+        NBN_SnapshotEntity *entity = &builder->entities[entity_id];
+        float priority = priority_cb ?
+            priority_cb(client->connection, entity_id, entity->state, entity->priority, user_data) : entity->priority;
 
-            NBN_LogInfo("Server connection is stale. Disconnected.");
+        if (priority <= 0)
+            continue;
 
-            NBN_Event e;
+        client->accumulators[entity_id] += priority;
 
-            e.type = NBN_DISCONNECTED;
-            e.data.connection = (NBN_Connection*)NULL;
+        NBN_SnapshotCandidate candidate = { entity_id, client->accumulators[entity_id] };
 
-            if (!NBN_EventQueue_Enqueue(&__game_client.endpoint.event_queue, e))
-                return NBN_ERROR;
-        }
-        else
-        {
-            if (NBN_Driver_GCli_RecvPackets() < 0)
-                return NBN_ERROR;
+        builder->candidates[candidate_count++] = candidate;
+    }
 
-            for (unsigned int i = 0; i < NBN_MAX_CHANNELS; i++)
-            {
-                NBN_Channel *channel = __game_client.server_connection->channels[i];
+    if (candidate_count == 0)
+        return 0;
 
-                if (channel)
-                {
-                    NBN_Message *msg;
+    qsort(builder->candidates, candidate_count, sizeof(NBN_SnapshotCandidate), SnapshotBuilder_CompareCandidates);
 
-                    while ((msg = channel->GetNextRecvedMessage(channel)) != NULL)
-                    {
-                        NBN_LogTrace("Got message %d of type %d from the recv queue", msg->header.id, msg->header.type);
+    NBN_SnapshotMessage *msg = NBN_SnapshotMessage_Create();
 
-                        if (GameClient_ProcessReceivedMessage(msg, __game_client.server_connection) < 0)
-                        {
-                            NBN_LogError("Failed to process received message");
+    if (msg == NULL)
+        return NBN_ERROR;
 
-                            return NBN_ERROR;
-                        }
-                    }
-                }
-            }
+    msg->tick = tick;
 
-            Connection_UpdateAverageDownloadBandwidth(__game_client.server_connection);
+    NBN_MeasureStream m_stream;
 
-            __game_client.server_connection->last_read_packets_time = __game_client.server_connection->time;
-        }
+    NBN_MeasureStream_Init(&m_stream);
+    NBN_SnapshotMessage_Serialize(msg, (NBN_Stream *)&m_stream);
+
+    unsigned int budget_bits = builder->budget * 8;
+    unsigned int msg_bits = m_stream.number_of_bits;
+
+    /* entities that don't fit are skipped, smaller ones with a lower priority may still fit */
+    for (unsigned int i = 0; i < candidate_count && msg->entity_count < NBN_SNAPSHOT_MAX_ENTITIES; i++)
+    {
+        uint32_t entity_id = builder->candidates[i].entity_id;
+        NBN_SnapshotEntity *entity = &builder->entities[entity_id];
+
+        if (msg_bits + entity->bits > budget_bits)
+            continue;
+
+        msg->entity_ids[msg->entity_count++] = entity_id;
+        msg_bits += entity->bits;
     }
 
-    bool ret = NBN_EventQueue_Dequeue(&__game_client.endpoint.event_queue, &client_last_event);
+    if (msg->entity_count == 0)
+    {
+        NBN_SnapshotMessage_Destroy(msg);
 
-    return ret ? GameClient_HandleEvent() : NBN_NO_EVENT;
-}
+        return 0;
+    }
 
-int NBN_GameClient_SendPackets(void)
-{
-    return NBN_Connection_FlushSendQueue(__game_client.server_connection);
-}
+    size_t entity_size = __snapshot_entity_type.size;
 
-void NBN_GameClient_SetContext(void *context)
-{
-    __game_client.context = context;
-}
+    msg->states = (uint8_t *)NBN_Allocator(msg->entity_count * entity_size);
 
-void *NBN_GameClient_GetContext(void)
-{
-    return __game_client.context;
-}
+    for (unsigned int i = 0; i < msg->entity_count; i++)
+    {
+        uint32_t entity_id = msg->entity_ids[i];
 
-NBN_OutgoingMessage *NBN_GameClient_CreateMessage(uint8_t msg_type, void *msg_data)
-{
-    return Endpoint_CreateOutgoingMessage(&__game_client.endpoint, msg_type, msg_data);
-}
+        memcpy(msg->states + i * entity_size, builder->entities[entity_id].state, entity_size);
 
-int NBN_GameClient_SendMessage(NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
-{
-    if (Endpoint_EnqueueOutgoingMessage(
-                &__game_client.endpoint, __game_client.server_connection, outgoing_msg, channel_id) < 0)
+        client->accumulators[entity_id] = 0;
+    }
+
+    msg->outgoing_msg.type = NBN_SNAPSHOT_MESSAGE_TYPE;
+    msg->outgoing_msg.ref_count = 0;
+    msg->outgoing_msg.data = msg;
+
+    if (NBN_GameServer_SendMessageTo(client->connection, &msg->outgoing_msg, builder->channel_id) < 0)
     {
-        NBN_LogError("Failed to create outgoing message");
+        if (msg->outgoing_msg.ref_count == 0)
+            NBN_SnapshotMessage_Destroy(msg);
 
         return NBN_ERROR;
     }
@@ -4594,994 +12048,1311 @@ int NBN_GameClient_SendMessage(NBN_OutgoingMessage *outgoing_msg, uint8_t channe
     return 0;
 }
 
-NBN_OutgoingMessage *NBN_GameClient_CreateByteArrayMessage(uint8_t *bytes, unsigned int length)
+/* Highest accumulated priority first, ties are broken by entity ID to keep snapshots deterministic */
+static int SnapshotBuilder_CompareCandidates(const void *a, const void *b)
 {
-    if (length > NBN_BYTE_ARRAY_MAX_SIZE)
-    {
-        NBN_LogError("Byte array cannot exceed %d bytes", NBN_BYTE_ARRAY_MAX_SIZE);
+    const NBN_SnapshotCandidate *c1 = (const NBN_SnapshotCandidate *)a;
+    const NBN_SnapshotCandidate *c2 = (const NBN_SnapshotCandidate *)b;
 
-        return NULL;
-    }
+    if (c1->accumulator != c2->accumulator)
+        return c1->accumulator > c2->accumulator ? -1 : 1;
 
-    NBN_ByteArrayMessage *msg = NBN_ByteArrayMessage_Create();
+    return c1->entity_id < c2->entity_id ? -1 : (c1->entity_id > c2->entity_id);
+}
 
-    memcpy(msg->bytes, bytes, length);
+#pragma endregion /* NBN_SnapshotBuilder */
 
-    msg->length = length;
+#pragma region NBN_SnapshotBuffer
 
-    return NBN_GameClient_CreateMessage(NBN_BYTE_ARRAY_MESSAGE_TYPE, msg);
-}
+static void SnapshotBuffer_UpdateJitter(NBN_SnapshotBuffer *, uint32_t);
+static void SnapshotBuffer_DropOldSnapshots(NBN_SnapshotBuffer *);
 
-int NBN_GameClient_SendUnreliableMessage(NBN_OutgoingMessage *outgoing_msg)
+NBN_SnapshotBuffer *NBN_SnapshotBuffer_Create(double tick_dt, double max_extrapolation)
 {
-    return NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_UNRELIABLE);
+    assert(tick_dt > 0);
+
+    NBN_SnapshotBuffer *buffer = (NBN_SnapshotBuffer *)NBN_Allocator(sizeof(NBN_SnapshotBuffer));
+
+    memset(buffer, 0, sizeof(NBN_SnapshotBuffer));
+
+    buffer->tick_dt = tick_dt;
+    buffer->max_extrapolation = max_extrapolation;
+
+    return buffer;
 }
 
-int NBN_GameClient_SendReliableMessage(NBN_OutgoingMessage *outgoing_msg)
+void NBN_SnapshotBuffer_Destroy(NBN_SnapshotBuffer *buffer)
 {
-    return NBN_GameClient_SendMessage(outgoing_msg, NBN_CHANNEL_RESERVED_RELIABLE);
+    for (unsigned int i = 0; i < NBN_SNAPSHOT_BUFFER_SIZE; i++)
+    {
+        if (buffer->snapshots[i])
+            NBN_SnapshotMessage_Destroy(buffer->snapshots[i]);
+    }
+
+    NBN_Deallocator(buffer);
 }
 
-NBN_Connection *NBN_GameClient_CreateServerConnection(void *driver_data)
+void NBN_SnapshotBuffer_AddTime(NBN_SnapshotBuffer *buffer, double time)
 {
-    NBN_Connection *server_connection = NBN_Endpoint_CreateConnection(&__game_client.endpoint, 0, driver_data);
+    buffer->time += time;
 
-#ifdef NBN_DEBUG
-    server_connection->OnMessageAddedToRecvQueue = __game_client.endpoint.OnMessageAddedToRecvQueue;
-#endif
+    /* slow down or speed up the playback instead of jumping to the target delay */
+    double max_adjustment = time * NBN_SNAPSHOT_BUFFER_DELAY_ADJUST_RATE;
+    double adjustment = buffer->target_delay - buffer->delay;
 
-    __game_client.server_connection = server_connection;
+    buffer->delay += MAX(-max_adjustment, MIN(adjustment, max_adjustment));
 
-    return server_connection;
+    /*
+       the minimum jumps when the fastest snapshot leaves the measurement window (and the target delay jumps the
+       other way), follow it at the same rate so the render time does not step back
+       */
+    double offset_adjustment = buffer->min_arrival_offset - buffer->arrival_offset;
+
+    buffer->arrival_offset += MAX(-max_adjustment, MIN(offset_adjustment, max_adjustment));
 }
 
-NBN_MessageInfo NBN_GameClient_GetMessageInfo(void)
+void NBN_SnapshotBuffer_Add(NBN_SnapshotBuffer *buffer, NBN_SnapshotMessage *msg)
 {
-    assert(client_last_event.type == NBN_MESSAGE_RECEIVED);
+    /* late snapshots are measured too, they are the ones the delay has to account for */
+    SnapshotBuffer_UpdateJitter(buffer, msg->tick);
 
-    return client_last_event.data.message_info;
-}
+    if (buffer->has_sampled && msg->tick < buffer->render_tick)
+        return;
 
-NBN_ConnectionStats NBN_GameClient_GetStats(void)
-{
-    return __game_client.server_connection->stats;
-}
+    unsigned int index = msg->tick % NBN_SNAPSHOT_BUFFER_SIZE;
+    NBN_SnapshotMessage *snapshot = buffer->snapshots[index];
 
-int NBN_GameClient_GetServerCloseCode(void)
-{
-    return client_closed_code;
-}
+    if (snapshot)
+    {
+        /* duplicate or older than the snapshot in the slot */
+        if (snapshot->tick >= msg->tick)
+            return;
 
-NBN_Stream *NBN_GameClient_GetAcceptDataReadStream(void)
-{
-    return (NBN_Stream *)&__game_client.server_connection->accept_data_r_stream;
-}
+        NBN_SnapshotMessage_Destroy(snapshot);
+    }
 
-bool NBN_GameClient_IsConnected(void)
-{
-    return __game_client.is_connected;
-}
+    snapshot = NBN_SnapshotMessage_Create();
 
-bool NBN_GameClient_IsEncryptionEnabled(void)
-{
-    return __game_client.endpoint.config.is_encryption_enabled;
-}
+    snapshot->tick = msg->tick;
+    snapshot->entity_count = msg->entity_count;
 
-#ifdef NBN_DEBUG
+    memcpy(snapshot->entity_ids, msg->entity_ids, sizeof(unsigned int) * msg->entity_count);
 
-void NBN_GameClient_Debug_RegisterCallback(NBN_ConnectionDebugCallback cb_type, void *cb)
-{
-    switch (cb_type)
+    if (msg->entity_count > 0)
     {
-        case NBN_DEBUG_CB_MSG_ADDED_TO_RECV_QUEUE:
-            __game_client.endpoint.OnMessageAddedToRecvQueue = (void (*)(NBN_Connection *, NBN_Message *))cb;
-            break;
+        size_t states_size = msg->entity_count * __snapshot_entity_type.size;
+
+        snapshot->states = (uint8_t *)NBN_Allocator(states_size);
+
+        memcpy(snapshot->states, msg->states, states_size);
     }
-}
 
-#endif /* NBN_DEBUG */
+    buffer->snapshots[index] = snapshot;
+}
 
-static int GameClient_ProcessReceivedMessage(NBN_Message *message, NBN_Connection *server_connection)
+int NBN_SnapshotBuffer_Sample(NBN_SnapshotBuffer *buffer, NBN_SnapshotSample *sample)
 {
-    assert(__game_client.server_connection == server_connection);
-
-    NBN_Event ev;
+    if (buffer->arrival_offset_count == 0)
+        return NBN_ERROR;
 
-    ev.type = NBN_MESSAGE_RECEIVED;
+    /* render time in ticks */
+    double render_tick = (buffer->time - buffer->arrival_offset - buffer->delay) / buffer->tick_dt;
+    NBN_SnapshotMessage *from = NULL;
+    NBN_SnapshotMessage *to = NULL;
+    NBN_SnapshotMessage *oldest = NULL;
 
-    if (message->header.type == NBN_MESSAGE_CHUNK_TYPE)
+    for (unsigned int i = 0; i < NBN_SNAPSHOT_BUFFER_SIZE; i++)
     {
-        NBN_Channel *channel = server_connection->channels[message->header.channel_id];
+        NBN_SnapshotMessage *snapshot = buffer->snapshots[i];
 
-        if (!NBN_Channel_AddChunk(channel, message))
-            return 0;
+        if (snapshot == NULL)
+            continue;
 
-        NBN_Message complete_message;
+        if (oldest == NULL || snapshot->tick < oldest->tick)
+            oldest = snapshot;
 
-        if (NBN_Channel_ReconstructMessageFromChunks(channel, server_connection, &complete_message) < 0)
+        if (snapshot->tick <= render_tick)
         {
-            NBN_LogError("Failed to reconstruct message from chunks");
-
-            return NBN_ERROR;
+            if (from == NULL || snapshot->tick > from->tick)
+                from = snapshot;
+        }
+        else if (to == NULL || snapshot->tick < to->tick)
+        {
+            to = snapshot;
         }
+    }
 
-        NBN_MessageInfo msg_info = { complete_message.header.type, complete_message.data, NULL };
+    if (oldest == NULL)
+        return NBN_ERROR;
 
-        ev.data.message_info = msg_info;
+    sample->is_extrapolated = false;
+
+    if (from == NULL)
+    {
+        /* nothing to render that far in the past, hold the oldest snapshot */
+        sample->from = oldest;
+        sample->to = oldest;
+        sample->t = 0;
+    }
+    else if (to)
+    {
+        sample->from = from;
+        sample->to = to;
+        sample->t = (float)((render_tick - from->tick) / (to->tick - from->tick));
     }
     else
     {
-        NBN_MessageInfo msg_info = { message->header.type, message->data, NULL };
+        /* the next snapshot is late, extrapolate from the last two snapshots */
+        NBN_SnapshotMessage *previous = NULL;
 
-        ev.data.message_info = msg_info;
+        for (unsigned int i = 0; i < NBN_SNAPSHOT_BUFFER_SIZE; i++)
+        {
+            NBN_SnapshotMessage *snapshot = buffer->snapshots[i];
+
+            if (snapshot && snapshot->tick < from->tick && (previous == NULL || snapshot->tick > previous->tick))
+                previous = snapshot;
+        }
+
+        double extrapolation = MIN(render_tick - from->tick, buffer->max_extrapolation / buffer->tick_dt);
+
+        sample->is_extrapolated = extrapolation > 0;
+
+        if (previous)
+        {
+            sample->from = previous;
+            sample->to = from;
+            sample->t = (float)((from->tick + extrapolation - previous->tick) / (from->tick - previous->tick));
+        }
+        else
+        {
+            sample->from = from;
+            sample->to = from;
+            sample->t = 0;
+        }
     }
 
-    if (!NBN_EventQueue_Enqueue(&__game_client.endpoint.event_queue, ev))
-        return NBN_ERROR;
+    buffer->render_tick = sample->from->tick;
+    buffer->has_sampled = true;
+
+    SnapshotBuffer_DropOldSnapshots(buffer);
 
     return 0;
 }
 
-static int GameClient_HandleEvent(void)
+static void SnapshotBuffer_UpdateJitter(NBN_SnapshotBuffer *buffer, uint32_t tick)
 {
-    switch (client_last_event.type)
+    buffer->arrival_offsets[buffer->next_arrival_offset] = buffer->time - tick * buffer->tick_dt;
+    buffer->next_arrival_offset = (buffer->next_arrival_offset + 1) % NBN_SNAPSHOT_BUFFER_JITTER_SAMPLES;
+
+    if (buffer->arrival_offset_count < NBN_SNAPSHOT_BUFFER_JITTER_SAMPLES)
+        buffer->arrival_offset_count++;
+
+    /* the fastest snapshot of the window has zero jitter */
+    double min_offset = buffer->arrival_offsets[0];
+
+    for (unsigned int i = 1; i < buffer->arrival_offset_count; i++)
+        min_offset = MIN(min_offset, buffer->arrival_offsets[i]);
+
+    memset(buffer->jitter_histogram, 0, sizeof(buffer->jitter_histogram));
+
+    for (unsigned int i = 0; i < buffer->arrival_offset_count; i++)
     {
-        case NBN_MESSAGE_RECEIVED:
-            return GameClient_HandleMessageReceivedEvent();
+        unsigned int bin = (unsigned int)((buffer->arrival_offsets[i] - min_offset) / NBN_SNAPSHOT_BUFFER_JITTER_BIN_SIZE);
 
-        default:
-            return client_last_event.type;
+        buffer->jitter_histogram[MIN(bin, NBN_SNAPSHOT_BUFFER_JITTER_BINS - 1)]++;
+    }
+
+    unsigned int percentile_count =
+        (unsigned int)ceil(buffer->arrival_offset_count * NBN_SNAPSHOT_BUFFER_JITTER_PERCENTILE);
+    unsigned int count = 0;
+    unsigned int bin = 0;
+
+    while (bin < NBN_SNAPSHOT_BUFFER_JITTER_BINS - 1 && (count += buffer->jitter_histogram[bin]) < percentile_count)
+        bin++;
+
+    buffer->min_arrival_offset = min_offset;
+    buffer->jitter = (bin + 1) * NBN_SNAPSHOT_BUFFER_JITTER_BIN_SIZE;
+
+    /* the snapshot following the rendered one has to be there as well */
+    buffer->target_delay = buffer->jitter + buffer->tick_dt;
+
+    if (buffer->arrival_offset_count == 1)
+    {
+        buffer->delay = buffer->target_delay;
+        buffer->arrival_offset = buffer->min_arrival_offset;
+    }
+}
+
+static void SnapshotBuffer_DropOldSnapshots(NBN_SnapshotBuffer *buffer)
+{
+    for (unsigned int i = 0; i < NBN_SNAPSHOT_BUFFER_SIZE; i++)
+    {
+        NBN_SnapshotMessage *snapshot = buffer->snapshots[i];
+
+        if (snapshot && snapshot->tick < buffer->render_tick)
+        {
+            NBN_SnapshotMessage_Destroy(snapshot);
+
+            buffer->snapshots[i] = NULL;
+        }
     }
 }
 
-static int GameClient_HandleMessageReceivedEvent(void)
+#pragma endregion /* NBN_SnapshotBuffer */
+
+#pragma region NBN_LagCompensator
+
+static bool LagCompensator_GetSlot(NBN_LagCompensator *, uint32_t, unsigned int, unsigned int *);
+
+NBN_LagCompensator *NBN_LagCompensator_Create(
+        unsigned int history_size, unsigned int entity_capacity, unsigned int value_count, double tick_dt)
+{
+    assert(history_size > 0);
+    assert(entity_capacity > 0);
+    assert(tick_dt > 0);
+
+    NBN_LagCompensator *compensator = (NBN_LagCompensator *)NBN_Allocator(sizeof(NBN_LagCompensator));
+    size_t entry_count = (size_t)history_size * entity_capacity;
+
+    compensator->history_size = history_size;
+    compensator->entity_capacity = entity_capacity;
+    compensator->value_count = value_count;
+    compensator->tick_dt = tick_dt;
+    compensator->ticks = (uint32_t *)NBN_Allocator(sizeof(uint32_t) * history_size);
+    compensator->is_tick_stored = (bool *)NBN_Allocator(sizeof(bool) * history_size);
+    compensator->is_entity_stored = (uint8_t *)NBN_Allocator(entry_count);
+    compensator->values = (float *)NBN_Allocator(sizeof(float) * entry_count * value_count);
+    compensator->last_tick = 0;
+    compensator->has_ticks = false;
+
+    memset(compensator->ticks, 0, sizeof(uint32_t) * history_size);
+    memset(compensator->is_tick_stored, 0, sizeof(bool) * history_size);
+    memset(compensator->is_entity_stored, 0, entry_count);
+
+    return compensator;
+}
+
+void NBN_LagCompensator_Destroy(NBN_LagCompensator *compensator)
+{
+    NBN_Deallocator(compensator->ticks);
+    NBN_Deallocator(compensator->is_tick_stored);
+    NBN_Deallocator(compensator->is_entity_stored);
+    NBN_Deallocator(compensator->values);
+    NBN_Deallocator(compensator);
+}
+
+void NBN_LagCompensator_PushTick(NBN_LagCompensator *compensator, uint32_t tick)
 {
-    NBN_MessageInfo message_info = client_last_event.data.message_info;
+    assert(!compensator->has_ticks || tick > compensator->last_tick);
 
-    int ret = NBN_NO_EVENT;
+    unsigned int slot = tick % compensator->history_size;
 
-    if (message_info.type == NBN_CLIENT_CLOSED_MESSAGE_TYPE)
-    {
-        __game_client.is_connected = false;
-        client_closed_code = ((NBN_ClientClosedMessage *)message_info.data)->code;
+    compensator->ticks[slot] = tick;
+    compensator->is_tick_stored[slot] = true;
+    compensator->last_tick = tick;
+    compensator->has_ticks = true;
 
-        ret = NBN_DISCONNECTED;
-    }
-    else if (message_info.type == NBN_CLIENT_ACCEPTED_MESSAGE_TYPE)
-    {
-        __game_client.is_connected = true;
+    memset(compensator->is_entity_stored + slot * compensator->entity_capacity, 0, compensator->entity_capacity);
+}
 
-        memcpy(__game_client.server_connection->accept_data,
-               ((NBN_ClientAcceptedMessage *)message_info.data)->data,
-               NBN_ACCEPT_DATA_MAX_SIZE);
+void NBN_LagCompensator_SetEntity(NBN_LagCompensator *compensator, unsigned int entity_id, const float *values)
+{
+    assert(compensator->has_ticks);
+    assert(entity_id < compensator->entity_capacity);
 
-        ret = NBN_CONNECTED;
-    }
-    else if (NBN_GameClient_IsEncryptionEnabled() && message_info.type == NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE)
-    {
-        NBN_LogDebug("Received server's crypto public info");
+    unsigned int slot = compensator->last_tick % compensator->history_size;
+    float *slot_values = compensator->values + (size_t)slot * compensator->value_count * compensator->entity_capacity;
 
-        if (GameClient_SendCryptoPublicInfo() < 0)
-        {
-            NBN_LogError("Failed to send public key to server");
-            NBN_Abort();
-        }
+    for (unsigned int i = 0; i < compensator->value_count; i++)
+        slot_values[i * compensator->entity_capacity + entity_id] = values[i];
 
-        NBN_PublicCryptoInfoMessage *pub_crypto_msg = (NBN_PublicCryptoInfoMessage*)message_info.data;
+    compensator->is_entity_stored[slot * compensator->entity_capacity + entity_id] = true;
+}
 
-        if (Connection_BuildSharedKey(&__game_client.server_connection->keys1, pub_crypto_msg->pub_key1) < 0)
-        {
-            NBN_LogError("Failed to build shared key (first key)");
-            NBN_Abort();
-        }
+double NBN_LagCompensator_GetViewTick(
+        NBN_LagCompensator *compensator, NBN_Connection *connection, double interpolation_delay)
+{
+    double rewind_time = connection->stats.ping + interpolation_delay;
 
-        if (Connection_BuildSharedKey(&__game_client.server_connection->keys2, pub_crypto_msg->pub_key2) < 0)
-        {
-            NBN_LogError("Failed to build shared key (second key)");
-            NBN_Abort();
-        }
+    return (double)compensator->last_tick - rewind_time / compensator->tick_dt;
+}
 
-        if (Connection_BuildSharedKey(&__game_client.server_connection->keys3, pub_crypto_msg->pub_key3) < 0)
-        {
-            NBN_LogError("Failed to build shared key (third key)");
-            NBN_Abort();
-        }
+int NBN_LagCompensator_GetEntity(NBN_LagCompensator *compensator, unsigned int entity_id, double tick, float *values)
+{
+    if (!compensator->has_ticks || entity_id >= compensator->entity_capacity)
+        return NBN_ERROR;
 
-        NBN_LogTrace("Client can now decrypt packets");
+    uint32_t last_tick = compensator->last_tick;
+    double first_tick = (double)last_tick - MIN(last_tick, compensator->history_size - 1);
 
-        memcpy(__game_client.server_connection->aes_iv, pub_crypto_msg->aes_iv, AES_BLOCKLEN);
-        __game_client.server_connection->can_decrypt = true;
+    tick = MAX(first_tick, MIN(tick, (double)last_tick));
+
+    uint32_t from_tick = (uint32_t)floor(tick);
+    uint32_t to_tick = MIN(from_tick + 1, last_tick);
+    float t = (float)(tick - from_tick);
+    unsigned int from_slot;
+    unsigned int to_slot;
+    bool has_from = LagCompensator_GetSlot(compensator, from_tick, entity_id, &from_slot);
+    bool has_to = LagCompensator_GetSlot(compensator, to_tick, entity_id, &to_slot);
+
+    if (!has_from && !has_to)
+        return NBN_ERROR;
+
+    /* the entity was spawned or despawned in between, use the only state available */
+    if (!has_from)
+    {
+        from_slot = to_slot;
+        t = 0;
     }
-    else if (NBN_GameClient_IsEncryptionEnabled() && message_info.type == NBN_START_ENCRYPT_MESSAGE_TYPE)
+    else if (!has_to)
     {
-        GameClient_StartEncryption();
+        to_slot = from_slot;
+        t = 0;
     }
-    else
+
+    size_t slot_size = (size_t)compensator->value_count * compensator->entity_capacity;
+    float *from_values = compensator->values + from_slot * slot_size;
+    float *to_values = compensator->values + to_slot * slot_size;
+
+    for (unsigned int i = 0; i < compensator->value_count; i++)
     {
-        ret = NBN_MESSAGE_RECEIVED;
+        float from = from_values[i * compensator->entity_capacity + entity_id];
+        float to = to_values[i * compensator->entity_capacity + entity_id];
+
+        values[i] = from + (to - from) * t;
     }
 
-    return ret;
+    return 0;
 }
 
-static int GameClient_SendCryptoPublicInfo(void)
+static bool LagCompensator_GetSlot(
+        NBN_LagCompensator *compensator, uint32_t tick, unsigned int entity_id, unsigned int *slot)
 {
-    assert(__game_client.server_connection);
+    *slot = tick % compensator->history_size;
 
-    NBN_PublicCryptoInfoMessage *msg = NBN_PublicCryptoInfoMessage_Create(); 
+    /* the slot may hold an older tick when some ticks have been skipped */
+    if (!compensator->is_tick_stored[*slot] || compensator->ticks[*slot] != tick)
+        return false;
 
-    memcpy(msg->pub_key1, __game_client.server_connection->keys1.pub_key, ECC_PUB_KEY_SIZE);
-    memcpy(msg->pub_key2, __game_client.server_connection->keys2.pub_key, ECC_PUB_KEY_SIZE);
-    memcpy(msg->pub_key3, __game_client.server_connection->keys3.pub_key, ECC_PUB_KEY_SIZE);
+    return compensator->is_entity_stored[*slot * compensator->entity_capacity + entity_id];
+}
 
-    /* Client does not send an AES IV to the server */
-    uint8_t zero_aes_iv[AES_BLOCKLEN] = {0};
+#pragma endregion /* NBN_LagCompensator */
 
-    memcpy(msg->aes_iv, zero_aes_iv, AES_BLOCKLEN);
+#pragma region NBN_Recorder
 
-    NBN_OutgoingMessage *outgoing_msg = NBN_GameClient_CreateMessage(NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE, msg);
+#if defined(_WIN32)
 
-    if (outgoing_msg == NULL)
+static int Recorder_MapFile(NBN_Recorder *recorder, uint64_t size)
+{
+    recorder->mapping = CreateFileMappingA(
+            recorder->file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+
+    if (recorder->mapping == NULL)
         return NBN_ERROR;
 
-    if (NBN_GameClient_SendReliableMessage(outgoing_msg) < 0)
+    recorder->map = (uint8_t *)MapViewOfFile(recorder->mapping, FILE_MAP_WRITE, 0, 0, (SIZE_T)size);
+
+    if (recorder->map == NULL)
+    {
+        CloseHandle(recorder->mapping);
+
         return NBN_ERROR;
+    }
 
-    NBN_LogDebug("Sent client's public key to the server");
+    recorder->map_size = size;
 
     return 0;
 }
 
-static void GameClient_StartEncryption(void)
+static void Recorder_UnmapFile(NBN_Recorder *recorder)
 {
-    Connection_StartEncryption(__game_client.server_connection);
+    UnmapViewOfFile(recorder->map);
+    CloseHandle(recorder->mapping);
+
+    recorder->map = NULL;
 }
 
-#pragma endregion /* NBN_GameClient */
+static int Recorder_OpenFile(NBN_Recorder *recorder, const char *path)
+{
+    recorder->file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-#pragma region Game client driver
+    return recorder->file == INVALID_HANDLE_VALUE ? NBN_ERROR : 0;
+}
 
-static void Driver_GCli_OnConnected(void);
-static void Driver_GCli_OnPacketReceived(NBN_Packet *packet);
+static void Recorder_CloseFile(NBN_Recorder *recorder, uint64_t size)
+{
+    LARGE_INTEGER offset;
 
-void NBN_Driver_GCli_RaiseEvent(NBN_Driver_GCli_EventType ev, void *data)
+    offset.QuadPart = (LONGLONG)size;
+
+    SetFilePointerEx(recorder->file, offset, NULL, FILE_BEGIN);
+    SetEndOfFile(recorder->file);
+    CloseHandle(recorder->file);
+}
+
+#elif !defined(__EMSCRIPTEN__)
+
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static int Recorder_MapFile(NBN_Recorder *recorder, uint64_t size)
 {
-    switch (ev)
-    {
-        case NBN_DRIVER_GCLI_CONNECTED:
-            Driver_GCli_OnConnected();
-            break;
+    if (ftruncate(recorder->fd, (off_t)size) < 0)
+        return NBN_ERROR;
 
-        case NBN_DRIVER_GCLI_SERVER_PACKET_RECEIVED:
-            Driver_GCli_OnPacketReceived((NBN_Packet*)data);
-            break;
-    }
+    void *map = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, recorder->fd, 0);
+
+    if (map == MAP_FAILED)
+        return NBN_ERROR;
+
+    recorder->map = (uint8_t *)map;
+    recorder->map_size = size;
+
+    return 0;
 }
 
-static void Driver_GCli_OnConnected(void)
+static void Recorder_UnmapFile(NBN_Recorder *recorder)
 {
+    munmap(recorder->map, (size_t)recorder->map_size);
+
+    recorder->map = NULL;
 }
 
-static void Driver_GCli_OnPacketReceived(NBN_Packet *packet)
+static int Recorder_OpenFile(NBN_Recorder *recorder, const char *path)
 {
-    int ret = Endpoint_ProcessReceivedPacket(&__game_client.endpoint, packet, __game_client.server_connection);
+    recorder->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
 
-    /* packets from server should always be valid */
-    assert(ret == 0);
+    return recorder->fd < 0 ? NBN_ERROR : 0;
 }
 
-#pragma endregion /* Game Client driver */
+static void Recorder_CloseFile(NBN_Recorder *recorder, uint64_t size)
+{
+    if (ftruncate(recorder->fd, (off_t)size) < 0)
+        NBN_LogError("Failed to truncate recording file");
 
-#pragma region NBN_GameServer
+    close(recorder->fd);
+}
 
-NBN_GameServer __game_server;
+#endif /* _WIN32 */
 
-static NBN_Event server_last_event;
+#ifdef __EMSCRIPTEN__
 
-static int GameServer_AddClient(NBN_Connection *);
-static int GameServer_CloseClientWithCode(NBN_Connection *client, int code, bool disconnection);
-static unsigned int GameServer_GetClientCount(void);
-static int GameServer_ProcessReceivedMessage(NBN_Message *, NBN_Connection *);
-static int GameServer_CloseStaleClientConnections(void);
-static void GameServer_RemoveClosedClientConnections(void);
-static int GameServer_HandleEvent(void);
-static int GameServer_HandleMessageReceivedEvent(void);
-static int GameServer_SendCryptoPublicInfoTo(NBN_Connection *);
-static int GameServer_StartEncryption(NBN_Connection *);
+NBN_Recorder *NBN_Recorder_Create(const char *path)
+{
+    (void)path;
 
-int NBN_GameServer_Start(const char *protocol_name, uint16_t port, bool encryption)
+    NBN_LogError("Message recording is not supported on this platform");
+
+    return NULL;
+}
+
+int NBN_Recorder_Destroy(NBN_Recorder *recorder)
 {
-    NBN_Config config = {protocol_name, NULL, port, encryption};
+    (void)recorder;
 
-    NBN_Endpoint_Init(&__game_server.endpoint, config, true);
+    return NBN_ERROR;
+}
 
-    if ((__game_server.clients = NBN_ConnectionVector_Create()) == NULL)
-    {
-        NBN_LogError("Failed to create connections vector");
+int NBN_Recorder_RecordMessage(
+        NBN_Recorder *recorder,
+        double time,
+        uint32_t connection_id,
+        uint8_t channel_id,
+        uint8_t type,
+        void *data,
+        NBN_MessageSerializer msg_serializer,
+        NBN_RecordDirection direction)
+{
+    (void)recorder;
+    (void)time;
+    (void)connection_id;
+    (void)channel_id;
+    (void)type;
+    (void)data;
+    (void)msg_serializer;
+    (void)direction;
 
-        return NBN_ERROR;
-    }
+    return NBN_ERROR;
+}
 
-    if (NBN_Driver_GServ_Start(Endpoint_BuildProtocolId(config.protocol_name), config.port) < 0)
-    {
-        NBN_LogError("Failed to start network driver");
+NBN_RecordReader *NBN_RecordReader_Open(const char *path, NBN_Endpoint *endpoint)
+{
+    (void)path;
+    (void)endpoint;
 
-        return NBN_ERROR;
-    }
+    NBN_LogError("Message recording is not supported on this platform");
 
-    NBN_LogInfo("Started");
+    return NULL;
+}
 
-    return 0;
+void NBN_RecordReader_Close(NBN_RecordReader *reader)
+{
+    (void)reader;
 }
 
-void NBN_GameServer_Stop(void)
+int NBN_RecordReader_Next(NBN_RecordReader *reader, NBN_RecordedMessage *message)
 {
-    NBN_GameServer_Poll(); /* Poll one last time to clear remaining events */
+    (void)reader;
+    (void)message;
 
-    NBN_Endpoint_Deinit(&__game_server.endpoint);
-    NBN_ConnectionVector_Destroy(__game_server.clients);
+    return NBN_ERROR;
+}
 
-    NBN_Driver_GServ_Stop();
+int NBN_RecordReader_Seek(NBN_RecordReader *reader, double time)
+{
+    (void)reader;
+    (void)time;
 
-    NBN_LogInfo("Stopped");
+    return NBN_ERROR;
 }
 
-void NBN_GameServer_RegisterMessage(
-        uint8_t msg_type,
-        NBN_MessageBuilder msg_builder,
-        NBN_MessageDestructor msg_destructor,
-        NBN_MessageSerializer msg_serializer)
+#else
+
+#define RECORD_ALIGN(size) (((size) + 7) & ~(uint64_t)7)
+
+static int Recorder_Reserve(NBN_Recorder *, uint64_t);
+static int RecordReader_ReadHeader(NBN_RecordReader *, NBN_RecordHeader *);
+static void RecordReader_DestroyLastMessage(NBN_RecordReader *);
+
+NBN_Recorder *NBN_Recorder_Create(const char *path)
 {
-    if (NBN_IsReservedMessage(msg_type))
+    NBN_Recorder *recorder = (NBN_Recorder *)NBN_Allocator(sizeof(NBN_Recorder));
+
+    if (Recorder_OpenFile(recorder, path) < 0)
     {
-        NBN_LogError("Message type %d is reserved by the library", msg_type);
-        NBN_Abort();
-    }
+        NBN_LogError("Failed to open recording file: %s", path);
+        NBN_Deallocator(recorder);
 
-    NBN_Endpoint_RegisterMessageBuilder(&__game_server.endpoint, msg_builder, msg_type);
-    NBN_Endpoint_RegisterMessageDestructor(&__game_server.endpoint, msg_destructor, msg_type);
-    NBN_Endpoint_RegisterMessageSerializer(&__game_server.endpoint, msg_serializer, msg_type);
-}
+        return NULL;
+    }
 
-void NBN_GameServer_RegisterChannel(uint8_t type, uint8_t id)
-{
-    if (id == NBN_CHANNEL_RESERVED_UNRELIABLE || id == NBN_CHANNEL_RESERVED_RELIABLE || id == NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES)
+    if (Recorder_MapFile(recorder, NBN_RECORDER_INITIAL_FILE_SIZE) < 0)
     {
-        NBN_LogError("Channel id %d is reserved by the library", type);
-        NBN_Abort();
+        NBN_LogError("Failed to map recording file: %s", path);
+        Recorder_CloseFile(recorder, 0);
+        NBN_Deallocator(recorder);
+
+        return NULL;
     }
 
-    NBN_Endpoint_RegisterChannel(&__game_server.endpoint, (NBN_ChannelType)type, id);
-}
+    recorder->data_size = sizeof(NBN_RecordFileHeader);
+    recorder->record_count = 0;
+    recorder->index_count = 0;
+    recorder->index_capacity = 64;
+    recorder->index = (NBN_RecordIndexEntry *)NBN_Allocator(sizeof(NBN_RecordIndexEntry) * recorder->index_capacity);
 
-void NBN_GameServer_AddTime(double time)
-{
-    for (unsigned int i = 0; i < __game_server.clients->count; i++)
-        NBN_Connection_AddTime(__game_server.clients->connections[i], time);
+    NBN_RecordFileHeader *header = (NBN_RecordFileHeader *)recorder->map;
 
-#if defined(NBN_DEBUG) && defined(NBN_USE_PACKET_SIMULATOR)
-    NBN_PacketSimulator_AddTime(&__game_server.endpoint.packet_simulator, time);
-#endif
+    header->magic = NBN_RECORD_FILE_MAGIC;
+    header->version = NBN_RECORD_FILE_VERSION;
+    header->data_size = recorder->data_size;
+    header->index_offset = 0;
+    header->record_count = 0;
+    header->index_count = 0;
+
+    return recorder;
 }
 
-int NBN_GameServer_Poll(void)
+int NBN_Recorder_Destroy(NBN_Recorder *recorder)
 {
-    if (NBN_EventQueue_IsEmpty(&__game_server.endpoint.event_queue))
+    uint64_t index_size = sizeof(NBN_RecordIndexEntry) * recorder->index_count;
+    uint64_t file_size = recorder->data_size;
+    int ret = 0;
+
+    if (Recorder_Reserve(recorder, index_size) < 0)
     {
-        if (GameServer_CloseStaleClientConnections() < 0)
-            return NBN_ERROR;
+        NBN_LogError("Failed to write the index of the recording file");
 
-        if (NBN_Driver_GServ_RecvPackets() < 0)
-            return NBN_ERROR;
+        ret = NBN_ERROR;
+    }
+    else
+    {
+        NBN_RecordFileHeader *header = (NBN_RecordFileHeader *)recorder->map;
 
-        __game_server.stats.download_bandwidth = 0;
+        memcpy(recorder->map + recorder->data_size, recorder->index, index_size);
 
-        for (unsigned int i = 0; i < __game_server.clients->count; i++)
-        {
-            NBN_Connection *client = __game_server.clients->connections[i];
+        header->index_offset = recorder->data_size;
+        header->index_count = recorder->index_count;
+        file_size += index_size;
+    }
 
-            for (unsigned int i = 0; i < NBN_MAX_CHANNELS; i++)
-            {
-                NBN_Channel *channel = client->channels[i];
+    if (recorder->map)
+        Recorder_UnmapFile(recorder);
 
-                if (channel)
-                {
-                    NBN_Message *msg;
+    Recorder_CloseFile(recorder, file_size);
 
-                    while ((msg = channel->GetNextRecvedMessage(channel)) != NULL)
-                    {
-                        if (GameServer_ProcessReceivedMessage(msg, client) < 0)
-                        {
-                            NBN_LogError("Failed to process received message");
+    NBN_Deallocator(recorder->index);
+    NBN_Deallocator(recorder);
 
-                            return NBN_ERROR;
-                        }
-                    }
-                }
-            }
+    return ret;
+}
 
-            if (!client->is_closed)
-                Connection_UpdateAverageDownloadBandwidth(client);
+int NBN_Recorder_RecordMessage(
+        NBN_Recorder *recorder,
+        double time,
+        uint32_t connection_id,
+        uint8_t channel_id,
+        uint8_t type,
+        void *data,
+        NBN_MessageSerializer msg_serializer,
+        NBN_RecordDirection direction)
+{
+    NBN_MeasureStream m_stream;
+
+    NBN_MeasureStream_Init(&m_stream);
+
+    if (msg_serializer(data, (NBN_Stream *)&m_stream) < 0)
+        return NBN_ERROR;
+
+    /* leave room for the last word flushed by the write stream */
+    unsigned int max_size = (m_stream.number_of_bits + 7) / 8 + WORD_BYTES;
 
-            __game_server.stats.download_bandwidth += client->stats.download_bandwidth;
-            client->last_read_packets_time = client->time;
-        }
+    if (Recorder_Reserve(recorder, sizeof(NBN_RecordHeader) + max_size) < 0)
+    {
+        NBN_LogError("Failed to grow recording file");
 
-        GameServer_RemoveClosedClientConnections();
+        return NBN_ERROR;
     }
 
+    uint8_t *record = recorder->map + recorder->data_size;
+    NBN_WriteStream w_stream;
 
-    while (true)
-    {
-        bool ret = NBN_EventQueue_Dequeue(&__game_server.endpoint.event_queue, &server_last_event);
+    NBN_WriteStream_Init(&w_stream, record + sizeof(NBN_RecordHeader), max_size);
 
-        if (!ret)
-            return NBN_NO_EVENT;
+    if (msg_serializer(data, (NBN_Stream *)&w_stream) < 0 || NBN_WriteStream_Flush(&w_stream) < 0)
+        return NBN_ERROR;
 
-        int ev = GameServer_HandleEvent();
+    NBN_RecordHeader record_header;
 
-        if (ev != NBN_SKIP_EVENT)
-            return ev;
-    }
-}
+    memset(&record_header, 0, sizeof(NBN_RecordHeader));
 
-int NBN_GameServer_SendPackets(void)
-{
-    __game_server.stats.upload_bandwidth = 0;
+    record_header.time = time;
+    record_header.connection_id = connection_id;
+    record_header.size = w_stream.bit_writer.byte_cursor;
+    record_header.type = type;
+    record_header.channel_id = channel_id;
+    record_header.direction = (uint8_t)direction;
 
-    for (unsigned int i = 0; i < __game_server.clients->count; i++)
+    memcpy(record, &record_header, sizeof(NBN_RecordHeader));
+
+    if (recorder->record_count % NBN_RECORDER_INDEX_INTERVAL == 0)
     {
-        NBN_Connection *client = __game_server.clients->connections[i];
+        if (recorder->index_count >= recorder->index_capacity)
+        {
+            recorder->index_capacity *= 2;
+            recorder->index = (NBN_RecordIndexEntry *)NBN_Reallocator(
+                    recorder->index, sizeof(NBN_RecordIndexEntry) * recorder->index_capacity);
+        }
 
-        if (!client->is_stale && NBN_Connection_FlushSendQueue(client) < 0)
-            return NBN_ERROR;
+        NBN_RecordIndexEntry entry = { time, recorder->data_size };
 
-        __game_server.stats.upload_bandwidth += client->stats.upload_bandwidth;
+        recorder->index[recorder->index_count++] = entry;
     }
 
+    recorder->data_size += RECORD_ALIGN(sizeof(NBN_RecordHeader) + record_header.size);
+    recorder->record_count++;
+
+    /* keep the header up to date so the records can be read if the recording is not stopped properly */
+    NBN_RecordFileHeader *header = (NBN_RecordFileHeader *)recorder->map;
+
+    header->data_size = recorder->data_size;
+    header->record_count = recorder->record_count;
+
     return 0;
 }
 
-void NBN_GameServer_SetContext(void *context)
+static int Recorder_Reserve(NBN_Recorder *recorder, uint64_t size)
 {
-    __game_server.context = context;
-}
+    if (recorder->map == NULL)
+        return NBN_ERROR; /* a previous remapping failed */
 
-void *NBN_GameServer_GetContext(void)
-{
-    return __game_server.context;
-}
+    uint64_t required_size = recorder->data_size + size;
 
-NBN_Connection *NBN_GameServer_CreateClientConnection(uint32_t id, void *driver_data)
-{
-    NBN_Connection *client = NBN_Endpoint_CreateConnection(&__game_server.endpoint, id, driver_data);
+    if (required_size <= recorder->map_size)
+        return 0;
 
-#ifdef NBN_DEBUG
-    client->OnMessageAddedToRecvQueue = __game_server.endpoint.OnMessageAddedToRecvQueue;
-#endif
+    uint64_t map_size = recorder->map_size;
 
-    return client;
-}
+    while (map_size < required_size)
+        map_size *= 2;
 
-int NBN_GameServer_CloseClientWithCode(NBN_Connection *client, int code)
-{ 
-    return GameServer_CloseClientWithCode(client, code, false);
-}
+    Recorder_UnmapFile(recorder);
 
-int NBN_GameServer_CloseClient(NBN_Connection *client)
-{
-    return GameServer_CloseClientWithCode(client, -1, false);
+    return Recorder_MapFile(recorder, map_size);
 }
 
-NBN_OutgoingMessage *NBN_GameServer_CreateMessage(uint8_t msg_type, void *msg_data)
+NBN_RecordReader *NBN_RecordReader_Open(const char *path, NBN_Endpoint *endpoint)
 {
-    return Endpoint_CreateOutgoingMessage(&__game_server.endpoint, msg_type, msg_data);
-}
+    NBN_RecordReader *reader = (NBN_RecordReader *)NBN_Allocator(sizeof(NBN_RecordReader));
 
-NBN_OutgoingMessage *NBN_GameServer_CreateByteArrayMessage(uint8_t *bytes, unsigned int length)
-{
-    if (length > NBN_BYTE_ARRAY_MAX_SIZE)
-    {
-        NBN_LogError("Byte array cannot exceed %d bytes", NBN_BYTE_ARRAY_MAX_SIZE);
+    memset(reader, 0, sizeof(NBN_RecordReader));
 
-        return NULL;
-    }
+    reader->endpoint = endpoint;
 
-    NBN_ByteArrayMessage *msg = NBN_ByteArrayMessage_Create();
+#ifdef _WIN32
+    reader->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
-    memcpy(msg->bytes, bytes, length);
+    LARGE_INTEGER file_size;
 
-    msg->length = length;
+    if (reader->file == INVALID_HANDLE_VALUE || !GetFileSizeEx(reader->file, &file_size))
+    {
+        NBN_LogError("Failed to open recording file: %s", path);
 
-    return NBN_GameServer_CreateMessage(NBN_BYTE_ARRAY_MESSAGE_TYPE, msg);
-}
+        if (reader->file != INVALID_HANDLE_VALUE)
+            CloseHandle(reader->file);
 
-int NBN_GameServer_SendMessageTo(NBN_Connection *client, NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
-{
-    /* The only message type we can send to an unaccepted client is a NBN_ClientAcceptedMessage message
-     * or a NBN_PublicCryptoInfoMessage */
-    assert(client->is_accepted ||
-            outgoing_msg->type == NBN_CLIENT_ACCEPTED_MESSAGE_TYPE || NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE);
+        NBN_Deallocator(reader);
 
-    if (Endpoint_EnqueueOutgoingMessage(&__game_server.endpoint, client, outgoing_msg, channel_id) < 0)
-    {
-        NBN_LogError("Failed to create outgoing message for client %d");
+        return NULL;
+    }
 
-        /* Do not close the client if we failed to send the close client message to avoid infinite loops */
-        if (outgoing_msg->type != NBN_CLIENT_CLOSED_MESSAGE_TYPE)
-        {
-            GameServer_CloseClientWithCode(client, -1, false);
+    reader->map_size = (uint64_t)file_size.QuadPart;
 
-            return NBN_ERROR;
-        }
+    if (reader->map_size >= sizeof(NBN_RecordFileHeader))
+    {
+        reader->mapping = CreateFileMappingA(reader->file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (reader->mapping)
+            reader->map = (uint8_t *)MapViewOfFile(reader->mapping, FILE_MAP_READ, 0, 0, 0);
     }
 
-    return 0;
-}
+    if (reader->map == NULL)
+    {
+        NBN_LogError("Failed to map recording file: %s", path);
 
-int NBN_GameServer_SendUnreliableMessageTo(NBN_Connection *client, NBN_OutgoingMessage *outgoing_msg)
-{
-    return NBN_GameServer_SendMessageTo(client, outgoing_msg, NBN_CHANNEL_RESERVED_UNRELIABLE);
-}
+        if (reader->mapping)
+            CloseHandle(reader->mapping);
 
-int NBN_GameServer_SendReliableMessageTo(NBN_Connection *client, NBN_OutgoingMessage *outgoing_msg)
-{
-    return NBN_GameServer_SendMessageTo(client, outgoing_msg, NBN_CHANNEL_RESERVED_RELIABLE);
-}
+        CloseHandle(reader->file);
+        NBN_Deallocator(reader);
 
-int NBN_GameServer_BroadcastMessage(NBN_OutgoingMessage *outgoing_msg, uint8_t channel_id)
-{
-    for (unsigned int i = 0; i < __game_server.clients->count; i++)
+        return NULL;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    off_t file_size = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+
+    if (file_size < (off_t)sizeof(NBN_RecordFileHeader))
     {
-        NBN_Connection *client = __game_server.clients->connections[i];
+        NBN_LogError("Failed to open recording file: %s", path);
 
-        if (!client->is_closed && !client->is_stale && client->is_accepted)
-        {
-            if (NBN_GameServer_SendMessageTo(client, outgoing_msg, channel_id) < 0)
-                return NBN_ERROR;
-        }
-    }
+        if (fd >= 0)
+            close(fd);
 
-    return 0;
-}
+        NBN_Deallocator(reader);
 
-int NBN_GameServer_BroadcastUnreliableMessage(NBN_OutgoingMessage *outgoing_msg)
-{
-    return NBN_GameServer_BroadcastMessage(outgoing_msg, NBN_CHANNEL_RESERVED_UNRELIABLE);
-}
+        return NULL;
+    }
 
-int NBN_GameServer_BroadcastReliableMessage(NBN_OutgoingMessage *outgoing_msg)
-{
-    return NBN_GameServer_BroadcastMessage(outgoing_msg, NBN_CHANNEL_RESERVED_RELIABLE);
-}
+    reader->map_size = (uint64_t)file_size;
 
-NBN_Stream *NBN_GameServer_GetConnectionAcceptDataWriteStream(NBN_Connection *client)
-{
-    return (NBN_Stream *)&client->accept_data_w_stream;
-}
+    void *map = mmap(NULL, (size_t)reader->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-int NBN_GameServer_AcceptIncomingConnection(void)
-{
-    assert(server_last_event.type == NBN_NEW_CONNECTION);
-    assert(server_last_event.data.connection != NULL);
+    close(fd); /* the mapping stays valid */
 
-    NBN_Connection *client = server_last_event.data.connection;
-    NBN_ClientAcceptedMessage *msg = NBN_ClientAcceptedMessage_Create();
+    if (map == MAP_FAILED)
+    {
+        NBN_LogError("Failed to map recording file: %s", path);
+        NBN_Deallocator(reader);
 
-    assert(msg != NULL);
+        return NULL;
+    }
 
-    NBN_WriteStream_Flush(&client->accept_data_w_stream);
+    reader->map = (uint8_t *)map;
+#endif /* _WIN32 */
 
-    memcpy(msg->data, client->accept_data, NBN_ACCEPT_DATA_MAX_SIZE);
+    NBN_RecordFileHeader header;
 
-    NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(NBN_CLIENT_ACCEPTED_MESSAGE_TYPE, msg);
+    memcpy(&header, reader->map, sizeof(NBN_RecordFileHeader));
 
-    if (outgoing_msg == NULL)
-        return NBN_ERROR;
+    if (header.magic != NBN_RECORD_FILE_MAGIC || header.version != NBN_RECORD_FILE_VERSION ||
+            header.data_size < sizeof(NBN_RecordFileHeader) || header.data_size > reader->map_size)
+    {
+        NBN_LogError("Invalid recording file: %s", path);
+        NBN_RecordReader_Close(reader);
 
-    if (NBN_GameServer_SendReliableMessageTo(client, outgoing_msg) < 0)
-        return NBN_ERROR;
+        return NULL;
+    }
 
-    client->is_accepted = true;
+    reader->data_size = header.data_size;
+    reader->cursor = sizeof(NBN_RecordFileHeader);
 
-    NBN_LogTrace("Client %d has been accepted", client->id);
+    if (header.index_offset >= header.data_size && header.index_offset <= reader->map_size &&
+            header.index_count <= (reader->map_size - header.index_offset) / sizeof(NBN_RecordIndexEntry))
+    {
+        reader->index = (NBN_RecordIndexEntry *)(reader->map + header.index_offset);
+        reader->index_count = header.index_count;
+    }
 
-    return 0;
+    return reader;
 }
 
-int NBN_GameServer_RejectIncomingConnectionWithCode(int code)
+void NBN_RecordReader_Close(NBN_RecordReader *reader)
 {
-    assert(server_last_event.type == NBN_NEW_CONNECTION);
-    assert(server_last_event.data.connection != NULL);
+    RecordReader_DestroyLastMessage(reader);
 
-    return GameServer_CloseClientWithCode(server_last_event.data.connection, code, false);
-}
+#ifdef _WIN32
+    UnmapViewOfFile(reader->map);
+    CloseHandle(reader->mapping);
+    CloseHandle(reader->file);
+#else
+    munmap(reader->map, (size_t)reader->map_size);
+#endif
 
-int NBN_GameServer_RejectIncomingConnection(void)
-{
-    return NBN_GameServer_RejectIncomingConnectionWithCode(-1);
+    NBN_Deallocator(reader);
 }
 
-NBN_Connection *NBN_GameServer_GetIncomingConnection(void)
+int NBN_RecordReader_Next(NBN_RecordReader *reader, NBN_RecordedMessage *message)
 {
-    assert(server_last_event.type == NBN_NEW_CONNECTION);
-    assert(server_last_event.data.connection != NULL);
+    RecordReader_DestroyLastMessage(reader);
 
-    return server_last_event.data.connection;
-}
+    NBN_RecordHeader record_header;
+    int ret = RecordReader_ReadHeader(reader, &record_header);
 
-uint8_t *NBN_GameServer_GetConnectionData(NBN_Connection *client)
-{
-    return client->connection_data;
-}
+    if (ret <= 0)
+        return ret;
 
-NBN_Connection *NBN_GameServer_GetDisconnectedClient(void)
-{
-    assert(server_last_event.type == NBN_CLIENT_DISCONNECTED);
+    NBN_MessageBuilder msg_builder = reader->endpoint->message_builders[record_header.type];
+    NBN_MessageSerializer msg_serializer = reader->endpoint->message_serializers[record_header.type];
 
-    return server_last_event.data.connection;
-}
+    if (msg_builder == NULL || msg_serializer == NULL)
+    {
+        NBN_LogError("No message builder or serializer is registered for messages of type %d", record_header.type);
 
-NBN_MessageInfo NBN_GameServer_GetMessageInfo(void)
-{
-    assert(server_last_event.type == NBN_CLIENT_MESSAGE_RECEIVED);
+        return NBN_ERROR;
+    }
 
-    return server_last_event.data.message_info;
-}
+    NBN_ReadStream r_stream;
 
-NBN_GameServerStats NBN_GameServer_GetStats(void)
-{
-    return __game_server.stats;
-}
+    NBN_ReadStream_Init(&r_stream, reader->map + reader->cursor + sizeof(NBN_RecordHeader), record_header.size);
 
-bool NBN_GameServer_IsEncryptionEnabled(void)
-{
-    return __game_server.endpoint.config.is_encryption_enabled;
-}
+    void *data = msg_builder();
 
-#ifdef NBN_DEBUG
+    reader->last_message_data = data;
+    reader->last_message_type = record_header.type;
 
-void NBN_GameServer_Debug_RegisterCallback(NBN_ConnectionDebugCallback cb_type, void *cb)
-{
-    switch (cb_type)
+    if (msg_serializer(data, (NBN_Stream *)&r_stream) < 0)
     {
-        case NBN_DEBUG_CB_MSG_ADDED_TO_RECV_QUEUE:
-            __game_server.endpoint.OnMessageAddedToRecvQueue = (void (*)(NBN_Connection *, NBN_Message *))cb;
-            break;
-    }
-}
-
-#endif /* NBN_DEBUG */
+        NBN_LogError("Failed to read recorded message of type %d", record_header.type);
 
-static int GameServer_AddClient(NBN_Connection *client)
-{
-    if (__game_server.clients->count >= NBN_MAX_CLIENTS)
         return NBN_ERROR;
+    }
 
-    if (NBN_ConnectionVector_Add(__game_server.clients, client) < 0)
-        return NBN_ERROR;
+    message->time = record_header.time;
+    message->connection_id = record_header.connection_id;
+    message->channel_id = record_header.channel_id;
+    message->type = record_header.type;
+    message->direction = (NBN_RecordDirection)record_header.direction;
+    message->data = data;
 
-    return 0;
+    reader->cursor += RECORD_ALIGN(sizeof(NBN_RecordHeader) + record_header.size);
+
+    return 1;
 }
 
-static int GameServer_CloseClientWithCode(NBN_Connection *client, int code, bool disconnection)
+int NBN_RecordReader_Seek(NBN_RecordReader *reader, double time)
 {
-    NBN_LogTrace("Closing connection %d", client->id);
+    RecordReader_DestroyLastMessage(reader);
 
-    if (!client->is_closed && client->is_accepted)
+    reader->cursor = sizeof(NBN_RecordFileHeader);
+
+    /* find the last indexed record before that time */
+    if (reader->index_count > 0)
     {
-        if (!disconnection)
+        unsigned int low = 0;
+        unsigned int high = reader->index_count;
+
+        while (low < high)
         {
-            NBN_Event e;
+            unsigned int mid = low + (high - low) / 2;
+            NBN_RecordIndexEntry entry;
 
-            e.type = NBN_CLIENT_DISCONNECTED;
-            e.data.connection = client;
+            memcpy(&entry, &reader->index[mid], sizeof(NBN_RecordIndexEntry));
 
-            if (!NBN_EventQueue_Enqueue(&__game_server.endpoint.event_queue, e))
-                return NBN_ERROR;
+            if (entry.time < time)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        if (low > 0)
+        {
+            NBN_RecordIndexEntry entry;
+
+            memcpy(&entry, &reader->index[low - 1], sizeof(NBN_RecordIndexEntry));
+
+            reader->cursor = entry.offset;
         }
     }
 
-    if (client->is_stale)
+    /* then skip the records before that time without deserializing them */
+    while (true)
     {
-        client->is_closed = true;
+        NBN_RecordHeader record_header;
+        int ret = RecordReader_ReadHeader(reader, &record_header);
 
-        return 0;
+        if (ret <= 0)
+            return ret;
+
+        if (record_header.time >= time)
+            return 0;
+
+        reader->cursor += RECORD_ALIGN(sizeof(NBN_RecordHeader) + record_header.size);
     }
+}
 
-    client->is_closed = true;
+/* Read the header of the record at the cursor, returns 0 at the end of the recording */
+static int RecordReader_ReadHeader(NBN_RecordReader *reader, NBN_RecordHeader *record_header)
+{
+    uint64_t cursor = reader->cursor;
 
-    if (!disconnection)
+    if (cursor == reader->data_size)
+        return 0;
+
+    /* the cursor may come from the index */
+    if (cursor < sizeof(NBN_RecordFileHeader) || cursor % 8 != 0 ||
+            cursor > reader->data_size || reader->data_size - cursor < sizeof(NBN_RecordHeader))
     {
-        NBN_LogDebug("Send close message for client %d (code: %d)", client->id, code);
+        NBN_LogError("Invalid record offset %llu", (unsigned long long)cursor);
 
-        NBN_ClientClosedMessage *msg = NBN_ClientClosedMessage_Create();
+        return NBN_ERROR;
+    }
 
-        msg->code = code;
+    memcpy(record_header, reader->map + cursor, sizeof(NBN_RecordHeader));
 
-        NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(NBN_CLIENT_CLOSED_MESSAGE_TYPE, msg);
+    if (RECORD_ALIGN(sizeof(NBN_RecordHeader) + (uint64_t)record_header->size) > reader->data_size - cursor)
+    {
+        NBN_LogError("Truncated record at offset %llu", (unsigned long long)cursor);
+
+        return NBN_ERROR;
+    }
 
-        if (outgoing_msg == NULL)
-            return NBN_ERROR;
+    if (record_header->channel_id >= NBN_MAX_CHANNELS || record_header->direction > NBN_RECORD_RECEIVED)
+    {
+        NBN_LogError("Invalid record at offset %llu", (unsigned long long)cursor);
 
-        NBN_GameServer_SendMessageTo(client, outgoing_msg, NBN_CHANNEL_RESERVED_LIBRARY_MESSAGES);
+        return NBN_ERROR;
     }
 
-    return 0;
+    return 1;
 }
 
-static unsigned int GameServer_GetClientCount(void)
+static void RecordReader_DestroyLastMessage(NBN_RecordReader *reader)
 {
-    return __game_server.clients->count;
+    if (reader->last_message_data == NULL)
+        return;
+
+    NBN_MessageDestructor msg_destructor = reader->endpoint->message_destructors[reader->last_message_type];
+
+    if (msg_destructor)
+        msg_destructor(reader->last_message_data);
+
+    reader->last_message_data = NULL;
 }
 
-static int GameServer_ProcessReceivedMessage(NBN_Message *message, NBN_Connection *client)
-{
-    NBN_Event ev;
+#endif /* __EMSCRIPTEN__ */
 
-    ev.type = NBN_CLIENT_MESSAGE_RECEIVED;
+#pragma endregion /* NBN_Recorder */
 
-    if (message->header.type == NBN_MESSAGE_CHUNK_TYPE)
-    {
-        NBN_Channel *channel = client->channels[message->header.channel_id];
+#pragma region Trace log
 
-        if (!NBN_Channel_AddChunk(channel, message))
-            return 0;
+#ifdef NBN_USE_TRACE_LOG
 
-        NBN_Message complete_message;
+#include <stdarg.h>
 
-        if (NBN_Channel_ReconstructMessageFromChunks(channel, client, &complete_message) < 0)
-        {
-            NBN_LogError("Failed to reconstruct message from chunks");
+#if defined(_MSC_VER) && !defined(__clang__)
 
-            return NBN_ERROR;
-        }
+#include <intrin.h>
 
-        NBN_MessageInfo msg_info = { complete_message.header.type, complete_message.data, client };
+/* volatile accesses have acquire/release semantics with MSVC */
+#define NBN_TRACE_LOG_FETCH_ADD(ptr) ((uint64_t)_InterlockedExchangeAdd64((volatile long long *)(ptr), 1))
+#define NBN_TRACE_LOG_LOAD(ptr) (*(volatile uint64_t *)(ptr))
+#define NBN_TRACE_LOG_STORE(ptr, v) (*(volatile uint64_t *)(ptr) = (v))
+#define NBN_TRACE_LOG_RELEASE_FENCE() MemoryBarrier()
+#define NBN_TRACE_LOG_ACQUIRE_FENCE() MemoryBarrier()
 
-        ev.data.message_info = msg_info;
-    }
-    else
-    {
-        NBN_MessageInfo msg_info = { message->header.type, message->data, client };
+#else
 
-        ev.data.message_info = msg_info;
-    }
+#define NBN_TRACE_LOG_FETCH_ADD(ptr) __atomic_fetch_add((ptr), 1, __ATOMIC_RELAXED)
+#define NBN_TRACE_LOG_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_ACQUIRE)
+#define NBN_TRACE_LOG_STORE(ptr, v) __atomic_store_n((ptr), (v), __ATOMIC_RELEASE)
+#define NBN_TRACE_LOG_RELEASE_FENCE() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define NBN_TRACE_LOG_ACQUIRE_FENCE() __atomic_thread_fence(__ATOMIC_ACQUIRE)
 
-    if (!NBN_EventQueue_Enqueue(&__game_server.endpoint.event_queue, ev))
-        return NBN_ERROR;
+#endif /* _MSC_VER */
 
-    return 0;
-}
+NBN_TraceLog __trace_log;
 
-static int GameServer_CloseStaleClientConnections(void)
+void NBN_TraceLog_Write(const char *format, ...)
 {
-    for (unsigned int i = 0; i < __game_server.clients->count; i++)
-    {
-        NBN_Connection *client = __game_server.clients->connections[i];
+    uint64_t index = NBN_TRACE_LOG_FETCH_ADD(&__trace_log.head);
+    NBN_TraceLogEntry *entry = &__trace_log.entries[index & (NBN_TRACE_LOG_SIZE - 1)];
+    int arg_count = 0;
+    va_list args;
 
-        if (!client->is_closed && !client->is_stale && NBN_Connection_CheckIfStale(client))
+    /* entries are not locked: a writer that laps another one on the same entry can mix their arguments */
+    NBN_TRACE_LOG_STORE(&entry->seq, 0);
+
+    /* readers must not see the new fields before the entry is marked as being written */
+    NBN_TRACE_LOG_RELEASE_FENCE();
+
+    entry->format = format;
+
+    va_start(args, format);
+
+    for (const char *c = strchr(format, '%'); c; c = strchr(c + 1, '%'))
+    {
+        if (c[1] == '%')
         {
-            NBN_LogInfo("Client %d connection is stale, closing it.", client->id);
+            c++;
+            continue;
+        }
 
-            client->is_stale = true;
+        c += 1 + strspn(c + 1, "-+ #.0123456789");
 
-            if (GameServer_CloseClientWithCode(client, -1, false) < 0)
-                return NBN_ERROR;
+        /* the type of the arguments of other conversions is unknown, they cannot be read */
+        if (*c == '\0' || !strchr("diuxXc", *c) || arg_count == NBN_TRACE_LOG_MAX_ARGS)
+        {
+            arg_count = -1;
+            break;
         }
+
+        entry->args[arg_count++] = va_arg(args, int);
     }
 
-    return 0;
+    va_end(args);
+
+    entry->arg_count = arg_count;
+
+    NBN_TRACE_LOG_STORE(&entry->seq, index + 1);
 }
 
-static void GameServer_RemoveClosedClientConnections(void)
+unsigned int NBN_TraceLog_Dump(FILE *file)
 {
-    unsigned int count = __game_server.clients->count;
+    uint64_t head = NBN_TRACE_LOG_LOAD(&__trace_log.head);
+    uint64_t first = head > NBN_TRACE_LOG_SIZE ? head - NBN_TRACE_LOG_SIZE : 0;
+    unsigned int count = 0;
 
-    for (unsigned int i = 0; i < count; i++)
+    for (uint64_t i = first; i < head; i++)
     {
-        NBN_Connection *client = __game_server.clients->connections[i];
+        NBN_TraceLogEntry *slot = &__trace_log.entries[i & (NBN_TRACE_LOG_SIZE - 1)];
 
-        if (client && client->is_closed && client->is_stale)
-        {
-            NBN_LogDebug("Remove closed client connection (ID: %d)", client->id);
+        if (NBN_TRACE_LOG_LOAD(&slot->seq) != i + 1)
+            continue;
 
-            NBN_Driver_GServ_RemoveClientConnection(client);
-            NBN_ConnectionVector_Remove(__game_server.clients, client); // actually destroying the connection should be done in user code
+        NBN_TraceLogEntry entry = *slot;
+
+        /* the copy must be complete before checking that the entry has not been overwritten in the meantime */
+        NBN_TRACE_LOG_ACQUIRE_FENCE();
+
+        if (NBN_TRACE_LOG_LOAD(&slot->seq) != i + 1)
+            continue;
+
+        fprintf(file, "[%llu] ", (unsigned long long)i);
+
+        if (entry.arg_count < 0)
+        {
+            fprintf(file, "(unsupported format) %s", entry.format);
+        }
+        else
+        {
+            /* unused arguments are ignored by fprintf */
+            fprintf(file, entry.format, entry.args[0], entry.args[1], entry.args[2],
+                    entry.args[3], entry.args[4], entry.args[5]);
         }
-    }
-}
 
-static int GameServer_HandleEvent(void)
-{
-    switch (server_last_event.type)
-    {
-        case NBN_CLIENT_MESSAGE_RECEIVED:
-            return GameServer_HandleMessageReceivedEvent();
+        fputc('\n', file);
 
-        default:
-            break;
+        count++;
     }
 
-    return server_last_event.type;
+    return count;
 }
 
-static int GameServer_HandleMessageReceivedEvent(void)
-{
-    NBN_MessageInfo message_info = server_last_event.data.message_info;
+#endif /* NBN_USE_TRACE_LOG */
 
-    // skip all events related to a closed or stale connection
-    if (message_info.sender->is_closed || message_info.sender->is_stale)
-        return NBN_SKIP_EVENT;
+#pragma endregion /* Trace log */
 
-    if (message_info.type == NBN_DISCONNECTION_MESSAGE_TYPE)
-    {
-        NBN_Connection *cli = server_last_event.data.message_info.sender;
+#pragma region Clock
 
-        NBN_LogInfo("Received disconnection message from client %d", cli->id);
+#if defined(_WIN32)
 
-        if (GameServer_CloseClientWithCode(cli, -1, true) < 0)
-            return NBN_ERROR;
+double NBN_Clock_GetTime(void)
+{
+    static LARGE_INTEGER frequency = { 0 };
+    LARGE_INTEGER counter;
 
-        cli->is_stale = true;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
 
-        GameServer_RemoveClosedClientConnections();
+    QueryPerformanceCounter(&counter);
 
-        server_last_event.type = NBN_CLIENT_DISCONNECTED;
-        server_last_event.data.connection = cli;
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
 
-        return NBN_CLIENT_DISCONNECTED;
-    }
+#elif defined(__EMSCRIPTEN__)
 
-    int ret = NBN_CLIENT_MESSAGE_RECEIVED;
- 
-    if (NBN_GameServer_IsEncryptionEnabled() && message_info.type == NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE)
-    {
-        ret = NBN_NO_EVENT;
+#include <emscripten.h>
 
-        NBN_PublicCryptoInfoMessage *pub_crypto_msg = (NBN_PublicCryptoInfoMessage*)message_info.data;
+double NBN_Clock_GetTime(void)
+{
+    return emscripten_get_now() / 1000.0;
+}
 
-        if (Connection_BuildSharedKey(&message_info.sender->keys1, pub_crypto_msg->pub_key1) < 0)
-        {
-            NBN_LogError("Failed to build shared key (first key)");
-            NBN_Abort();
-        }
+#else
 
-        if (Connection_BuildSharedKey(&message_info.sender->keys2, pub_crypto_msg->pub_key2) < 0)
-        {
-            NBN_LogError("Failed to build shared key (second key)");
-            NBN_Abort();
-        }
+#include <time.h>
 
-        if (Connection_BuildSharedKey(&message_info.sender->keys3, pub_crypto_msg->pub_key3) < 0)
-        {
-            NBN_LogError("Failed to build shared key (third key)");
-            NBN_Abort();
-        }
+double NBN_Clock_GetTime(void)
+{
+    struct timespec ts;
 
-        NBN_LogDebug("Received public crypto info of client %d", message_info.sender->id);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-        if (GameServer_StartEncryption(message_info.sender))
-        {
-            NBN_LogError("Failed to start encryption of client %d", message_info.sender->id);
-            NBN_Abort();
-        }
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
 
-        message_info.sender->can_decrypt = true; 
-    }
-    else if (message_info.type == NBN_CONNECTION_REQUEST_MESSAGE_TYPE)
-    {
-        ret = NBN_NO_EVENT;
+#endif /* _WIN32 */
 
-        NBN_ConnectionRequestMessage *msg = (NBN_ConnectionRequestMessage *)message_info.data;
+#pragma endregion /* Clock */
 
-        memcpy(message_info.sender->connection_data, msg->data, NBN_CONNECTION_DATA_MAX_SIZE);
+#pragma region NBN_TickDriver
 
-        NBN_Event e;
+static void TickDriver_WaitUntil(double);
+static void TickDriver_Sleep(double);
+static void TickDriver_HandleOverrun(NBN_TickDriver *, double);
+static void TickDriver_UpdateStats(NBN_TickDriver *, double, double);
 
-        e.type = NBN_NEW_CONNECTION;
-        e.data.connection = message_info.sender;
+NBN_TickDriver *NBN_TickDriver_Create(double tick_rate, NBN_TickOverrunPolicy overrun_policy)
+{
+    assert(tick_rate > 0);
 
-        if (!NBN_EventQueue_Enqueue(&__game_server.endpoint.event_queue, e))
-            return NBN_ERROR;
-    }
+    NBN_TickDriver *driver = (NBN_TickDriver *)NBN_Allocator(sizeof(NBN_TickDriver));
 
-    return ret;
-}
+    memset(driver, 0, sizeof(NBN_TickDriver));
 
-#pragma endregion /* NBN_GameServer */
+    driver->tick_dt = 1.0 / tick_rate;
+    driver->overrun_policy = overrun_policy;
 
-#pragma region Game server driver
+    return driver;
+}
 
-static int Driver_GServ_OnClientConnected(NBN_Connection *);
-static int Driver_GServ_OnClientPacketReceived(NBN_Packet *);
+void NBN_TickDriver_Destroy(NBN_TickDriver *driver)
+{
+    NBN_Deallocator(driver);
+}
 
-int NBN_Driver_GServ_RaiseEvent(NBN_Driver_GServ_EventType ev, void *data)
+int NBN_TickDriver_Run(NBN_TickDriver *driver, NBN_TickCallback tick_callback, void *user_data)
 {
-    switch (ev)
+    driver->is_running = true;
+    driver->next_tick_time = NBN_Clock_GetTime();
+
+    while (driver->is_running)
     {
-        case NBN_DRIVER_GSERV_CLIENT_CONNECTED:
-            return Driver_GServ_OnClientConnected((NBN_Connection*)data);
+        TickDriver_WaitUntil(driver->next_tick_time);
 
-        case NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED:
-            return Driver_GServ_OnClientPacketReceived((NBN_Packet*)data);
-    }
+        double start_time = NBN_Clock_GetTime();
+        double lateness = start_time - driver->next_tick_time;
 
-    return 0;
-}
+        if (lateness >= driver->tick_dt)
+        {
+            TickDriver_HandleOverrun(driver, start_time);
 
-static int Driver_GServ_OnClientConnected(NBN_Connection *client)
-{
-    if (GameServer_AddClient(client) < 0)
-    {
-        NBN_LogError("Failed to add client");
+            lateness = start_time - driver->next_tick_time;
+        }
 
-        return NBN_ERROR;
-    }
+        int ret = tick_callback(driver->tick, driver->tick_dt, user_data);
 
-    if (NBN_GameServer_IsEncryptionEnabled())
-    {
-        if (GameServer_SendCryptoPublicInfoTo(client) < 0)
+        double end_time = NBN_Clock_GetTime();
+
+        driver->tick++;
+        driver->next_tick_time += driver->tick_dt;
+
+        TickDriver_UpdateStats(driver, end_time - start_time, lateness);
+
+        if (end_time > driver->next_tick_time)
+            driver->stats.overrun_count++;
+
+        if (ret != 0)
         {
-            NBN_LogError("Failed to send public key to client %d", client->id);
-            NBN_Abort();
+            driver->is_running = false;
+
+            return ret < 0 ? NBN_ERROR : ret;
         }
     }
 
     return 0;
 }
 
-static int Driver_GServ_OnClientPacketReceived(NBN_Packet *packet)
+void NBN_TickDriver_Stop(NBN_TickDriver *driver)
 {
-    if (Endpoint_ProcessReceivedPacket(&__game_server.endpoint, packet, packet->sender) < 0)
-    {
-        NBN_LogError("An error occured while processing packet from client %d, closing the client", packet->sender->id);
-
-        return GameServer_CloseClientWithCode(packet->sender, -1, false);
-    }
-
-    return 0;
+    driver->is_running = false;
 }
 
-static int GameServer_SendCryptoPublicInfoTo(NBN_Connection *client)
+NBN_TickStats NBN_TickDriver_GetStats(NBN_TickDriver *driver)
 {
-    NBN_PublicCryptoInfoMessage *msg = NBN_PublicCryptoInfoMessage_Create();
+    return driver->stats;
+}
 
-    memcpy(msg->pub_key1, client->keys1.pub_key, ECC_PUB_KEY_SIZE);
-    memcpy(msg->pub_key2, client->keys2.pub_key, ECC_PUB_KEY_SIZE);
-    memcpy(msg->pub_key3, client->keys3.pub_key, ECC_PUB_KEY_SIZE);
-    memcpy(msg->aes_iv, client->aes_iv, AES_BLOCKLEN);
+static void TickDriver_WaitUntil(double time)
+{
+    double remaining = time - NBN_Clock_GetTime();
 
-    NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(NBN_PUBLIC_CRYPTO_INFO_MESSAGE_TYPE, msg);
+    /* coarse sleep first, then spin for the last moments */
+    if (remaining > NBN_TICK_DRIVER_SPIN_TIME)
+        TickDriver_Sleep(remaining - NBN_TICK_DRIVER_SPIN_TIME);
 
-    if (outgoing_msg == NULL)
-        return NBN_ERROR;
+    while (NBN_Clock_GetTime() < time) {}
+}
 
-    if (NBN_GameServer_SendReliableMessageTo(client, outgoing_msg) < 0)
-        return NBN_ERROR;
+static void TickDriver_Sleep(double duration)
+{
+#if defined(_WIN32)
+    Sleep((DWORD)(duration * 1000));
+#elif defined(__EMSCRIPTEN__)
+    emscripten_sleep((unsigned int)(duration * 1000));
+#else
+    struct timespec ts;
 
-    NBN_LogDebug("Sent server's public key to the client %d", client->id);
+    ts.tv_sec = (time_t)duration;
+    ts.tv_nsec = (long)((duration - ts.tv_sec) * 1e9);
 
-    return 0;
+    nanosleep(&ts, NULL);
+#endif
 }
 
-static int GameServer_StartEncryption(NBN_Connection *client)
+static void TickDriver_HandleOverrun(NBN_TickDriver *driver, double time)
 {
-    Connection_StartEncryption(client);
+    /* number of ticks that should have already started */
+    unsigned int late_ticks = (unsigned int)((time - driver->next_tick_time) / driver->tick_dt);
+    unsigned int skipped_ticks = late_ticks;
 
-    NBN_OutgoingMessage *outgoing_msg = NBN_GameServer_CreateMessage(
-            NBN_START_ENCRYPT_MESSAGE_TYPE, NBN_StartEncryptMessage_Create());
+    if (driver->overrun_policy == NBN_TICK_OVERRUN_CATCH_UP)
+        skipped_ticks = late_ticks > NBN_TICK_DRIVER_MAX_CATCH_UP_TICKS ? late_ticks - NBN_TICK_DRIVER_MAX_CATCH_UP_TICKS : 0;
 
-    if (outgoing_msg == NULL)
-        return NBN_ERROR;
+    driver->stats.skipped_tick_count += skipped_ticks;
 
-    if (NBN_GameServer_SendReliableMessageTo(client, outgoing_msg) < 0)
-        return NBN_ERROR;
+    if (driver->overrun_policy == NBN_TICK_OVERRUN_RESET)
+        driver->next_tick_time = time;
+    else
+        driver->next_tick_time += skipped_ticks * driver->tick_dt;
+}
 
-    return 0;
+static void TickDriver_UpdateStats(NBN_TickDriver *driver, double duration, double lateness)
+{
+    NBN_TickStats *stats = &driver->stats;
+    unsigned int count = ++stats->tick_count;
+
+    stats->min_tick_duration = count == 1 ? duration : MIN(stats->min_tick_duration, duration);
+    stats->max_tick_duration = MAX(stats->max_tick_duration, duration);
+    stats->avg_tick_duration += (duration - stats->avg_tick_duration) / count;
+    stats->max_lateness = MAX(stats->max_lateness, lateness);
+    stats->avg_lateness += (lateness - stats->avg_lateness) / count;
 }
 
-#pragma endregion /* Game server driver */
+#pragma endregion /* NBN_TickDriver */
 
 #pragma region Packet simulator
 
@@ -5699,6 +13470,24 @@ void NBN_PacketSimulator_AddTime(NBN_PacketSimulator *packet_simulator, double t
     packet_simulator->time += time;
 }
 
+void NBN_PacketSimulator_Lock(NBN_PacketSimulator *packet_simulator)
+{
+#ifdef NBNET_WINDOWS
+    WaitForSingleObject(packet_simulator->queue_mutex, INFINITE);
+#else
+    pthread_mutex_lock(&packet_simulator->queue_mutex);
+#endif
+}
+
+void NBN_PacketSimulator_Unlock(NBN_PacketSimulator *packet_simulator)
+{
+#ifdef NBNET_WINDOWS
+    ReleaseMutex(packet_simulator->queue_mutex);
+#else
+    pthread_mutex_unlock(&packet_simulator->queue_mutex);
+#endif
+}
+
 #ifdef NBNET_WINDOWS
 DWORD WINAPI PacketSimulator_Routine(LPVOID arg)
 #else
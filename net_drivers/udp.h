@@ -320,6 +320,7 @@ static char err_msg[32];
 static int InitSocket(void);
 static void DeinitSocket(void);
 static int BindSocket(uint16_t);
+static int RecvPacket(uint8_t *, SOCKADDR_IN *, double *);
 static char *GetLastErrorMessage(void);
 
 static int InitSocket(void)
@@ -358,6 +359,14 @@ static int InitSocket(void)
     }
 #endif
 
+#ifdef SO_TIMESTAMPNS
+    int timestamps = 1;
+
+    /* not fatal, packets are then timestamped when nbnet reads them */
+    if (setsockopt(udp_sock, SOL_SOCKET, SO_TIMESTAMPNS, &timestamps, sizeof(timestamps)) < 0)
+        NBN_LogDebug("setsockopt() failed to enable packet timestamps: %s", GetLastErrorMessage());
+#endif
+
     return 0;
 }
 
@@ -417,6 +426,58 @@ static int ResolveIpAddress(const char *host, uint16_t port, NBN_IPAddress *addr
     return 0;
 }
 
+/* Read the next datagram and the clock time it was received at (negative when it's not available) */
+static int RecvPacket(uint8_t *buffer, SOCKADDR_IN *src_addr, double *recv_time)
+{
+    *recv_time = -1;
+
+#ifdef SO_TIMESTAMPNS
+    struct iovec iov;
+    struct msghdr msg;
+    uint8_t control[CMSG_SPACE(sizeof(struct timespec))];
+
+    iov.iov_base = buffer;
+    iov.iov_len = NBN_PACKET_MAX_SIZE;
+
+    memset(&msg, 0, sizeof(msg));
+
+    msg.msg_name = src_addr;
+    msg.msg_namelen = sizeof(*src_addr);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int bytes = recvmsg(udp_sock, &msg, 0);
+
+    if (bytes <= 0)
+        return bytes;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec timestamp;
+            struct timespec now;
+
+            memcpy(&timestamp, CMSG_DATA(cmsg), sizeof(timestamp));
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            /* the kernel timestamp is a wall clock time, convert it to the monotonic clock of nbnet */
+            double age = (now.tv_sec - timestamp.tv_sec) + (now.tv_nsec - timestamp.tv_nsec) / 1e9;
+
+            *recv_time = NBN_Clock_GetTime() - MAX(age, 0);
+        }
+    }
+
+    return bytes;
+#else
+    socklen_t src_addr_len = sizeof(*src_addr);
+
+    return recvfrom(udp_sock, (char *)buffer, NBN_PACKET_MAX_SIZE, 0, (SOCKADDR *)src_addr, &src_addr_len);
+#endif /* SO_TIMESTAMPNS */
+}
+
 static char *GetLastErrorMessage(void)
 {
 #ifdef PLATFORM_WINDOWS
@@ -430,6 +491,90 @@ static char *GetLastErrorMessage(void)
 
 #pragma endregion /* Socket functions */
 
+#pragma region Packet capture
+
+/*
+    The datagrams received by the driver can be written to a capture file, to benchmark the receive path
+    offline with real traffic (see bench/replay.c).
+
+    The file starts with NBN_UDP_CAPTURE_MAGIC followed by a record for every received datagram, before it is
+    checked in any way: a NBN_UDPCaptureRecord and the datagram bytes. Values are stored in the byte order of
+    the capturing machine.
+*/
+
+#define NBN_UDP_CAPTURE_MAGIC 0x4E425543 /* NBUC */
+#define NBN_UDP_CAPTURE_BUFFER_SIZE (1 << 20)
+
+typedef struct
+{
+    double time; /* Clock time the datagram was received at (see NBN_Clock_GetTime) */
+    uint32_t host; /* Source address */
+    uint16_t port; /* Source port */
+    uint16_t size; /* Size of the datagram */
+} NBN_UDPCaptureRecord;
+
+static FILE *capture_file = NULL;
+
+int NBN_UDP_StartCapture(const char *);
+void NBN_UDP_StopCapture(void);
+static void CapturePacket(uint8_t *, unsigned int, NBN_IPAddress, double);
+
+/* Start writing the received datagrams to a capture file, an existing file is overwritten */
+int NBN_UDP_StartCapture(const char *path)
+{
+    if (capture_file)
+        NBN_UDP_StopCapture();
+
+    if ((capture_file = fopen(path, "wb")) == NULL)
+    {
+        NBN_LogError("Failed to open capture file %s: %s", path, strerror(errno));
+
+        return -1;
+    }
+
+    /* datagrams are written by large blocks to keep the capture cheap */
+    setvbuf(capture_file, NULL, _IOFBF, NBN_UDP_CAPTURE_BUFFER_SIZE);
+
+    uint32_t magic = NBN_UDP_CAPTURE_MAGIC;
+
+    fwrite(&magic, sizeof(magic), 1, capture_file);
+
+    NBN_LogInfo("Started capturing packets to %s", path);
+
+    return 0;
+}
+
+void NBN_UDP_StopCapture(void)
+{
+    if (capture_file == NULL)
+        return;
+
+    fclose(capture_file);
+
+    capture_file = NULL;
+
+    NBN_LogInfo("Stopped capturing packets");
+}
+
+static void CapturePacket(uint8_t *buffer, unsigned int size, NBN_IPAddress address, double recv_time)
+{
+    NBN_UDPCaptureRecord record;
+
+    record.time = recv_time >= 0 ? recv_time : NBN_Clock_GetTime();
+    record.host = address.host;
+    record.port = address.port;
+    record.size = (uint16_t)size;
+
+    if (fwrite(&record, sizeof(record), 1, capture_file) != 1 || fwrite(buffer, size, 1, capture_file) != 1)
+    {
+        NBN_LogError("Failed to write to capture file: %s", strerror(errno));
+
+        NBN_UDP_StopCapture();
+    }
+}
+
+#pragma endregion /* Packet capture */
+
 #pragma region Game server
 
 static HTable *__clients = NULL;
@@ -453,6 +598,7 @@ int NBN_Driver_GServ_Start(uint32_t proto_id, uint16_t port)
 
 void NBN_Driver_GServ_Stop(void)
 {
+    NBN_UDP_StopCapture();
     HTable_Destroy(__clients);
     DeinitSocket();
 }
@@ -461,12 +607,12 @@ int NBN_Driver_GServ_RecvPackets(void)
 {
     uint8_t buffer[NBN_PACKET_MAX_SIZE] = {0};
     SOCKADDR_IN src_addr;
-    socklen_t src_addr_len = sizeof(src_addr);
     NBN_IPAddress ip_address;
+    double recv_time;
 
     while (true)
     {
-        int bytes = recvfrom(udp_sock, (char *)buffer, sizeof(buffer), 0, (SOCKADDR *)&src_addr, &src_addr_len);
+        int bytes = RecvPacket(buffer, &src_addr, &recv_time);
 
         if (bytes <= 0)
             break;
@@ -474,6 +620,9 @@ int NBN_Driver_GServ_RecvPackets(void)
         ip_address.host = ntohl(src_addr.sin_addr.s_addr);
         ip_address.port = ntohs(src_addr.sin_port);
 
+        if (capture_file)
+            CapturePacket(buffer, bytes, ip_address, recv_time);
+
         if (NBN_Packet_ReadProtocolId(buffer, bytes) != protocol_id)
             continue; /* not matching the protocol of the receiver */ 
 
@@ -487,6 +636,8 @@ int NBN_Driver_GServ_RecvPackets(void)
         if (NBN_Packet_InitRead(&packet, conn, buffer, bytes) < 0)
             continue; /* not a valid packet */
 
+        packet.recv_time = recv_time;
+
         if (NBN_Driver_GServ_RaiseEvent(NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED, &packet) < 0)
         {
             NBN_LogError("Failed to raise game server event");
@@ -549,6 +700,13 @@ static NBN_Connection *FindOrCreateClientConnectionByAddress(NBN_IPAddress addre
         udp_conn->address = address;
         udp_conn->conn = NBN_GameServer_CreateClientConnection(udp_conn->id, udp_conn);
 
+        if (udp_conn->conn == NULL)
+        {
+            NBN_Deallocator(udp_conn);
+
+            return NULL;
+        }
+
         HTable_Add(__clients, address, udp_conn);
 
         NBN_LogDebug("New UDP connection (id: %d)", udp_conn->id);
@@ -599,11 +757,15 @@ int NBN_Driver_GCli_Start(uint32_t proto_id, const char *host, uint16_t port)
 
     server_connection = NBN_GameClient_CreateServerConnection(udp_conn);
 
+    if (server_connection == NULL)
+        return -1;
+
     return 0;
 }
 
 void NBN_Driver_GCli_Stop(void)
 {
+    NBN_UDP_StopCapture();
     DeinitSocket();
 }
 
@@ -612,11 +774,11 @@ int NBN_Driver_GCli_RecvPackets(void)
     NBN_UDPConnection *udp_conn = (NBN_UDPConnection*)server_connection->driver_data;
     uint8_t buffer[NBN_PACKET_MAX_SIZE] = {0};
     SOCKADDR_IN src_addr;
-    socklen_t src_addr_len = sizeof(src_addr);
+    double recv_time;
 
     while (true)
     {
-        int bytes = recvfrom(udp_sock, (char *)buffer, sizeof(buffer), 0, (SOCKADDR *)&src_addr, &src_addr_len);
+        int bytes = RecvPacket(buffer, &src_addr, &recv_time);
 
         if (bytes <= 0)
             break;
@@ -626,6 +788,9 @@ int NBN_Driver_GCli_RecvPackets(void)
         ip_address.host = ntohl(src_addr.sin_addr.s_addr);
         ip_address.port = ntohs(src_addr.sin_port);
 
+        if (capture_file)
+            CapturePacket(buffer, bytes, ip_address, recv_time);
+
         /* make sure the received packet is from the server */
         if (ip_address.host != udp_conn->address.host || ip_address.port != udp_conn->address.port)
             continue;
@@ -638,6 +803,8 @@ int NBN_Driver_GCli_RecvPackets(void)
         if (NBN_Packet_InitRead(&packet, server_connection, buffer, bytes) < 0)
             continue; /* not a valid packet */ 
 
+        packet.recv_time = recv_time;
+
         /* First received packet from server triggers the client connected event */
         if (!is_connected_to_server)
         {
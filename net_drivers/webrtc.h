@@ -28,10 +28,22 @@ freely, subject to the following restrictions:
     How to use:
 
         Include this header *once* after the nbnet header in the same file where you defined the NBNET_IMPL macro.
+
+        The packets of a tick are batched and handed to JS at once, NBN_DRIVER_HAS_FLUSH has to be defined before
+        including the nbnet header so that nbnet flushes them.
+
+        Define NBN_WEBRTC_RELIABLE_CHANNEL (on both the client and the server) to open a second, reliable and ordered,
+        data channel: packets only made of reliable messages (large chunked messages, handshakes, ...) are sent
+        through it and rely on SCTP reliability instead of being resent by nbnet. Unreliable traffic stays on the
+        unreliable data channel, as do all packets while the reliable data channel of the peer is not open.
 */
 
 #ifdef NBNET_IMPL
 
+#ifndef NBN_DRIVER_HAS_FLUSH
+#error "The WebRTC driver batches packets, define NBN_DRIVER_HAS_FLUSH before including nbnet.h"
+#endif
+
 #if !defined(EXTERN_C)
     #if defined(__cplusplus)
         #define NBN_EXTERN extern "C"
@@ -259,20 +271,187 @@ static void HTable_Grow(HTable *htable)
 
 #pragma endregion // Hashtable
 
+#pragma region Packet ring
+
+/*
+    Received packets are written by the JS layer straight into a ring buffer allocated in the WASM heap, the
+    driver drains it once per poll without calling into JS.
+
+    head and tail are free running byte counters (the ring size is a power of two), the JS layer writes packets
+    at head and the driver reads them from tail. A packet is stored as its length, the id of the peer it was
+    received from and its bytes padded to 4 bytes. A packet that does not fit before the end of the ring is
+    written at its start, after a NBN_WEBRTC_RING_WRAP marker.
+
+    Packets received while the ring is full are dropped, like by a full socket buffer.
+*/
+
+#ifndef NBN_WEBRTC_RECV_RING_SIZE
+#define NBN_WEBRTC_RECV_RING_SIZE (1 << 18)
+#endif
+
+#define NBN_WEBRTC_RING_WRAP 0xFFFFFFFF
+#define NBN_WEBRTC_RING_ENTRY_SIZE(len) (8 + (((len) + 3) & ~3))
+
+typedef struct
+{
+    uint32_t head; /* Written by the JS layer */
+    uint32_t tail; /* Written by the driver */
+    uint32_t size;
+    uint32_t dropped_count; /* Number of packets dropped because the ring was full */
+} NBN_PacketRing; /* followed by the ring data */
+
+static NBN_PacketRing *PacketRing_Create(unsigned int);
+static void PacketRing_Destroy(NBN_PacketRing *);
+static uint8_t *PacketRing_Peek(NBN_PacketRing *, uint32_t *, unsigned int *);
+static void PacketRing_Pop(NBN_PacketRing *, unsigned int);
+
+static NBN_PacketRing *PacketRing_Create(unsigned int size)
+{
+    assert((size & (size - 1)) == 0); /* has to be a power of two */
+
+    NBN_PacketRing *ring = (NBN_PacketRing *)NBN_Allocator(sizeof(NBN_PacketRing) + size);
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->size = size;
+    ring->dropped_count = 0;
+
+    return ring;
+}
+
+static void PacketRing_Destroy(NBN_PacketRing *ring)
+{
+    NBN_Deallocator(ring);
+}
+
+/* Return the next packet of the ring (NULL when the ring is empty), it stays in the ring until it's popped */
+static uint8_t *PacketRing_Peek(NBN_PacketRing *ring, uint32_t *peer_id, unsigned int *len)
+{
+    uint8_t *data = (uint8_t *)(ring + 1);
+
+    while (true)
+    {
+        uint32_t tail = ring->tail;
+
+        if (tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE))
+            return NULL;
+
+        uint32_t offset = tail & (ring->size - 1);
+        uint32_t *entry = (uint32_t *)(data + offset);
+
+        if (entry[0] == NBN_WEBRTC_RING_WRAP)
+        {
+            __atomic_store_n(&ring->tail, tail + (ring->size - offset), __ATOMIC_RELEASE);
+
+            continue;
+        }
+
+        *len = entry[0];
+        *peer_id = entry[1];
+
+        return (uint8_t *)(entry + 2);
+    }
+}
+
+static void PacketRing_Pop(NBN_PacketRing *ring, unsigned int len)
+{
+    __atomic_store_n(&ring->tail, ring->tail + NBN_WEBRTC_RING_ENTRY_SIZE(len), __ATOMIC_RELEASE);
+}
+
+#pragma endregion /* Packet ring */
+
+#pragma region Send batch
+
+/*
+    Packets sent during a tick are appended to a batch allocated in the WASM heap, using the same layout as the
+    entries of NBN_PacketRing, and handed to the JS layer in a single call when the driver is flushed (once per
+    NBN_GameServer_SendPackets or NBN_GameClient_SendPackets). The JS layer sends every packet from a view of the
+    heap and the batch is reused for the next tick.
+*/
+
+#ifndef NBN_WEBRTC_SEND_BATCH_SIZE
+#define NBN_WEBRTC_SEND_BATCH_SIZE (1 << 16)
+#endif
+
+/* Set in the length of a batched packet to be sent through the reliable data channel */
+#define NBN_WEBRTC_RELIABLE_PACKET_FLAG 0x80000000
+
+#ifdef NBN_WEBRTC_RELIABLE_CHANNEL
+#define NBN_WEBRTC_USE_RELIABLE_CHANNEL true
+#else
+#define NBN_WEBRTC_USE_RELIABLE_CHANNEL false
+#endif
+
+typedef struct
+{
+    uint8_t *data;
+    unsigned int length;
+} NBN_PacketBatch;
+
+static void PacketBatch_Init(NBN_PacketBatch *);
+static void PacketBatch_Deinit(NBN_PacketBatch *);
+static bool PacketBatch_Add(NBN_PacketBatch *, NBN_Packet *, uint32_t, bool);
+static bool PacketBatch_IsReliable(NBN_Packet *);
+
+static void PacketBatch_Init(NBN_PacketBatch *batch)
+{
+    batch->data = (uint8_t *)NBN_Allocator(NBN_WEBRTC_SEND_BATCH_SIZE);
+    batch->length = 0;
+}
+
+static void PacketBatch_Deinit(NBN_PacketBatch *batch)
+{
+    NBN_Deallocator(batch->data);
+
+    batch->data = NULL;
+    batch->length = 0;
+}
+
+/* Return false when the batch is too full to hold the packet, it has to be flushed first */
+static bool PacketBatch_Add(NBN_PacketBatch *batch, NBN_Packet *packet, uint32_t peer_id, bool is_reliable)
+{
+    unsigned int entry_size = NBN_WEBRTC_RING_ENTRY_SIZE(packet->size);
+
+    if (batch->length + entry_size > NBN_WEBRTC_SEND_BATCH_SIZE)
+        return false;
+
+    uint32_t *entry = (uint32_t *)(batch->data + batch->length);
+
+    entry[0] = packet->size | (is_reliable ? NBN_WEBRTC_RELIABLE_PACKET_FLAG : 0);
+    entry[1] = peer_id;
+
+    memcpy(entry + 2, packet->buffer, packet->size);
+
+    batch->length += entry_size;
+
+    return true;
+}
+
+/* Whether a packet can go through the reliable data channel, once it's open */
+static bool PacketBatch_IsReliable(NBN_Packet *packet)
+{
+    return NBN_WEBRTC_USE_RELIABLE_CHANNEL && packet->is_reliable;
+}
+
+#pragma endregion /* Send batch */
+
 #pragma region Game server
 
 /* --- JS API --- */
 
-NBN_EXTERN void __js_game_server_init(uint32_t, bool, const char *, const char *);
+NBN_EXTERN void __js_game_server_init(uint32_t, bool, const char *, const char *, bool);
 NBN_EXTERN int __js_game_server_start(uint16_t);
-NBN_EXTERN uint8_t *__js_game_server_dequeue_packet(uint32_t *, unsigned int *);
-NBN_EXTERN int __js_game_server_send_packet_to(uint8_t *, unsigned int, uint32_t);
+NBN_EXTERN void __js_game_server_set_recv_ring(NBN_PacketRing *);
+NBN_EXTERN void __js_game_server_send_packets(uint8_t *, unsigned int);
 NBN_EXTERN void __js_game_server_close_client_peer(unsigned int);
+NBN_EXTERN bool __js_game_server_is_reliable_channel_open(unsigned int);
 NBN_EXTERN void __js_game_server_stop(void);
 
 /* --- Driver implementation --- */
 
 static HTable *__peers = NULL;
+static NBN_PacketRing *__gserv_recv_ring = NULL;
+static NBN_PacketBatch __gserv_send_batch = {0};
 
 int NBN_Driver_GServ_Start(uint32_t protocol_id, uint16_t port)
 {
@@ -285,10 +464,15 @@ int NBN_Driver_GServ_Start(uint32_t protocol_id, uint16_t port)
 #ifndef NBN_HTTPS_CERT_PEM
 #define NBN_HTTPS_CERT_PEM "cert.pem"
 #endif
-    __js_game_server_init(protocol_id, true, NBN_HTTPS_KEY_PEM, NBN_HTTPS_CERT_PEM);
+    __js_game_server_init(protocol_id, true, NBN_HTTPS_KEY_PEM, NBN_HTTPS_CERT_PEM, NBN_WEBRTC_USE_RELIABLE_CHANNEL);
 #else
-    __js_game_server_init(protocol_id, false, NULL, NULL);
+    __js_game_server_init(protocol_id, false, NULL, NULL, NBN_WEBRTC_USE_RELIABLE_CHANNEL);
 #endif // NBN_USE_HTTPS
+
+    __gserv_recv_ring = PacketRing_Create(NBN_WEBRTC_RECV_RING_SIZE);
+    __js_game_server_set_recv_ring(__gserv_recv_ring);
+
+    PacketBatch_Init(&__gserv_send_batch);
     
     if (__js_game_server_start(port) < 0)
         return -1;
@@ -300,8 +484,12 @@ int NBN_Driver_GServ_Start(uint32_t protocol_id, uint16_t port)
 
 void NBN_Driver_GServ_Stop(void)
 {
+    NBN_Driver_GServ_FlushPackets();
+    PacketBatch_Deinit(&__gserv_send_batch);
+
     __js_game_server_stop();
     HTable_Destroy(__peers);
+    PacketRing_Destroy(__gserv_recv_ring);
 }
 
 int NBN_Driver_GServ_RecvPackets(void)
@@ -310,7 +498,7 @@ int NBN_Driver_GServ_RecvPackets(void)
     uint32_t peer_id;
     unsigned int len;
 
-    while ((data = __js_game_server_dequeue_packet(&peer_id, &len)) != NULL)
+    while ((data = PacketRing_Peek(__gserv_recv_ring, &peer_id, &len)) != NULL)
     {
         NBN_Packet packet;
 
@@ -319,7 +507,11 @@ int NBN_Driver_GServ_RecvPackets(void)
         if (peer == NULL)
         {
             if (GameServer_GetClientCount() >= NBN_MAX_CLIENTS)
+            {
+                PacketRing_Pop(__gserv_recv_ring, len);
+
                 continue;
+            }
 
             NBN_LogTrace("Peer %d has connected", peer_id);
 
@@ -328,12 +520,25 @@ int NBN_Driver_GServ_RecvPackets(void)
             peer->id = peer_id; 
             peer->conn = NBN_GameServer_CreateClientConnection(peer_id, peer);
 
+            if (peer->conn == NULL)
+            {
+                NBN_Deallocator(peer);
+                PacketRing_Pop(__gserv_recv_ring, len);
+
+                continue;
+            }
+
             HTable_Add(__peers, peer_id, peer);
 
             NBN_Driver_GServ_RaiseEvent(NBN_DRIVER_GSERV_CLIENT_CONNECTED, peer->conn);
         }
 
-        if (NBN_Packet_InitRead(&packet, peer->conn, data, len) < 0)
+        int ret = NBN_Packet_InitRead(&packet, peer->conn, data, len);
+
+        /* the packet has been copied, its space in the ring can be reused */
+        PacketRing_Pop(__gserv_recv_ring, len);
+
+        if (ret < 0)
             continue;
 
         packet.sender = peer->conn;
@@ -348,6 +553,8 @@ void NBN_Driver_GServ_RemoveClientConnection(NBN_Connection *conn)
 {
     assert(conn != NULL);
 
+    NBN_Driver_GServ_FlushPackets(); /* the batch may hold packets for that peer */
+
     __js_game_server_close_client_peer(conn->id);
 
     NBN_Peer *peer = HTable_Remove(__peers, ((NBN_Peer *)conn->driver_data)->id);
@@ -362,7 +569,30 @@ void NBN_Driver_GServ_RemoveClientConnection(NBN_Connection *conn)
 
 int NBN_Driver_GServ_SendPacketTo(NBN_Packet *packet, NBN_Connection *conn)
 {
-    return __js_game_server_send_packet_to(packet->buffer, packet->size, conn->id);
+    /* until the reliable data channel is open, packets go through nbnet reliability */
+    bool is_reliable = PacketBatch_IsReliable(packet) && __js_game_server_is_reliable_channel_open(conn->id);
+
+    if (!PacketBatch_Add(&__gserv_send_batch, packet, conn->id, is_reliable))
+    {
+        NBN_Driver_GServ_FlushPackets();
+
+        if (!PacketBatch_Add(&__gserv_send_batch, packet, conn->id, is_reliable))
+            return NBN_ERROR;
+    }
+
+    return is_reliable ? NBN_DRIVER_PACKET_SENT_RELIABLY : 0;
+}
+
+int NBN_Driver_GServ_FlushPackets(void)
+{
+    if (__gserv_send_batch.length > 0)
+    {
+        __js_game_server_send_packets(__gserv_send_batch.data, __gserv_send_batch.length);
+
+        __gserv_send_batch.length = 0;
+    }
+
+    return 0;
 }
 
 #pragma endregion /* Game server */
@@ -371,27 +601,38 @@ int NBN_Driver_GServ_SendPacketTo(NBN_Packet *packet, NBN_Connection *conn)
 
 /* --- JS API --- */
 
-NBN_EXTERN void __js_game_client_init(uint32_t, bool);
+NBN_EXTERN void __js_game_client_init(uint32_t, bool, bool);
 NBN_EXTERN int __js_game_client_start(const char *, uint16_t);
-NBN_EXTERN uint8_t *__js_game_client_dequeue_packet(unsigned int *);
-NBN_EXTERN int __js_game_client_send_packet(uint8_t *, unsigned int);
+NBN_EXTERN void __js_game_client_set_recv_ring(NBN_PacketRing *);
+NBN_EXTERN void __js_game_client_send_packets(uint8_t *, unsigned int);
 NBN_EXTERN void __js_game_client_close(void);
+NBN_EXTERN bool __js_game_client_is_reliable_channel_open(void);
 
 /* --- Driver implementation --- */
 
 static NBN_Connection *server = NULL;
 static bool is_connected_to_server = false;
+static NBN_PacketRing *__gcli_recv_ring = NULL;
+static NBN_PacketBatch __gcli_send_batch = {0};
 
 int NBN_Driver_GCli_Start(uint32_t protocol_id, const char *host, uint16_t port)
 {
 #ifdef NBN_USE_HTTPS
-    __js_game_client_init(protocol_id, true);
+    __js_game_client_init(protocol_id, true, NBN_WEBRTC_USE_RELIABLE_CHANNEL);
 #else
-    __js_game_client_init(protocol_id, false);
+    __js_game_client_init(protocol_id, false, NBN_WEBRTC_USE_RELIABLE_CHANNEL);
 #endif // NBN_USE_HTTPS
 
+    __gcli_recv_ring = PacketRing_Create(NBN_WEBRTC_RECV_RING_SIZE);
+    __js_game_client_set_recv_ring(__gcli_recv_ring);
+
+    PacketBatch_Init(&__gcli_send_batch);
+
     server = NBN_GameClient_CreateServerConnection(NULL);
 
+    if (server == NULL)
+        return -1;
+
     int res;
 
     if ((res = __js_game_client_start(host, port)) < 0)
@@ -402,19 +643,27 @@ int NBN_Driver_GCli_Start(uint32_t protocol_id, const char *host, uint16_t port)
 
 void NBN_Driver_GCli_Stop(void)
 {
+    NBN_Driver_GCli_FlushPackets();
+    PacketBatch_Deinit(&__gcli_send_batch);
+
     __js_game_client_close();
+    PacketRing_Destroy(__gcli_recv_ring);
 }
 
 int NBN_Driver_GCli_RecvPackets(void)
 {
     uint8_t *data;
+    uint32_t peer_id;
     unsigned int len;
 
-    while ((data = __js_game_client_dequeue_packet(&len)) != NULL)
+    while ((data = PacketRing_Peek(__gcli_recv_ring, &peer_id, &len)) != NULL)
     {
         NBN_Packet packet;
+        int ret = NBN_Packet_InitRead(&packet, server, data, len);
+
+        PacketRing_Pop(__gcli_recv_ring, len);
 
-        if (NBN_Packet_InitRead(&packet, server, data, len) < 0)
+        if (ret < 0)
             continue;
 
         if (!is_connected_to_server)
@@ -432,7 +681,30 @@ int NBN_Driver_GCli_RecvPackets(void)
 
 int NBN_Driver_GCli_SendPacket(NBN_Packet *packet)
 {
-    return __js_game_client_send_packet(packet->buffer, packet->size);
+    /* until the reliable data channel is open, packets go through nbnet reliability */
+    bool is_reliable = PacketBatch_IsReliable(packet) && __js_game_client_is_reliable_channel_open();
+
+    if (!PacketBatch_Add(&__gcli_send_batch, packet, 0, is_reliable))
+    {
+        NBN_Driver_GCli_FlushPackets();
+
+        if (!PacketBatch_Add(&__gcli_send_batch, packet, 0, is_reliable))
+            return NBN_ERROR;
+    }
+
+    return is_reliable ? NBN_DRIVER_PACKET_SENT_RELIABLY : 0;
+}
+
+int NBN_Driver_GCli_FlushPackets(void)
+{
+    if (__gcli_send_batch.length > 0)
+    {
+        __js_game_client_send_packets(__gcli_send_batch.data, __gcli_send_batch.length);
+
+        __gcli_send_batch.length = 0;
+    }
+
+    return 0;
 }
 
 #pragma endregion /* Game client */
@@ -20,13 +20,79 @@ freely, subject to the following restrictions:
 
 */
 
+// --- Packet ring ---
+
+mergeInto(LibraryManager.library, {
+    // Write a received packet into a ring buffer of the WASM heap, drained by the C driver (see NBN_PacketRing)
+    $nbnetPacketRing: {
+        write: function (ringPtr, packet, peerId) {
+            const ring = ringPtr >> 2
+            const head = Atomics.load(HEAPU32, ring)
+            const tail = Atomics.load(HEAPU32, ring + 1)
+            const size = HEAPU32[ring + 2]
+            const len = packet.byteLength
+            const entrySize = 8 + ((len + 3) & ~3)
+            const offset = head & (size - 1)
+            const skip = offset + entrySize > size ? size - offset : 0
+
+            if (skip + entrySize > size - ((head - tail) >>> 0)) {
+                HEAPU32[ring + 3]++ // ring is full, drop the packet
+
+                return false
+            }
+
+            const data = ringPtr + 16
+
+            if (skip) {
+                HEAPU32[(data + offset) >> 2] = 0xFFFFFFFF // wrap marker
+            }
+
+            const entry = data + ((head + skip) & (size - 1))
+
+            HEAPU32[entry >> 2] = len
+            HEAPU32[(entry >> 2) + 1] = peerId
+            HEAPU8.set(new Uint8Array(packet), entry + 8)
+
+            // publish the packet once it's entirely written
+            Atomics.store(HEAPU32, ring, (head + skip + entrySize) >>> 0)
+
+            return true
+        }
+    },
+
+    // Send the packets of a batch written by the C driver (see NBN_PacketBatch)
+    $nbnetPacketBatch: {
+        forEach: function (batchPtr, length, send) {
+            // data channels refuse views of a shared memory (pthreads builds), the packets have to be copied then
+            const shared = typeof SharedArrayBuffer !== 'undefined' && HEAPU8.buffer instanceof SharedArrayBuffer
+            let offset = 0
+
+            while (offset < length) {
+                const entry = batchPtr + offset
+                const word = HEAPU32[entry >> 2]
+                const len = word & 0x7FFFFFFF
+                const reliable = (word & 0x80000000) !== 0 // see NBN_WEBRTC_RELIABLE_PACKET_FLAG
+                const peerId = HEAPU32[(entry >> 2) + 1]
+                const start = entry + 8
+
+                send(shared ? HEAPU8.slice(start, start + len) : HEAPU8.subarray(start, start + len), peerId, reliable)
+
+                offset += 8 + ((len + 3) & ~3)
+            }
+        }
+    }
+})
+
 // --- Game server API ---
 
 mergeInto(LibraryManager.library, {
-    __js_game_server_send_packet_to__proxy: 'sync',
-    __js_game_server_dequeue_packet__proxy: 'sync', 
+    __js_game_server_send_packets__proxy: 'sync',
+    __js_game_server_send_packets__deps: ['$nbnetPacketBatch'],
+    __js_game_server_set_recv_ring__proxy: 'sync',
+    __js_game_server_set_recv_ring__deps: ['$nbnetPacketRing'],
+    __js_game_server_is_reliable_channel_open__proxy: 'sync',
 
-    __js_game_server_init: function (protocol_id, use_https, key_pem, cert_pem) {
+    __js_game_server_init: function (protocol_id, use_https, key_pem, cert_pem, reliable_channel) {
         const nbnet = require('nbnet')
 
         const signalingServer = new nbnet.Standalone.SignalingServer(
@@ -34,7 +100,7 @@ mergeInto(LibraryManager.library, {
             use_https ? { https: true, key: UTF8ToString(key_pem), cert: UTF8ToString(cert_pem) } : {}
         )
 
-        this.gameServer = new nbnet.GameServer(signalingServer)
+        this.gameServer = new nbnet.GameServer(signalingServer, { reliableChannel: !!reliable_channel })
     },
 
     __js_game_server_start: function (port) {
@@ -47,36 +113,28 @@ mergeInto(LibraryManager.library, {
         })
     },
 
-    __js_game_server_dequeue_packet: function(peerIdPtr, lenPtr) {
-        const packet = this.gameServer.packets.shift()
-
-        if (packet) {
-	    const packetData = packet[0]
-            const packetSenderId = packet[1]
-            const ptr = stackAlloc(packetData.byteLength)
-            const byteArray = new Uint8Array(packetData)
-
-            setValue(peerIdPtr, packetSenderId, 'i32')
-            setValue(lenPtr, packetData.byteLength, 'i32')
-            writeArrayToMemory(byteArray, ptr)
-
-            return ptr
-        } else {
-            return null
+    __js_game_server_set_recv_ring: function(ringPtr) {
+        this.gameServer.onPacketReceived = (packet, peerId) => {
+            nbnetPacketRing.write(ringPtr, packet, peerId)
         }
     },
 
-    __js_game_server_send_packet_to: function (packetPtr, packetSize, peerId) {
-        const data = new Uint8Array(Module.HEAPU8.subarray(packetPtr, packetPtr + packetSize))
-
-        this.gameServer.send(data, peerId)
+    __js_game_server_send_packets: function (batchPtr, length) {
+        nbnetPacketBatch.forEach(batchPtr, length, (packet, peerId, reliable) => {
+            this.gameServer.send(packet, peerId, reliable)
+        })
     },
 
     __js_game_server_close_client_peer: function(peerId) {
         this.gameServer.closePeer(peerId)
     },
 
+    __js_game_server_is_reliable_channel_open: function(peerId) {
+        return this.gameServer.isReliableChannelOpen(peerId)
+    },
+
     __js_game_server_stop: function() {
+        this.gameServer.onPacketReceived = null // the ring is about to be released
         this.gameServer.stop()
     }
 })
@@ -84,10 +142,13 @@ mergeInto(LibraryManager.library, {
 // --- Game client API ---
 
 mergeInto(LibraryManager.library, {
-    __js_game_client_send_packet__proxy: 'sync',
-    __js_game_client_dequeue_packet__proxy: 'sync',
+    __js_game_client_send_packets__proxy: 'sync',
+    __js_game_client_send_packets__deps: ['$nbnetPacketBatch'],
+    __js_game_client_set_recv_ring__proxy: 'sync',
+    __js_game_client_set_recv_ring__deps: ['$nbnetPacketRing'],
+    __js_game_client_is_reliable_channel_open__proxy: 'sync',
 
-    __js_game_client_init: function(protocol_id, use_https) {
+    __js_game_client_init: function(protocol_id, use_https, reliable_channel) {
         let nbnet
 
         if (typeof window === 'undefined') {
@@ -100,7 +161,7 @@ mergeInto(LibraryManager.library, {
 
         const signalingClient = new nbnet.Standalone.SignalingClient(protocol_id, { https: use_https })
 
-        this.gameClient = new nbnet.GameClient(signalingClient)
+        this.gameClient = new nbnet.GameClient(signalingClient, { reliableChannel: !!reliable_channel })
     },
 
     __js_game_client_start: function(hostPtr, port) {
@@ -113,29 +174,25 @@ mergeInto(LibraryManager.library, {
         })
     },
 
-    __js_game_client_dequeue_packet: function(lenPtr) {
-        const packet = this.gameClient.packets.shift()
-
-        if (packet) {
-            const ptr = stackAlloc(packet.byteLength)
-            const byteArray = new Uint8Array(packet)
-
-            setValue(lenPtr, packet.byteLength, 'i32')
-            writeArrayToMemory(byteArray, ptr)
-
-            return ptr
-        } else {
-            return null
+    __js_game_client_set_recv_ring: function(ringPtr) {
+        this.gameClient.onPacketReceived = (packet) => {
+            nbnetPacketRing.write(ringPtr, packet, 0)
         }
     },
 
-    __js_game_client_send_packet: function (packetPtr, packetSize) {
-        const data = new Uint8Array(Module.HEAPU8.subarray(packetPtr, packetPtr + packetSize))
+    __js_game_client_send_packets: function (batchPtr, length) {
+        nbnetPacketBatch.forEach(batchPtr, length, (packet, _, reliable) => {
+            this.gameClient.send(packet, reliable)
+        })
+    },
 
-        this.gameClient.send(data)
+    __js_game_client_is_reliable_channel_open: function() {
+        return this.gameClient.isReliableChannelOpen()
     },
 
     __js_game_client_close: function() {
+        this.gameClient.onPacketReceived = null // the ring is about to be released
+
         Asyncify.handleSleep(function (wakeUp) {
             this.gameClient.close().then(wakeUp).catch(wakeUp)
         });
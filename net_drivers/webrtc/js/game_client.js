@@ -23,10 +23,10 @@ freely, subject to the following restrictions:
 const loggerFactory = require('./logger.js')
 const Peer = require('./peer.js')
 
-function GameClient(signalingClient) {
+function GameClient(signalingClient, options) {
     this.signalingClient = signalingClient
-    this.peer = new Peer(0, signalingClient)
-    this.packets = []
+    this.peer = new Peer(0, signalingClient, options)
+    this.onPacketReceived = null
     this.logger = loggerFactory.createLogger('GameClient')
 
     this.signalingClient.onDataReceived = (data) => {
@@ -50,7 +50,9 @@ function GameClient(signalingClient) {
     }
 
     this.peer.onPacketReceived = (packet) => {
-        this.packets.push(packet)
+        if (this.onPacketReceived) {
+            this.onPacketReceived(packet)
+        }
     }
 }
 
@@ -80,8 +82,12 @@ GameClient.prototype.connect = function(host, port) {
     })
 }
 
-GameClient.prototype.send = function(data) {
-    this.peer.send(data)
+GameClient.prototype.send = function(data, reliable) {
+    this.peer.send(data, reliable)
+}
+
+GameClient.prototype.isReliableChannelOpen = function() {
+    return this.peer ? this.peer.isReliableChannelOpen() : false
 }
 
 GameClient.prototype.close = function() {
@@ -23,10 +23,11 @@ freely, subject to the following restrictions:
 const loggerFactory = require('./logger.js')
 const Peer = require('./peer.js')
 
-function GameServer(signalingServer) {
+function GameServer(signalingServer, options) {
     this.signalingServer = signalingServer
+    this.options = options || {}
     this.peers = {}
-    this.packets = []
+    this.onPacketReceived = null
     this.nextPeerId = 0;
     this.logger = loggerFactory.createLogger('GameServer')
 }
@@ -53,16 +54,22 @@ GameServer.prototype.start = function(port) {
     })
 }
 
-GameServer.prototype.send = function(packet, peerId) {
+GameServer.prototype.send = function(packet, peerId, reliable) {
     const peer = this.peers[peerId]
 
     if (peer) {
-        peer.send(packet)
+        peer.send(packet, reliable)
     } else {
         this.logger.warn("Trying to send packet to an unknown peer: " + peerId)
     }
 }
 
+GameServer.prototype.isReliableChannelOpen = function(peerId) {
+    const peer = this.peers[peerId]
+
+    return peer ? peer.isReliableChannelOpen() : false
+}
+
 GameServer.prototype.closePeer = function(peerId) {
     const peer = this.peers[peerId]
 
@@ -76,7 +83,7 @@ GameServer.prototype.stop = function() {
 }
 
 function handleConnection(gameServer, connection) {
-    const peer = new Peer(gameServer.nextPeerId++, connection)
+    const peer = new Peer(gameServer.nextPeerId++, connection, gameServer.options)
 
     peer.onConnected = () => {
         gameServer.logger.info('Peer %d is connected', peer.id)
@@ -99,7 +106,9 @@ function handleConnection(gameServer, connection) {
     }
 
     peer.onPacketReceived = (packet) => {
-        gameServer.packets.push([packet, peer.id])
+        if (gameServer.onPacketReceived) {
+            gameServer.onPacketReceived(packet, peer.id)
+        }
     }
 
     gameServer.logger.info('Created new peer (id: %d) for connection %d', peer.id, connection.id)
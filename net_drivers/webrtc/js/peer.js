@@ -25,7 +25,7 @@ const RTCPeerConnection = webrtc.RTCPeerConnection
 const RTCSessionDescription = webrtc.RTCSessionDescription
 const loggerFactory = require('./logger.js')
 
-function Peer(id, connection) {
+function Peer(id, connection, options) {
     this.id = id
     this.connection = connection
     this.candidates = []
@@ -34,6 +34,12 @@ function Peer(id, connection) {
         { negotiated: true, id: 0, maxRetransmits: 0, ordered: false })
     this.channel.binaryType = 'arraybuffer'
 
+    if (options && options.reliableChannel) {
+        // packets made of reliable messages only, nbnet does not resend them (see NBN_WEBRTC_RELIABLE_CHANNEL)
+        this.reliableChannel = this.peerConnection.createDataChannel('reliable', { negotiated: true, id: 1, ordered: true })
+        this.reliableChannel.binaryType = 'arraybuffer'
+    }
+
     // peer connection event listeners
     this.peerConnection.addEventListener('icecandidate', ({ candidate }) => { onIceCandidate(this, candidate) })
     this.peerConnection.addEventListener('signalingstatechange', () => { onSignalingStateChange(this) })
@@ -46,6 +52,12 @@ function Peer(id, connection) {
     this.channel.addEventListener('error', () => { onDataChannelError(this, this.channel) })
     this.channel.addEventListener('message', (ev) => { onPacketReceived(this, ev.data) })
 
+    if (this.reliableChannel) {
+        this.reliableChannel.addEventListener('open', () => { onReliableDataChannelOpened(this) })
+        this.reliableChannel.addEventListener('error', () => { onDataChannelError(this, this.reliableChannel) })
+        this.reliableChannel.addEventListener('message', (ev) => { onPacketReceived(this, ev.data) })
+    }
+
     this.logger = loggerFactory.createLogger(`Peer(${this.id})`)
 }
 
@@ -91,9 +103,19 @@ Peer.prototype.notifySignalingData = function(data) {
     }
 }
 
-Peer.prototype.send = function(data) {
+// nbnet only sends packets reliably while this is true, the other ones are resent by nbnet
+Peer.prototype.isReliableChannelOpen = function() {
+    return this.reliableChannel !== undefined && this.reliableChannel.readyState === 'open'
+}
+
+Peer.prototype.send = function(data, reliable) {
     try {
-        this.channel.send(data)
+        // when the reliable channel closed after nbnet flagged the packet, nbnet resends it if its ack never comes
+        if (reliable && this.isReliableChannelOpen()) {
+            this.reliableChannel.send(data)
+        } else {
+            this.channel.send(data)
+        }
     } catch(err) {
         this.logger.error('Failed to send: ' + err)
 
@@ -222,6 +244,10 @@ function onDataChannelOpened(peer, dataChannel) {
     peer.onConnected()
 }
 
+function onReliableDataChannelOpened(peer) {
+    peer.logger.info('%s data channel opened (id: %d)', peer.reliableChannel.label, peer.reliableChannel.id)
+}
+
 function onDataChannelError(peer, dataChannel, err) {
     raiseError(peer, `Data channel ${dataChannel.label} (id: ${dataChannel.id}) error: ${err}`)
 }
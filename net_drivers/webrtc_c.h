@@ -0,0 +1,1358 @@
+/*
+
+Copyright (C) 2020 BIAGINI Nathan
+
+This software is provided 'as-is', without any express or implied
+warranty.  In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+3. This notice may not be removed or altered from any source distribution.
+
+*/
+
+/*
+    --- NBNET NATIVE WEBRTC DRIVER ---
+
+    Native WebRTC driver for the nbnet library, built on the C API of libdatachannel
+    (https://github.com/paullouisageneau/libdatachannel). No JS runtime is needed.
+
+    Peers talk the same way as with the emscripten WebRTC driver (see webrtc.h): packets go through a single
+    negotiated, unreliable and unordered data channel and peers are connected through a WebSocket signaling server
+    speaking the protocol of the standalone JS signaling client. The signaling server is embedded in the driver, so
+    browser clients built with the emscripten driver can connect straight to a native game server. The game client
+    side is implemented as well, to connect native clients (the soak test can be built with this driver).
+
+    libdatachannel runs the network on its own threads: its callbacks only queue received packets and update the
+    peers under the driver mutex. Peers are created, signaled and logged by the game thread when the game server or
+    client polls, so NBN_Allocator and the log macros are never called from libdatachannel threads.
+
+    How to use:
+
+        Include this header *once* after the nbnet header in the same file where you defined the NBNET_IMPL macro
+        and link with libdatachannel.
+
+        Define NBN_USE_HTTPS to run the signaling over TLS, the server uses the NBN_HTTPS_KEY_PEM and
+        NBN_HTTPS_CERT_PEM files.
+
+        Define NBN_WEBRTC_RELIABLE_CHANNEL to open the reliable data channel, like with the emscripten driver.
+*/
+
+#ifdef NBNET_IMPL
+
+#include <stdio.h>
+#include <assert.h>
+#include <rtc/rtc.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <pthread.h>
+#endif
+
+/* Maximum number of received packets waiting to be polled, packets received past that are dropped */
+#ifndef NBN_WEBRTC_C_MAX_QUEUED_PACKETS
+#define NBN_WEBRTC_C_MAX_QUEUED_PACKETS 4096
+#endif
+
+/* Time given to the game client to open its data channel to the server (in seconds) */
+#ifndef NBN_WEBRTC_C_CONNECT_TIMEOUT
+#define NBN_WEBRTC_C_CONNECT_TIMEOUT 5
+#endif
+
+#ifndef NBN_WEBRTC_C_LOG_LEVEL
+#define NBN_WEBRTC_C_LOG_LEVEL RTC_LOG_WARNING
+#endif
+
+/* Define NBN_WEBRTC_C_ICE_SERVER to use a STUN or TURN server, e.g. "stun:stun.l.google.com:19302" */
+
+#pragma region Peers
+
+/* Maximum number of local ice candidates of a peer, gathered by libdatachannel before they are sent */
+#define NBN_WEBRTC_C_MAX_CANDIDATES 16
+
+/* Events kept for new signaling connections, packets do not fill them */
+#define NBN_WEBRTC_C_RESERVED_EVENTS 8
+
+typedef enum
+{
+    NBN_WEBRTC_C_EVENT_PACKET,
+    NBN_WEBRTC_C_EVENT_SIGNALING_CONNECTION
+} NBN_WebRTC_C_EventType;
+
+typedef struct __NBN_WebRTC_C_Peer NBN_WebRTC_C_Peer;
+typedef struct __NBN_WebRTC_C_Context NBN_WebRTC_C_Context;
+
+typedef struct
+{
+    NBN_WebRTC_C_EventType type;
+    NBN_WebRTC_C_Peer *peer;
+    int ws; /* WebSocket of a new signaling connection */
+    double recv_time;
+    unsigned int size;
+    uint8_t data[NBN_PACKET_MAX_SIZE];
+} NBN_WebRTC_C_Event;
+
+/* Only allocated and grown by the game thread, events are dropped when it is full */
+typedef struct
+{
+    NBN_WebRTC_C_Event *events;
+    unsigned int count;
+    unsigned int capacity;
+    bool is_full; /* Packets have been dropped */
+} NBN_WebRTC_C_EventQueue;
+
+typedef struct
+{
+    char candidate[256];
+    char mid[32];
+} NBN_WebRTC_C_Candidate;
+
+struct __NBN_WebRTC_C_Peer
+{
+    uint32_t id;
+    int ws; /* Signaling WebSocket */
+    int pc;
+    int dc;
+    int reliable_dc; /* Reliable data channel, -1 when not used (see NBN_WEBRTC_RELIABLE_CHANNEL) */
+    NBN_WebRTC_C_Context *context;
+
+    /* Accessed under the driver mutex */
+    bool is_open; /* Data channel is open */
+    bool is_reliable_open; /* Reliable data channel is open */
+    bool is_remote_closed;
+    bool is_deleted; /* No more packet is queued once set */
+    bool is_local_description_set; /* Local description to send to the remote peer */
+    NBN_WebRTC_C_Candidate candidates[NBN_WEBRTC_C_MAX_CANDIDATES]; /* Gathered local ice candidates */
+    unsigned int candidate_count;
+    unsigned int dropped_candidate_count;
+
+    /* Only accessed by the game thread */
+    NBN_Connection *conn;
+    bool is_closed;
+    bool is_disconnected;
+    bool was_open;
+    bool was_reliable_open;
+    bool is_ready_for_candidates; /* Remote peer is ready to receive our ice candidates */
+    unsigned int sent_candidate_count;
+    NBN_WebRTC_C_Peer *next_closed;
+};
+
+/* State of the game server or game client side of the driver */
+struct __NBN_WebRTC_C_Context
+{
+    uint32_t protocol_id;
+    bool is_server;
+    NBN_WebRTC_C_EventQueue events; /* Filled by the libdatachannel threads */
+    NBN_WebRTC_C_EventQueue polled_events; /* Handled by the game thread */
+    NBN_WebRTC_C_Peer **peers; /* Only accessed by the game thread */
+    unsigned int peer_count;
+    unsigned int peer_capacity;
+    NBN_WebRTC_C_Peer *closed_peers; /* Freed once their remaining events have been polled */
+};
+
+#if defined(_WIN32) || defined(_WIN64)
+static HANDLE __mutex = NULL;
+#else
+static pthread_mutex_t __mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void Lock(void);
+static void Unlock(void);
+static int EventQueue_Init(NBN_WebRTC_C_EventQueue *);
+static void EventQueue_Grow(NBN_WebRTC_C_EventQueue *);
+static NBN_WebRTC_C_Event *EventQueue_Push(NBN_WebRTC_C_EventQueue *, bool);
+static void EventQueue_Deinit(NBN_WebRTC_C_EventQueue *);
+static int Context_Init(NBN_WebRTC_C_Context *, uint32_t, bool);
+static void Context_Deinit(NBN_WebRTC_C_Context *);
+static int Context_AddPeer(NBN_WebRTC_C_Context *, NBN_WebRTC_C_Peer *);
+static void Context_RemovePeer(NBN_WebRTC_C_Context *, NBN_WebRTC_C_Peer *);
+static NBN_WebRTC_C_Peer *Context_Poll(NBN_WebRTC_C_Context *);
+static void Context_FreeClosedPeers(NBN_WebRTC_C_Peer *);
+static NBN_WebRTC_C_Peer *Peer_Create(uint32_t, int, NBN_WebRTC_C_Context *);
+static void Peer_Close(NBN_WebRTC_C_Peer *);
+static bool Peer_IsOpen(NBN_WebRTC_C_Peer *);
+static bool Peer_Poll(NBN_WebRTC_C_Peer *);
+static int Peer_Send(NBN_WebRTC_C_Peer *, NBN_Packet *);
+static void Peer_SetRemoteClosed(NBN_WebRTC_C_Peer *);
+static void Peer_SendSignaling(NBN_WebRTC_C_Peer *, const char *);
+static void Peer_ReceiveSignaling(NBN_WebRTC_C_Peer *);
+static void Peer_HandleSignalingMessage(NBN_WebRTC_C_Peer *, const char *);
+static void Peer_SendLocalDescription(NBN_WebRTC_C_Peer *);
+static void Peer_SendCandidates(NBN_WebRTC_C_Peer *, unsigned int);
+static void Peer_OnSignalingClosed(int, void *);
+static void Peer_OnLocalDescription(int, const char *, const char *, void *);
+static void Peer_OnLocalCandidate(int, const char *, const char *, void *);
+static void Peer_OnStateChange(int, rtcState, void *);
+static void Peer_OnDataChannelOpen(int, void *);
+static void Peer_OnDataChannelClosed(int, void *);
+static void Peer_OnPacketReceived(int, const char *, int, void *);
+static bool Signaling_ReadString(const char *, const char *, char *, size_t);
+static bool Signaling_EscapeString(const char *, char *, size_t);
+
+static void Lock(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    WaitForSingleObject(__mutex, INFINITE);
+#else
+    pthread_mutex_lock(&__mutex);
+#endif
+}
+
+static void Unlock(void)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    ReleaseMutex(__mutex);
+#else
+    pthread_mutex_unlock(&__mutex);
+#endif
+}
+
+static int EventQueue_Init(NBN_WebRTC_C_EventQueue *queue)
+{
+    memset(queue, 0, sizeof(NBN_WebRTC_C_EventQueue));
+
+    queue->capacity = MIN(64, NBN_WEBRTC_C_MAX_QUEUED_PACKETS);
+    queue->events = (NBN_WebRTC_C_Event *)NBN_Allocator(sizeof(NBN_WebRTC_C_Event) * queue->capacity);
+
+    return queue->events ? 0 : NBN_ERROR;
+}
+
+/* Called by the game thread when the queue is not filled by the libdatachannel threads */
+static void EventQueue_Grow(NBN_WebRTC_C_EventQueue *queue)
+{
+    unsigned int capacity = MIN(queue->capacity * 2, NBN_WEBRTC_C_MAX_QUEUED_PACKETS);
+
+    if (capacity <= queue->capacity)
+        return;
+
+    NBN_WebRTC_C_Event *events = (NBN_WebRTC_C_Event *)NBN_Reallocator(
+            queue->events, sizeof(NBN_WebRTC_C_Event) * capacity);
+
+    /* keep the current capacity, packets will still be dropped */
+    if (events == NULL)
+        return;
+
+    queue->events = events;
+    queue->capacity = capacity;
+}
+
+/*
+    Return a new event at the end of the queue, NULL when it does not fit.
+
+    Called under the driver mutex, the queue is never grown here: droppable events leave room for the other ones.
+*/
+static NBN_WebRTC_C_Event *EventQueue_Push(NBN_WebRTC_C_EventQueue *queue, bool is_droppable)
+{
+    unsigned int reserved = is_droppable ? NBN_WEBRTC_C_RESERVED_EVENTS : 0;
+
+    if (queue->count + reserved >= queue->capacity)
+    {
+        queue->is_full = true;
+
+        return NULL;
+    }
+
+    return &queue->events[queue->count++];
+}
+
+static void EventQueue_Deinit(NBN_WebRTC_C_EventQueue *queue)
+{
+    NBN_Deallocator(queue->events);
+
+    memset(queue, 0, sizeof(NBN_WebRTC_C_EventQueue));
+}
+
+static int Context_Init(NBN_WebRTC_C_Context *context, uint32_t protocol_id, bool is_server)
+{
+#if defined(_WIN32) || defined(_WIN64)
+    if (__mutex == NULL)
+        __mutex = CreateMutex(NULL, FALSE, NULL);
+#endif
+
+    memset(context, 0, sizeof(NBN_WebRTC_C_Context));
+
+    context->protocol_id = protocol_id;
+    context->is_server = is_server;
+
+    if (EventQueue_Init(&context->events) < 0 || EventQueue_Init(&context->polled_events) < 0)
+    {
+        NBN_LogError("Failed to allocate event queues");
+
+        EventQueue_Deinit(&context->events);
+        EventQueue_Deinit(&context->polled_events);
+
+        return NBN_ERROR;
+    }
+
+    rtcInitLogger(NBN_WEBRTC_C_LOG_LEVEL, NULL);
+
+    return 0;
+}
+
+/* Called once no more signaling connection can be queued */
+static void Context_Deinit(NBN_WebRTC_C_Context *context)
+{
+    while (context->peer_count > 0)
+        Peer_Close(context->peers[context->peer_count - 1]);
+
+    /* signaling connections that never got a peer */
+    for (unsigned int i = 0; i < context->events.count; i++)
+    {
+        if (context->events.events[i].type == NBN_WEBRTC_C_EVENT_SIGNALING_CONNECTION)
+            rtcDeleteWebSocket(context->events.events[i].ws);
+    }
+
+    Context_FreeClosedPeers(context->closed_peers);
+    EventQueue_Deinit(&context->events);
+    EventQueue_Deinit(&context->polled_events);
+    NBN_Deallocator(context->peers);
+
+    context->closed_peers = NULL;
+    context->peers = NULL;
+    context->peer_count = 0;
+    context->peer_capacity = 0;
+}
+
+static int Context_AddPeer(NBN_WebRTC_C_Context *context, NBN_WebRTC_C_Peer *peer)
+{
+    if (context->peer_count >= context->peer_capacity)
+    {
+        unsigned int capacity = context->peer_capacity ? context->peer_capacity * 2 : 8;
+        NBN_WebRTC_C_Peer **peers = (NBN_WebRTC_C_Peer **)NBN_Reallocator(
+                context->peers, sizeof(NBN_WebRTC_C_Peer *) * capacity);
+
+        if (peers == NULL)
+            return NBN_ERROR;
+
+        context->peers = peers;
+        context->peer_capacity = capacity;
+    }
+
+    context->peers[context->peer_count++] = peer;
+
+    return 0;
+}
+
+static void Context_RemovePeer(NBN_WebRTC_C_Context *context, NBN_WebRTC_C_Peer *peer)
+{
+    for (unsigned int i = 0; i < context->peer_count; i++)
+    {
+        if (context->peers[i] == peer)
+        {
+            context->peers[i] = context->peers[--context->peer_count];
+
+            return;
+        }
+    }
+}
+
+/*
+    Move the queued events to polled_events, to be handled by the game thread without holding the mutex.
+
+    Return the peers closed since the last poll: all their events are in polled_events, so they can be freed
+    (see Context_FreeClosedPeers) once the polled events have been handled.
+*/
+static NBN_WebRTC_C_Peer *Context_Poll(NBN_WebRTC_C_Context *context)
+{
+    NBN_WebRTC_C_EventQueue *queue = &context->polled_events;
+
+    /* the libdatachannel threads never allocate, the queue they fill next is grown here when it was too small */
+    if (queue->is_full)
+        EventQueue_Grow(queue);
+
+    queue->count = 0;
+    queue->is_full = false;
+
+    Lock();
+
+    NBN_WebRTC_C_EventQueue events = context->events;
+    NBN_WebRTC_C_Peer *closed_peers = context->closed_peers;
+
+    context->events = context->polled_events;
+    context->polled_events = events;
+    context->closed_peers = NULL;
+
+    Unlock();
+
+    return closed_peers;
+}
+
+static void Context_FreeClosedPeers(NBN_WebRTC_C_Peer *peer)
+{
+    while (peer)
+    {
+        NBN_WebRTC_C_Peer *next = peer->next_closed;
+
+        NBN_Deallocator(peer);
+
+        peer = next;
+    }
+}
+
+/*
+    Create a peer signaled through the given WebSocket, return NULL on failure (the WebSocket is deleted).
+
+    Peers are created and signaled by the game thread, their libdatachannel callbacks only update them under the
+    driver mutex.
+*/
+static NBN_WebRTC_C_Peer *Peer_Create(uint32_t id, int ws, NBN_WebRTC_C_Context *context)
+{
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)NBN_Allocator(sizeof(NBN_WebRTC_C_Peer));
+
+    if (peer == NULL)
+    {
+        NBN_LogError("Failed to allocate peer %d", id);
+
+        rtcDeleteWebSocket(ws);
+
+        return NULL;
+    }
+
+    memset(peer, 0, sizeof(NBN_WebRTC_C_Peer));
+
+    peer->id = id;
+    peer->ws = ws;
+    peer->reliable_dc = -1;
+    peer->context = context;
+
+    if (Context_AddPeer(context, peer) < 0)
+    {
+        NBN_LogError("Failed to add peer %d", id);
+
+        rtcDeleteWebSocket(ws);
+        NBN_Deallocator(peer);
+
+        return NULL;
+    }
+
+    rtcConfiguration config;
+
+    memset(&config, 0, sizeof(config));
+
+#ifdef NBN_WEBRTC_C_ICE_SERVER
+    const char *ice_servers[] = { NBN_WEBRTC_C_ICE_SERVER };
+
+    config.iceServers = ice_servers;
+    config.iceServersCount = 1;
+#endif
+
+    /* offers and answers are created when signaled */
+    config.disableAutoNegotiation = true;
+
+    if ((peer->pc = rtcCreatePeerConnection(&config)) < 0)
+    {
+        NBN_LogError("Failed to create peer connection for peer %d", id);
+
+        Context_RemovePeer(context, peer);
+        rtcDeleteWebSocket(ws);
+        NBN_Deallocator(peer);
+
+        return NULL;
+    }
+
+    rtcDataChannelInit init;
+
+    memset(&init, 0, sizeof(init));
+
+    /* same channel as the one opened by the JS peers */
+    init.reliability.unordered = true;
+    init.reliability.unreliable = true;
+    init.reliability.maxRetransmits = 0;
+    init.negotiated = true;
+    init.manualStream = true;
+    init.stream = 0;
+
+    if ((peer->dc = rtcCreateDataChannelEx(peer->pc, "unreliable", &init)) < 0)
+    {
+        NBN_LogError("Failed to create data channel for peer %d", id);
+
+        Context_RemovePeer(context, peer);
+        rtcDeletePeerConnection(peer->pc);
+        rtcDeleteWebSocket(ws);
+        NBN_Deallocator(peer);
+
+        return NULL;
+    }
+
+#ifdef NBN_WEBRTC_RELIABLE_CHANNEL
+    rtcDataChannelInit reliable_init;
+
+    memset(&reliable_init, 0, sizeof(reliable_init));
+
+    /* reliable and ordered */
+    reliable_init.negotiated = true;
+    reliable_init.manualStream = true;
+    reliable_init.stream = 1;
+
+    if ((peer->reliable_dc = rtcCreateDataChannelEx(peer->pc, "reliable", &reliable_init)) < 0)
+    {
+        NBN_LogError("Failed to create reliable data channel for peer %d", id);
+
+        Context_RemovePeer(context, peer);
+        rtcDeleteDataChannel(peer->dc);
+        rtcDeletePeerConnection(peer->pc);
+        rtcDeleteWebSocket(ws);
+        NBN_Deallocator(peer);
+
+        return NULL;
+    }
+
+    rtcSetUserPointer(peer->reliable_dc, peer);
+    rtcSetOpenCallback(peer->reliable_dc, Peer_OnDataChannelOpen);
+    rtcSetClosedCallback(peer->reliable_dc, Peer_OnDataChannelClosed);
+    rtcSetMessageCallback(peer->reliable_dc, Peer_OnPacketReceived);
+#endif /* NBN_WEBRTC_RELIABLE_CHANNEL */
+
+    /* no message callback: signaling messages are kept by libdatachannel until the game thread receives them */
+    rtcSetUserPointer(ws, peer);
+    rtcSetClosedCallback(ws, Peer_OnSignalingClosed);
+
+    /* a signaling connection of the game server may have closed before the callback was set */
+    if (context->is_server && rtcIsClosed(ws))
+        Peer_SetRemoteClosed(peer);
+
+    rtcSetUserPointer(peer->pc, peer);
+    rtcSetLocalDescriptionCallback(peer->pc, Peer_OnLocalDescription);
+    rtcSetLocalCandidateCallback(peer->pc, Peer_OnLocalCandidate);
+    rtcSetStateChangeCallback(peer->pc, Peer_OnStateChange);
+
+    rtcSetUserPointer(peer->dc, peer);
+    rtcSetOpenCallback(peer->dc, Peer_OnDataChannelOpen);
+    rtcSetClosedCallback(peer->dc, Peer_OnDataChannelClosed);
+    rtcSetMessageCallback(peer->dc, Peer_OnPacketReceived);
+
+    return peer;
+}
+
+/* Called from the game thread, the peer is freed once its remaining events have been polled */
+static void Peer_Close(NBN_WebRTC_C_Peer *peer)
+{
+    NBN_WebRTC_C_Context *context = peer->context;
+
+    peer->is_closed = true;
+
+    Context_RemovePeer(context, peer);
+
+    Lock();
+
+    peer->is_deleted = true;
+
+    Unlock();
+
+    /* not holding the mutex, deleting waits for the running callbacks */
+    if (peer->reliable_dc >= 0)
+        rtcDeleteDataChannel(peer->reliable_dc);
+
+    rtcDeleteDataChannel(peer->dc);
+    rtcDeletePeerConnection(peer->pc);
+    rtcDeleteWebSocket(peer->ws);
+
+    Lock();
+
+    peer->next_closed = context->closed_peers;
+    context->closed_peers = peer;
+
+    Unlock();
+
+    NBN_LogDebug("Closed peer %d", peer->id);
+}
+
+static bool Peer_IsOpen(NBN_WebRTC_C_Peer *peer)
+{
+    Lock();
+
+    bool is_open = peer->is_open;
+
+    Unlock();
+
+    return is_open;
+}
+
+/*
+    Handle the signaling of a peer and what its callbacks reported, called by the game thread on every poll.
+
+    Return true when the peer has been closed by the remote peer.
+*/
+static bool Peer_Poll(NBN_WebRTC_C_Peer *peer)
+{
+    Peer_ReceiveSignaling(peer);
+
+    Lock();
+
+    bool is_open = peer->is_open;
+    bool is_reliable_open = peer->is_reliable_open;
+    bool is_remote_closed = peer->is_remote_closed;
+    bool is_local_description_set = peer->is_local_description_set;
+    unsigned int candidate_count = peer->candidate_count;
+    unsigned int dropped_candidate_count = peer->dropped_candidate_count;
+
+    peer->is_local_description_set = false;
+    peer->dropped_candidate_count = 0;
+
+    Unlock();
+
+    if (is_open && !peer->was_open)
+        NBN_LogDebug("Data channel of peer %d is open", peer->id);
+
+    if (is_reliable_open && !peer->was_reliable_open)
+        NBN_LogDebug("Reliable data channel of peer %d is open", peer->id);
+
+    peer->was_open = is_open;
+    peer->was_reliable_open = is_reliable_open;
+
+    if (dropped_candidate_count > 0)
+        NBN_LogError("Dropped %d ice candidates of peer %d", dropped_candidate_count, peer->id);
+
+    if (is_local_description_set)
+        Peer_SendLocalDescription(peer);
+
+    /* sent once the remote peer has set our description */
+    if (peer->is_ready_for_candidates)
+        Peer_SendCandidates(peer, candidate_count);
+
+    return is_remote_closed;
+}
+
+static int Peer_Send(NBN_WebRTC_C_Peer *peer, NBN_Packet *packet)
+{
+    if (packet->is_reliable && peer->reliable_dc >= 0)
+    {
+        Lock();
+
+        bool is_reliable_open = peer->is_reliable_open;
+
+        Unlock();
+
+        /* until the reliable channel is open, packets go through nbnet reliability */
+        if (is_reliable_open && rtcSendMessage(peer->reliable_dc, (const char *)packet->buffer, packet->size) >= 0)
+            return NBN_DRIVER_PACKET_SENT_RELIABLY;
+    }
+
+    if (rtcSendMessage(peer->dc, (const char *)packet->buffer, packet->size) < 0)
+    {
+        /* the data channel is closed, the connection will go stale */
+        NBN_LogDebug("Failed to send packet to peer %d", peer->id);
+    }
+
+    return 0;
+}
+
+static void Peer_SetRemoteClosed(NBN_WebRTC_C_Peer *peer)
+{
+    Lock();
+
+    peer->is_remote_closed = true;
+
+    Unlock();
+}
+
+static void Peer_SendSignaling(NBN_WebRTC_C_Peer *peer, const char *msg)
+{
+    /* a negative size sends a text message */
+    if (rtcSendMessage(peer->ws, msg, -1) < 0)
+        NBN_LogError("Failed to send signaling message to peer %d", peer->id);
+}
+
+static void Peer_ReceiveSignaling(NBN_WebRTC_C_Peer *peer)
+{
+    int size = 0;
+
+    /* without a buffer, the size of the next message is returned and the message is kept */
+    while (rtcReceiveMessage(peer->ws, NULL, &size) >= 0)
+    {
+        bool is_text = size < 0; /* the size of a text message is negative and counts the null character */
+
+        size = is_text ? -size : size;
+
+        char *msg = (char *)NBN_Allocator(size + 1);
+
+        if (msg == NULL)
+        {
+            NBN_LogError("Failed to allocate signaling message of peer %d", peer->id);
+
+            return;
+        }
+
+        if (rtcReceiveMessage(peer->ws, msg, &size) < 0)
+        {
+            NBN_LogError("Failed to receive signaling message of peer %d", peer->id);
+            NBN_Deallocator(msg);
+
+            return;
+        }
+
+        /* signaling messages are JSON texts */
+        if (is_text)
+            Peer_HandleSignalingMessage(peer, msg);
+
+        NBN_Deallocator(msg);
+
+        size = 0;
+    }
+}
+
+static void Peer_HandleSignalingMessage(NBN_WebRTC_C_Peer *peer, const char *msg)
+{
+    size_t buffer_size = strlen(msg) + 1; /* read strings are never longer than the message */
+    char *buffer = (char *)NBN_Allocator(buffer_size);
+    char type[16];
+    char mid[64];
+
+    if (buffer == NULL)
+    {
+        NBN_LogError("Failed to allocate signaling message of peer %d", peer->id);
+
+        return;
+    }
+
+    if (Signaling_ReadString(msg, "type", type, sizeof(type)))
+    {
+        if (Signaling_ReadString(msg, "sdp", buffer, buffer_size))
+        {
+            NBN_LogDebug("Got %s from peer %d", type, peer->id);
+
+            if (rtcSetRemoteDescription(peer->pc, buffer, type) < 0)
+            {
+                NBN_LogError("Failed to set remote description of peer %d", peer->id);
+            }
+            else
+            {
+                if (strcmp(type, "offer") == 0)
+                    rtcSetLocalDescription(peer->pc, "answer");
+
+                /* the remote peer can now send its ice candidates */
+                Peer_SendSignaling(peer, "{\"signaling\":{\"ready_for_candidates\":true}}");
+            }
+        }
+    }
+    else if (strstr(msg, "\"ready_for_candidates\""))
+    {
+        NBN_LogDebug("Peer %d is ready to receive our ice candidates", peer->id);
+
+        peer->is_ready_for_candidates = true;
+    }
+    else if (Signaling_ReadString(msg, "candidate", buffer, buffer_size) && buffer[0] != '\0')
+    {
+        bool has_mid = Signaling_ReadString(msg, "sdpMid", mid, sizeof(mid));
+
+        if (rtcAddRemoteCandidate(peer->pc, buffer, has_mid ? mid : NULL) < 0)
+            NBN_LogError("Failed to add ice candidate of peer %d", peer->id);
+    }
+
+    NBN_Deallocator(buffer);
+}
+
+static void Peer_SendLocalDescription(NBN_WebRTC_C_Peer *peer)
+{
+    char type[16];
+    int sdp_size = rtcGetLocalDescription(peer->pc, NULL, 0); /* counts the null character */
+
+    if (sdp_size <= 0 || rtcGetLocalDescriptionType(peer->pc, type, sizeof(type)) < 0)
+    {
+        NBN_LogError("Failed to get local description of peer %d", peer->id);
+
+        return;
+    }
+
+    size_t size = sdp_size * 6 + 64;
+    char *sdp = (char *)NBN_Allocator(sdp_size);
+    char *escaped_sdp = (char *)NBN_Allocator(size);
+    char *msg = (char *)NBN_Allocator(size + 64);
+
+    if (sdp && escaped_sdp && msg &&
+            rtcGetLocalDescription(peer->pc, sdp, sdp_size) >= 0 && Signaling_EscapeString(sdp, escaped_sdp, size))
+    {
+        snprintf(msg, size + 64, "{\"type\":\"%s\",\"sdp\":\"%s\"}", type, escaped_sdp);
+
+        Peer_SendSignaling(peer, msg);
+    }
+    else
+    {
+        NBN_LogError("Failed to send local description to peer %d", peer->id);
+    }
+
+    NBN_Deallocator(sdp);
+    NBN_Deallocator(escaped_sdp);
+    NBN_Deallocator(msg);
+}
+
+/* Send the gathered candidates that have not been sent yet */
+static void Peer_SendCandidates(NBN_WebRTC_C_Peer *peer, unsigned int candidate_count)
+{
+    /* candidates below the count read under the mutex are not written anymore */
+    for (; peer->sent_candidate_count < candidate_count; peer->sent_candidate_count++)
+    {
+        NBN_WebRTC_C_Candidate *candidate = &peer->candidates[peer->sent_candidate_count];
+        char escaped_cand[512];
+        char escaped_mid[64];
+        char msg[sizeof(escaped_cand) + sizeof(escaped_mid) + 64];
+
+        if (!Signaling_EscapeString(candidate->candidate, escaped_cand, sizeof(escaped_cand)) ||
+                !Signaling_EscapeString(candidate->mid, escaped_mid, sizeof(escaped_mid)))
+        {
+            NBN_LogError("Ice candidate of peer %d is too long", peer->id);
+
+            continue;
+        }
+
+        snprintf(msg, sizeof(msg), "{\"candidate\":{\"candidate\":\"%s\",\"sdpMid\":\"%s\"}}", escaped_cand, escaped_mid);
+
+        Peer_SendSignaling(peer, msg);
+    }
+}
+
+static void Peer_OnSignalingClosed(int ws, void *user_ptr)
+{
+    (void)ws;
+
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)user_ptr;
+
+    /* like the JS game server, a peer is closed with its signaling connection */
+    if (peer->context->is_server)
+        Peer_SetRemoteClosed(peer);
+}
+
+static void Peer_OnLocalDescription(int pc, const char *sdp, const char *type, void *user_ptr)
+{
+    (void)pc;
+    (void)sdp;
+    (void)type;
+
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)user_ptr;
+
+    /* sent by the game thread */
+    Lock();
+
+    peer->is_local_description_set = true;
+
+    Unlock();
+}
+
+static void Peer_OnLocalCandidate(int pc, const char *cand, const char *mid, void *user_ptr)
+{
+    (void)pc;
+
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)user_ptr;
+
+    mid = mid ? mid : "0";
+
+    Lock();
+
+    /* sent by the game thread, the ones that do not fit are reported by it */
+    if (peer->candidate_count < NBN_WEBRTC_C_MAX_CANDIDATES &&
+            strlen(cand) < sizeof(peer->candidates[0].candidate) && strlen(mid) < sizeof(peer->candidates[0].mid))
+    {
+        NBN_WebRTC_C_Candidate *candidate = &peer->candidates[peer->candidate_count++];
+
+        strcpy(candidate->candidate, cand);
+        strcpy(candidate->mid, mid);
+    }
+    else
+    {
+        peer->dropped_candidate_count++;
+    }
+
+    Unlock();
+}
+
+static void Peer_OnStateChange(int pc, rtcState state, void *user_ptr)
+{
+    (void)pc;
+
+    if (state == RTC_DISCONNECTED || state == RTC_FAILED || state == RTC_CLOSED)
+        Peer_SetRemoteClosed((NBN_WebRTC_C_Peer *)user_ptr);
+}
+
+static void Peer_OnDataChannelOpen(int dc, void *user_ptr)
+{
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)user_ptr;
+
+    Lock();
+
+    if (dc == peer->reliable_dc)
+        peer->is_reliable_open = true;
+    else
+        peer->is_open = true;
+
+    Unlock();
+}
+
+static void Peer_OnDataChannelClosed(int dc, void *user_ptr)
+{
+    (void)dc;
+
+    Peer_SetRemoteClosed((NBN_WebRTC_C_Peer *)user_ptr);
+}
+
+static void Peer_OnPacketReceived(int dc, const char *data, int size, void *user_ptr)
+{
+    (void)dc;
+
+    if (size < 0 || size > NBN_PACKET_MAX_SIZE)
+        return; /* not a nbnet packet */
+
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)user_ptr;
+    double recv_time = NBN_Clock_GetTime();
+
+    Lock();
+
+    if (!peer->is_deleted)
+    {
+        NBN_WebRTC_C_Event *ev = EventQueue_Push(&peer->context->events, true);
+
+        /* the queue is full, drop the packet like a full socket buffer would */
+        if (ev)
+        {
+            ev->type = NBN_WEBRTC_C_EVENT_PACKET;
+            ev->peer = peer;
+            ev->recv_time = recv_time;
+            ev->size = size;
+
+            memcpy(ev->data, data, size);
+        }
+    }
+
+    Unlock();
+}
+
+/*
+    Read the string value of a key of a signaling message in out, return false if there is none.
+
+    Signaling messages are small JSON objects, only string values are looked for: nested keys are found as well
+    and keys with a non string value are skipped.
+*/
+static bool Signaling_ReadString(const char *msg, const char *key, char *out, size_t size)
+{
+    char quoted_key[64];
+    int key_len = snprintf(quoted_key, sizeof(quoted_key), "\"%s\"", key);
+    const char *c = msg;
+
+    while ((c = strstr(c, quoted_key)) != NULL)
+    {
+        c += key_len;
+
+        while (*c == ' ') c++;
+
+        if (*c != ':')
+            continue;
+
+        c++;
+
+        while (*c == ' ') c++;
+
+        if (*c != '"')
+            continue;
+
+        c++;
+
+        size_t len = 0;
+
+        while (*c != '"')
+        {
+            char ch = *c++;
+
+            if (ch == '\0')
+                return false;
+
+            if (ch == '\\')
+            {
+                ch = *c++;
+
+                switch (ch)
+                {
+                case 'n': ch = '\n'; break;
+                case 'r': ch = '\r'; break;
+                case 't': ch = '\t'; break;
+                case 'b': ch = '\b'; break;
+                case 'f': ch = '\f'; break;
+                case 'u':
+                    /* signaling messages are ASCII, other characters are not expected */
+                    {
+                        char hex[5] = {0};
+
+                        if (strlen(c) < 4)
+                            return false;
+
+                        memcpy(hex, c, 4);
+
+                        ch = (char)strtol(hex, NULL, 16);
+                        c += 4;
+                    }
+                    break;
+                case '\0': return false;
+                default: break; /* '"', '\\' and '/' */
+                }
+            }
+
+            if (len + 1 >= size)
+                return false;
+
+            out[len++] = ch;
+        }
+
+        out[len] = '\0';
+
+        return true;
+    }
+
+    return false;
+}
+
+/* Escape str to be written as a JSON string, return false when it does not fit in out */
+static bool Signaling_EscapeString(const char *str, char *out, size_t size)
+{
+    size_t len = 0;
+
+    for (const char *c = str; *c; c++)
+    {
+        char escaped[8];
+        const char *s = escaped;
+
+        switch (*c)
+        {
+        case '"': s = "\\\""; break;
+        case '\\': s = "\\\\"; break;
+        case '\n': s = "\\n"; break;
+        case '\r': s = "\\r"; break;
+        case '\t': s = "\\t"; break;
+        default:
+            if ((unsigned char)*c < 0x20)
+            {
+                snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)*c);
+            }
+            else
+            {
+                escaped[0] = *c;
+                escaped[1] = '\0';
+            }
+        }
+
+        size_t n = strlen(s);
+
+        if (len + n + 1 > size)
+            return false;
+
+        memcpy(out + len, s, n);
+
+        len += n;
+    }
+
+    out[len] = '\0';
+
+    return true;
+}
+
+#pragma endregion /* Peers */
+
+#pragma region Game server
+
+static NBN_WebRTC_C_Context __gserv_context;
+static int __gserv_ws_server = -1;
+static uint32_t __gserv_next_peer_id = 0;
+
+static void GServ_OnSignalingConnection(int, int, void *);
+
+int NBN_Driver_GServ_Start(uint32_t protocol_id, uint16_t port)
+{
+    if (Context_Init(&__gserv_context, protocol_id, true) < 0)
+        return NBN_ERROR;
+
+    rtcWsServerConfiguration config;
+
+    memset(&config, 0, sizeof(config));
+
+    config.port = port;
+
+#ifdef NBN_USE_HTTPS
+
+#ifndef NBN_HTTPS_KEY_PEM
+#define NBN_HTTPS_KEY_PEM "key.pem"
+#endif
+
+#ifndef NBN_HTTPS_CERT_PEM
+#define NBN_HTTPS_CERT_PEM "cert.pem"
+#endif
+
+    config.enableTls = true;
+    config.keyPemFile = NBN_HTTPS_KEY_PEM;
+    config.certificatePemFile = NBN_HTTPS_CERT_PEM;
+#endif /* NBN_USE_HTTPS */
+
+    if ((__gserv_ws_server = rtcCreateWebSocketServer(&config, GServ_OnSignalingConnection)) < 0)
+    {
+        NBN_LogError("Failed to start signaling server on port %d", port);
+
+        return NBN_ERROR;
+    }
+
+    NBN_LogInfo("Signaling server listening on port %d", port);
+
+    return 0;
+}
+
+void NBN_Driver_GServ_Stop(void)
+{
+    /* no new peer past this point */
+    if (__gserv_ws_server >= 0)
+        rtcDeleteWebSocketServer(__gserv_ws_server);
+
+    __gserv_ws_server = -1;
+
+    Context_Deinit(&__gserv_context);
+}
+
+int NBN_Driver_GServ_RecvPackets(void)
+{
+    NBN_WebRTC_C_Peer *closed_peers = Context_Poll(&__gserv_context);
+    NBN_WebRTC_C_EventQueue *events = &__gserv_context.polled_events;
+
+    for (unsigned int i = 0; i < events->count; i++)
+    {
+        NBN_WebRTC_C_Event *ev = &events->events[i];
+
+        if (ev->type == NBN_WEBRTC_C_EVENT_SIGNALING_CONNECTION)
+        {
+            uint32_t peer_id = __gserv_next_peer_id++;
+
+            if (Peer_Create(peer_id, ev->ws, &__gserv_context))
+                NBN_LogDebug("Created peer %d", peer_id);
+
+            continue;
+        }
+
+        NBN_WebRTC_C_Peer *peer = ev->peer;
+
+        if (peer->is_closed)
+            continue;
+
+        if (NBN_Packet_ReadProtocolId(ev->data, ev->size) != __gserv_context.protocol_id)
+            continue; /* not matching the protocol of the receiver */
+
+        if (peer->conn == NULL)
+        {
+            if (GameServer_GetClientCount() >= NBN_MAX_CLIENTS)
+                continue;
+
+            NBN_LogTrace("Peer %d has connected", peer->id);
+
+            if ((peer->conn = NBN_GameServer_CreateClientConnection(peer->id, peer)) == NULL)
+                continue;
+
+            NBN_Driver_GServ_RaiseEvent(NBN_DRIVER_GSERV_CLIENT_CONNECTED, peer->conn);
+        }
+
+        NBN_Packet packet;
+
+        if (NBN_Packet_InitRead(&packet, peer->conn, ev->data, ev->size) < 0)
+            continue; /* not a valid packet */
+
+        packet.sender = peer->conn;
+        packet.recv_time = ev->recv_time;
+
+        NBN_Driver_GServ_RaiseEvent(NBN_DRIVER_GSERV_CLIENT_PACKET_RECEIVED, &packet);
+    }
+
+    /* backwards, closed peers are replaced by the last one */
+    for (unsigned int i = __gserv_context.peer_count; i > 0; i--)
+    {
+        NBN_WebRTC_C_Peer *peer = __gserv_context.peers[i - 1];
+
+        if (!Peer_Poll(peer) || peer->is_disconnected)
+            continue;
+
+        NBN_LogDebug("Peer %d has disconnected", peer->id);
+
+        peer->is_disconnected = true;
+
+        /* peers with a connection are closed once the connection goes stale */
+        if (peer->conn == NULL)
+            Peer_Close(peer);
+    }
+
+    Context_FreeClosedPeers(closed_peers);
+
+    return 0;
+}
+
+void NBN_Driver_GServ_RemoveClientConnection(NBN_Connection *conn)
+{
+    assert(conn != NULL);
+
+    NBN_WebRTC_C_Peer *peer = (NBN_WebRTC_C_Peer *)conn->driver_data;
+
+    if (!peer->is_closed)
+        Peer_Close(peer);
+}
+
+int NBN_Driver_GServ_SendPacketTo(NBN_Packet *packet, NBN_Connection *conn)
+{
+    return Peer_Send((NBN_WebRTC_C_Peer *)conn->driver_data, packet);
+}
+
+/* Called from a libdatachannel thread, the peer is created by the game thread */
+static void GServ_OnSignalingConnection(int ws_server, int ws, void *user_ptr)
+{
+    (void)ws_server;
+    (void)user_ptr;
+
+    Lock();
+
+    NBN_WebRTC_C_Event *ev = EventQueue_Push(&__gserv_context.events, false);
+
+    if (ev)
+    {
+        ev->type = NBN_WEBRTC_C_EVENT_SIGNALING_CONNECTION;
+        ev->peer = NULL;
+        ev->ws = ws;
+        ev->size = 0;
+    }
+
+    Unlock();
+
+    /* too many connections since the last poll */
+    if (ev == NULL)
+        rtcDeleteWebSocket(ws);
+}
+
+#pragma endregion /* Game server */
+
+#pragma region Game client
+
+static NBN_WebRTC_C_Context __gcli_context;
+static NBN_WebRTC_C_Peer *__gcli_peer = NULL;
+static NBN_Connection *server = NULL;
+static bool is_connected_to_server = false;
+
+int NBN_Driver_GCli_Start(uint32_t protocol_id, const char *host, uint16_t port)
+{
+    if (Context_Init(&__gcli_context, protocol_id, false) < 0)
+        return NBN_ERROR;
+
+    char url[256];
+    char protocol[16];
+
+#ifdef NBN_USE_HTTPS
+    snprintf(url, sizeof(url), "wss://%s:%d", host, port);
+#else
+    snprintf(url, sizeof(url), "ws://%s:%d", host, port);
+#endif
+
+    /* the signaling server accepts the protocol id as WebSocket protocol */
+    snprintf(protocol, sizeof(protocol), "%u", protocol_id);
+
+    const char *protocols[] = { protocol };
+    rtcWsConfiguration config;
+
+    memset(&config, 0, sizeof(config));
+
+    config.protocols = protocols;
+    config.protocolsCount = 1;
+
+    int ws = rtcCreateWebSocketEx(url, &config);
+
+    if (ws < 0)
+    {
+        NBN_LogError("Failed to create signaling connection to %s", url);
+
+        return NBN_ERROR;
+    }
+
+    if ((__gcli_peer = Peer_Create(0, ws, &__gcli_context)) == NULL)
+        return NBN_ERROR;
+
+    if ((server = NBN_GameClient_CreateServerConnection(__gcli_peer)) == NULL)
+        return NBN_ERROR;
+
+    /* wait for the data channel to open, like the JS game client does */
+    double timeout = NBN_Clock_GetTime() + NBN_WEBRTC_C_CONNECT_TIMEOUT;
+    bool is_offer_sent = false;
+
+    while (!Peer_IsOpen(__gcli_peer))
+    {
+        if (!is_offer_sent && rtcIsOpen(ws))
+        {
+            NBN_LogDebug("Connected to signaling server, sending offer");
+
+            rtcSetLocalDescription(__gcli_peer->pc, "offer");
+
+            is_offer_sent = true;
+        }
+
+        if (Peer_Poll(__gcli_peer) || NBN_Clock_GetTime() >= timeout)
+        {
+            NBN_LogError("Failed to connect to %s", url);
+
+            return NBN_ERROR;
+        }
+
+        TickDriver_Sleep(0.01);
+    }
+
+    return 0;
+}
+
+void NBN_Driver_GCli_Stop(void)
+{
+    Context_Deinit(&__gcli_context);
+
+    __gcli_peer = NULL;
+    is_connected_to_server = false;
+}
+
+int NBN_Driver_GCli_RecvPackets(void)
+{
+    NBN_WebRTC_C_Peer *closed_peers = Context_Poll(&__gcli_context);
+    NBN_WebRTC_C_EventQueue *events = &__gcli_context.polled_events;
+
+    for (unsigned int i = 0; i < events->count; i++)
+    {
+        NBN_WebRTC_C_Event *ev = &events->events[i];
+
+        if (ev->peer->is_closed)
+            continue;
+
+        if (NBN_Packet_ReadProtocolId(ev->data, ev->size) != __gcli_context.protocol_id)
+            continue;
+
+        NBN_Packet packet;
+
+        if (NBN_Packet_InitRead(&packet, server, ev->data, ev->size) < 0)
+            continue;
+
+        packet.recv_time = ev->recv_time;
+
+        if (!is_connected_to_server)
+        {
+            NBN_Driver_GCli_RaiseEvent(NBN_DRIVER_GCLI_CONNECTED, NULL);
+
+            is_connected_to_server = true;
+        }
+
+        NBN_Driver_GCli_RaiseEvent(NBN_DRIVER_GCLI_SERVER_PACKET_RECEIVED, &packet);
+    }
+
+    /* ice candidates keep being exchanged once connected, a closed server peer is detected as a connection timeout */
+    if (__gcli_peer && !__gcli_peer->is_closed)
+        Peer_Poll(__gcli_peer);
+
+    Context_FreeClosedPeers(closed_peers);
+
+    return 0;
+}
+
+int NBN_Driver_GCli_SendPacket(NBN_Packet *packet)
+{
+    return Peer_Send(__gcli_peer, packet);
+}
+
+#pragma endregion /* Game client */
+
+#endif /* NBNET_IMPL */
@@ -25,9 +25,12 @@
 
 #include "soak.h"
 
-#ifdef __EMSCRIPTEN__
+#if defined(__EMSCRIPTEN__)
 /* Use WebRTC driver */
 #include "../net_drivers/webrtc.h"
+#elif defined(SOAK_WEBRTC_C_DRIVER)
+/* Use native WebRTC driver */
+#include "../net_drivers/webrtc_c.h"
 #else
 /* Use UDP driver */
 #include "../net_drivers/udp.h"
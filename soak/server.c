@@ -29,9 +29,12 @@
 
 #include "soak.h"
 
-#ifdef __EMSCRIPTEN__
+#if defined(__EMSCRIPTEN__)
 /* Use WebRTC driver */
 #include "../net_drivers/webrtc.h"
+#elif defined(SOAK_WEBRTC_C_DRIVER)
+/* Use native WebRTC driver */
+#include "../net_drivers/webrtc_c.h"
 #else
 /* Use UDP driver */
 #include "../net_drivers/udp.h"
@@ -282,6 +285,17 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+#if !defined(__EMSCRIPTEN__) && !defined(SOAK_WEBRTC_C_DRIVER)
+    const char *capture_path = Soak_GetOptions().capture_path;
+
+    if (capture_path && NBN_UDP_StartCapture(capture_path) < 0)
+    {
+        NBN_GameServer_Stop();
+
+        return 1;
+    }
+#endif
+
     int ret = Soak_MainLoop(Tick);
 
     NBN_GameServer_Stop();
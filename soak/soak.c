@@ -25,17 +25,11 @@
 #include <stdlib.h>
 #include <stdbool.h>
 
-#ifdef __EMSCRIPTEN__
-#include <emscripten/emscripten.h>
-#elif !defined(_WIN32) && !defined(_WIN64)
-// we are on unix or osx
-#include <time.h>
-#endif
-
 #include "soak.h"
 #include "cargs.h"
 
 static bool running = true;
+static NBN_TickDriver *tick_driver = NULL;
 static SoakOptions soak_options = {0};
 static unsigned int created_outgoing_soak_message_count = 0;
 static unsigned int created_incoming_soak_message_count = 0;
@@ -124,7 +118,10 @@ int Soak_ReadCommandLine(int argc, char *argv[])
         {'l', NULL, "packet_loss", "VALUE", "Packet loss frenquency (0-1)"},
         {'d', NULL, "packet_duplication", "VALUE", "Packet duplication frequency (0-1)"},
         {'p', NULL, "ping", "VALUE", "Ping in seconds"},
-        {'j', NULL, "jitter", "VALUE", "Jitter in seconds"}
+        {'j', NULL, "jitter", "VALUE", "Jitter in seconds"},
+#ifdef SOAK_SERVER
+        {'c', NULL, "capture", "VALUE", "Capture the received packets to a file (see bench/replay.c)"}
+#endif
     };
     cag_option_context context;
 
@@ -154,43 +151,56 @@ int Soak_ReadCommandLine(int argc, char *argv[])
         case 'j':
             soak_options.jitter = atof(cag_option_get_value(&context));
             break;
+
+#ifdef SOAK_SERVER
+        case 'c':
+            soak_options.capture_path = cag_option_get_value(&context);
+            break;
+#endif
         }
     }
 
     return 0;
 }
 
+static int Soak_Tick(uint32_t tick, double dt, void *user_data)
+{
+    (void)tick;
+    (void)dt;
+
+    int (*Tick)(void) = *(int (**)(void))user_data;
+
+    return Tick();
+}
+
 int Soak_MainLoop(int (*Tick)(void))
 {
-    while (running)
-    {
-        int ret = Tick();
+    if (!running)
+        return 0;
 
-        if (ret < 0) // Error
-            return 1;
+    tick_driver = NBN_TickDriver_Create(SOAK_TICK_RATE, NBN_TICK_OVERRUN_CATCH_UP);
 
-        if (ret == SOAK_DONE) // All soak messages have been received
-            return 0;
+    int ret = NBN_TickDriver_Run(tick_driver, Soak_Tick, &Tick);
+    NBN_TickStats stats = NBN_TickDriver_GetStats(tick_driver);
 
-#ifdef __EMSCRIPTEN__
-        emscripten_sleep(SOAK_TICK_DT * 1000);
-#elif defined(_WIN32) || defined(_WIN64)
-        Sleep(SOAK_TICK_DT * 1000);
-#else
-        long nanos = SOAK_TICK_DT * 1e9;
-        struct timespec t = { .tv_sec = nanos / 999999999, .tv_nsec = nanos % 999999999 };
+    Soak_LogInfo("Ticks: %u (overruns: %u, skipped: %u, avg duration: %fms, max lateness: %fms)",
+        stats.tick_count, stats.overrun_count, stats.skipped_tick_count,
+        stats.avg_tick_duration * 1000, stats.max_lateness * 1000);
 
-        nanosleep(&t, &t);
-#endif
-    }
+    NBN_TickDriver_Destroy(tick_driver);
+    tick_driver = NULL;
 
-    return 0;
+    // Error or all soak messages have been received
+    return ret < 0 ? 1 : 0;
 }
 
 void Soak_Stop(void)
 {
     running = false;
 
+    if (tick_driver)
+        NBN_TickDriver_Stop(tick_driver);
+
     Soak_LogInfo("Soak test stopped");
 }
 
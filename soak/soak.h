@@ -43,6 +43,11 @@
 #define NBN_LogDebug Soak_LogDebug
 #define NBN_LogError Soak_LogError
 
+#ifdef __EMSCRIPTEN__
+/* the WebRTC driver batches the packets of a tick */
+#define NBN_DRIVER_HAS_FLUSH
+#endif
+
 #include "../nbnet.h"
 
 #define SOAK_PROTOCOL_NAME "nbnet_soak"
@@ -66,6 +71,7 @@ typedef struct
     float packet_duplication; /* 0 - 1 */
     float ping; /* in seconds */
     float jitter; /* in seconds */
+    const char *capture_path; /* file the received packets are captured to (NULL when not capturing) */
 } SoakOptions;
 
 typedef struct
@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CuTest.h"
+
+#define NBNET_IMPL
+
+#define NBN_LogInfo printf
+#define NBN_LogTrace printf
+#define NBN_LogDebug printf
+#define NBN_LogError printf
+
+#define NBN_Allocator malloc
+#define NBN_Deallocator free
+
+#include "../nbnet.h"
+#include "../net_drivers/udp.h"
+
+#define TEST_MESSAGE_TYPE 0
+#define TEST_CHANNEL 0
+#define TEST_CHANNEL_BUFFER_SIZE 8
+
+typedef struct
+{
+    unsigned int value;
+} TestMessage;
+
+static unsigned int destroyed_message_count;
+
+static TestMessage *TestMessage_Create(void)
+{
+    return malloc(sizeof(TestMessage));
+}
+
+static void TestMessage_Destroy(TestMessage *msg)
+{
+    destroyed_message_count++;
+
+    free(msg);
+}
+
+static int TestMessage_Serialize(TestMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->value, 0, 1000);
+
+    return 0;
+}
+
+static NBN_Connection *Begin(NBN_Endpoint *endpoint, NBN_ChannelType channel_type)
+{
+    /* hooks are not reset by NBN_Endpoint_Init */
+    memset(endpoint, 0, sizeof(NBN_Endpoint));
+
+    NBN_Endpoint_Init(
+            endpoint, (NBN_Config){ .protocol_name = "tests", .channel_buffer_size = TEST_CHANNEL_BUFFER_SIZE }, false);
+    NBN_Endpoint_RegisterMessageBuilder(endpoint, (NBN_MessageBuilder)TestMessage_Create, TEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(endpoint, (NBN_MessageSerializer)TestMessage_Serialize, TEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(endpoint, (NBN_MessageDestructor)TestMessage_Destroy, TEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterChannel(endpoint, channel_type, TEST_CHANNEL);
+
+    destroyed_message_count = 0;
+
+    return NBN_Endpoint_CreateConnection(endpoint, 0, NULL);
+}
+
+static void End(NBN_Connection *conn, NBN_Endpoint *endpoint)
+{
+    NBN_Connection_Destroy(conn);
+    NBN_Endpoint_Deinit(endpoint);
+}
+
+static int SendTestMessage(NBN_Endpoint *endpoint, NBN_Connection *conn, unsigned int value)
+{
+    TestMessage *msg = TestMessage_Create();
+
+    msg->value = value;
+
+    return Endpoint_EnqueueOutgoingMessage(
+            endpoint, conn, Endpoint_CreateOutgoingMessage(endpoint, TEST_MESSAGE_TYPE, msg), TEST_CHANNEL);
+}
+
+static NBN_Message BuildReceivedMessage(uint16_t id, unsigned int value)
+{
+    TestMessage *msg = TestMessage_Create();
+
+    msg->value = value;
+
+    return (NBN_Message){ { id, TEST_MESSAGE_TYPE, TEST_CHANNEL }, NULL, NULL, msg };
+}
+
+void Test_UnreliableUnorderedChannel_DropOldestOutgoingMessage(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *conn = Begin(&endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED);
+    NBN_Channel *channel = conn->channels[TEST_CHANNEL];
+
+    for (unsigned int i = 0; i < TEST_CHANNEL_BUFFER_SIZE + 2; i++)
+        CuAssertIntEquals(tc, 0, SendTestMessage(&endpoint, conn, i));
+
+    /* the two oldest messages were dropped to make room for the last ones */
+    CuAssertIntEquals(tc, 2, destroyed_message_count);
+    CuAssertIntEquals(tc, TEST_CHANNEL_BUFFER_SIZE, channel->outgoing_message_count);
+
+    for (unsigned int i = 2; i < TEST_CHANNEL_BUFFER_SIZE + 2; i++)
+    {
+        NBN_Message *message = channel->GetNextOutgoingMessage(channel);
+
+        CuAssertPtrNotNull(tc, message);
+        CuAssertIntEquals(tc, i, ((TestMessage *)message->data)->value);
+        CuAssertIntEquals(tc, 0, channel->OnOutgoingMessageSent(channel, message));
+    }
+
+    CuAssertPtrEquals(tc, NULL, channel->GetNextOutgoingMessage(channel));
+    CuAssertIntEquals(tc, 0, channel->outgoing_message_count);
+    CuAssertIntEquals(tc, TEST_CHANNEL_BUFFER_SIZE + 2, destroyed_message_count);
+
+    End(conn, &endpoint);
+}
+
+void Test_UnreliableUnorderedChannel_DeliverLateMessages(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *conn = Begin(&endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED);
+    NBN_Channel *channel = conn->channels[TEST_CHANNEL];
+    uint16_t ids[] = { 3, 1, 2 };
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        NBN_Message message = BuildReceivedMessage(ids[i], ids[i]);
+
+        CuAssertTrue(tc, channel->AddReceivedMessage(channel, &message));
+    }
+
+    /* messages come out in the order they were received */
+    for (unsigned int i = 0; i < 3; i++)
+    {
+        NBN_Message *message = channel->GetNextRecvedMessage(channel);
+
+        CuAssertPtrNotNull(tc, message);
+        CuAssertIntEquals(tc, ids[i], message->header.id);
+        Connection_RecycleMessage(conn, message);
+    }
+
+    CuAssertPtrEquals(tc, NULL, channel->GetNextRecvedMessage(channel));
+
+    End(conn, &endpoint);
+}
+
+void Test_UnreliableRedundantChannel_DropDuplicatedMessages(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *conn = Begin(&endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_REDUNDANT);
+    NBN_Channel *channel = conn->channels[TEST_CHANNEL];
+    NBN_Message message = BuildReceivedMessage(1, 1);
+
+    CuAssertTrue(tc, channel->AddReceivedMessage(channel, &message));
+
+    /* redundant copy of a message already in the recv queue */
+    message = BuildReceivedMessage(1, 1);
+    CuAssertTrue(tc, !channel->AddReceivedMessage(channel, &message));
+    Connection_RecycleMessage(conn, &message);
+
+    /* message 0 is skipped, it was lost along with all its copies */
+    NBN_Message *r_message = channel->GetNextRecvedMessage(channel);
+
+    CuAssertPtrNotNull(tc, r_message);
+    CuAssertIntEquals(tc, 1, r_message->header.id);
+    Connection_RecycleMessage(conn, r_message);
+
+    /* message already delivered */
+    message = BuildReceivedMessage(0, 0);
+    CuAssertTrue(tc, !channel->AddReceivedMessage(channel, &message));
+    Connection_RecycleMessage(conn, &message);
+
+    CuAssertPtrEquals(tc, NULL, channel->GetNextRecvedMessage(channel));
+    CuAssertIntEquals(tc, 3, destroyed_message_count);
+
+    End(conn, &endpoint);
+}
+
+int main(int argc, char *argv[])
+{
+    CuString *output = CuStringNew();
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_UnreliableUnorderedChannel_DropOldestOutgoingMessage);
+    SUITE_ADD_TEST(suite, Test_UnreliableUnorderedChannel_DeliverLateMessages);
+    SUITE_ADD_TEST(suite, Test_UnreliableRedundantChannel_DropDuplicatedMessages);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, output);
+    CuSuiteDetails(suite, output);
+
+    printf("%s\n", output->buffer);
+
+    return suite->failCount;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CuTest.h"
+
+#define NBNET_IMPL
+
+#define NBN_LogInfo printf
+#define NBN_LogTrace printf
+#define NBN_LogDebug printf
+#define NBN_LogError printf
+
+/* number of allocations left before the allocator fails, negative to never fail */
+static int alloc_countdown = -1;
+
+static void *TestAllocator(size_t size)
+{
+    if (alloc_countdown == 0)
+        return NULL;
+
+    if (alloc_countdown > 0)
+        alloc_countdown--;
+
+    return malloc(size);
+}
+
+#define NBN_Allocator TestAllocator
+#define NBN_Deallocator free
+
+#include "../nbnet.h"
+#include "../net_drivers/udp.h"
+
+static int Init(NBN_Endpoint *endpoint, NBN_Config config)
+{
+    /* hooks are not reset by NBN_Endpoint_Init */
+    memset(endpoint, 0, sizeof(NBN_Endpoint));
+
+    config.protocol_name = "tests";
+
+    return NBN_Endpoint_Init(endpoint, config, false);
+}
+
+static void AssertConfigRejected(CuTest *tc, NBN_Config config)
+{
+    NBN_Endpoint endpoint;
+
+    CuAssertIntEquals(tc, NBN_ERROR, Init(&endpoint, config));
+}
+
+void Test_DefaultConfig(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+
+    CuAssertIntEquals(tc, 0, Init(&endpoint, (NBN_Config){ 0 }));
+    CuAssertIntEquals(tc, NBN_CHANNEL_BUFFER_SIZE, endpoint.config.channel_buffer_size);
+    CuAssertIntEquals(tc, NBN_MAX_PACKET_ENTRIES, endpoint.config.max_packet_entries);
+    CuAssertIntEquals(tc, NBN_EVENT_QUEUE_CAPACITY, endpoint.config.event_queue_capacity);
+    CuAssertIntEquals(tc, NBN_ENDPOINT_OUTGOING_MESSAGE_BUFFER_SIZE, endpoint.config.outgoing_message_buffer_size);
+    CuAssertIntEquals(tc, NBN_CONNECTION_MAX_SENT_PACKET_COUNT, endpoint.config.max_sent_packet_count);
+
+    NBN_Endpoint_Deinit(&endpoint);
+}
+
+void Test_RejectInvalidBufferSizes(CuTest *tc)
+{
+    AssertConfigRejected(tc, (NBN_Config){ .channel_buffer_size = 100 });
+    AssertConfigRejected(tc, (NBN_Config){ .channel_buffer_size = 0x10000 });
+    AssertConfigRejected(tc, (NBN_Config){ .max_packet_entries = 32 });
+    AssertConfigRejected(tc, (NBN_Config){ .max_packet_entries = 1000 });
+    AssertConfigRejected(tc, (NBN_Config){ .event_queue_capacity = 8 });
+    AssertConfigRejected(tc, (NBN_Config){ .event_queue_capacity = 1000 });
+    AssertConfigRejected(tc, (NBN_Config){ .outgoing_message_buffer_size = 8 });
+    AssertConfigRejected(tc, (NBN_Config){ .outgoing_message_buffer_size = 0x20000 });
+}
+
+void Test_RejectInvalidFlushLimits(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+
+    AssertConfigRejected(tc, (NBN_Config){ .max_sent_packet_count = NBN_CONNECTION_MAX_SENT_PACKET_COUNT_LIMIT + 1 });
+    AssertConfigRejected(tc, (NBN_Config){ .stale_time_threshold = NBN_CONNECTION_KEEP_ALIVE_INTERVAL });
+
+    /* a flush must leave room for a FEC group */
+    NBN_Config config = { .is_fec_enabled = true, .max_sent_packet_count = NBN_FEC_MAX_GROUP_SPAN - NBN_FEC_MIN_GROUP_SIZE - 1 };
+
+    AssertConfigRejected(tc, config);
+
+    config.max_sent_packet_count--;
+
+    CuAssertIntEquals(tc, 0, Init(&endpoint, config));
+
+    NBN_Endpoint_Deinit(&endpoint);
+}
+
+void Test_CreateConnectionAllocationFailure(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *connection = NULL;
+    int failed_alloc = 0;
+
+    CuAssertIntEquals(tc, 0, Init(&endpoint, (NBN_Config){ 0 }));
+
+    /* fail every allocation made by the connection creation in turn, until it succeeds */
+    while (connection == NULL)
+    {
+        CuAssertTrue(tc, failed_alloc < 64);
+
+        alloc_countdown = failed_alloc++;
+        connection = NBN_Endpoint_CreateConnection(&endpoint, 0, NULL);
+    }
+
+    alloc_countdown = -1;
+
+    CuAssertTrue(tc, failed_alloc > 1);
+
+    for (int i = 0; i < NBN_MAX_CHANNELS; i++)
+        CuAssertTrue(tc, (connection->channels[i] != NULL) == (endpoint.channels[i] != NBN_CHANNEL_TYPE_UNDEFINED));
+
+    NBN_Connection_Destroy(connection);
+    NBN_Endpoint_Deinit(&endpoint);
+}
+
+int main(int argc, char *argv[])
+{
+    CuString *output = CuStringNew();
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_DefaultConfig);
+    SUITE_ADD_TEST(suite, Test_RejectInvalidBufferSizes);
+    SUITE_ADD_TEST(suite, Test_RejectInvalidFlushLimits);
+    SUITE_ADD_TEST(suite, Test_CreateConnectionAllocationFailure);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, output);
+    CuSuiteDetails(suite, output);
+
+    printf("%s\n", output->buffer);
+
+    return suite->failCount;
+}
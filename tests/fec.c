@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CuTest.h"
+
+#define NBNET_IMPL
+
+#define NBN_LogInfo printf
+#define NBN_LogTrace printf
+#define NBN_LogDebug printf
+#define NBN_LogError printf
+
+#define NBN_Allocator malloc
+#define NBN_Deallocator free
+
+#include "../nbnet.h"
+#include "../net_drivers/udp.h"
+
+#define TEST_MESSAGE_TYPE 0
+#define TEST_CHANNEL 0
+#define TEST_PACKET_COUNT 4
+
+typedef struct
+{
+    unsigned int value;
+} TestMessage;
+
+static TestMessage *TestMessage_Create(void)
+{
+    return malloc(sizeof(TestMessage));
+}
+
+static void TestMessage_Destroy(TestMessage *msg)
+{
+    free(msg);
+}
+
+static int TestMessage_Serialize(TestMessage *msg, NBN_Stream *stream)
+{
+    NBN_SerializeUInt(stream, msg->value, 0, 1000);
+
+    return 0;
+}
+
+static NBN_Connection *Begin(NBN_Endpoint *endpoint)
+{
+    /* hooks are not reset by NBN_Endpoint_Init */
+    memset(endpoint, 0, sizeof(NBN_Endpoint));
+
+    NBN_Endpoint_Init(endpoint, (NBN_Config){ .protocol_name = "tests", .is_fec_enabled = true }, false);
+    NBN_Endpoint_RegisterMessageBuilder(endpoint, (NBN_MessageBuilder)TestMessage_Create, TEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageSerializer(endpoint, (NBN_MessageSerializer)TestMessage_Serialize, TEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterMessageDestructor(endpoint, (NBN_MessageDestructor)TestMessage_Destroy, TEST_MESSAGE_TYPE);
+    NBN_Endpoint_RegisterChannel(endpoint, NBN_CHANNEL_TYPE_UNRELIABLE_UNORDERED, TEST_CHANNEL);
+
+    return NBN_Endpoint_CreateConnection(endpoint, 0, NULL);
+}
+
+static void End(NBN_Connection *conn, NBN_Endpoint *endpoint)
+{
+    NBN_Connection_Destroy(conn);
+    NBN_Endpoint_Deinit(endpoint);
+}
+
+/* Write a packet carrying a test message and add it to the sender's FEC group, as Connection_SendPacket does */
+static void WritePacket(NBN_Connection *sender, NBN_Packet *packet, unsigned int value)
+{
+    NBN_PacketEntry *packet_entry;
+    TestMessage msg = { value };
+    NBN_Message message = { { (uint16_t)value, TEST_MESSAGE_TYPE, TEST_CHANNEL }, NULL, NULL, &msg };
+
+    Connection_InitOutgoingPacket(sender, packet, &packet_entry);
+    NBN_Packet_WriteMessage(packet, &message, (NBN_MessageSerializer)TestMessage_Serialize);
+    NBN_WriteStream_Flush(&packet->w_stream);
+    Connection_AddPacketToFECGroup(sender, packet);
+    NBN_Packet_Seal(packet, sender);
+}
+
+/* Write the parity packet of the sender's current FEC group, as Connection_SendFECParityPacket does */
+static void WriteParityPacket(NBN_Connection *sender, NBN_Packet *packet)
+{
+    NBN_PacketEntry *packet_entry;
+    NBN_Message message =
+        { { 0, NBN_FEC_PARITY_MESSAGE_TYPE, NBN_CHANNEL_RESERVED_UNRELIABLE }, NULL, NULL, &sender->fec_encoder->parity };
+
+    Connection_InitOutgoingPacket(sender, packet, &packet_entry);
+    NBN_Packet_WriteMessage(packet, &message, (NBN_MessageSerializer)NBN_FECParityMessage_Serialize);
+    NBN_Packet_Seal(packet, sender);
+
+    sender->fec_encoder->packet_count = 0;
+}
+
+static int ReceivePacket(NBN_Connection *receiver, NBN_Packet *packet)
+{
+    NBN_Packet r_packet;
+
+    if (NBN_Packet_InitRead(&r_packet, receiver, packet->buffer, packet->size) < 0)
+        return NBN_ERROR;
+
+    return NBN_Connection_ProcessReceivedPacket(receiver, &r_packet);
+}
+
+/* Send a group of packets, drop the ones flagged as lost and return the number of messages the receiver got */
+static unsigned int SendGroup(CuTest *tc, NBN_Connection *sender, NBN_Connection *receiver, bool lost[], unsigned int first_value)
+{
+    NBN_Packet packet;
+
+    for (unsigned int i = 0; i < TEST_PACKET_COUNT; i++)
+    {
+        WritePacket(sender, &packet, first_value + i);
+
+        if (!lost[i])
+            CuAssertIntEquals(tc, 0, ReceivePacket(receiver, &packet));
+    }
+
+    CuAssertIntEquals(tc, TEST_PACKET_COUNT, sender->fec_encoder->packet_count);
+
+    WriteParityPacket(sender, &packet);
+    CuAssertIntEquals(tc, 0, ReceivePacket(receiver, &packet));
+
+    NBN_Channel *channel = receiver->channels[TEST_CHANNEL];
+    NBN_Message *message;
+    unsigned int received_count = 0;
+
+    while ((message = channel->GetNextRecvedMessage(channel)))
+    {
+        CuAssertTrue(tc, ((TestMessage *)message->data)->value >= first_value);
+        CuAssertTrue(tc, ((TestMessage *)message->data)->value < first_value + TEST_PACKET_COUNT);
+
+        received_count++;
+        Connection_RecycleMessage(receiver, message);
+    }
+
+    return received_count;
+}
+
+void Test_RecoverLostPacketOfFirstGroup(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *sender = Begin(&endpoint);
+    NBN_Connection *receiver = NBN_Endpoint_CreateConnection(&endpoint, 1, NULL);
+    bool lost[TEST_PACKET_COUNT] = { false, false, true, false };
+
+    /* the decoder exists before the first parity is received */
+    CuAssertPtrNotNull(tc, sender->fec_encoder);
+    CuAssertPtrNotNull(tc, receiver->fec_decoder);
+
+    CuAssertIntEquals(tc, TEST_PACKET_COUNT, SendGroup(tc, sender, receiver, lost, 0));
+    CuAssertTrue(tc, Connection_IsPacketReceived(receiver, 3));
+
+    /* next group */
+    lost[2] = false;
+    lost[0] = true;
+
+    CuAssertIntEquals(tc, TEST_PACKET_COUNT, SendGroup(tc, sender, receiver, lost, TEST_PACKET_COUNT));
+
+    NBN_Connection_Destroy(receiver);
+    End(sender, &endpoint);
+}
+
+void Test_DoNotRecoverSeveralLostPackets(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *sender = Begin(&endpoint);
+    NBN_Connection *receiver = NBN_Endpoint_CreateConnection(&endpoint, 1, NULL);
+    bool lost[TEST_PACKET_COUNT] = { true, false, true, false };
+
+    /* a XOR parity can only rebuild a single packet of its group */
+    CuAssertIntEquals(tc, TEST_PACKET_COUNT - 2, SendGroup(tc, sender, receiver, lost, 0));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(receiver, 1));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(receiver, 3));
+
+    NBN_Connection_Destroy(receiver);
+    End(sender, &endpoint);
+}
+
+void Test_ParityOfLargestPacketFits(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *conn = Begin(&endpoint);
+    NBN_Packet packet;
+    NBN_PacketEntry *packet_entry;
+    NBN_FECParityMessage *parity = &conn->fec_encoder->parity;
+    NBN_Message message = { { 0, NBN_FEC_PARITY_MESSAGE_TYPE, NBN_CHANNEL_RESERVED_UNRELIABLE }, NULL, NULL, parity };
+
+    memset(parity, 0xFF, sizeof(NBN_FECParityMessage));
+    parity->data_length = NBN_FEC_MAX_PAYLOAD_SIZE;
+
+    Connection_InitOutgoingPacket(conn, &packet, &packet_entry);
+
+    CuAssertIntEquals(tc, NBN_PACKET_WRITE_OK,
+            NBN_Packet_WriteMessage(&packet, &message, (NBN_MessageSerializer)NBN_FECParityMessage_Serialize));
+
+    Connection_CancelOutgoingPacket(conn, &packet);
+    End(conn, &endpoint);
+}
+
+int main(int argc, char *argv[])
+{
+    CuString *output = CuStringNew();
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_RecoverLostPacketOfFirstGroup);
+    SUITE_ADD_TEST(suite, Test_DoNotRecoverSeveralLostPackets);
+    SUITE_ADD_TEST(suite, Test_ParityOfLargestPacketFits);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, output);
+    CuSuiteDetails(suite, output);
+
+    printf("%s\n", output->buffer);
+
+    return suite->failCount;
+}
@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CuTest.h"
+
+#define NBNET_IMPL
+
+#define NBN_LogInfo printf
+#define NBN_LogTrace printf
+#define NBN_LogDebug printf
+#define NBN_LogError printf
+
+#define NBN_Allocator malloc
+#define NBN_Deallocator free
+
+#include "../nbnet.h"
+#include "../net_drivers/udp.h"
+
+static NBN_Connection *Begin(NBN_Endpoint *endpoint)
+{
+    /* hooks are not reset by NBN_Endpoint_Init */
+    memset(endpoint, 0, sizeof(NBN_Endpoint));
+
+    NBN_Endpoint_Init(endpoint, (NBN_Config){ .protocol_name = "tests" }, false);
+
+    return NBN_Endpoint_CreateConnection(endpoint, 0, NULL);
+}
+
+static void End(NBN_Connection *conn, NBN_Endpoint *endpoint)
+{
+    NBN_Connection_Destroy(conn);
+    NBN_Endpoint_Deinit(endpoint);
+}
+
+/* Create the entries of packets 1 to count as if they were sent, packet n carrying the ack n * 2 */
+static void SendPackets(NBN_Connection *conn, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        NBN_Packet packet;
+        NBN_PacketEntry *packet_entry;
+
+        Connection_InitOutgoingPacket(conn, &packet, &packet_entry);
+
+        packet_entry->ack = packet.header.seq_number * 2;
+    }
+}
+
+static bool IsPacketAcked(NBN_Connection *conn, uint16_t seq_number)
+{
+    NBN_PacketEntry *packet_entry = Connection_FindSendPacketEntry(conn, seq_number);
+
+    return packet_entry && packet_entry->acked;
+}
+
+void Test_InsertReceivedPacketEntry(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *conn = Begin(&endpoint);
+
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 1));
+    CuAssertIntEquals(tc, 1, conn->last_received_packet_seq_number);
+
+    /* duplicated packet */
+    CuAssertTrue(tc, !Connection_InsertReceivedPacketEntry(conn, 1));
+
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 5));
+    CuAssertIntEquals(tc, 5, conn->last_received_packet_seq_number);
+    CuAssertTrue(tc, !Connection_IsPacketReceived(conn, 3));
+
+    /* received out of order */
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 3));
+    CuAssertIntEquals(tc, 5, conn->last_received_packet_seq_number);
+    CuAssertTrue(tc, Connection_IsPacketReceived(conn, 3));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(conn, 4));
+    CuAssertTrue(tc, !Connection_InsertReceivedPacketEntry(conn, 3));
+
+    /* slide the window over several words */
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 200));
+    CuAssertTrue(tc, Connection_IsPacketReceived(conn, 1));
+    CuAssertTrue(tc, Connection_IsPacketReceived(conn, 3));
+    CuAssertTrue(tc, Connection_IsPacketReceived(conn, 5));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(conn, 2));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(conn, 199));
+    CuAssertTrue(tc, !Connection_InsertReceivedPacketEntry(conn, 5));
+
+    /* packets older than the window cannot be told apart from duplicates and are dropped */
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 300));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(conn, 1));
+    CuAssertTrue(tc, !Connection_InsertReceivedPacketEntry(conn, 1));
+    CuAssertTrue(tc, !Connection_InsertReceivedPacketEntry(conn, 300 - NBN_PACKET_RECV_WINDOW_SIZE));
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 300 - NBN_PACKET_RECV_WINDOW_SIZE + 1));
+
+    /* sequence numbers wrap around */
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 30000));
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 60000));
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 65530));
+    CuAssertTrue(tc, Connection_InsertReceivedPacketEntry(conn, 4));
+    CuAssertIntEquals(tc, 4, conn->last_received_packet_seq_number);
+    CuAssertTrue(tc, Connection_IsPacketReceived(conn, 65530));
+    CuAssertTrue(tc, !Connection_IsPacketReceived(conn, 0));
+
+    End(conn, &endpoint);
+}
+
+void Test_DecodePacketHeader(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *conn = Begin(&endpoint);
+    NBN_Packet packet;
+
+    SendPackets(conn, 40);
+
+    /* acks packets 8 to 40 but 35 */
+    packet.header.seq_number = 1;
+    packet.header.ack = 40;
+    packet.header.ack_bits = ~((uint32_t)1 << 4);
+
+    CuAssertIntEquals(tc, 0, Connection_DecodePacketHeader(conn, &packet));
+
+    for (uint16_t i = 1; i <= 40; i++)
+        CuAssertTrue(tc, IsPacketAcked(conn, i) == (i >= 8 && i != 35));
+
+    CuAssertIntEquals(tc, 80, conn->delivered_ack);
+    CuAssertIntEquals(tc, 40, conn->last_received_ack);
+
+    /* header of an older packet, received out of order */
+    packet.header.seq_number = 0;
+    packet.header.ack = 35;
+    packet.header.ack_bits = (uint32_t)1 << 29;
+
+    CuAssertIntEquals(tc, 0, Connection_DecodePacketHeader(conn, &packet));
+    CuAssertTrue(tc, IsPacketAcked(conn, 35));
+    CuAssertTrue(tc, IsPacketAcked(conn, 5));
+    CuAssertTrue(tc, !IsPacketAcked(conn, 6));
+    CuAssertIntEquals(tc, 80, conn->delivered_ack);
+    CuAssertIntEquals(tc, 40, conn->last_received_ack);
+    CuAssertTrue(tc, (conn->received_ack_window >> 5) & 1);
+
+    /* every ack of a duplicated header has already been read */
+    uint64_t received_ack_window = conn->received_ack_window;
+
+    packet.header.ack = 40;
+    packet.header.ack_bits = 0xFFFFFFFF;
+
+    CuAssertIntEquals(tc, 0, Connection_DecodePacketHeader(conn, &packet));
+    CuAssertTrue(tc, conn->received_ack_window == received_ack_window);
+
+    End(conn, &endpoint);
+}
+
+void Test_AckRangesRoundTrip(CuTest *tc)
+{
+    NBN_Endpoint endpoint;
+    NBN_Connection *sender = Begin(&endpoint);
+    NBN_Connection *receiver = NBN_Endpoint_CreateConnection(&endpoint, 1, NULL);
+
+    SendPackets(sender, 100);
+
+    /* packets 10 to 19, 50, 70 and 71 are lost */
+    for (uint16_t i = 1; i <= 100; i++)
+    {
+        if ((i < 10 || i > 19) && i != 50 && i != 70 && i != 71)
+            Connection_InsertReceivedPacketEntry(receiver, i);
+    }
+
+    NBN_Packet packet;
+    NBN_PacketEntry *packet_entry;
+
+    /* nothing is known to be delivered yet, the packets the header cannot ack go into ack ranges */
+    Connection_InitOutgoingPacket(receiver, &packet, &packet_entry);
+
+    CuAssertIntEquals(tc, 0, Connection_WriteAckRanges(receiver, &packet, packet_entry));
+    CuAssertIntEquals(tc, 1, packet.header.messages_count);
+    CuAssertTrue(tc, packet_entry->has_ack_ranges);
+    CuAssertIntEquals(tc, 0, NBN_Packet_Seal(&packet, receiver));
+
+    NBN_Packet r_packet;
+
+    CuAssertIntEquals(tc, 0, NBN_Packet_InitRead(&r_packet, sender, packet.buffer, packet.size));
+    CuAssertIntEquals(tc, 0, NBN_Connection_ProcessReceivedPacket(sender, &r_packet));
+
+    /* a packet that only carries ack ranges does not need to be acked */
+    CuAssertTrue(tc, !sender->is_ack_pending);
+
+    for (uint16_t i = 1; i <= 100; i++)
+        CuAssertTrue(tc, IsPacketAcked(sender, i) == Connection_IsPacketReceived(receiver, i));
+
+    /* the previous packet acked everything and is not overdue: no ack ranges */
+    Connection_InitOutgoingPacket(receiver, &packet, &packet_entry);
+
+    CuAssertIntEquals(tc, 0, Connection_WriteAckRanges(receiver, &packet, packet_entry));
+    CuAssertIntEquals(tc, 0, packet.header.messages_count);
+
+    Connection_CancelOutgoingPacket(receiver, &packet);
+
+    /* the previous packet has not been acked in time, its header may have been lost */
+    receiver->time = 1;
+
+    Connection_InitOutgoingPacket(receiver, &packet, &packet_entry);
+
+    CuAssertIntEquals(tc, 0, Connection_WriteAckRanges(receiver, &packet, packet_entry));
+    CuAssertIntEquals(tc, 1, packet.header.messages_count);
+
+    NBN_Connection_Destroy(receiver);
+    End(sender, &endpoint);
+}
+
+int main(int argc, char *argv[])
+{
+    CuString *output = CuStringNew();
+    CuSuite* suite = CuSuiteNew();
+
+    SUITE_ADD_TEST(suite, Test_InsertReceivedPacketEntry);
+    SUITE_ADD_TEST(suite, Test_DecodePacketHeader);
+    SUITE_ADD_TEST(suite, Test_AckRangesRoundTrip);
+
+    CuSuiteRun(suite);
+    CuSuiteSummary(suite, output);
+    CuSuiteDetails(suite, output);
+
+    printf("%s\n", output->buffer);
+
+    return suite->failCount;
+}
@@ -0,0 +1,1408 @@
+/*
+
+   Copyright (C) 2020 BIAGINI Nathan
+
+   This software is provided 'as-is', without any express or implied
+   warranty.  In no event will the authors be held liable for any damages
+   arising from the use of this software.
+
+   Permission is granted to anyone to use this software for any purpose,
+   including commercial applications, and to alter it and redistribute it
+   freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source distribution.
+
+*/
+
+/*
+    Message code generator: reads a schema describing message types and generates a single header with their C
+    structs, pooled builders and destructors and specialized serializers.
+
+    Usage: msggen <schema file> <output header>
+
+    The generated header is used like nbnet: include it after nbnet.h and, in exactly one source file, define
+    <NAME>_IMPL before including it (<NAME> being the upper case name of the header, e.g GAME_MESSAGES_IMPL for
+    game_messages.h). Message types are registered with <Name>_RegisterGameClientMessages and
+    <Name>_RegisterGameServerMessages (e.g. GameMessages_RegisterGameServerMessages).
+
+    Schema:
+
+        # comment
+        const MAX_CLIENTS 4
+
+        struct ClientState
+            uint client_id 0 4294967295
+            int x -100 100
+            float val -100 100 3
+            bool ready
+        end
+
+        message GameStateMessage 2
+            ClientState clients[MAX_CLIENTS]
+            bytes name 16
+            bytes data[512]
+        end
+
+    Fields:
+
+        uint <name> <min> <max>                 unsigned int in [min, max]
+        int <name> <min> <max>                  int in [min, max]
+        float <name> <min> <max> <precision>    float in [min, max] quantized with <precision> decimals
+        bool <name>
+        bytes <name> <length>                   fixed length byte array
+        bytes <name>[<max length>]              variable length byte array (length in <name>_length)
+        <struct> <name>                         previously declared struct
+        <type> <name>[<max count>]              variable length array of any of the above but bytes
+                                                (element count in <name>_count)
+
+    Numbers can be replaced by constants. The wire format is the same as the one of the NBN_Serialize* macros
+    called in the order of the fields (array counts and byte array lengths are serialized right before the
+    elements) so generated serializers can replace hand written ones without breaking compatibility.
+
+    Instead of going through the stream function pointers for every field, the generated serializers switch on
+    the stream type once and then:
+
+        - write and read consecutive scalar fields with as few bit writer/reader calls as possible (up to 32 bits
+          at a time), with the ranges, bit counts and masks computed at generation time
+        - measure messages with a single addition when their size does not depend on their content
+
+    <NAME>_MAX_SIZE gives the maximum size in bytes of the serialized data of a message (header excluded).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+
+/* for the message types reserved by nbnet */
+#include "../nbnet.h"
+
+#define MSGGEN_MAX_TYPES 128
+#define MSGGEN_MAX_FIELDS 64
+#define MSGGEN_MAX_CONSTS 128
+#define MSGGEN_MAX_NAME 64
+#define MSGGEN_MAX_TOKENS 8
+#define MSGGEN_WORD_BITS 32
+
+typedef enum
+{
+    FIELD_UINT,
+    FIELD_INT,
+    FIELD_FLOAT,
+    FIELD_BOOL,
+    FIELD_BYTES,
+    FIELD_STRUCT
+} FieldKind;
+
+typedef struct
+{
+    FieldKind kind;
+    char name[MSGGEN_MAX_NAME];
+    unsigned int array_size; /* Max element count (or length for byte arrays), 0 when not a variable length array */
+    char array_size_text[MSGGEN_MAX_NAME];
+    unsigned int length; /* Length of fixed length byte arrays */
+    char length_text[MSGGEN_MAX_NAME];
+    unsigned int umin; /* uint */
+    unsigned int umax;
+    int imin; /* int, and float once quantized */
+    int imax;
+    unsigned int mult; /* float */
+    int struct_index; /* struct */
+} Field;
+
+typedef struct
+{
+    char name[MSGGEN_MAX_NAME];
+    bool is_message;
+    unsigned int type_id;
+    Field fields[MSGGEN_MAX_FIELDS];
+    unsigned int field_count;
+} Type;
+
+typedef struct
+{
+    char name[MSGGEN_MAX_NAME];
+    double value;
+} Const;
+
+/* A scalar value packed with others into a bit writer/reader word */
+typedef struct
+{
+    const Field *field;
+    char access[MSGGEN_MAX_NAME * 2];
+    unsigned int bits;
+} Piece;
+
+static Type types[MSGGEN_MAX_TYPES];
+static unsigned int type_count;
+static Const consts[MSGGEN_MAX_CONSTS];
+static unsigned int const_count;
+static const char *schema_path;
+static unsigned int line_number;
+static FILE *out;
+
+#pragma region Schema
+
+static void Fail(const char *fmt, const char *arg)
+{
+    fprintf(stderr, "%s:%u: error: ", schema_path, line_number);
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, "\n");
+
+    exit(1);
+}
+
+static bool IsIdentifier(const char *s)
+{
+    if (!isalpha((unsigned char)*s) && *s != '_')
+        return false;
+
+    for (s++; *s; s++)
+    {
+        if (!isalnum((unsigned char)*s) && *s != '_')
+            return false;
+    }
+
+    return true;
+}
+
+static void CopyName(char *dest, const char *name)
+{
+    if (!IsIdentifier(name) || strlen(name) >= MSGGEN_MAX_NAME)
+        Fail("invalid name: %s", name);
+
+    strcpy(dest, name);
+}
+
+/* Copy a number (or constant name) as written in the schema */
+static void CopyNumberText(char *dest, const char *text)
+{
+    if (strlen(text) >= MSGGEN_MAX_NAME)
+        Fail("number is too long: %s", text);
+
+    strcpy(dest, text);
+}
+
+static double ParseNumber(const char *token)
+{
+    bool negative = token[0] == '-';
+    const char *s = negative ? token + 1 : token;
+
+    for (unsigned int i = 0; i < const_count; i++)
+    {
+        if (strcmp(consts[i].name, s) == 0)
+            return negative ? -consts[i].value : consts[i].value;
+    }
+
+    char *end;
+    double value = strtod(token, &end);
+
+    if (*token == '\0' || *end != '\0')
+        Fail("invalid number: %s", token);
+
+    return value;
+}
+
+static unsigned int ParseUInt(const char *token)
+{
+    double value = ParseNumber(token);
+
+    if (value < 0 || value > UINT_MAX || value != floor(value))
+        Fail("invalid unsigned integer: %s", token);
+
+    return (unsigned int)value;
+}
+
+static int ParseInt(const char *token)
+{
+    double value = ParseNumber(token);
+
+    /* INT_MIN is excluded so that the absolute value of any value of the range fits in an int */
+    if (value < -INT_MAX || value > INT_MAX || value != floor(value))
+        Fail("invalid integer: %s", token);
+
+    return (int)value;
+}
+
+static int FindType(const char *name)
+{
+    for (unsigned int i = 0; i < type_count; i++)
+    {
+        if (strcmp(types[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+static void ParseField(Type *type, char **tokens, unsigned int token_count)
+{
+    if (type->field_count >= MSGGEN_MAX_FIELDS)
+        Fail("too many fields in %s", type->name);
+
+    if (token_count < 2)
+        Fail("missing field name after %s", tokens[0]);
+
+    Field *field = &type->fields[type->field_count++];
+    char *name = tokens[1];
+    char *bracket = strchr(name, '[');
+    unsigned int expected_token_count;
+
+    memset(field, 0, sizeof(Field));
+
+    if (bracket)
+    {
+        char *closing = strchr(bracket, ']');
+
+        if (closing == NULL || closing[1] != '\0' || closing == bracket + 1)
+            Fail("invalid array: %s", name);
+
+        *bracket = '\0';
+        *closing = '\0';
+        field->array_size = ParseUInt(bracket + 1);
+
+        if (field->array_size == 0)
+            Fail("empty array: %s", name);
+
+        CopyNumberText(field->array_size_text, bracket + 1);
+    }
+
+    CopyName(field->name, name);
+
+    for (unsigned int i = 0; i < type->field_count - 1; i++)
+    {
+        if (strcmp(type->fields[i].name, field->name) == 0)
+            Fail("duplicate field: %s", field->name);
+    }
+
+    if (strcmp(tokens[0], "uint") == 0)
+    {
+        field->kind = FIELD_UINT;
+        expected_token_count = 4;
+
+        if (token_count == expected_token_count)
+        {
+            field->umin = ParseUInt(tokens[2]);
+            field->umax = ParseUInt(tokens[3]);
+
+            if (field->umin > field->umax)
+                Fail("invalid range for %s", field->name);
+        }
+    }
+    else if (strcmp(tokens[0], "int") == 0)
+    {
+        field->kind = FIELD_INT;
+        expected_token_count = 4;
+
+        if (token_count == expected_token_count)
+        {
+            field->imin = ParseInt(tokens[2]);
+            field->imax = ParseInt(tokens[3]);
+
+            if (field->imin > field->imax)
+                Fail("invalid range for %s", field->name);
+        }
+    }
+    else if (strcmp(tokens[0], "float") == 0)
+    {
+        field->kind = FIELD_FLOAT;
+        expected_token_count = 5;
+
+        if (token_count == expected_token_count)
+        {
+            float min = (float)ParseNumber(tokens[2]);
+            float max = (float)ParseNumber(tokens[3]);
+            unsigned int precision = ParseUInt(tokens[4]);
+
+            if (min > max)
+                Fail("invalid range for %s", field->name);
+
+            if (precision > 9)
+                Fail("precision is too high for %s", field->name);
+
+            /* same computations as NBN_WriteStream_SerializeFloat */
+            field->mult = (unsigned int)pow(10, precision);
+
+            float quantized_min = min * field->mult;
+            float quantized_max = max * field->mult;
+
+            if (quantized_min < -INT_MAX || quantized_max > INT_MAX)
+                Fail("range is too large for %s", field->name);
+
+            field->imin = (int)quantized_min;
+            field->imax = (int)quantized_max;
+        }
+    }
+    else if (strcmp(tokens[0], "bool") == 0)
+    {
+        field->kind = FIELD_BOOL;
+        expected_token_count = 2;
+    }
+    else if (strcmp(tokens[0], "bytes") == 0)
+    {
+        field->kind = FIELD_BYTES;
+        expected_token_count = field->array_size ? 2 : 3;
+
+        if (token_count == 3)
+        {
+            field->length = ParseUInt(tokens[2]);
+
+            if (field->length == 0)
+                Fail("empty byte array: %s", field->name);
+
+            CopyNumberText(field->length_text, tokens[2]);
+        }
+    }
+    else
+    {
+        field->kind = FIELD_STRUCT;
+        field->struct_index = FindType(tokens[0]);
+        expected_token_count = 2;
+
+        if (field->struct_index < 0 || types[field->struct_index].is_message)
+            Fail("unknown field type: %s", tokens[0]);
+    }
+
+    if (token_count != expected_token_count)
+        Fail("wrong number of arguments for field %s", field->name);
+}
+
+static void ParseSchema(FILE *file)
+{
+    char line[1024];
+    Type *type = NULL;
+
+    while (fgets(line, sizeof(line), file))
+    {
+        char *tokens[MSGGEN_MAX_TOKENS];
+        unsigned int token_count = 0;
+        char *comment = strchr(line, '#');
+
+        line_number++;
+
+        if (comment)
+            *comment = '\0';
+
+        for (char *token = strtok(line, " \t\r\n"); token; token = strtok(NULL, " \t\r\n"))
+        {
+            if (token_count == MSGGEN_MAX_TOKENS)
+                Fail("too many tokens", "");
+
+            tokens[token_count++] = token;
+        }
+
+        if (token_count == 0)
+            continue;
+
+        if (strcmp(tokens[0], "end") == 0)
+        {
+            if (type == NULL)
+                Fail("unexpected end", "");
+
+            if (type->field_count == 0)
+                Fail("%s has no fields", type->name);
+
+            type = NULL;
+        }
+        else if (type)
+        {
+            ParseField(type, tokens, token_count);
+        }
+        else if (strcmp(tokens[0], "const") == 0)
+        {
+            if (token_count != 3 || const_count == MSGGEN_MAX_CONSTS)
+                Fail("invalid constant", "");
+
+            CopyName(consts[const_count].name, tokens[1]);
+            consts[const_count].value = ParseNumber(tokens[2]);
+            const_count++;
+        }
+        else if (strcmp(tokens[0], "struct") == 0 || strcmp(tokens[0], "message") == 0)
+        {
+            bool is_message = strcmp(tokens[0], "message") == 0;
+
+            if (token_count != (is_message ? 3u : 2u) || type_count == MSGGEN_MAX_TYPES)
+                Fail("invalid %s declaration", tokens[0]);
+
+            if (FindType(tokens[1]) >= 0)
+                Fail("%s is already declared", tokens[1]);
+
+            type = &types[type_count++];
+
+            CopyName(type->name, tokens[1]);
+            type->is_message = is_message;
+            type->field_count = 0;
+
+            if (is_message)
+            {
+                type->type_id = ParseUInt(tokens[2]);
+
+                /* the last message types are reserved by nbnet */
+                if (type->type_id >= NBN_FIRST_RESERVED_MESSAGE_TYPE)
+                    Fail("invalid message type: %s (the last message types are reserved by nbnet)", tokens[2]);
+
+                for (unsigned int i = 0; i < type_count - 1; i++)
+                {
+                    if (types[i].is_message && types[i].type_id == type->type_id)
+                        Fail("message type %s is already used", tokens[2]);
+                }
+            }
+        }
+        else
+        {
+            Fail("unexpected token: %s", tokens[0]);
+        }
+    }
+
+    if (type)
+        Fail("missing end for %s", type->name);
+}
+
+#pragma endregion /* Schema */
+
+#pragma region Sizes
+
+/* Same as BITS_REQUIRED in nbnet */
+static unsigned int BitsRequired(unsigned int min, unsigned int max)
+{
+    unsigned int v = max - min;
+    unsigned int bits = 0;
+
+    while (v)
+    {
+        bits++;
+        v >>= 1;
+    }
+
+    return bits;
+}
+
+static unsigned int IntAbsMin(const Field *field)
+{
+    unsigned int abs_min = abs(field->imin);
+    unsigned int abs_max = abs(field->imax);
+
+    /* same as NBN_WriteStream_SerializeInt */
+    if (field->imin < 0 && field->imax > 0)
+        return 0;
+
+    return abs_min < abs_max ? abs_min : abs_max;
+}
+
+static unsigned int IntAbsMax(const Field *field)
+{
+    unsigned int abs_min = abs(field->imin);
+    unsigned int abs_max = abs(field->imax);
+
+    return abs_min > abs_max ? abs_min : abs_max;
+}
+
+static bool IsScalar(const Field *field)
+{
+    return field->kind == FIELD_UINT || field->kind == FIELD_INT ||
+        field->kind == FIELD_FLOAT || field->kind == FIELD_BOOL;
+}
+
+/* Number of bits of a scalar value (sign bit included for integers and floats) */
+static unsigned int ScalarBits(const Field *field)
+{
+    switch (field->kind)
+    {
+        case FIELD_UINT:
+            return BitsRequired(field->umin, field->umax);
+
+        case FIELD_INT:
+        case FIELD_FLOAT:
+            return 1 + BitsRequired(IntAbsMin(field), IntAbsMax(field));
+
+        default:
+            return 1;
+    }
+}
+
+/* Number of bits of the serialized type when it does not depend on the content nor on the alignment */
+static bool StaticBits(const Type *type, unsigned int *bits)
+{
+    unsigned int total = 0;
+
+    for (unsigned int i = 0; i < type->field_count; i++)
+    {
+        const Field *field = &type->fields[i];
+        unsigned int field_bits;
+
+        if (field->array_size || field->kind == FIELD_BYTES)
+            return false;
+
+        if (field->kind == FIELD_STRUCT)
+        {
+            if (!StaticBits(&types[field->struct_index], &field_bits))
+                return false;
+        }
+        else
+        {
+            field_bits = ScalarBits(field);
+        }
+
+        total += field_bits;
+    }
+
+    *bits = total;
+
+    return true;
+}
+
+static unsigned long long MaxBits(const Type *type)
+{
+    unsigned long long bits = 0;
+
+    for (unsigned int i = 0; i < type->field_count; i++)
+    {
+        const Field *field = &type->fields[i];
+        unsigned long long element_bits;
+
+        if (field->kind == FIELD_BYTES)
+        {
+            /* byte arrays are aligned on bytes */
+            unsigned int length = field->array_size ? field->array_size : field->length;
+
+            if (field->array_size)
+                bits += BitsRequired(0, field->array_size);
+
+            bits += 7 + length * 8;
+
+            continue;
+        }
+
+        element_bits = field->kind == FIELD_STRUCT ? MaxBits(&types[field->struct_index]) : ScalarBits(field);
+
+        if (field->array_size)
+            bits += BitsRequired(0, field->array_size) + field->array_size * element_bits;
+        else
+            bits += element_bits;
+    }
+
+    return bits;
+}
+
+#pragma endregion /* Sizes */
+
+#pragma region Generation
+
+/* UpdateStateMessage -> UPDATE_STATE_MESSAGE */
+static void UpperSnakeCase(char *dest, const char *name)
+{
+    char *d = dest;
+
+    for (const char *c = name; *c; c++)
+    {
+        if (c != name && isupper((unsigned char)*c) &&
+                (islower((unsigned char)c[-1]) || (islower((unsigned char)c[1]) && isupper((unsigned char)c[-1]))))
+            *d++ = '_';
+
+        *d++ = toupper((unsigned char)*c);
+    }
+
+    *d = '\0';
+}
+
+/* game_messages -> GameMessages */
+static void PascalCase(char *dest, const char *name)
+{
+    char *d = dest;
+    bool upper = true;
+
+    for (const char *c = name; *c; c++)
+    {
+        if (!isalnum((unsigned char)*c))
+        {
+            upper = true;
+            continue;
+        }
+
+        *d++ = upper ? toupper((unsigned char)*c) : *c;
+        upper = false;
+    }
+
+    *d = '\0';
+}
+
+static const char *ScalarCType(const Field *field)
+{
+    switch (field->kind)
+    {
+        case FIELD_UINT:
+            return "unsigned int";
+
+        case FIELD_INT:
+            return "int";
+
+        case FIELD_FLOAT:
+            return "float";
+
+        default:
+            return "bool";
+    }
+}
+
+static void InitPiece(Piece *piece, const Field *field, const char *access)
+{
+    piece->field = field;
+    piece->bits = ScalarBits(field);
+
+    snprintf(piece->access, sizeof(piece->access), "%s", access);
+}
+
+/* The array element count (or byte array length) is serialized as an unsigned integer */
+static void InitCountPiece(Piece *piece, Field *count_field, const Field *field)
+{
+    char access[MSGGEN_MAX_NAME * 2];
+
+    memset(count_field, 0, sizeof(Field));
+
+    count_field->kind = FIELD_UINT;
+    count_field->umax = field->array_size;
+
+    snprintf(access, sizeof(access), "msg->%s_%s", field->name, field->kind == FIELD_BYTES ? "length" : "count");
+
+    InitPiece(piece, count_field, access);
+}
+
+static void EmitPieceAssert(const Piece *piece, const char *indent, unsigned int index)
+{
+    const Field *field = piece->field;
+
+    if (field->kind == FIELD_UINT)
+    {
+        if (field->umin > 0 && field->umax < UINT_MAX)
+            fprintf(out, "%sassert(%s >= %uu && %s <= %uu);\n",
+                    indent, piece->access, field->umin, piece->access, field->umax);
+        else if (field->umin > 0)
+            fprintf(out, "%sassert(%s >= %uu);\n", indent, piece->access, field->umin);
+        else if (field->umax < UINT_MAX)
+            fprintf(out, "%sassert(%s <= %uu);\n", indent, piece->access, field->umax);
+    }
+    else if (field->kind == FIELD_INT)
+    {
+        fprintf(out, "%sassert(%s >= %d && %s <= %d);\n",
+                indent, piece->access, field->imin, piece->access, field->imax);
+    }
+    else if (field->kind == FIELD_FLOAT)
+    {
+        fprintf(out, "%sassert(v%u >= %d && v%u <= %d);\n", indent, index, field->imin, index, field->imax);
+    }
+}
+
+/* Expression of the bits of a piece, as a Word */
+static void EmitPieceValue(const Piece *piece, unsigned int index)
+{
+    const Field *field = piece->field;
+
+    if (field->kind == FIELD_UINT)
+    {
+        if (field->umin > 0)
+            fprintf(out, "(Word)(%s - %uu)", piece->access, field->umin);
+        else
+            fprintf(out, "(Word)%s", piece->access);
+    }
+    else if (field->kind == FIELD_BOOL)
+    {
+        fprintf(out, "(Word)%s", piece->access);
+    }
+    else
+    {
+        char value[MSGGEN_MAX_NAME * 2];
+        unsigned int abs_min = IntAbsMin(field);
+
+        if (field->kind == FIELD_FLOAT)
+            snprintf(value, sizeof(value), "v%u", index);
+        else
+            snprintf(value, sizeof(value), "%s", piece->access);
+
+        /* sign bit first, then the absolute value */
+        fprintf(out, "((Word)(%s < 0) | ((Word)((unsigned int)(%s < 0 ? -%s : %s)",
+                value, value, value, value);
+
+        if (abs_min > 0)
+            fprintf(out, " - %uu", abs_min);
+
+        fprintf(out, ") << 1))");
+    }
+}
+
+static bool EmitsWriteGroupPrologue(const Piece *pieces, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        const Field *field = pieces[i].field;
+
+        if (field->kind == FIELD_INT || field->kind == FIELD_FLOAT ||
+                (field->kind == FIELD_UINT && (field->umin > 0 || field->umax < UINT_MAX)))
+            return true;
+    }
+
+    return false;
+}
+
+static void EmitWriteGroup(const Piece *pieces, unsigned int count, const char *indent)
+{
+    unsigned int bits = 0;
+    char piece_indent[32];
+
+    snprintf(piece_indent, sizeof(piece_indent), "%s    ", indent);
+
+    fprintf(out, "%s{\n", indent);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (pieces[i].field->kind == FIELD_FLOAT)
+            fprintf(out, "%sint v%u = (int)(%s * %u.f);\n", piece_indent, i, pieces[i].access, pieces[i].field->mult);
+    }
+
+    for (unsigned int i = 0; i < count; i++)
+        EmitPieceAssert(&pieces[i], piece_indent, i);
+
+    if (EmitsWriteGroupPrologue(pieces, count))
+        fprintf(out, "\n");
+
+    fprintf(out, "%sif (NBN_BitWriter_Write(&stream->bit_writer, ", piece_indent);
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (i > 0)
+            fprintf(out, " |\n%s                ", indent);
+
+        if (bits > 0)
+        {
+            fprintf(out, "(");
+            EmitPieceValue(&pieces[i], i);
+            fprintf(out, " << %u)", bits);
+        }
+        else
+        {
+            EmitPieceValue(&pieces[i], i);
+        }
+
+        bits += pieces[i].bits;
+    }
+
+    fprintf(out, ", %u) < 0)\n", bits);
+    fprintf(out, "%s        return NBN_ERROR;\n", indent);
+    fprintf(out, "%s}\n", indent);
+}
+
+static void EmitReadPiece(const Piece *piece, unsigned int shift, const char *indent)
+{
+    const Field *field = piece->field;
+    char bits[MSGGEN_MAX_NAME];
+
+    if (shift > 0 && piece->bits < MSGGEN_WORD_BITS)
+        snprintf(bits, sizeof(bits), "(word >> %u) & 0x%Xu", shift, (1u << piece->bits) - 1);
+    else if (shift > 0)
+        snprintf(bits, sizeof(bits), "word >> %u", shift);
+    else if (piece->bits < MSGGEN_WORD_BITS)
+        snprintf(bits, sizeof(bits), "word & 0x%Xu", (1u << piece->bits) - 1);
+    else
+        snprintf(bits, sizeof(bits), "word");
+
+    if (field->kind == FIELD_BOOL)
+    {
+        fprintf(out, "%s%s = %s;\n", indent, piece->access, bits);
+    }
+    else if (field->kind == FIELD_UINT)
+    {
+        if (field->umin > 0)
+            fprintf(out, "%s%s = (%s) + %uu;\n", indent, piece->access, bits, field->umin);
+        else
+            fprintf(out, "%s%s = %s;\n", indent, piece->access, bits);
+
+        if (field->umin > 0 && field->umax < UINT_MAX)
+            fprintf(out, "%sif (%s < %uu || %s > %uu)\n", indent, piece->access, field->umin, piece->access, field->umax);
+        else if (field->umin > 0)
+            fprintf(out, "%sif (%s < %uu)\n", indent, piece->access, field->umin);
+        else if (field->umax < UINT_MAX)
+            fprintf(out, "%sif (%s > %uu)\n", indent, piece->access, field->umax);
+        else
+            return;
+
+        fprintf(out, "%s    return NBN_ERROR;\n", indent);
+    }
+    else
+    {
+        unsigned int abs_min = IntAbsMin(field);
+
+        fprintf(out, "%s{\n", indent);
+        fprintf(out, "%s    Word bits = %s;\n", indent, bits);
+
+        if (abs_min > 0)
+            fprintf(out, "%s    unsigned int abs_value = (bits >> 1) + %uu;\n", indent, abs_min);
+        else
+            fprintf(out, "%s    unsigned int abs_value = bits >> 1;\n", indent);
+
+        fprintf(out, "%s    int value = (bits & 1) ? -(int)abs_value : (int)abs_value;\n\n", indent);
+        fprintf(out, "%s    if (value < %d || value > %d)\n", indent, field->imin, field->imax);
+        fprintf(out, "%s        return NBN_ERROR;\n\n", indent);
+
+        if (field->kind == FIELD_FLOAT)
+            fprintf(out, "%s    %s = (float)value / %u.f;\n", indent, piece->access, field->mult);
+        else
+            fprintf(out, "%s    %s = value;\n", indent, piece->access);
+
+        fprintf(out, "%s}\n", indent);
+    }
+}
+
+static void EmitReadGroup(const Piece *pieces, unsigned int count, const char *indent)
+{
+    unsigned int bits = 0;
+    char piece_indent[32];
+
+    for (unsigned int i = 0; i < count; i++)
+        bits += pieces[i].bits;
+
+    snprintf(piece_indent, sizeof(piece_indent), "%s    ", indent);
+
+    fprintf(out, "%s{\n", indent);
+    fprintf(out, "%s    Word word;\n\n", indent);
+    fprintf(out, "%s    if (NBN_BitReader_Read(&stream->bit_reader, &word, %u) < 0)\n", indent, bits);
+    fprintf(out, "%s        return NBN_ERROR;\n\n", indent);
+
+    bits = 0;
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (i > 0)
+            fprintf(out, "\n");
+
+        EmitReadPiece(&pieces[i], bits, piece_indent);
+
+        bits += pieces[i].bits;
+    }
+
+    fprintf(out, "%s}\n", indent);
+}
+
+/* Pack consecutive scalar values into as few words as possible */
+static void EmitPieces(const Piece *pieces, unsigned int count, bool write, const char *indent)
+{
+    Piece group[MSGGEN_MAX_FIELDS];
+    unsigned int group_count = 0;
+    unsigned int group_bits = 0;
+
+    for (unsigned int i = 0; i <= count; i++)
+    {
+        if (i == count || group_bits + pieces[i].bits > MSGGEN_WORD_BITS)
+        {
+            if (group_count > 0)
+            {
+                if (write)
+                    EmitWriteGroup(group, group_count, indent);
+                else
+                    EmitReadGroup(group, group_count, indent);
+
+                fprintf(out, "\n");
+            }
+
+            group_count = 0;
+            group_bits = 0;
+        }
+
+        if (i == count)
+            break;
+
+        if (pieces[i].bits == 0)
+        {
+            /* values of single value ranges are not serialized */
+            if (!write)
+            {
+                if (pieces[i].field->kind == FIELD_UINT)
+                    fprintf(out, "%s%s = %uu;\n\n", indent, pieces[i].access, pieces[i].field->umin);
+            }
+
+            continue;
+        }
+
+        group[group_count++] = pieces[i];
+        group_bits += pieces[i].bits;
+    }
+}
+
+static void EmitSerializeField(const Field *field, bool write, const char *indent)
+{
+    const char *func = write ? "Write" : "Read";
+    const char *stream_type = write ? "NBN_WriteStream" : "NBN_ReadStream";
+    char access[MSGGEN_MAX_NAME * 2];
+
+    if (field->kind == FIELD_BYTES)
+    {
+        if (field->array_size)
+        {
+            Piece count_piece;
+            Field count_field;
+
+            InitCountPiece(&count_piece, &count_field, field);
+            EmitPieces(&count_piece, 1, write, indent);
+
+            fprintf(out, "%sif (msg->%s_length > 0 && %s_SerializeBytes(stream, msg->%s, msg->%s_length) < 0)\n",
+                    indent, field->name, stream_type, field->name, field->name);
+        }
+        else
+        {
+            fprintf(out, "%sif (%s_SerializeBytes(stream, msg->%s, %u) < 0)\n",
+                    indent, stream_type, field->name, field->length);
+        }
+
+        fprintf(out, "%s    return NBN_ERROR;\n\n", indent);
+
+        return;
+    }
+
+    if (field->array_size)
+    {
+        Piece count_piece;
+        Field count_field;
+
+        InitCountPiece(&count_piece, &count_field, field);
+        EmitPieces(&count_piece, 1, write, indent);
+
+        fprintf(out, "%sfor (unsigned int i = 0; i < msg->%s_count; i++)\n", indent, field->name);
+        fprintf(out, "%s{\n", indent);
+
+        snprintf(access, sizeof(access), "msg->%s[i]", field->name);
+    }
+    else
+    {
+        snprintf(access, sizeof(access), "msg->%s", field->name);
+    }
+
+    const char *field_indent = field->array_size ? "        " : indent;
+
+    if (field->kind == FIELD_STRUCT)
+    {
+        fprintf(out, "%sif (%s_%s(&%s, stream) < 0)\n", field_indent, types[field->struct_index].name, func, access);
+        fprintf(out, "%s    return NBN_ERROR;\n", field_indent);
+    }
+    else
+    {
+        Piece piece;
+
+        InitPiece(&piece, field, access);
+        EmitPieces(&piece, 1, write, field_indent);
+    }
+
+    if (field->array_size)
+        fprintf(out, "%s}\n", indent);
+
+    fprintf(out, "\n");
+}
+
+static void EmitSerializeFunction(const Type *type, bool write)
+{
+    Piece run[MSGGEN_MAX_FIELDS];
+    unsigned int run_count = 0;
+
+    fprintf(out, "%sint %s_%s(%s *msg, %s *stream)\n{\n", type->is_message ? "" : "static ",
+            type->name, write ? "Write" : "Read", type->name, write ? "NBN_WriteStream" : "NBN_ReadStream");
+
+    for (unsigned int i = 0; i < type->field_count; i++)
+    {
+        const Field *field = &type->fields[i];
+
+        if (IsScalar(field) && !field->array_size)
+        {
+            char access[MSGGEN_MAX_NAME * 2];
+
+            snprintf(access, sizeof(access), "msg->%s", field->name);
+            InitPiece(&run[run_count++], field, access);
+
+            continue;
+        }
+
+        EmitPieces(run, run_count, write, "    ");
+        run_count = 0;
+
+        EmitSerializeField(field, write, "    ");
+    }
+
+    EmitPieces(run, run_count, write, "    ");
+
+    fprintf(out, "    return 0;\n}\n\n");
+}
+
+static void EmitMeasureFunction(const Type *type)
+{
+    unsigned int bits = 0;
+
+    /* the size of static structs is added to the size of the types containing them */
+    if (!type->is_message && StaticBits(type, &bits))
+        return;
+
+    fprintf(out, "%sint %s_Measure(%s *msg, NBN_MeasureStream *stream)\n{\n",
+            type->is_message ? "" : "static ", type->name, type->name);
+
+    if (StaticBits(type, &bits))
+    {
+        fprintf(out, "    (void)msg;\n\n");
+        fprintf(out, "    stream->number_of_bits += %u;\n\n", bits);
+        fprintf(out, "    return 0;\n}\n\n");
+
+        return;
+    }
+
+    for (unsigned int i = 0; i < type->field_count; i++)
+    {
+        const Field *field = &type->fields[i];
+        unsigned int element_bits;
+
+        if (!field->array_size && field->kind != FIELD_BYTES)
+        {
+            if (field->kind != FIELD_STRUCT)
+            {
+                bits += ScalarBits(field);
+
+                continue;
+            }
+
+            if (StaticBits(&types[field->struct_index], &element_bits))
+            {
+                bits += element_bits;
+
+                continue;
+            }
+        }
+
+        if (field->array_size)
+            bits += BitsRequired(0, field->array_size);
+
+        if (bits > 0)
+            fprintf(out, "    stream->number_of_bits += %u;\n", bits);
+
+        bits = 0;
+
+        if (field->kind == FIELD_BYTES)
+        {
+            if (field->array_size)
+            {
+                fprintf(out, "\n    if (msg->%s_length > 0)\n    ", field->name);
+                fprintf(out, "    NBN_MeasureStream_SerializeBytes(stream, msg->%s, msg->%s_length);\n\n",
+                        field->name, field->name);
+            }
+            else
+            {
+                fprintf(out, "    NBN_MeasureStream_SerializeBytes(stream, msg->%s, %u);\n\n", field->name, field->length);
+            }
+        }
+        else if (field->kind != FIELD_STRUCT)
+        {
+            fprintf(out, "    stream->number_of_bits += msg->%s_count * %u;\n\n", field->name, ScalarBits(field));
+        }
+        else if (StaticBits(&types[field->struct_index], &element_bits))
+        {
+            fprintf(out, "    stream->number_of_bits += msg->%s_count * %u;\n\n", field->name, element_bits);
+        }
+        else if (field->array_size)
+        {
+            fprintf(out, "    for (unsigned int i = 0; i < msg->%s_count; i++)\n", field->name);
+            fprintf(out, "        %s_Measure(&msg->%s[i], stream);\n\n", types[field->struct_index].name, field->name);
+        }
+        else
+        {
+            fprintf(out, "    %s_Measure(&msg->%s, stream);\n\n", types[field->struct_index].name, field->name);
+        }
+    }
+
+    if (bits > 0)
+        fprintf(out, "    stream->number_of_bits += %u;\n\n", bits);
+
+    fprintf(out, "    return 0;\n}\n\n");
+}
+
+static void EmitStruct(const Type *type)
+{
+    char upper_name[MSGGEN_MAX_NAME * 2];
+    unsigned long long max_bits = MaxBits(type);
+
+    UpperSnakeCase(upper_name, type->name);
+
+    fprintf(out, "typedef struct\n{\n");
+
+    for (unsigned int i = 0; i < type->field_count; i++)
+    {
+        const Field *field = &type->fields[i];
+        const char *c_type = field->kind == FIELD_STRUCT ? types[field->struct_index].name : ScalarCType(field);
+
+        if (field->kind == FIELD_BYTES)
+        {
+            if (field->array_size)
+            {
+                fprintf(out, "    uint8_t %s[%s];\n", field->name, field->array_size_text);
+                fprintf(out, "    unsigned int %s_length; /* [1, %s] (or 0 for no data) */\n",
+                        field->name, field->array_size_text);
+            }
+            else
+            {
+                fprintf(out, "    uint8_t %s[%s];\n", field->name, field->length_text);
+            }
+
+            continue;
+        }
+
+        if (field->array_size)
+            fprintf(out, "    %s %s[%s];\n", c_type, field->name, field->array_size_text);
+        else
+            fprintf(out, "    %s %s;", c_type, field->name);
+
+        if (!field->array_size)
+        {
+            if (field->kind == FIELD_UINT)
+                fprintf(out, " /* [%u, %u] */", field->umin, field->umax);
+            else if (field->kind == FIELD_INT)
+                fprintf(out, " /* [%d, %d] */", field->imin, field->imax);
+            else if (field->kind == FIELD_FLOAT)
+                fprintf(out, " /* [%g, %g], precision: 1/%u */",
+                        (double)field->imin / field->mult, (double)field->imax / field->mult, field->mult);
+
+            fprintf(out, "\n");
+        }
+        else
+        {
+            fprintf(out, "    unsigned int %s_count; /* [0, %s] */\n", field->name, field->array_size_text);
+        }
+    }
+
+    fprintf(out, "} %s;\n\n", type->name);
+
+    if (type->is_message)
+        fprintf(out, "#define %s_TYPE %u\n", upper_name, type->type_id);
+
+    fprintf(out, "#define %s_MAX_SIZE %llu /* Serialized data, in bytes */\n\n", upper_name, (max_bits + 7) / 8);
+
+    if (type->is_message)
+    {
+        fprintf(out, "%s *%s_Create(void);\n", type->name, type->name);
+        fprintf(out, "void %s_Destroy(%s *);\n", type->name, type->name);
+        fprintf(out, "int %s_Serialize(%s *, NBN_Stream *);\n", type->name, type->name);
+        fprintf(out, "int %s_Write(%s *, NBN_WriteStream *);\n", type->name, type->name);
+        fprintf(out, "int %s_Read(%s *, NBN_ReadStream *);\n", type->name, type->name);
+        fprintf(out, "int %s_Measure(%s *, NBN_MeasureStream *);\n\n", type->name, type->name);
+    }
+}
+
+static void EmitMessageFunctions(const Type *type, const char *prefix)
+{
+    char lower_name[MSGGEN_MAX_NAME * 2];
+
+    UpperSnakeCase(lower_name, type->name);
+
+    for (char *c = lower_name; *c; c++)
+        *c = tolower((unsigned char)*c);
+
+    fprintf(out, "static %s_PoolBlock *__%s_pool;\n\n", prefix, lower_name);
+
+    fprintf(out, "%s *%s_Create(void)\n{\n", type->name, type->name);
+    fprintf(out, "    return (%s *)%s_PoolAlloc(&__%s_pool, sizeof(%s));\n}\n\n",
+            type->name, prefix, lower_name, type->name);
+
+    fprintf(out, "void %s_Destroy(%s *msg)\n{\n", type->name, type->name);
+    fprintf(out, "    %s_PoolFree(&__%s_pool, msg);\n}\n\n", prefix, lower_name);
+
+    fprintf(out, "int %s_Serialize(%s *msg, NBN_Stream *stream)\n{\n", type->name, type->name);
+    fprintf(out, "    switch (stream->type)\n    {\n");
+    fprintf(out, "        case NBN_STREAM_WRITE:\n");
+    fprintf(out, "            return %s_Write(msg, (NBN_WriteStream *)stream);\n\n", type->name);
+    fprintf(out, "        case NBN_STREAM_READ:\n");
+    fprintf(out, "            return %s_Read(msg, (NBN_ReadStream *)stream);\n\n", type->name);
+    fprintf(out, "        default:\n");
+    fprintf(out, "            return %s_Measure(msg, (NBN_MeasureStream *)stream);\n", type->name);
+    fprintf(out, "    }\n}\n\n");
+}
+
+static void EmitHeader(const char *output_path)
+{
+    const char *base = strrchr(output_path, '/');
+    char name[MSGGEN_MAX_NAME * 2];
+    char guard[MSGGEN_MAX_NAME * 2];
+    char prefix[MSGGEN_MAX_NAME * 2];
+
+    base = base ? base + 1 : output_path;
+
+    snprintf(name, sizeof(name), "%s", base);
+
+    char *dot = strrchr(name, '.');
+
+    if (dot)
+        *dot = '\0';
+
+    PascalCase(prefix, name);
+
+    for (unsigned int i = 0; ; i++)
+    {
+        guard[i] = isalnum((unsigned char)name[i]) ? toupper((unsigned char)name[i]) : (name[i] ? '_' : '\0');
+
+        if (guard[i] == '\0')
+            break;
+    }
+
+    fprintf(out, "/* Generated by msggen from %s, do not edit */\n\n", schema_path);
+    fprintf(out, "#ifndef %s_H\n#define %s_H\n\n", guard, guard);
+
+    for (unsigned int i = 0; i < const_count; i++)
+        fprintf(out, "#define %s %.9g\n", consts[i].name, consts[i].value);
+
+    if (const_count > 0)
+        fprintf(out, "\n");
+
+    for (unsigned int i = 0; i < type_count; i++)
+        EmitStruct(&types[i]);
+
+    fprintf(out, "/* Register all the message types on the game client */\n");
+    fprintf(out, "void %s_RegisterGameClientMessages(void);\n\n", prefix);
+    fprintf(out, "/* Register all the message types on the game server */\n");
+    fprintf(out, "void %s_RegisterGameServerMessages(void);\n\n", prefix);
+    fprintf(out, "/* Release the memory of the destroyed messages kept for reuse */\n");
+    fprintf(out, "void %s_ReleasePools(void);\n\n", prefix);
+
+    fprintf(out, "#ifdef %s_IMPL\n\n", guard);
+
+    /* message pools */
+    fprintf(out, "/* Destroyed messages are kept in a free list per type for reuse (not thread safe) */\n");
+    fprintf(out, "typedef struct %s_PoolBlock\n{\n    struct %s_PoolBlock *next;\n} %s_PoolBlock;\n\n",
+            prefix, prefix, prefix);
+    fprintf(out, "static void *%s_PoolAlloc(%s_PoolBlock **pool, size_t size)\n{\n", prefix, prefix);
+    fprintf(out, "    %s_PoolBlock *block = *pool;\n\n", prefix);
+    fprintf(out, "    if (block == NULL)\n");
+    fprintf(out, "        return NBN_Allocator(size < sizeof(%s_PoolBlock) ? sizeof(%s_PoolBlock) : size);\n\n",
+            prefix, prefix);
+    fprintf(out, "    *pool = block->next;\n\n    return block;\n}\n\n");
+    fprintf(out, "static void %s_PoolFree(%s_PoolBlock **pool, void *ptr)\n{\n", prefix, prefix);
+    fprintf(out, "    %s_PoolBlock *block = (%s_PoolBlock *)ptr;\n\n", prefix, prefix);
+    fprintf(out, "    block->next = *pool;\n    *pool = block;\n}\n\n");
+    fprintf(out, "static void %s_PoolRelease(%s_PoolBlock **pool)\n{\n", prefix, prefix);
+    fprintf(out, "    while (*pool)\n    {\n");
+    fprintf(out, "        %s_PoolBlock *block = *pool;\n\n", prefix);
+    fprintf(out, "        *pool = block->next;\n\n        NBN_Deallocator(block);\n    }\n}\n\n");
+
+    for (unsigned int i = 0; i < type_count; i++)
+    {
+        const Type *type = &types[i];
+        unsigned int bits;
+
+        if (!type->is_message)
+        {
+            fprintf(out, "static int %s_Write(%s *, NBN_WriteStream *);\n", type->name, type->name);
+            fprintf(out, "static int %s_Read(%s *, NBN_ReadStream *);\n", type->name, type->name);
+
+            if (!StaticBits(type, &bits))
+                fprintf(out, "static int %s_Measure(%s *, NBN_MeasureStream *);\n", type->name, type->name);
+
+            fprintf(out, "\n");
+        }
+    }
+
+    for (unsigned int i = 0; i < type_count; i++)
+    {
+        const Type *type = &types[i];
+
+        if (type->is_message)
+            EmitMessageFunctions(type, prefix);
+
+        EmitSerializeFunction(type, true);
+        EmitSerializeFunction(type, false);
+        EmitMeasureFunction(type);
+    }
+
+    for (int server = 0; server < 2; server++)
+    {
+        fprintf(out, "void %s_RegisterGame%sMessages(void)\n{\n", prefix, server ? "Server" : "Client");
+
+        for (unsigned int i = 0; i < type_count; i++)
+        {
+            const Type *type = &types[i];
+            char upper_name[MSGGEN_MAX_NAME * 2];
+
+            if (!type->is_message)
+                continue;
+
+            UpperSnakeCase(upper_name, type->name);
+
+            fprintf(out, "    NBN_Game%s_RegisterMessage(\n", server ? "Server" : "Client");
+            fprintf(out, "        %s_TYPE,\n", upper_name);
+            fprintf(out, "        (NBN_MessageBuilder)%s_Create,\n", type->name);
+            fprintf(out, "        (NBN_MessageDestructor)%s_Destroy,\n", type->name);
+            fprintf(out, "        (NBN_MessageSerializer)%s_Serialize);\n", type->name);
+        }
+
+        fprintf(out, "}\n\n");
+    }
+
+    fprintf(out, "void %s_ReleasePools(void)\n{\n", prefix);
+
+    for (unsigned int i = 0; i < type_count; i++)
+    {
+        char lower_name[MSGGEN_MAX_NAME * 2];
+
+        if (!types[i].is_message)
+            continue;
+
+        UpperSnakeCase(lower_name, types[i].name);
+
+        for (char *c = lower_name; *c; c++)
+            *c = tolower((unsigned char)*c);
+
+        fprintf(out, "    %s_PoolRelease(&__%s_pool);\n", prefix, lower_name);
+    }
+
+    fprintf(out, "}\n\n");
+    fprintf(out, "#endif /* %s_IMPL */\n\n", guard);
+    fprintf(out, "#endif /* %s_H */\n", guard);
+}
+
+#pragma endregion /* Generation */
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s <schema file> <output header>\n", argv[0]);
+
+        return 1;
+    }
+
+    schema_path = argv[1];
+
+    FILE *schema = fopen(schema_path, "r");
+
+    if (schema == NULL)
+    {
+        fprintf(stderr, "Failed to open %s\n", schema_path);
+
+        return 1;
+    }
+
+    ParseSchema(schema);
+    fclose(schema);
+
+    out = fopen(argv[2], "w");
+
+    if (out == NULL)
+    {
+        fprintf(stderr, "Failed to open %s\n", argv[2]);
+
+        return 1;
+    }
+
+    EmitHeader(argv[2]);
+    fclose(out);
+
+    return 0;
+}